@@ -0,0 +1,105 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fossil/sanity/framework.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+
+// Multi-producer push throughput as the producer count grows. One consumer
+// drains the queue while the producers run. The "mutex" column wraps a plain
+// queue in one global lock, which is what callers had to do before; the
+// "lock-free" column uses fossil_sanity_log_enable_concurrent.
+
+#define BENCH_TOTAL 2000000
+
+typedef struct {
+    fossil_sanity_log_queue_t queue;
+    pthread_mutex_t lock;
+    bool locked;
+    size_t per_thread;
+    atomic_int running;
+} bench_state_t;
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *bench_produce(void *arg) {
+    bench_state_t *state = (bench_state_t *)arg;
+    for (size_t i = 0; i < state->per_thread; i++) {
+        if (state->locked) pthread_mutex_lock(&state->lock);
+        fossil_sanity_log_push(&state->queue, "request served", (int)(i % FOSSIL_SANITY_LOG_LEVEL_COUNT), FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        if (state->locked) pthread_mutex_unlock(&state->lock);
+    }
+    atomic_fetch_sub(&state->running, 1);
+    return NULL;
+}
+
+static size_t bench_drain(bench_state_t *state) {
+    size_t drained = 0;
+    for (;;) {
+        if (state->locked) pthread_mutex_lock(&state->lock);
+        char *message = fossil_sanity_log_pop(&state->queue);
+        if (state->locked) pthread_mutex_unlock(&state->lock);
+        if (message) {
+            free(message);
+            drained++;
+        } else if (atomic_load(&state->running) == 0) {
+            break;
+        }
+    }
+    return drained;
+}
+
+static double bench_run(int threads, bool locked) {
+    bench_state_t state;
+    pthread_t workers[64];
+
+    fossil_sanity_log_init(&state.queue);
+    if (!locked) fossil_sanity_log_enable_concurrent(&state.queue);
+    pthread_mutex_init(&state.lock, NULL);
+    state.locked = locked;
+    state.per_thread = BENCH_TOTAL / (size_t)threads;
+    atomic_init(&state.running, threads);
+
+    double start = bench_now();
+    for (int t = 0; t < threads; t++) {
+        pthread_create(&workers[t], NULL, bench_produce, &state);
+    }
+    size_t drained = bench_drain(&state);
+    drained += bench_drain(&state);  // Anything published after the last producer finished
+    for (int t = 0; t < threads; t++) {
+        pthread_join(workers[t], NULL);
+    }
+    double elapsed = bench_now() - start;
+
+    fossil_sanity_log_destroy(&state.queue);
+    pthread_mutex_destroy(&state.lock);
+    return (double)drained / elapsed / 1e6;
+}
+
+int main(void) {
+    static const int counts[] = {1, 2, 4, 8, 16, 32};
+
+    printf("%-10s %16s %16s\n", "producers", "mutex Mops/s", "lock-free Mops/s");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        double locked = bench_run(counts[i], true);
+        double lockfree = bench_run(counts[i], false);
+        printf("%-10d %16.2f %16.2f\n", counts[i], locked, lockfree);
+    }
+    return 0;
+}
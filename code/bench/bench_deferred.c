@@ -0,0 +1,77 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fossil/sanity/framework.h>
+#include <time.h>
+
+// Producer-side cost of logging a formatted message: vsnprintf on the
+// caller's thread followed by a push (what fossil_sanity_log_smart_logf
+// does), against fossil_sanity_log_push_deferred, which only records the
+// format pointer and raw arguments. The consumer-side cost of turning the
+// entries back into text with pop is reported as well.
+
+#define BENCH_ENTRIES 200000
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void bench_formatted(fossil_sanity_log_queue_t *queue, int priority, const char *format, ...) {
+    char buffer[MAX_LOG_MESSAGE_LENGTH];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    fossil_sanity_log_push(queue, buffer, priority, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+}
+
+static double bench_drain(fossil_sanity_log_queue_t *queue) {
+    double start = bench_now();
+    char *message;
+    while ((message = fossil_sanity_log_pop(queue)) != NULL) {
+        free(message);
+    }
+    return (bench_now() - start) / BENCH_ENTRIES;
+}
+
+int main(void) {
+    static const char *users[] = { "alice", "bob", "carol", "dave" };
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_pool_reserve(&queue, BENCH_ENTRIES);
+
+    printf("%-10s %18s %18s\n", "path", "producer ns/entry", "drain ns/entry");
+
+    double start = bench_now();
+    for (int i = 0; i < BENCH_ENTRIES; i++) {
+        bench_formatted(&queue, i % FOSSIL_SANITY_LOG_LEVEL_COUNT, "request %d from %s took %.3f ms (%zu bytes)",
+                        i, users[i & 3], (double)i * 0.001, (size_t)i * 17);
+    }
+    double produce = (bench_now() - start) / BENCH_ENTRIES;
+    printf("%-10s %18.1f %18.1f\n", "snprintf", produce, bench_drain(&queue));
+
+    start = bench_now();
+    for (int i = 0; i < BENCH_ENTRIES; i++) {
+        fossil_sanity_log_push_deferred(&queue, i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW,
+                                        "request %d from %s took %.3f ms (%zu bytes)",
+                                        i, users[i & 3], (double)i * 0.001, (size_t)i * 17);
+    }
+    produce = (bench_now() - start) / BENCH_ENTRIES;
+    printf("%-10s %18.1f %18.1f\n", "deferred", produce, bench_drain(&queue));
+
+    fossil_sanity_log_destroy(&queue);
+    return 0;
+}
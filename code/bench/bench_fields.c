@@ -0,0 +1,92 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fossil/sanity/framework.h>
+#include <time.h>
+
+// Cost of turning a structured entry into a JSON line: the hand-written
+// encoder behind fossil_sanity_log_encode_entry against the same line built
+// with snprintf from the decoded fields, as a sink would have to without
+// it. Both write into a stack buffer, so only formatting is measured.
+
+#define BENCH_ENTRIES 1000
+#define BENCH_ROUNDS  200
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+// JSON via snprintf; string values are assumed not to need escaping
+static size_t bench_snprintf(const fossil_sanity_log_entry_t *entry, char *buffer, size_t size) {
+    static const char *const levels[] = { "debug", "info", "warning", "error", "fatal" };
+    fossil_sanity_log_field_t fields[8];
+    size_t count = fossil_sanity_log_entry_fields(entry, fields, 8);
+    int length = snprintf(buffer, size, "{\"ts\":%llu,\"level\":\"%s\",\"severity\":%d,\"msg\":\"%s\"",
+                          (unsigned long long)entry->timestamp, levels[entry->priority], entry->severity, entry->message);
+    for (size_t i = 0; i < count && (size_t)length < size; i++) {
+        char *out = buffer + length;
+        size_t room = size - (size_t)length;
+        switch (fields[i].type) {
+            case FOSSIL_SANITY_LOG_FIELD_INT:    length += snprintf(out, room, ",\"%s\":%lld", fields[i].key, (long long)fields[i].value.i); break;
+            case FOSSIL_SANITY_LOG_FIELD_DOUBLE: length += snprintf(out, room, ",\"%s\":%g", fields[i].key, fields[i].value.d); break;
+            case FOSSIL_SANITY_LOG_FIELD_STRING: length += snprintf(out, room, ",\"%s\":\"%s\"", fields[i].key, fields[i].value.s); break;
+            case FOSSIL_SANITY_LOG_FIELD_BOOL:   length += snprintf(out, room, ",\"%s\":%s", fields[i].key, fields[i].value.b ? "true" : "false"); break;
+        }
+    }
+    if ((size_t)length < size) length += snprintf(buffer + length, size - (size_t)length, "}");
+    return (size_t)length;
+}
+
+int main(void) {
+    static const char *paths[] = { "/", "/index.html", "/api/v1/users", "/static/app.js" };
+    fossil_sanity_log_queue_t queue;
+    char line[512];
+    size_t sink = 0;
+    fossil_sanity_log_init(&queue);
+
+    for (int i = 0; i < BENCH_ENTRIES; i++) {
+        fossil_sanity_log_field_t fields[] = {
+            FOSSIL_SANITY_LOG_KV_STR("path", paths[i & 3]),
+            FOSSIL_SANITY_LOG_KV_INT("status", 200 + (i % 5) * 100),
+            FOSSIL_SANITY_LOG_KV_INT("bytes", i * 37),
+            FOSSIL_SANITY_LOG_KV_DOUBLE("ms", (double)i * 0.125),
+            FOSSIL_SANITY_LOG_KV_BOOL("cached", i & 1)
+        };
+        fossil_sanity_log_push_fields(&queue, i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW, "request served", fields, 5);
+    }
+
+    printf("%-10s %12s\n", "path", "ns/entry");
+
+    double start = bench_now();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (const fossil_sanity_log_entry_t *entry = queue.head; entry; entry = entry->next) {
+            sink += bench_snprintf(entry, line, sizeof(line));
+        }
+    }
+    printf("%-10s %12.1f\n", "snprintf", (bench_now() - start) / (BENCH_ENTRIES * BENCH_ROUNDS));
+
+    start = bench_now();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        for (const fossil_sanity_log_entry_t *entry = queue.head; entry; entry = entry->next) {
+            sink += fossil_sanity_log_encode_entry(entry, FOSSIL_SANITY_LOG_ENCODING_JSON, line, sizeof(line));
+        }
+    }
+    printf("%-10s %12.1f\n", "encoder", (bench_now() - start) / (BENCH_ENTRIES * BENCH_ROUNDS));
+
+    printf("(%zu bytes encoded)\n", sink);
+    fossil_sanity_log_destroy(&queue);
+    return 0;
+}
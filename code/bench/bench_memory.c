@@ -0,0 +1,60 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fossil/sanity/framework.h>
+#include <sys/resource.h>
+
+// Resident memory of one million queued entries.
+//
+//   bench-memory [message-length] [pool]
+//
+// The RSS high-water mark is taken before and after the pushes, so run one
+// configuration per process.
+
+#define BENCH_ENTRIES 1000000
+
+static long bench_rss_kb(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+int main(int argc, char **argv) {
+    size_t length = argc > 1 ? (size_t)strtoul(argv[1], NULL, 10) : 12;
+    bool pooled = argc > 2 && strcmp(argv[2], "pool") == 0;
+
+    char *message = (char *)malloc(length + 1);
+    memset(message, 'x', length);
+    message[length] = '\0';
+
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+
+    long before = bench_rss_kb();
+    if (pooled) {
+        fossil_sanity_log_pool_reserve(&queue, BENCH_ENTRIES);
+    }
+    for (int i = 0; i < BENCH_ENTRIES; i++) {
+        fossil_sanity_log_push(&queue, message, i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    long after = bench_rss_kb();
+
+    printf("%d entries, %zu-byte messages%s: %ld KiB RSS (%.1f bytes/entry)\n",
+           BENCH_ENTRIES, length, pooled ? ", pooled" : "", after - before,
+           (double)(after - before) * 1024.0 / BENCH_ENTRIES);
+
+    fossil_sanity_log_destroy(&queue);
+    free(message);
+    return 0;
+}
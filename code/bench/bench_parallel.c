@@ -0,0 +1,77 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fossil/sanity/framework.h>
+#include <time.h>
+
+// Serial against parallel search, sort and filter over identical queues.
+// The parallel calls share a pool sized to the cores online, so on a
+// single core they show only the cost of the split.
+
+#define BENCH_ENTRIES 500000
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static void bench_fill(fossil_sanity_log_queue_t *queue) {
+    unsigned int seed = 0x2545f491u;
+    char message[64];
+    fossil_sanity_log_init(queue);
+    for (int i = 0; i < BENCH_ENTRIES; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        snprintf(message, sizeof(message), "request %d from host-%u", i, seed % 977);
+        fossil_sanity_log_push(queue, message, (int)(seed % FOSSIL_SANITY_LOG_LEVEL_COUNT), (int)((seed >> 8) % 3));
+    }
+}
+
+static bool bench_keep(const fossil_sanity_log_entry_t *entry, void *context) {
+    return entry->priority >= *(const int *)context;
+}
+
+int main(void) {
+    fossil_sanity_log_queue_t serial, parallel;
+    int min = FOSSIL_SANITY_LOG_LEVEL_WARNING;
+    bench_fill(&serial);
+    bench_fill(&parallel);
+
+    printf("%-10s %12s %12s\n", "operation", "serial ms", "parallel ms");
+
+    double start = bench_now();
+    size_t hits = fossil_sanity_log_search_all(&serial, "host-97", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0);
+    double middle = bench_now();
+    hits += fossil_sanity_log_search_all_parallel(&parallel, "host-97", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0);
+    printf("%-10s %12.2f %12.2f\n", "search", middle - start, bench_now() - middle);
+
+    start = bench_now();
+    fossil_sanity_log_sort_by(&serial, fossil_sanity_log_compare_severity);
+    middle = bench_now();
+    fossil_sanity_log_sort_parallel(&parallel, fossil_sanity_log_compare_severity);
+    printf("%-10s %12.2f %12.2f\n", "sort", middle - start, bench_now() - middle);
+
+    start = bench_now();
+    fossil_sanity_log_filter(&serial, min);
+    middle = bench_now();
+    fossil_sanity_log_filter_parallel(&parallel, bench_keep, &min);
+    printf("%-10s %12.2f %12.2f\n", "filter", middle - start, bench_now() - middle);
+
+    printf("(%zu matches, %zu kept)\n", hits, parallel.count);
+    fossil_sanity_log_destroy(&serial);
+    fossil_sanity_log_destroy(&parallel);
+    return 0;
+}
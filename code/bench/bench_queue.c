@@ -0,0 +1,75 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fossil/sanity/framework.h>
+#include <time.h>
+
+// Push/pop throughput at increasing queue depth. Each round holds the queue
+// at a fixed depth while timing a run of pushes followed by the same number
+// of pops, so the numbers should stay flat as the depth grows. The second
+// table repeats the run with the queue backed by a preallocated entry pool.
+
+#define BENCH_OPS 200000
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static unsigned int bench_rand(unsigned int *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static void bench_depths(bool pooled) {
+    static const size_t depths[] = {1000, 10000, 100000, 1000000};
+    unsigned int seed = 0x9e3779b9u;
+
+    printf("%-10s %14s %14s  (%s)\n", "depth", "push ns/op", "pop ns/op", pooled ? "pool" : "malloc");
+    for (size_t d = 0; d < sizeof(depths) / sizeof(depths[0]); d++) {
+        fossil_sanity_log_queue_t queue;
+        fossil_sanity_log_init(&queue);
+        if (pooled) {
+            fossil_sanity_log_pool_reserve(&queue, depths[d] + BENCH_OPS);
+        }
+
+        for (size_t i = 0; i < depths[d]; i++) {
+            fossil_sanity_log_push(&queue, "steady state entry", (int)(bench_rand(&seed) % FOSSIL_SANITY_LOG_LEVEL_COUNT), FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        }
+
+        double start = bench_now();
+        for (size_t i = 0; i < BENCH_OPS; i++) {
+            fossil_sanity_log_push(&queue, "measured entry", (int)(bench_rand(&seed) % FOSSIL_SANITY_LOG_LEVEL_COUNT), FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        }
+        double push_ns = (bench_now() - start) / BENCH_OPS;
+
+        start = bench_now();
+        for (size_t i = 0; i < BENCH_OPS; i++) {
+            free(fossil_sanity_log_pop(&queue));
+        }
+        double pop_ns = (bench_now() - start) / BENCH_OPS;
+
+        printf("%-10zu %14.1f %14.1f\n", depths[d], push_ns, pop_ns);
+        fossil_sanity_log_destroy(&queue);
+    }
+}
+
+int main(void) {
+    bench_depths(false);
+    bench_depths(true);
+    return 0;
+}
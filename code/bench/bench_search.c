@@ -0,0 +1,116 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fossil/sanity/framework.h>
+#include <time.h>
+
+// Keyword search over a queue of mixed messages: the token index behind
+// fossil_sanity_log_index_enable against the linear scan, for a rare token
+// (one hit per thousand entries) and a common one. Push cost with the index
+// enabled is reported as well, since every push now tokenizes its message,
+// and so is a rare-token search right after each deferred push, which must
+// index only the new entry.
+
+#define BENCH_QUERIES 200
+
+static const char *bench_words[] = {
+    "disk", "network", "timeout", "user", "session", "cache", "retry", "socket",
+    "write", "read", "flush", "commit", "reject", "accept", "worker", "queue",
+};
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static unsigned int bench_rand(unsigned int *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static double bench_fill(fossil_sanity_log_queue_t *queue, size_t count) {
+    unsigned int seed = 0x2545f491u;
+    size_t words = sizeof(bench_words) / sizeof(bench_words[0]);
+    char message[96];
+
+    double start = bench_now();
+    for (size_t i = 0; i < count; i++) {
+        snprintf(message, sizeof(message), "%s %s id%zu %s", bench_words[bench_rand(&seed) % words],
+                 bench_words[bench_rand(&seed) % words], i, i % 1000 == 0 ? "panic" : "ok");
+        fossil_sanity_log_push(queue, message, (int)(bench_rand(&seed) % FOSSIL_SANITY_LOG_LEVEL_COUNT), FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    return bench_now() - start;
+}
+
+// Milliseconds per query
+static double bench_query(fossil_sanity_log_queue_t *queue, const char *keyword, size_t *found) {
+    double start = bench_now();
+    for (int i = 0; i < BENCH_QUERIES; i++) {
+        *found = fossil_sanity_log_search_all(queue, keyword, FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0);
+    }
+    return (bench_now() - start) / BENCH_QUERIES;
+}
+
+// Milliseconds per deferred push followed by a query
+static double bench_query_deferred(fossil_sanity_log_queue_t *queue, const char *keyword, size_t *found) {
+    double start = bench_now();
+    for (int i = 0; i < BENCH_QUERIES; i++) {
+        fossil_sanity_log_push_deferred(queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, "late %s %d", keyword, i);
+        *found = fossil_sanity_log_search_all(queue, keyword, FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0);
+    }
+    return (bench_now() - start) / BENCH_QUERIES;
+}
+
+int main(void) {
+    static const size_t counts[] = {10000, 100000, 1000000};
+    static const char *keywords[] = {"panic", "disk"};
+
+    printf("%-10s %-8s %8s %14s %14s %10s\n", "entries", "keyword", "hits", "linear ms", "indexed ms", "speedup");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        fossil_sanity_log_queue_t linear, indexed;
+        fossil_sanity_log_init(&linear);
+        fossil_sanity_log_init(&indexed);
+        fossil_sanity_log_index_enable(&indexed);
+        double push_linear = bench_fill(&linear, counts[i]);
+        double push_indexed = bench_fill(&indexed, counts[i]);
+
+        for (size_t k = 0; k < sizeof(keywords) / sizeof(keywords[0]); k++) {
+            size_t hits_linear, hits_indexed;
+            double scan = bench_query(&linear, keywords[k], &hits_linear);
+            double lookup = bench_query(&indexed, keywords[k], &hits_indexed);
+            if (hits_linear != hits_indexed) {
+                fprintf(stderr, "mismatch for %s: %zu vs %zu\n", keywords[k], hits_linear, hits_indexed);
+                return 1;
+            }
+            printf("%-10zu %-8s %8zu %14.3f %14.3f %9.1fx\n", counts[i], keywords[k], hits_indexed, scan, lookup, scan / lookup);
+        }
+        size_t hits_linear, hits_indexed;
+        double scan = bench_query_deferred(&linear, "panic", &hits_linear);
+        double lookup = bench_query_deferred(&indexed, "panic", &hits_indexed);
+        if (hits_linear != hits_indexed) {
+            fprintf(stderr, "mismatch after deferred pushes: %zu vs %zu\n", hits_linear, hits_indexed);
+            return 1;
+        }
+        printf("%-10zu %-8s %8zu %14.3f %14.3f %9.1fx  (deferred push + search)\n", counts[i], "panic", hits_indexed, scan, lookup, scan / lookup);
+        printf("%-10zu push ns/entry: %.0f plain, %.0f indexed\n", counts[i],
+               push_linear * 1e6 / (double)counts[i], push_indexed * 1e6 / (double)counts[i]);
+
+        fossil_sanity_log_destroy(&linear);
+        fossil_sanity_log_destroy(&indexed);
+    }
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fossil/sanity/framework.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Cost of bringing a saved queue back: pushing every message again, as a
+// restart would without snapshots, against fossil_sanity_log_restore on a
+// blob from fossil_sanity_log_snapshot. Every tenth message is too long to
+// be stored inline.
+
+#define BENCH_ENTRIES 100000
+#define BENCH_ROUNDS  5
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+int main(void) {
+    static const char *const short_messages[] = { "cache miss", "request served", "retrying upstream", "disk usage at 80%" };
+    const char *messages[BENCH_ENTRIES];
+    char long_message[200];
+    fossil_sanity_log_queue_t queue;
+    size_t sink = 0;
+
+    memset(long_message, 'x', sizeof(long_message) - 1);
+    long_message[sizeof(long_message) - 1] = '\0';
+    fossil_sanity_log_init(&queue);
+    for (int i = 0; i < BENCH_ENTRIES; i++) {
+        messages[i] = i % 10 ? short_messages[i & 3] : long_message;
+        fossil_sanity_log_push(&queue, messages[i], i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+
+    size_t size = fossil_sanity_log_snapshot(&queue, NULL, 0);
+    char *blob = (char *)malloc(size);
+    if (!blob) return 1;
+
+    printf("%-10s %12s\n", "path", "ns/entry");
+
+    double start = bench_now();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        fossil_sanity_log_snapshot(&queue, blob, size);
+    }
+    printf("%-10s %12.1f\n", "snapshot", (bench_now() - start) / ((double)BENCH_ENTRIES * BENCH_ROUNDS));
+
+    // Copies stay alive until both paths are measured, so each one lands
+    // on memory the process has not touched yet, as after a restart
+    fossil_sanity_log_queue_t copies[2][BENCH_ROUNDS];
+    start = bench_now();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        fossil_sanity_log_init(&copies[0][round]);
+        for (int i = 0; i < BENCH_ENTRIES; i++) {
+            fossil_sanity_log_push(&copies[0][round], messages[i], i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        }
+    }
+    printf("%-10s %12.1f\n", "re-push", (bench_now() - start) / ((double)BENCH_ENTRIES * BENCH_ROUNDS));
+
+    start = bench_now();
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        fossil_sanity_log_init(&copies[1][round]);
+        fossil_sanity_log_restore(&copies[1][round], blob, size);
+    }
+    printf("%-10s %12.1f\n", "restore", (bench_now() - start) / ((double)BENCH_ENTRIES * BENCH_ROUNDS));
+
+    for (int round = 0; round < BENCH_ROUNDS; round++) {
+        sink += copies[1][round].count;
+        fossil_sanity_log_destroy(&copies[0][round]);
+        fossil_sanity_log_destroy(&copies[1][round]);
+    }
+    printf("(%zu entries restored, %zu byte snapshot)\n", sink, size);
+    free(blob);
+    fossil_sanity_log_destroy(&queue);
+    return 0;
+}
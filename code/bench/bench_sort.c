@@ -0,0 +1,127 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fossil/sanity/framework.h>
+#include <time.h>
+
+// Sorting a queue of shuffled entries: the relinking merge sort behind
+// fossil_sanity_log_sort_by against the original bubble sort, which swapped
+// 256-byte message buffers. The bubble sort is quadratic, so by default it
+// only runs up to 20k entries; pass "all" to time it at 100k as well.
+//
+//   bench-sort [all]
+
+#define LEGACY_LIMIT 20000
+
+// The entry layout and sort the queue used before the merge sort
+typedef struct legacy_entry {
+    int priority;
+    int severity;
+    char message[MAX_LOG_MESSAGE_LENGTH];
+    struct legacy_entry *prev;
+    struct legacy_entry *next;
+} legacy_entry_t;
+
+static void legacy_sort(legacy_entry_t *head) {
+    bool swapped;
+    do {
+        swapped = false;
+        legacy_entry_t *current = head;
+        while (current && current->next) {
+            if (current->priority < current->next->priority) {
+                int temp_priority = current->priority;
+                int temp_severity = current->severity;
+                char temp_message[MAX_LOG_MESSAGE_LENGTH];
+                strcpy(temp_message, current->message);
+
+                current->priority = current->next->priority;
+                current->severity = current->next->severity;
+                strcpy(current->message, current->next->message);
+
+                current->next->priority = temp_priority;
+                current->next->severity = temp_severity;
+                strcpy(current->next->message, temp_message);
+
+                swapped = true;
+            }
+            current = current->next;
+        }
+    } while (swapped);
+}
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e3 + (double)ts.tv_nsec / 1e6;
+}
+
+static unsigned int bench_rand(unsigned int *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 17;
+    *state ^= *state << 5;
+    return *state;
+}
+
+static double bench_legacy(size_t count) {
+    unsigned int seed = 0x2545f491u;
+    legacy_entry_t *entries = (legacy_entry_t *)calloc(count, sizeof(legacy_entry_t));
+    for (size_t i = 0; i < count; i++) {
+        entries[i].priority = (int)(bench_rand(&seed) % 1000);
+        snprintf(entries[i].message, sizeof(entries[i].message), "legacy entry %zu", i);
+        entries[i].prev = i ? &entries[i - 1] : NULL;
+        entries[i].next = i + 1 < count ? &entries[i + 1] : NULL;
+    }
+    double start = bench_now();
+    legacy_sort(entries);
+    double elapsed = bench_now() - start;
+    free(entries);
+    return elapsed;
+}
+
+// Severity-major order within each level, so the merge sort does real work
+static int bench_compare(const fossil_sanity_log_entry_t *a, const fossil_sanity_log_entry_t *b) {
+    return (a->severity > b->severity) - (a->severity < b->severity);
+}
+
+static double bench_merge(size_t count) {
+    unsigned int seed = 0x2545f491u;
+    char message[64];
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    for (size_t i = 0; i < count; i++) {
+        snprintf(message, sizeof(message), "merge entry %zu", i);
+        fossil_sanity_log_push(&queue, message, (int)(bench_rand(&seed) % FOSSIL_SANITY_LOG_LEVEL_COUNT), (int)(bench_rand(&seed) % 1000));
+    }
+    double start = bench_now();
+    fossil_sanity_log_sort_by(&queue, bench_compare);
+    double elapsed = bench_now() - start;
+    fossil_sanity_log_destroy(&queue);
+    return elapsed;
+}
+
+int main(int argc, char **argv) {
+    static const size_t counts[] = {1000, 10000, 100000};
+    bool all = argc > 1 && strcmp(argv[1], "all") == 0;
+
+    printf("%-10s %16s %16s\n", "entries", "bubble ms", "merge ms");
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        double merge = bench_merge(counts[i]);
+        if (all || counts[i] <= LEGACY_LIMIT) {
+            printf("%-10zu %16.2f %16.2f\n", counts[i], bench_legacy(counts[i]), merge);
+        } else {
+            printf("%-10zu %16s %16.2f\n", counts[i], "skipped", merge);
+        }
+    }
+    return 0;
+}
@@ -18,6 +18,8 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
 
 // Log Levels (Priority-based)
 #define FOSSIL_SANITY_LOG_LEVEL_DEBUG    0
@@ -25,6 +27,14 @@
 #define FOSSIL_SANITY_LOG_LEVEL_WARNING  2
 #define FOSSIL_SANITY_LOG_LEVEL_ERROR    3
 #define FOSSIL_SANITY_LOG_LEVEL_FATAL    4
+#define FOSSIL_SANITY_LOG_LEVEL_COUNT    5  // Number of priority buckets in a queue
+
+// Lowest level compiled into FOSSIL_SANITY_LOG_* macro call sites. Calls
+// below it expand to nothing, arguments included. Set through the meson
+// option 'log_min_level' or by defining it before including this header.
+#ifndef FOSSIL_SANITY_LOG_MIN_LEVEL
+#define FOSSIL_SANITY_LOG_MIN_LEVEL FOSSIL_SANITY_LOG_LEVEL_DEBUG
+#endif
 
 // Severity Levels
 #define FOSSIL_SANITY_LOG_SEVERITY_LOW    0
@@ -34,6 +44,22 @@
 // Max length for log message
 #define MAX_LOG_MESSAGE_LENGTH 256
 #define MAX_LOG_FILE_SIZE      1024 * 1024  // 1 MB for log file size
+#define FOSSIL_SANITY_LOG_NOTIFY_SINKS 8     // Notification callbacks at most
+
+// Rotated generations kept when a rotation does not set max_files
+#ifndef FOSSIL_SANITY_LOG_ROTATE_FILES
+#define FOSSIL_SANITY_LOG_ROTATE_FILES 5
+#endif
+
+// Messages shorter than this are stored inside the entry itself; longer ones
+// go to the queue's message arena. Part of the entry layout, so not configurable.
+#define FOSSIL_SANITY_LOG_INLINE_LENGTH 24
+
+// Largest number of entries a thread stages before publishing them
+#define FOSSIL_SANITY_LOG_THREAD_BATCH 64
+
+// Default number of entries carved out of each slab of a queue's entry pool
+#define FOSSIL_SANITY_LOG_POOL_CHUNK 64
 
 #ifdef __cplusplus
 extern "C" {
@@ -43,23 +69,259 @@ extern "C" {
 typedef struct fossil_sanity_log_entry {
     int priority;                // Log level priority
     int severity;                // Severity level of the log
-    char message[MAX_LOG_MESSAGE_LENGTH];  // Log message
+    unsigned int flags;          // Storage flags owned by the queue
+    uint32_t length;             // Message length in bytes, excluding the terminator
+    uint64_t sequence;           // Insertion order within the queue
+    uint64_t timestamp;          // Push time in nanoseconds (see fossil_sanity_log_now)
+    const char *message;         // Log message, stored inline or in the queue arena; a binary
+                                 // record for deferred entries (see fossil_sanity_log_format_entry)
+    char inline_message[FOSSIL_SANITY_LOG_INLINE_LENGTH]; // Storage for short messages
+    struct fossil_sanity_log_posting *postings; // Keyword index postings, NULL when not indexed
+    struct fossil_sanity_log_entry **time_slot; // Time index slot, NULL when not indexed
     struct fossil_sanity_log_entry *prev;
     struct fossil_sanity_log_entry *next;
 } fossil_sanity_log_entry_t;
 
+// Slab pool of log entries, owned by a queue
+typedef struct fossil_sanity_log_pool {
+    struct fossil_sanity_log_slab *slabs;   // Cache-aligned slabs backing the pool
+    fossil_sanity_log_entry_t *free_list;   // Released entries ready for reuse
+    size_t chunk_entries;  // Entries per slab (0 while the pool is disabled)
+    size_t slab_count;     // Number of slabs allocated
+    size_t capacity;       // Entries provided by all slabs
+    size_t in_use;         // Entries currently handed out
+} fossil_sanity_log_pool_t;
+
+// Snapshot of a queue's pool occupancy
+typedef struct fossil_sanity_log_pool_stats {
+    size_t slab_count;     // Number of slabs allocated
+    size_t capacity;       // Entries provided by all slabs
+    size_t in_use;         // Entries holding queued messages
+    size_t available;      // Entries waiting on the free list
+    size_t bytes;          // Bytes reserved by the slabs
+} fossil_sanity_log_pool_stats_t;
+
 // Double-ended priority queue (DEPQ)
+//
+// Entries stay on a single list ordered by descending priority, with one FIFO
+// bucket per log level threaded through it. The bucket bounds and the
+// non-empty bitmap let push and pop find their position in constant time.
+// Priorities outside the defined levels share the nearest level's bucket,
+// where they are kept in descending order too (a walk within the bucket).
 typedef struct fossil_sanity_log_queue {
     fossil_sanity_log_entry_t *head;
     fossil_sanity_log_entry_t *tail;
+    fossil_sanity_log_entry_t *level_head[FOSSIL_SANITY_LOG_LEVEL_COUNT]; // Oldest entry of each level
+    fossil_sanity_log_entry_t *level_tail[FOSSIL_SANITY_LOG_LEVEL_COUNT]; // Newest entry of each level
+    unsigned int level_mask; // Bit n is set while level n holds entries
+    size_t count;            // Number of queued entries
+    size_t peak_count;       // Most entries queued at once
+    uint64_t sequence;       // Sequence number given to the next pushed entry
+    size_t capacity;         // Most entries kept, 0 for unbounded (see fossil_sanity_log_set_capacity)
+    uint64_t evicted[FOSSIL_SANITY_LOG_LEVEL_COUNT]; // Entries of each level evicted to honor the capacity
+    fossil_sanity_log_pool_t pool; // Optional entry pool (see fossil_sanity_log_pool_enable)
+    struct fossil_sanity_log_arena_block *arena; // Arena block receiving new long messages
+    struct fossil_sanity_log_mpsc *mpsc;         // Lock-free producer stage (see fossil_sanity_log_enable_concurrent)
+    struct fossil_sanity_log_index *index;       // Keyword index (see fossil_sanity_log_index_enable)
+    struct fossil_sanity_log_limiter *limiter;   // Smart log limits (see fossil_sanity_log_limit_enable)
+    fossil_sanity_log_entry_t *borrowed;         // Entry lent out by fossil_sanity_log_pop_borrow
+    struct fossil_sanity_log_time_index *time_index; // Time chunks (see fossil_sanity_log_time_index_enable)
+    struct fossil_sanity_log_sampler *sampler;   // Smart log sampling (see fossil_sanity_log_sample_enable)
 } fossil_sanity_log_queue_t;
 
-// Log rotation state
+// Token index over a queue's messages (opaque)
+typedef struct fossil_sanity_log_index fossil_sanity_log_index_t;
+
+// Cursor over the entries matching a keyword search
+typedef struct fossil_sanity_log_search_iter {
+    fossil_sanity_log_queue_t *queue;
+    const char *keyword;
+    size_t length;
+    int min_priority;
+    bool token;                                  // Keyword is a single token
+    int level;                                   // Level being walked in the index
+    struct fossil_sanity_log_term *term;         // Index term of the keyword
+    const struct fossil_sanity_log_posting *posting; // Next posting to visit
+    const fossil_sanity_log_entry_t *entry;      // Next entry to scan without the index
+} fossil_sanity_log_search_iter_t;
+
+// Duplicate suppression and rate limits applied by the smart log
+typedef struct fossil_sanity_log_limit_config {
+    unsigned int window_ms;  // Fold repeats of a message within this window; 0 disables
+    unsigned int rate[FOSSIL_SANITY_LOG_LEVEL_COUNT];  // Entries per second per level; 0 is unlimited
+    unsigned int burst[FOSSIL_SANITY_LOG_LEVEL_COUNT]; // Bucket size per level; 0 selects the rate
+} fossil_sanity_log_limit_config_t;
+
+// Counters of what the smart log limits held back
+typedef struct fossil_sanity_log_limit_stats {
+    uint64_t coalesced;      // Repeats folded into an earlier entry
+    uint64_t rate_limited[FOSSIL_SANITY_LOG_LEVEL_COUNT]; // Entries dropped by each level's bucket
+    uint64_t notifications_suppressed; // High-severity notifications skipped
+} fossil_sanity_log_limit_stats_t;
+
+// How the smart log thins out one level
+typedef enum {
+    FOSSIL_SANITY_LOG_SAMPLE_ALL,        // Keep every entry
+    FOSSIL_SANITY_LOG_SAMPLE_ONE_IN_N,   // Keep each entry with probability 1/n
+    FOSSIL_SANITY_LOG_SAMPLE_RESERVOIR   // Keep about n entries per window, spread over it
+} fossil_sanity_log_sample_mode_t;
+
+typedef struct fossil_sanity_log_sample_rule {
+    fossil_sanity_log_sample_mode_t mode;
+    unsigned int n;          // Sampling rate, or entries kept per window
+    unsigned int window_ms;  // Reservoir window; 0 selects one second
+} fossil_sanity_log_sample_rule_t;
+
+// Sampling rules of the smart log, one per level
+typedef struct fossil_sanity_log_sample_config {
+    fossil_sanity_log_sample_rule_t levels[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+} fossil_sanity_log_sample_config_t;
+
+// Smart log sampling state of a queue (opaque)
+typedef struct fossil_sanity_log_sampler fossil_sanity_log_sampler_t;
+
+// Value types of structured fields
+typedef enum {
+    FOSSIL_SANITY_LOG_FIELD_INT,
+    FOSSIL_SANITY_LOG_FIELD_DOUBLE,
+    FOSSIL_SANITY_LOG_FIELD_STRING,
+    FOSSIL_SANITY_LOG_FIELD_BOOL
+} fossil_sanity_log_field_type_t;
+
+// A typed key-value pair attached to an entry
+typedef struct fossil_sanity_log_field {
+    const char *key;         // At most 255 bytes are kept
+    fossil_sanity_log_field_type_t type;
+    union {
+        int64_t i;
+        double d;
+        const char *s;
+        bool b;
+    } value;
+} fossil_sanity_log_field_t;
+
+// Output of fossil_sanity_log_print and the background writer
+typedef enum {
+    FOSSIL_SANITY_LOG_ENCODING_PLAIN,   // The message, then any fields as key=value
+    FOSSIL_SANITY_LOG_ENCODING_JSON,    // One JSON object per line
+    FOSSIL_SANITY_LOG_ENCODING_LOGFMT   // ts=... level=... msg=... key=value
+} fossil_sanity_log_encoding_t;
+
+// Called for each visited entry; return false to stop the traversal
+typedef bool (*fossil_sanity_log_visit_t)(const fossil_sanity_log_entry_t *entry, void *context);
+
+// Orders two entries of the same priority: negative if a comes first,
+// positive if b does, zero to keep their current order
+typedef int (*fossil_sanity_log_compare_t)(const fossil_sanity_log_entry_t *a, const fossil_sanity_log_entry_t *b);
+
+// Log rotation state. Rotated files are kept as numbered generations,
+// log_file_path.1 (newest) up to log_file_path.N (oldest). Set it up with
+// fossil_sanity_log_rotation_init or fossil_sanity_log_rotation_open; a
+// rotation filled in by hand must be zero-initialized first.
 typedef struct fossil_sanity_log_rotation {
     char log_file_path[MAX_LOG_MESSAGE_LENGTH]; // Log file path for rotation
-    size_t current_size;   // Current size of the log file
+    size_t current_size;   // Current size of the log file, tracked from bytes written
+    size_t max_size;       // Rotate once the file grows past this; 0 selects MAX_LOG_FILE_SIZE
+    unsigned int max_files; // Generations kept; 0 selects FOSSIL_SANITY_LOG_ROTATE_FILES
+    int fd;                // Append descriptor, valid while is_open is set
+    bool is_open;
 } fossil_sanity_log_rotation_t;
 
+// Background writer draining a queue into a log file (opaque)
+typedef struct fossil_sanity_log_writer fossil_sanity_log_writer_t;
+
+// Time-bucketed index over a queue's entries (opaque)
+typedef struct fossil_sanity_log_time_index fossil_sanity_log_time_index_t;
+
+// Duplicate suppression and rate limiting state of a queue (opaque)
+typedef struct fossil_sanity_log_limiter fossil_sanity_log_limiter_t;
+
+// What a full notification queue does with a new alert
+typedef enum {
+    FOSSIL_SANITY_LOG_NOTIFY_DROP_NEWEST,  // Discard the new alert
+    FOSSIL_SANITY_LOG_NOTIFY_DROP_OLDEST,  // Discard the oldest queued alert
+    FOSSIL_SANITY_LOG_NOTIFY_BLOCK         // Wait for room
+} fossil_sanity_log_notify_policy_t;
+
+// Notification thread settings
+typedef struct fossil_sanity_log_notify_config {
+    size_t capacity;                          // Alerts queued at most; 0 selects 1024
+    fossil_sanity_log_notify_policy_t policy; // Overflow policy
+    size_t batch;                             // Alerts handed to a sink at once; 0 selects 32
+    unsigned int linger_ms;                   // Wait this long for a batch to fill; 0 sends at once
+} fossil_sanity_log_notify_config_t;
+
+typedef struct fossil_sanity_log_notify_stats {
+    uint64_t submitted;  // Alerts passed to fossil_sanity_log_notify
+    uint64_t delivered;  // Alerts handed to the sinks
+    uint64_t dropped;    // Alerts discarded by the overflow policy
+    uint64_t batches;    // Sink deliveries
+} fossil_sanity_log_notify_stats_t;
+
+// Receives a batch of alerts on the notification thread
+typedef void (*fossil_sanity_log_notify_fn)(const char *const *messages, size_t count, void *context);
+
+// Crash-safe memory-mapped ring log file (opaque)
+typedef struct fossil_sanity_log_ring fossil_sanity_log_ring_t;
+
+// Shared-memory ring collecting entries from several processes (opaque)
+typedef struct fossil_sanity_log_shm fossil_sanity_log_shm_t;
+
+// State of a shared-memory ring, summed over every process using it
+typedef struct fossil_sanity_log_shm_stats {
+    size_t capacity;     // Slots in the ring
+    size_t pending;      // Entries pushed, or being pushed, and not yet collected
+    uint64_t dropped;    // Pushes refused because the ring was full
+    uint64_t abandoned;  // Slots reclaimed from producers that died mid-write
+} fossil_sanity_log_shm_stats_t;
+
+// Filters of an offline query; a zeroed query matches every line. Lines
+// that do not carry an attribute a filter needs do not match it.
+typedef struct fossil_sanity_log_query {
+    unsigned int levels;   // Bit (1 << level) per level to match; 0 for every level
+    int min_severity;      // Lowest severity to match
+    uint64_t since;        // Earliest timestamp in nanoseconds, as logged; 0 for no bound
+    uint64_t until;        // Latest timestamp in nanoseconds, as logged; 0 for no bound
+    const char *keyword;   // Text the line must contain; NULL for any
+} fossil_sanity_log_query_t;
+
+// Receives a matching line, without its newline, valid only during the call.
+// Returning false ends the query.
+typedef bool (*fossil_sanity_log_line_fn)(const char *line, size_t length, void *context);
+
+// Summary of a latency histogram, in nanoseconds. Percentiles are accurate
+// to within 1/8 of the value (8 sub-buckets per power of two).
+typedef struct fossil_sanity_log_latency {
+    uint64_t count;
+    uint64_t mean;
+    uint64_t p50;
+    uint64_t p90;
+    uint64_t p99;
+    uint64_t p999;
+    uint64_t max;
+} fossil_sanity_log_latency_t;
+
+// Counters of the log subsystem, summed over every thread since start
+typedef struct fossil_sanity_log_metrics {
+    uint64_t pushes[FOSSIL_SANITY_LOG_LEVEL_COUNT]; // Entries queued per level
+    uint64_t drained;        // Entries removed by pops and the writer
+    uint64_t bytes_stored;   // Message bytes queued
+    uint64_t bytes_written;  // Bytes appended to log files
+    uint64_t dropped;        // Entries lost to allocation failures or rate limits
+    uint64_t evicted;        // Entries evicted to honor a capacity
+    uint64_t suppressed;     // Repeats folded by the smart log limits
+    uint64_t sampled[FOSSIL_SANITY_LOG_LEVEL_COUNT]; // Smart log entries skipped by sampling
+    size_t depth;            // Entries in the queue passed to the read
+    size_t peak_depth;       // Most entries that queue held at once
+    fossil_sanity_log_latency_t push_latency;  // Filled while timing is enabled
+    fossil_sanity_log_latency_t drain_latency;
+} fossil_sanity_log_metrics_t;
+
+typedef enum {
+    FOSSIL_SANITY_LOG_METRICS_TEXT,
+    FOSSIL_SANITY_LOG_METRICS_JSON
+} fossil_sanity_log_metrics_format_t;
+
 /**
  * @brief Initialize the log queue.
  *
@@ -70,6 +332,12 @@ void fossil_sanity_log_init(fossil_sanity_log_queue_t *queue);
 /**
  * @brief Push a log message onto the queue.
  *
+ * The entry is appended to the FIFO bucket of its priority in constant time,
+ * so entries of equal priority keep their insertion order. A priority outside
+ * the defined levels goes into the nearest level's bucket, ahead of any lower
+ * priority there. Messages of any length are stored in full; short ones live
+ * inside the entry and longer ones in the queue's bump-allocated message arena.
+ *
  * @param queue Pointer to the log queue.
  * @param message The log message to push.
  * @param priority The priority of the log message.
@@ -77,14 +345,147 @@ void fossil_sanity_log_init(fossil_sanity_log_queue_t *queue);
  */
 void fossil_sanity_log_push(fossil_sanity_log_queue_t *queue, const char *message, int priority, int severity);
 
+/**
+ * @brief Push an entry whose message is formatted later.
+ *
+ * Instead of formatting on the caller's thread, the entry stores a compact
+ * binary record: the format pointer and the raw bytes of the arguments
+ * (strings are copied). The text is produced when the entry is consumed:
+ * by pop, print, the background writer or fossil_sanity_log_format_entry.
+ * Searching or indexing an entry formats it once and keeps the text. A
+ * keyword index does not format on push: deferred entries are indexed by
+ * the next keyword search answered from the index.
+ * Formats with %n, wide characters or arguments that do not fit in
+ * MAX_LOG_MESSAGE_LENGTH bytes are formatted immediately instead.
+ *
+ * @param queue Pointer to the log queue.
+ * @param priority The priority of the log message.
+ * @param severity The severity of the log message.
+ * @param format A printf format that must stay valid until the entry is
+ *        consumed, typically a string literal.
+ */
+void fossil_sanity_log_push_deferred(fossil_sanity_log_queue_t *queue, int priority, int severity, const char *format, ...);
+
+/**
+ * @brief va_list form of fossil_sanity_log_push_deferred.
+ */
+void fossil_sanity_log_push_deferredv(fossil_sanity_log_queue_t *queue, int priority, int severity, const char *format, va_list args);
+
+/**
+ * @brief Render the text of an entry, formatting a deferred record.
+ *
+ * @param entry The entry to render.
+ * @param buffer Receives the NUL-terminated text; may be NULL if size is 0.
+ * @param size Size of the buffer.
+ * @return The full text length, which may exceed size - 1 (as snprintf).
+ */
+size_t fossil_sanity_log_format_entry(const fossil_sanity_log_entry_t *entry, char *buffer, size_t size);
+
 /**
  * @brief Pop a log message from the queue.
  *
+ * Removes the oldest entry of the highest non-empty priority in constant time.
+ *
  * @param queue Pointer to the log queue.
  * @return The popped log message.
  */
 char *fossil_sanity_log_pop(fossil_sanity_log_queue_t *queue);
 
+/**
+ * @brief Pop the highest priority message into a caller buffer.
+ *
+ * Nothing is allocated. When the buffer is too small the entry stays
+ * queued and length reports the size needed (without the terminator).
+ *
+ * @param queue Pointer to the log queue.
+ * @param buffer Receives the NUL-terminated message.
+ * @param size Size of the buffer.
+ * @param length Receives the message length; 0 when the queue is empty.
+ * @return True if an entry was popped.
+ */
+bool fossil_sanity_log_pop_into(fossil_sanity_log_queue_t *queue, char *buffer, size_t size, size_t *length);
+
+/**
+ * @brief Pop the highest priority entry and lend it to the caller.
+ *
+ * The entry is unlinked but not freed, so its message and length can be
+ * read in place. It stays valid until the next call of this function or
+ * until the queue is cleared or destroyed.
+ *
+ * @param queue Pointer to the log queue.
+ * @return The popped entry, or NULL if the queue is empty.
+ */
+const fossil_sanity_log_entry_t *fossil_sanity_log_pop_borrow(fossil_sanity_log_queue_t *queue);
+
+/**
+ * @brief Pop up to max entries in one call, handing each to a visitor.
+ *
+ * Entries are removed in pop order and freed once the visitor returns;
+ * the visitor must copy whatever it keeps. Returning false stops the
+ * batch after the current entry.
+ *
+ * @param queue Pointer to the log queue.
+ * @param max Most entries to pop.
+ * @param visitor Receives each popped entry.
+ * @param context Passed to the visitor.
+ * @return The number of entries popped.
+ */
+size_t fossil_sanity_log_pop_batch(fossil_sanity_log_queue_t *queue, size_t max, fossil_sanity_log_visit_t visitor, void *context);
+
+/**
+ * @brief Visit the queued entries in pop order without removing them.
+ *
+ * Walks the list in place like fossil_sanity_log_print, without copying or
+ * allocating; deferred messages are formatted once on first visit.
+ *
+ * @param queue Pointer to the log queue.
+ * @param visitor Receives each entry; returning false stops the walk.
+ * @param context Passed to the visitor.
+ * @return The number of entries visited.
+ */
+size_t fossil_sanity_log_for_each(fossil_sanity_log_queue_t *queue, fossil_sanity_log_visit_t visitor, void *context);
+
+/**
+ * @brief Pop the least important log message from the queue.
+ *
+ * Removes the oldest entry of the lowest non-empty priority in constant time.
+ *
+ * @param queue Pointer to the log queue.
+ * @return The popped log message, or NULL if the queue is empty.
+ */
+char *fossil_sanity_log_pop_min(fossil_sanity_log_queue_t *queue);
+
+/**
+ * @brief Look at the entry fossil_sanity_log_pop would remove.
+ *
+ * @param queue Pointer to the log queue.
+ * @return The entry, valid until the queue changes, or NULL if empty.
+ */
+const fossil_sanity_log_entry_t *fossil_sanity_log_peek_max(fossil_sanity_log_queue_t *queue);
+
+/**
+ * @brief Look at the entry fossil_sanity_log_pop_min would remove.
+ *
+ * @param queue Pointer to the log queue.
+ * @return The entry, valid until the queue changes, or NULL if empty.
+ */
+const fossil_sanity_log_entry_t *fossil_sanity_log_peek_min(fossil_sanity_log_queue_t *queue);
+
+/**
+ * @brief Bound the number of queued entries.
+ *
+ * Once the queue holds more than capacity entries, the entry
+ * fossil_sanity_log_pop_min would remove is evicted and counted in
+ * evicted[level], so memory stays capped while the most important entries
+ * survive. A new entry of the lowest level is itself evicted when the rest
+ * are more important. Lowering the capacity evicts right away. In
+ * concurrent mode the bound is applied as entries are collected.
+ *
+ * @param queue Pointer to the log queue.
+ * @param capacity Most entries kept; 0 removes the bound.
+ */
+void fossil_sanity_log_set_capacity(fossil_sanity_log_queue_t *queue, size_t capacity);
+
 /**
  * @brief Print all log messages in the queue.
  *
@@ -95,17 +496,158 @@ void fossil_sanity_log_print(fossil_sanity_log_queue_t *queue);
 /**
  * @brief Clear all log messages from the queue.
  *
+ * Pooled entries go back to the free list; the pool itself is kept.
+ *
  * @param queue Pointer to the log queue.
  */
 void fossil_sanity_log_clear(fossil_sanity_log_queue_t *queue);
 
+/**
+ * @brief Clear the queue and release every resource it owns, including pool slabs.
+ *
+ * @param queue Pointer to the log queue.
+ */
+void fossil_sanity_log_destroy(fossil_sanity_log_queue_t *queue);
+
+/**
+ * @brief Back the queue's entries with a slab pool.
+ *
+ * Entries are carved out of cache-aligned slabs and recycled through a free
+ * list instead of going back to the allocator. Entries already queued keep
+ * their original storage.
+ *
+ * @param queue Pointer to the log queue.
+ * @param chunk_entries Entries per slab, or 0 for FOSSIL_SANITY_LOG_POOL_CHUNK.
+ * @return True if the pool is enabled.
+ */
+bool fossil_sanity_log_pool_enable(fossil_sanity_log_queue_t *queue, size_t chunk_entries);
+
+/**
+ * @brief Preallocate pool slabs until at least the given number of entries fit.
+ *
+ * Enables the pool with the default slab size if needed. A queue that never
+ * holds more than the reserved capacity does no allocation on push or pop.
+ *
+ * @param queue Pointer to the log queue.
+ * @param capacity The number of entries to provide.
+ * @return True if the capacity is available.
+ */
+bool fossil_sanity_log_pool_reserve(fossil_sanity_log_queue_t *queue, size_t capacity);
+
+/**
+ * @brief Report the occupancy of the queue's entry pool.
+ *
+ * @param queue Pointer to the log queue.
+ * @param stats Receives the pool statistics.
+ */
+void fossil_sanity_log_pool_stats(const fossil_sanity_log_queue_t *queue, fossil_sanity_log_pool_stats_t *stats);
+
+/**
+ * @brief Let many threads push into the queue without external locking.
+ *
+ * After this call fossil_sanity_log_push and fossil_sanity_log_smart_log may be
+ * called from any number of threads at once. Each level gets a lock-free
+ * multi-producer queue; pushed entries are moved into the level buckets by
+ * the single consumer thread whenever it calls pop, print, clear, sort,
+ * filter or search, so the consumer still sees priority order. All of those
+ * calls, and destroy, must come from one thread at a time.
+ *
+ * @param queue Pointer to the log queue.
+ * @return True if concurrent pushes are enabled.
+ */
+bool fossil_sanity_log_enable_concurrent(fossil_sanity_log_queue_t *queue);
+
+/**
+ * @brief Stage concurrent pushes in a per-thread ring and publish them in batches.
+ *
+ * Enables concurrent mode if needed. Each pushing thread collects entries in
+ * a small thread-local ring and hands them to the shared queue with one
+ * atomic exchange per level once the ring holds batch entries, when the
+ * thread calls fossil_sanity_log_flush_thread, or when the thread exits.
+ * Staged entries are invisible to the consumer until published; priority
+ * order holds once they are. Producers must flush or exit before the queue
+ * is destroyed.
+ *
+ * @param queue Pointer to the log queue.
+ * @param batch Entries per batch, or 0 for FOSSIL_SANITY_LOG_THREAD_BATCH.
+ * @return True if thread buffering is enabled.
+ */
+bool fossil_sanity_log_enable_thread_buffering(fossil_sanity_log_queue_t *queue, size_t batch);
+
+/**
+ * @brief Publish every entry the calling thread has staged.
+ */
+void fossil_sanity_log_flush_thread(void);
+
 /**
  * @brief Sort the log messages in the queue.
  *
+ * Stable O(n log n) merge sort by descending priority that relinks entries
+ * without copying them.
+ *
  * @param queue Pointer to the log queue.
  */
 void fossil_sanity_log_sort(fossil_sanity_log_queue_t *queue);
 
+/**
+ * @brief Sort the queue by priority, then by a comparator within each priority.
+ *
+ * Entries stay grouped by descending priority; the comparator orders entries
+ * of equal priority. The sort is stable and only relinks prev/next pointers.
+ *
+ * @param queue Pointer to the log queue.
+ * @param compare Tie-breaker within a priority, or NULL to keep insertion order.
+ */
+void fossil_sanity_log_sort_by(fossil_sanity_log_queue_t *queue, fossil_sanity_log_compare_t compare);
+
+/**
+ * @brief Comparator: higher severity first, then insertion order.
+ */
+int fossil_sanity_log_compare_severity(const fossil_sanity_log_entry_t *a, const fossil_sanity_log_entry_t *b);
+
+/**
+ * @brief Comparator: insertion order.
+ */
+int fossil_sanity_log_compare_sequence(const fossil_sanity_log_entry_t *a, const fossil_sanity_log_entry_t *b);
+
+/**
+ * @brief Merge several queues into one.
+ *
+ * A k-way merge over a binary heap of the queue heads: entries leave by
+ * descending priority, then ascending timestamp, then input order (the
+ * destination's own entries first), so each queue keeps its internal order.
+ * Entries are relinked, never copied. The destination takes over the pool
+ * slabs of the sources, and messages keep their arena blocks alive through
+ * the blocks' reference counts, so the sources stay usable and
+ * independent. Entries lent by fossil_sanity_log_pop_borrow from a source
+ * are released. Merged entries are renumbered from the destination's
+ * sequence counter in the order they were logged (timestamp, then input
+ * order), so sequences stay unique. The destination's capacity applies
+ * once the merge is done. O(n log n) for n entries.
+ *
+ * @param dest The queue receiving every entry; may hold entries already.
+ * @param sources The queues to drain; NULL items and dest are skipped.
+ * @param count Number of sources.
+ * @return The number of entries moved, including those of dest.
+ */
+size_t fossil_sanity_log_merge(fossil_sanity_log_queue_t *dest, fossil_sanity_log_queue_t *const *sources, size_t count);
+
+/**
+ * @brief Stream the merge of several queues into a sink.
+ *
+ * Same order as fossil_sanity_log_merge, without building a merged queue:
+ * each entry is unlinked from its queue, handed to the sink, then freed.
+ * When the sink returns false the merge stops and the remaining entries
+ * stay in their queues.
+ *
+ * @param sources The queues to drain; NULL items are skipped.
+ * @param count Number of sources.
+ * @param sink Receives each entry, formatted, before it is freed.
+ * @param context Passed to the sink.
+ * @return The number of entries handed to the sink.
+ */
+size_t fossil_sanity_log_merge_stream(fossil_sanity_log_queue_t *const *sources, size_t count, fossil_sanity_log_visit_t sink, void *context);
+
 /**
  * @brief Filter log messages in the queue by minimum priority.
  *
@@ -119,27 +661,700 @@ void fossil_sanity_log_filter(fossil_sanity_log_queue_t *queue, int min_priority
  *
  * @param queue Pointer to the log queue.
  * @param keyword The keyword to search for.
- * @return The found log message.
+ * @return The found log message, owned by the queue and valid while the entry is queued.
  */
 char *fossil_sanity_log_search(fossil_sanity_log_queue_t *queue, const char *keyword);
 
+/**
+ * @brief Maintain a token index over the queue for fast keyword searches.
+ *
+ * Messages are split into tokens (runs of letters, digits and '_'). Each
+ * token keeps one posting list per level, updated on every push and
+ * removal, so searches touch only matching entries. Entries already queued
+ * are indexed immediately. Deferred entries pushed later are formatted and
+ * indexed by the first indexed search after them; other entries are not
+ * revisited.
+ *
+ * @param queue Pointer to the log queue.
+ * @return True if the index is enabled.
+ */
+bool fossil_sanity_log_index_enable(fossil_sanity_log_queue_t *queue);
+
+/**
+ * @brief Start a search for every entry matching the keyword.
+ *
+ * A keyword made of a single token matches messages containing it as a
+ * whole token, answered from the index when one is enabled. Any other
+ * keyword matches as a substring by scanning the queue. Matches come from
+ * the highest level down, oldest first within a level, and only levels at
+ * or above min_priority are visited. The queue must not change while the
+ * iterator is in use.
+ *
+ * @param iter The iterator to initialize.
+ * @param queue Pointer to the log queue.
+ * @param keyword The keyword to search for; must outlive the iterator.
+ * @param min_priority The lowest priority to return.
+ */
+void fossil_sanity_log_search_begin(fossil_sanity_log_search_iter_t *iter, fossil_sanity_log_queue_t *queue, const char *keyword, int min_priority);
+
+/**
+ * @brief Advance a search iterator.
+ *
+ * @param iter The iterator.
+ * @return The next matching entry, or NULL when there are no more.
+ */
+const fossil_sanity_log_entry_t *fossil_sanity_log_search_next(fossil_sanity_log_search_iter_t *iter);
+
+/**
+ * @brief Collect every entry matching the keyword.
+ *
+ * Uses the same matching rules and order as fossil_sanity_log_search_begin.
+ *
+ * @param queue Pointer to the log queue.
+ * @param keyword The keyword to search for.
+ * @param min_priority The lowest priority to return.
+ * @param results Receives up to max_results matching entries; may be NULL.
+ * @param max_results Capacity of results.
+ * @return The total number of matches, which may exceed max_results.
+ */
+size_t fossil_sanity_log_search_all(fossil_sanity_log_queue_t *queue, const char *keyword, int min_priority, const fossil_sanity_log_entry_t **results, size_t max_results);
+
+/**
+ * @brief Remove every entry the predicate rejects, testing entries in parallel.
+ *
+ * The queue is cut into contiguous chunks that an internal pool of worker
+ * threads tests at once; the rejected entries are then removed by the
+ * caller. The pool has one thread per core, the caller included. Queues too
+ * small to gain from it, and every queue on a single core, are filtered on
+ * the calling thread. The predicate runs on several threads and must be thread-safe;
+ * it sees formatted messages. Like every consumer call, only one thread may
+ * use the queue while it runs.
+ *
+ * @param queue Pointer to the log queue.
+ * @param keep Returns true for entries to keep.
+ * @param context Passed to the predicate.
+ * @return The number of entries removed.
+ */
+size_t fossil_sanity_log_filter_parallel(fossil_sanity_log_queue_t *queue, fossil_sanity_log_visit_t keep, void *context);
+
+/**
+ * @brief Collect every entry matching the keyword, scanning in parallel.
+ *
+ * Returns the same entries in the same order as fossil_sanity_log_search_all.
+ * A token keyword on an indexed queue is answered from the index instead.
+ *
+ * @param queue Pointer to the log queue.
+ * @param keyword The keyword to search for.
+ * @param min_priority The lowest priority to return.
+ * @param results Receives up to max_results matching entries; may be NULL.
+ * @param max_results Capacity of results.
+ * @return The total number of matches, which may exceed max_results.
+ */
+size_t fossil_sanity_log_search_all_parallel(fossil_sanity_log_queue_t *queue, const char *keyword, int min_priority, const fossil_sanity_log_entry_t **results, size_t max_results);
+
+/**
+ * @brief Sort the queue like fossil_sanity_log_sort_by, on several threads.
+ *
+ * Runs of the queue are sorted in parallel and merged pairwise; the result
+ * is identical to fossil_sanity_log_sort_by. The comparator must be
+ * thread-safe.
+ *
+ * @param queue Pointer to the log queue.
+ * @param compare Tie-breaker within a priority, or NULL to keep insertion order.
+ */
+void fossil_sanity_log_sort_parallel(fossil_sanity_log_queue_t *queue, fossil_sanity_log_compare_t compare);
+
+/**
+ * @brief Set up a rotation policy without opening the file.
+ *
+ * The rotation is left closed: fossil_sanity_log_rotate then checks the
+ * file with a stat, and fossil_sanity_log_writer_start opens its own copy.
+ *
+ * @param rotation The rotation state to initialize.
+ * @param path The log file path, shorter than MAX_LOG_MESSAGE_LENGTH.
+ * @param max_size Size that triggers a rotation; 0 selects MAX_LOG_FILE_SIZE.
+ * @param max_files Generations to keep; 0 selects FOSSIL_SANITY_LOG_ROTATE_FILES.
+ * @return False if the path does not fit.
+ */
+bool fossil_sanity_log_rotation_init(fossil_sanity_log_rotation_t *rotation, const char *path, size_t max_size, unsigned int max_files);
+
+/**
+ * @brief Open a log file for appending under a rotation policy.
+ *
+ * The file is opened once with O_APPEND and its size read once; from then
+ * on the size is tracked from the bytes written through the rotation.
+ *
+ * @param rotation The rotation state to initialize.
+ * @param path The log file path, shorter than MAX_LOG_MESSAGE_LENGTH.
+ * @param max_size Size that triggers a rotation; 0 selects MAX_LOG_FILE_SIZE.
+ * @param max_files Generations to keep; 0 selects FOSSIL_SANITY_LOG_ROTATE_FILES.
+ * @return True if the file was opened; false if it could not be or the
+ *         path does not fit.
+ */
+bool fossil_sanity_log_rotation_open(fossil_sanity_log_rotation_t *rotation, const char *path, size_t max_size, unsigned int max_files);
+
+/**
+ * @brief Append to the current log file.
+ *
+ * Never rotates, so it costs one write call; call fossil_sanity_log_rotate
+ * from a less latency-sensitive place to roll the file over.
+ *
+ * @param rotation An open rotation.
+ * @param data The bytes to append.
+ * @param length The number of bytes.
+ * @return True if every byte was written.
+ */
+bool fossil_sanity_log_rotation_write(fossil_sanity_log_rotation_t *rotation, const void *data, size_t length);
+
+/**
+ * @brief Close the log file of a rotation.
+ *
+ * @param rotation The rotation to close.
+ */
+void fossil_sanity_log_rotation_close(fossil_sanity_log_rotation_t *rotation);
+
+/**
+ * @brief Read the clock used to timestamp entries.
+ *
+ * A coarse monotonic clock (CLOCK_MONOTONIC_COARSE where available), read
+ * without a system call; its resolution is a few milliseconds at most.
+ *
+ * @return The current time in nanoseconds.
+ */
+uint64_t fossil_sanity_log_now(void);
+
+/**
+ * @brief Keep a time index so range queries skip whole chunks of entries.
+ *
+ * Entries are recorded in arrival order in fixed-size chunks that know the
+ * time span they cover; a range query only opens chunks overlapping the
+ * range. Entries already queued are indexed immediately.
+ *
+ * @param queue Pointer to the log queue.
+ * @return True if the index is enabled.
+ */
+bool fossil_sanity_log_time_index_enable(fossil_sanity_log_queue_t *queue);
+
+/**
+ * @brief Visit the entries pushed within a time range, oldest first.
+ *
+ * Without a time index the queue is scanned, merging the levels by
+ * sequence number; once the queue was sorted by another key the matching
+ * entries are gathered and ordered by sequence instead.
+ *
+ * @param queue Pointer to the log queue.
+ * @param from First timestamp included.
+ * @param to First timestamp excluded.
+ * @param visitor Receives each matching entry; returning false stops.
+ * @param context Passed to the visitor.
+ * @return The number of entries visited.
+ */
+size_t fossil_sanity_log_query_time(fossil_sanity_log_queue_t *queue, uint64_t from, uint64_t to, fossil_sanity_log_visit_t visitor, void *context);
+
+/**
+ * @brief Push a message with typed key-value fields.
+ *
+ * The fields are packed behind the message in the entry's own storage
+ * (inline or in the arena, like any message): one type byte, the key and
+ * the raw value each, with no per-field allocation. The message stays a
+ * plain string for search, pop and the indexes; the fields are emitted by
+ * fossil_sanity_log_print, the background writer and
+ * fossil_sanity_log_encode_entry.
+ *
+ * @param queue Pointer to the log queue.
+ * @param priority The priority of the log message.
+ * @param severity The severity of the log message.
+ * @param message The log message.
+ * @param fields The fields; keys and strings are copied.
+ * @param count Number of fields, at most 255.
+ */
+void fossil_sanity_log_push_fields(fossil_sanity_log_queue_t *queue, int priority, int severity, const char *message, const fossil_sanity_log_field_t *fields, size_t count);
+
+/**
+ * @brief Read back the fields of an entry.
+ *
+ * Keys and string values point into the entry and stay valid while it is
+ * queued.
+ *
+ * @param entry The entry.
+ * @param fields Receives up to max fields.
+ * @param max Size of the fields array.
+ * @return The number of fields the entry has.
+ */
+size_t fossil_sanity_log_entry_fields(const fossil_sanity_log_entry_t *entry, fossil_sanity_log_field_t *fields, size_t max);
+
+/**
+ * @brief Choose how fossil_sanity_log_print and the background writer emit entries.
+ *
+ * @param encoding FOSSIL_SANITY_LOG_ENCODING_PLAIN (the default), _JSON or _LOGFMT.
+ */
+void fossil_sanity_log_set_encoding(fossil_sanity_log_encoding_t encoding);
+
+/**
+ * @brief Encode an entry as one line, without the newline.
+ *
+ * A hand-written serializer that appends straight into the buffer: no
+ * allocation and no format string parsing. JSON and logfmt lines carry
+ * ts, level, severity and msg, then the fields in push order; strings are
+ * escaped, doubles are written with up to six decimals. Same contract as
+ * snprintf: returns the full length and writes at most size bytes.
+ *
+ * @param entry The entry.
+ * @param encoding The output encoding.
+ * @param buffer Receives the line.
+ * @param size Size of the buffer.
+ * @return The length of the full line.
+ */
+size_t fossil_sanity_log_encode_entry(const fossil_sanity_log_entry_t *entry, fossil_sanity_log_encoding_t encoding, char *buffer, size_t size);
+
 /**
  * @brief Rotate the log files based on the rotation policy.
  *
- * @param rotation Pointer to the log rotation policy.
+ * Once the file has grown past the size limit, each generation moves up one
+ * number, the oldest beyond the count limit is replaced, and the current
+ * file becomes log_file_path.1. An open rotation decides from its tracked
+ * size without any system call and reopens a fresh file; a rotation that
+ * was never opened reads the file size with a single stat.
+ *
+ * @param rotation Pointer to the log rotation policy, set up as described at
+ *        fossil_sanity_log_rotation_t.
  */
 void fossil_sanity_log_rotate(fossil_sanity_log_rotation_t *rotation);
 
+/**
+ * @brief Start a background thread that writes the queue to a log file.
+ *
+ * Enables concurrent mode on the queue, so producers only pay for the
+ * enqueue. The writer becomes the queue's consumer: it wakes every few
+ * milliseconds, drains all queued entries oldest first, formats them into
+ * a large buffer and appends that buffer with as few write/writev calls as
+ * possible. Rotation is checked by the same thread after every drain,
+ * so producers never wait on a rename.
+ * No other thread may pop, print, filter, sort, search or clear the queue
+ * while the writer runs.
+ *
+ * @param queue Pointer to the log queue to drain.
+ * @param rotation Rotation policy naming the log file and its limits; the
+ *        writer copies the policy and opens its own descriptor.
+ * @return The running writer, or NULL if the file or thread could not be started.
+ */
+fossil_sanity_log_writer_t *fossil_sanity_log_writer_start(fossil_sanity_log_queue_t *queue, const fossil_sanity_log_rotation_t *rotation);
+
+/**
+ * @brief Block until every entry pushed before the call has been written.
+ *
+ * Entries staged by other threads' buffers are covered once those threads
+ * flush them.
+ *
+ * @param writer The writer to flush.
+ */
+void fossil_sanity_log_writer_flush(fossil_sanity_log_writer_t *writer);
+
+/**
+ * @brief Drain the queue completely, then stop the writer and close the file.
+ *
+ * @param writer The writer to stop; freed by this call.
+ */
+void fossil_sanity_log_writer_stop(fossil_sanity_log_writer_t *writer);
+
+/**
+ * @brief Serialize a queue into one self-checking binary blob.
+ *
+ * Entries are written in queue order with their level, severity, sequence,
+ * timestamp, text and fields; deferred entries are saved as formatted
+ * text. The blob is in native byte order and only meant to be restored by
+ * the same build on the same kind of machine. The queue is left as is.
+ *
+ * @param queue The queue to save.
+ * @param buffer Destination, or NULL to only compute the size.
+ * @param size Bytes available at buffer.
+ * @return Bytes the snapshot takes; nothing is written if that exceeds
+ *         size. 0 on allocation failure.
+ */
+size_t fossil_sanity_log_snapshot(fossil_sanity_log_queue_t *queue, void *buffer, size_t size);
+
+/**
+ * @brief Rebuild a queue from a blob made by fossil_sanity_log_snapshot.
+ *
+ * The whole blob is checked (magic, version, bounds and checksum) before
+ * anything is allocated. Entries then come from a single slab and their
+ * long messages from a single arena block, linked in the saved order
+ * without reinsertion; enabled indexes are rebuilt and the sequence
+ * counter continues from the saved queue. Capacity limits apply. The slab
+ * joins the queue's pool without enabling pooling for later pushes.
+ *
+ * Entry timestamps come from a clock that restarts with the machine, so
+ * they are rebased onto the current clock: each entry keeps its age at
+ * snapshot time plus the wall-clock time elapsed since. Time queries on
+ * the restored queue therefore see the entries in the past, in order.
+ *
+ * @param queue An empty queue.
+ * @param blob The snapshot.
+ * @param size Snapshot size in bytes.
+ * @return False if the queue is not empty, the blob is damaged or
+ *         allocation failed; the queue is then unchanged.
+ */
+bool fossil_sanity_log_restore(fossil_sanity_log_queue_t *queue, const void *blob, size_t size);
+
+/**
+ * @brief Open a fixed-size ring log file mapped into memory.
+ *
+ * Appends are plain memory copies into a shared mapping, so the kernel
+ * persists them without a system call per entry, and entries survive a
+ * crash of the process. A small header holds the cursors: a record is
+ * visible to recovery only once the commit cursor has passed it. When the
+ * ring is full the oldest records are overwritten. An existing ring file
+ * is reopened and appended to.
+ *
+ * @param path The ring file path.
+ * @param capacity Bytes of record space; 0 reuses the size of an existing ring.
+ * @return The open ring, or NULL on failure.
+ */
+fossil_sanity_log_ring_t *fossil_sanity_log_ring_open(const char *path, size_t capacity);
+
+/**
+ * @brief Append an entry to the ring. Calls are serialized internally.
+ *
+ * @param ring The ring.
+ * @param message The log message.
+ * @param priority The log level.
+ * @param severity The log severity.
+ * @return False if the message does not fit in a quarter of the ring.
+ */
+bool fossil_sanity_log_ring_append(fossil_sanity_log_ring_t *ring, const char *message, int priority, int severity);
+
+/**
+ * @brief Force the ring's pages to storage, surviving a system crash too.
+ *
+ * @param ring The ring.
+ */
+void fossil_sanity_log_ring_sync(fossil_sanity_log_ring_t *ring);
+
+/**
+ * @brief Unmap and close a ring.
+ *
+ * @param ring The ring; freed by this call.
+ */
+void fossil_sanity_log_ring_close(fossil_sanity_log_ring_t *ring);
+
+/**
+ * @brief Read the most recent committed entries back from a ring file.
+ *
+ * Intended for use after a crash. Records still being written when the
+ * process died are skipped. Recovered entries are pushed oldest first and
+ * keep the time they were appended.
+ *
+ * @param path The ring file path.
+ * @param queue The queue receiving the entries.
+ * @param max_entries The most recent entries to recover; 0 for all.
+ * @return The number of entries recovered.
+ */
+size_t fossil_sanity_log_ring_recover(const char *path, fossil_sanity_log_queue_t *queue, size_t max_entries);
+
+/**
+ * @brief Create the shared-memory ring of a collector, or reattach to it.
+ *
+ * The ring is a POSIX shared memory object of fixed-size slots that any
+ * number of processes push into without locks; one collector drains it.
+ * A ring left by a previous collector with the same capacity is reused
+ * with its pending entries, anything else is reinitialized.
+ *
+ * @param name Shared memory object name, starting with '/'.
+ * @param capacity Slots in the ring, rounded up to a power of two; 0 selects 1024.
+ * @return The ring, or NULL on failure.
+ */
+fossil_sanity_log_shm_t *fossil_sanity_log_shm_create(const char *name, size_t capacity);
+
+/**
+ * @brief Attach a producer to a ring made by fossil_sanity_log_shm_create.
+ *
+ * A ring handle created or opened before fork() also works in the child.
+ *
+ * @param name Shared memory object name.
+ * @return The ring, or NULL if it does not exist or is not a log ring.
+ */
+fossil_sanity_log_shm_t *fossil_sanity_log_shm_open(const char *name);
+
+/**
+ * @brief Unmap a ring. The shared memory object stays until unlinked.
+ *
+ * @param shm The ring; freed by this call.
+ */
+void fossil_sanity_log_shm_close(fossil_sanity_log_shm_t *shm);
+
+/**
+ * @brief Remove a ring's shared memory object; mappings stay valid.
+ *
+ * @param name Shared memory object name.
+ * @return True if the object was removed.
+ */
+bool fossil_sanity_log_shm_unlink(const char *name);
+
+/**
+ * @brief Claim a slot and return its message buffer to write in place.
+ *
+ * The buffer holds MAX_LOG_MESSAGE_LENGTH bytes. The entry is stamped
+ * with the calling process's id, its next sequence number (counted per
+ * process from 0, restarting in a forked child) and the current time.
+ * It reaches the collector once committed; if the process dies before
+ * that, the collector reclaims the slot and counts it as abandoned.
+ *
+ * @param shm The ring.
+ * @param priority The log level.
+ * @param severity The log severity.
+ * @return The message buffer, or NULL if the ring is full.
+ */
+char *fossil_sanity_log_shm_begin(fossil_sanity_log_shm_t *shm, int priority, int severity);
+
+/**
+ * @brief Publish a slot claimed by fossil_sanity_log_shm_begin.
+ *
+ * @param shm The ring.
+ * @param message The buffer returned by fossil_sanity_log_shm_begin.
+ * @param length Message length; longer messages are truncated to fit.
+ */
+void fossil_sanity_log_shm_commit(fossil_sanity_log_shm_t *shm, char *message, size_t length);
+
+/**
+ * @brief Push an entry into a shared-memory ring. Lock-free.
+ *
+ * @param shm The ring.
+ * @param message The log message, truncated to MAX_LOG_MESSAGE_LENGTH - 1 bytes.
+ * @param priority The log level.
+ * @param severity The log severity.
+ * @return False if the ring is full; the entry is counted as dropped.
+ */
+bool fossil_sanity_log_shm_push(fossil_sanity_log_shm_t *shm, const char *message, int priority, int severity);
+
+/**
+ * @brief Hand the committed entries of a ring to a sink, oldest first.
+ *
+ * Only one process may collect from a ring at a time. Each entry carries
+ * the producer's sequence number and timestamp, and two integer fields,
+ * "pid" and "seq", naming its origin. Collection stops at a slot whose
+ * producer is still writing it; a slot whose producer has exited is
+ * skipped. A reaped producer is detected as exited, a zombie is not.
+ *
+ * @param shm The ring.
+ * @param sink Receives each entry, valid only during the call; returning false stops.
+ * @param context Passed to the sink.
+ * @param max The most entries to collect; 0 for no limit.
+ * @return The number of entries handed to the sink.
+ */
+size_t fossil_sanity_log_shm_drain_to(fossil_sanity_log_shm_t *shm, fossil_sanity_log_visit_t sink, void *context, size_t max);
+
+/**
+ * @brief Move the committed entries of a ring into a queue.
+ *
+ * Same rules as fossil_sanity_log_shm_drain_to; the entries keep their
+ * "pid" and "seq" fields and the time their producer logged them, and are
+ * numbered in the order they are collected.
+ *
+ * @param shm The ring.
+ * @param queue The queue receiving the entries.
+ * @param max The most entries to collect; 0 for no limit.
+ * @return The number of entries moved.
+ */
+size_t fossil_sanity_log_shm_drain(fossil_sanity_log_shm_t *shm, fossil_sanity_log_queue_t *queue, size_t max);
+
+/**
+ * @brief Read the state of a shared-memory ring.
+ *
+ * @param shm The ring.
+ * @param stats Receives the state.
+ */
+void fossil_sanity_log_shm_stats(const fossil_sanity_log_shm_t *shm, fossil_sanity_log_shm_stats_t *stats);
+
+/**
+ * @brief Run a query over a log file written by the library.
+ *
+ * The file is mapped and cut into slices that the worker pool filters at
+ * once; matches reach the sink on the calling thread in file order. Text
+ * files are read line by line: JSON and logfmt lines carry a level,
+ * severity and timestamp, plain lines only the level of their smart format
+ * tag. Ring files (see fossil_sanity_log_ring_open) are recognized by
+ * their header; their records have a level, severity and timestamp and are
+ * passed on as tagged plain lines. A keyword matches anywhere in a line as written,
+ * and in the message of a ring record.
+ *
+ * @param path The file.
+ * @param query The filters.
+ * @param sink Receives each matching line.
+ * @param context Passed to the sink.
+ * @param matched Receives the number of lines handed to the sink; may be NULL.
+ * @return False if the file could not be read.
+ */
+bool fossil_sanity_log_query_file(const char *path, const fossil_sanity_log_query_t *query, fossil_sanity_log_line_fn sink, void *context, size_t *matched);
+
+/**
+ * @brief Run a query over a log and its rotated generations.
+ *
+ * Generations path.N down to path.1 are read first, oldest first, then
+ * the log itself, so lines come out in the order they were written.
+ *
+ * @param path The log file path as given to the rotation.
+ * @param query The filters.
+ * @param sink Receives each matching line.
+ * @param context Passed to the sink.
+ * @param matched Receives the number of lines handed to the sink; may be NULL.
+ * @return False if a file could not be read.
+ */
+bool fossil_sanity_log_query_rotated(const char *path, const fossil_sanity_log_query_t *query, fossil_sanity_log_line_fn sink, void *context, size_t *matched);
+
 /**
  * @brief Send a notification with the given message.
  *
+ * While the notification thread runs, the message is copied into its
+ * bounded queue and the call returns without any I/O (unless the policy is
+ * FOSSIL_SANITY_LOG_NOTIFY_BLOCK and the queue is full). Otherwise the
+ * alert is printed to stdout right away.
+ *
  * @param message The message to notify.
  */
 void fossil_sanity_log_notify(const char *message);
 
+/**
+ * @brief Start the thread that delivers notifications to the sinks.
+ *
+ * @param config Queue size, overflow policy and batching.
+ * @return False if it is already running or could not be started.
+ */
+bool fossil_sanity_log_notify_start(const fossil_sanity_log_notify_config_t *config);
+
+/**
+ * @brief Register a callback receiving batches of alerts.
+ *
+ * Callbacks run on the notification thread, in registration order.
+ *
+ * @param callback The callback.
+ * @param context Passed back to the callback.
+ * @return False if FOSSIL_SANITY_LOG_NOTIFY_SINKS callbacks are registered.
+ */
+bool fossil_sanity_log_notify_register(fossil_sanity_log_notify_fn callback, void *context);
+
+/**
+ * @brief Register a sink writing one "ALERT: ..." line per alert to a file
+ *        descriptor, such as a log file or a pipe. The descriptor stays
+ *        owned by the caller.
+ *
+ * @param fd The descriptor.
+ * @return False if no more sinks can be registered.
+ */
+bool fossil_sanity_log_notify_register_fd(int fd);
+
+/**
+ * @brief Wait until every alert submitted so far was delivered or dropped.
+ */
+void fossil_sanity_log_notify_flush(void);
+
+/**
+ * @brief Deliver the queued alerts, stop the thread and drop the sinks.
+ */
+void fossil_sanity_log_notify_stop(void);
+
+/**
+ * @brief Read the counters of the notification thread.
+ *
+ * @param stats Receives the counters of the current or last run.
+ */
+void fossil_sanity_log_notify_stats(fossil_sanity_log_notify_stats_t *stats);
+
+/**
+ * @brief Apply duplicate suppression and rate limits to the smart log.
+ *
+ * Within window_ms of its first occurrence, a repeat of a message at the
+ * same level is only counted: it is neither queued nor notified. When the
+ * window has passed, the next occurrence (or fossil_sanity_log_limit_flush)
+ * pushes one "<message> (repeated N times)" entry for the folded repeats.
+ * Entries that get past the coalescing then take a token from their
+ * level's bucket, refilled at rate per second up to burst; an entry
+ * finding the bucket empty is dropped and counted. Calling this again
+ * replaces the configuration and keeps the counters.
+ *
+ * @param queue Pointer to the log queue.
+ * @param config The limits to apply.
+ * @return True if the limits are active.
+ */
+bool fossil_sanity_log_limit_enable(fossil_sanity_log_queue_t *queue, const fossil_sanity_log_limit_config_t *config);
+
+/**
+ * @brief Push the pending repeat counts of every coalesced message now.
+ *
+ * @param queue Pointer to the log queue.
+ */
+void fossil_sanity_log_limit_flush(fossil_sanity_log_queue_t *queue);
+
+/**
+ * @brief Read the counters of the smart log limits.
+ *
+ * @param queue Pointer to the log queue.
+ * @param stats Receives the counters; zeroed when no limits are enabled.
+ */
+void fossil_sanity_log_limit_stats(fossil_sanity_log_queue_t *queue, fossil_sanity_log_limit_stats_t *stats);
+
+/**
+ * @brief Sample the smart log per level.
+ *
+ * The decision is taken right after the level gate, before the message is
+ * formatted, copied or counted by the limits, so a skipped entry costs a
+ * few arithmetic operations on a thread-local random generator.
+ * FOSSIL_SANITY_LOG_SAMPLE_ONE_IN_N keeps each entry with probability 1/n.
+ * FOSSIL_SANITY_LOG_SAMPLE_RESERVOIR keeps at most n entries per window,
+ * each with probability n divided by the traffic of the previous window,
+ * so the kept entries spread over the whole window instead of being its
+ * first n. Skipped entries are counted per level in the metrics
+ * (sampled), so pushes plus sampled gives the full traffic. Calling this
+ * again replaces the rules; it is safe while other threads log.
+ *
+ * @param queue Pointer to the log queue.
+ * @param config The rule of each level.
+ * @return True if sampling is active.
+ */
+bool fossil_sanity_log_sample_enable(fossil_sanity_log_queue_t *queue, const fossil_sanity_log_sample_config_t *config);
+
+/**
+ * @brief Record push and drain latencies in the metrics histograms.
+ *
+ * Off by default: timing costs two clock reads per operation, while the
+ * plain counters are always kept.
+ *
+ * @param enable Whether to time operations.
+ */
+void fossil_sanity_log_metrics_timing(bool enable);
+
+/**
+ * @brief Read the metrics of the log subsystem.
+ *
+ * Every thread counts into its own counters without synchronization; the
+ * read adds them up, along with the totals of threads that have exited.
+ * Counters are process-wide; depth and peak_depth describe one queue.
+ *
+ * @param queue The queue whose depth is reported, or NULL.
+ * @param metrics Receives the totals.
+ */
+void fossil_sanity_log_metrics_read(const fossil_sanity_log_queue_t *queue, fossil_sanity_log_metrics_t *metrics);
+
+/**
+ * @brief Render metrics as "name value" lines or a JSON object.
+ *
+ * Same contract as snprintf: writes at most size bytes, NUL-terminated,
+ * and returns the length the full text needs. Does not allocate.
+ *
+ * @param metrics The metrics to render.
+ * @param format FOSSIL_SANITY_LOG_METRICS_TEXT or FOSSIL_SANITY_LOG_METRICS_JSON.
+ * @param buffer Receives the text.
+ * @param size Size of the buffer.
+ * @return The length of the full text.
+ */
+size_t fossil_sanity_log_metrics_format(const fossil_sanity_log_metrics_t *metrics, fossil_sanity_log_metrics_format_t format, char *buffer, size_t size);
+
 /**
  * @brief Log a message using the smart log system.
  *
+ * Passes the level gate, the sampling of fossil_sanity_log_sample_enable
+ * and the limits of fossil_sanity_log_limit_enable when set, before pushing
+ * the message and notifying high severities.
+ *
  * @param queue Pointer to the log queue.
  * @param level The log level.
  * @param severity The severity of the log message.
@@ -147,6 +1362,41 @@ void fossil_sanity_log_notify(const char *message);
  */
 void fossil_sanity_log_smart_log(fossil_sanity_log_queue_t *queue, int level, int severity, const char *message);
 
+/**
+ * @brief Log a printf-style message using the smart log system.
+ *
+ * The runtime level gate and sampling are checked before the message is
+ * formatted.
+ *
+ * @param queue Pointer to the log queue.
+ * @param level The log level.
+ * @param severity The severity of the log message.
+ * @param format The printf-style format string.
+ */
+void fossil_sanity_log_smart_logf(fossil_sanity_log_queue_t *queue, int level, int severity, const char *format, ...);
+
+/**
+ * @brief va_list variant of fossil_sanity_log_smart_logf.
+ */
+void fossil_sanity_log_smart_logv(fossil_sanity_log_queue_t *queue, int level, int severity, const char *format, va_list args);
+
+/**
+ * @brief Set the lowest level accepted by the smart log at runtime.
+ *
+ * Messages below this level are dropped by fossil_sanity_log_smart_log and
+ * the FOSSIL_SANITY_LOG_* macros before any formatting or allocation.
+ *
+ * @param level The minimum level to accept.
+ */
+void fossil_sanity_log_set_level(int level);
+
+/**
+ * @brief Get the lowest level accepted by the smart log at runtime.
+ *
+ * @return The runtime minimum level.
+ */
+int fossil_sanity_log_get_level(void);
+
 /**
  * @brief Enable or disable the smart log format.
  *
@@ -158,4 +1408,58 @@ void fossil_sanity_log_set_smart_format(bool enable);
 }
 #endif
 
+// ==================================================================
+// Leveled logging macros
+// ==================================================================
+
+// True if a message at this level would be kept
+#define FOSSIL_SANITY_LOG_ENABLED(level) \
+    ((level) >= FOSSIL_SANITY_LOG_MIN_LEVEL && (level) >= fossil_sanity_log_get_level())
+
+// Log a printf-style message; arguments are only evaluated when the level is enabled
+#define FOSSIL_SANITY_LOG_AT(queue, level, severity, ...) \
+    do { \
+        if (FOSSIL_SANITY_LOG_ENABLED(level)) { \
+            fossil_sanity_log_smart_logf((queue), (level), (severity), __VA_ARGS__); \
+        } \
+    } while (0)
+
+#if FOSSIL_SANITY_LOG_MIN_LEVEL <= FOSSIL_SANITY_LOG_LEVEL_DEBUG
+#define FOSSIL_SANITY_LOG_DEBUG(queue, severity, ...) FOSSIL_SANITY_LOG_AT(queue, FOSSIL_SANITY_LOG_LEVEL_DEBUG, severity, __VA_ARGS__)
+#else
+#define FOSSIL_SANITY_LOG_DEBUG(queue, severity, ...) ((void)0)
+#endif
+
+#if FOSSIL_SANITY_LOG_MIN_LEVEL <= FOSSIL_SANITY_LOG_LEVEL_INFO
+#define FOSSIL_SANITY_LOG_INFO(queue, severity, ...) FOSSIL_SANITY_LOG_AT(queue, FOSSIL_SANITY_LOG_LEVEL_INFO, severity, __VA_ARGS__)
+#else
+#define FOSSIL_SANITY_LOG_INFO(queue, severity, ...) ((void)0)
+#endif
+
+#if FOSSIL_SANITY_LOG_MIN_LEVEL <= FOSSIL_SANITY_LOG_LEVEL_WARNING
+#define FOSSIL_SANITY_LOG_WARNING(queue, severity, ...) FOSSIL_SANITY_LOG_AT(queue, FOSSIL_SANITY_LOG_LEVEL_WARNING, severity, __VA_ARGS__)
+#else
+#define FOSSIL_SANITY_LOG_WARNING(queue, severity, ...) ((void)0)
+#endif
+
+#if FOSSIL_SANITY_LOG_MIN_LEVEL <= FOSSIL_SANITY_LOG_LEVEL_ERROR
+#define FOSSIL_SANITY_LOG_ERROR(queue, severity, ...) FOSSIL_SANITY_LOG_AT(queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, severity, __VA_ARGS__)
+#else
+#define FOSSIL_SANITY_LOG_ERROR(queue, severity, ...) ((void)0)
+#endif
+
+#define FOSSIL_SANITY_LOG_FATAL(queue, severity, ...) FOSSIL_SANITY_LOG_AT(queue, FOSSIL_SANITY_LOG_LEVEL_FATAL, severity, __VA_ARGS__)
+
+// Field initializers for fossil_sanity_log_push_fields, e.g.
+//   fossil_sanity_log_field_t fields[] = { FOSSIL_SANITY_LOG_KV_INT("status", 200), FOSSIL_SANITY_LOG_KV_STR("path", path) };
+#ifdef __cplusplus
+#define FOSSIL_SANITY_LOG_KV(key, kind, member, v) fossil_sanity_log_field_t{ (key), (kind), { .member = (v) } }
+#else
+#define FOSSIL_SANITY_LOG_KV(key, kind, member, v) ((fossil_sanity_log_field_t){ (key), (kind), { .member = (v) } })
+#endif
+#define FOSSIL_SANITY_LOG_KV_INT(key, v)    FOSSIL_SANITY_LOG_KV(key, FOSSIL_SANITY_LOG_FIELD_INT, i, (int64_t)(v))
+#define FOSSIL_SANITY_LOG_KV_DOUBLE(key, v) FOSSIL_SANITY_LOG_KV(key, FOSSIL_SANITY_LOG_FIELD_DOUBLE, d, (double)(v))
+#define FOSSIL_SANITY_LOG_KV_STR(key, v)    FOSSIL_SANITY_LOG_KV(key, FOSSIL_SANITY_LOG_FIELD_STRING, s, (v))
+#define FOSSIL_SANITY_LOG_KV_BOOL(key, v)   FOSSIL_SANITY_LOG_KV(key, FOSSIL_SANITY_LOG_FIELD_BOOL, b, (bool)(v))
+
 #endif // FOSSIL_SANITY_LOG_H
@@ -11,11 +11,23 @@
  * Copyright (C) 2024 Fossil Logic. All rights reserved.
  * -----------------------------------------------------------------------------
  */
+#define _POSIX_C_SOURCE 200809L
 #include "fossil/sanity/sanity.h"
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
 
 char *_custom_strdup(const char *str) {
     if (!str) return NULL;
@@ -29,216 +41,5463 @@ char *_custom_strdup(const char *str) {
 // Static variable to hold the smart log format setting
 static bool smart_log_format = false;
 
+// Runtime level gate for the smart log
+static atomic_int smart_log_level = FOSSIL_SANITY_LOG_LEVEL_DEBUG;
+
+#define FOSSIL_SANITY_LOG_CACHE_LINE   64
+
+#define FOSSIL_SANITY_LOG_ENTRY_POOLED 0x1u  // Entry storage belongs to the queue pool
+#define FOSSIL_SANITY_LOG_ENTRY_NODE   0x2u  // Entry lives in a concurrent producer node
+#define FOSSIL_SANITY_LOG_ENTRY_DEFERRED 0x4u  // Message is a deferred format record
+#define FOSSIL_SANITY_LOG_ENTRY_FIELDS 0x8u    // Structured fields follow the message
+
+// Producer-side node of the concurrent queue. The message follows the node
+// in the same allocation when it does not fit inline.
+typedef struct fossil_sanity_log_node {
+    _Atomic(struct fossil_sanity_log_node *) link;
+    fossil_sanity_log_entry_t entry;
+} fossil_sanity_log_node_t;
+
+// Intrusive multi-producer single-consumer queue for one level. Producers
+// only exchange the tail; the consumer owns the head.
+typedef struct fossil_sanity_log_mpsc_level {
+    _Alignas(FOSSIL_SANITY_LOG_CACHE_LINE) _Atomic(fossil_sanity_log_node_t *) tail;
+    _Alignas(FOSSIL_SANITY_LOG_CACHE_LINE) fossil_sanity_log_node_t *head;
+    fossil_sanity_log_node_t stub;
+} fossil_sanity_log_mpsc_level_t;
+
+typedef struct fossil_sanity_log_mpsc {
+    fossil_sanity_log_mpsc_level_t levels[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+    size_t batch;  // Per-thread staging batch size, 0 when pushes publish directly
+    fossil_sanity_log_entry_t **collected;  // Consumer scratch: entries of one collect
+    size_t collected_capacity;
+    _Alignas(FOSSIL_SANITY_LOG_CACHE_LINE) _Atomic uint64_t sequence;  // Replaces queue->sequence once concurrent
+} fossil_sanity_log_mpsc_t;
+
+// Per-thread staging ring. Nodes wait here until the ring fills, the thread
+// flushes or the thread exits, and are then published one chain per level.
+typedef struct fossil_sanity_log_stage {
+    fossil_sanity_log_queue_t *queue;  // Queue the staged nodes belong to
+    size_t count;
+    fossil_sanity_log_node_t *nodes[FOSSIL_SANITY_LOG_THREAD_BATCH];
+} fossil_sanity_log_stage_t;
+
+static _Thread_local fossil_sanity_log_stage_t thread_stage;
+static pthread_key_t thread_stage_key;
+static pthread_once_t thread_stage_once = PTHREAD_ONCE_INIT;
+
+// Slab header, padded so the entries that follow start on a cache line
+typedef struct fossil_sanity_log_slab {
+    struct fossil_sanity_log_slab *next;
+    size_t entries;
+} fossil_sanity_log_slab_t;
+
+#define FOSSIL_SANITY_LOG_SLAB_HEADER \
+    ((sizeof(fossil_sanity_log_slab_t) + FOSSIL_SANITY_LOG_CACHE_LINE - 1) & ~(size_t)(FOSSIL_SANITY_LOG_CACHE_LINE - 1))
+
+#define FOSSIL_SANITY_LOG_ARENA_BLOCK  (64 * 1024)
+
+// Header of a message arena block. Every message stored in a block is
+// preceded by its offset from the block start, so releasing a message finds
+// the block without a lookup. A block is freed once it holds no live
+// messages and no queue is still filling it.
+typedef struct fossil_sanity_log_arena_block {
+    size_t size;   // Usable bytes after the header
+    size_t used;   // Bytes handed out so far
+    size_t live;   // Messages still referenced by entries
+    bool current;  // Still the fill block of a queue
+} fossil_sanity_log_arena_block_t;
+
+#define FOSSIL_SANITY_LOG_ARENA_HEADER \
+    ((sizeof(fossil_sanity_log_arena_block_t) + 7) & ~(size_t)7)
+
+static fossil_sanity_log_arena_block_t *_fossil_sanity_log_arena_block_new(size_t size) {
+    fossil_sanity_log_arena_block_t *block = (fossil_sanity_log_arena_block_t *)malloc(FOSSIL_SANITY_LOG_ARENA_HEADER + size);
+    if (!block) {
+        perror("Failed to allocate memory for log arena");
+        return NULL;
+    }
+    block->size = size;
+    block->used = 0;
+    block->live = 0;
+    block->current = false;
+    return block;
+}
+
+// Stop filling a block, freeing it if nothing references it anymore
+static void _fossil_sanity_log_arena_retire(fossil_sanity_log_arena_block_t *block) {
+    block->current = false;
+    if (!block->live) {
+        free(block);
+    }
+}
+
+// Block bytes a message of the given length takes, offset included
+static size_t _fossil_sanity_log_arena_need(size_t length) {
+    return (sizeof(uint32_t) + length + 1 + 3) & ~(size_t)3;
+}
+
+// Hand out the next need bytes of a block that has room for them
+static char *_fossil_sanity_log_arena_carve(fossil_sanity_log_arena_block_t *block, size_t need) {
+    char *slot = (char *)block + FOSSIL_SANITY_LOG_ARENA_HEADER + block->used;
+    uint32_t offset = (uint32_t)(slot - (char *)block);
+    memcpy(slot, &offset, sizeof(offset));
+    block->used += need;
+    block->live++;
+    return slot + sizeof(offset);
+}
+
+// Bump-allocate storage for a message of the given length
+static char *_fossil_sanity_log_arena_alloc(fossil_sanity_log_queue_t *queue, size_t length) {
+    size_t need = _fossil_sanity_log_arena_need(length);
+    fossil_sanity_log_arena_block_t *block = queue->arena;
+
+    if (!block || block->used + need > block->size) {
+        size_t usable = FOSSIL_SANITY_LOG_ARENA_BLOCK - FOSSIL_SANITY_LOG_ARENA_HEADER;
+        if (need > usable / 4) {
+            // Oversized messages get a block of their own and leave the fill block alone
+            block = _fossil_sanity_log_arena_block_new(need);
+            if (!block) return NULL;
+        } else {
+            block = _fossil_sanity_log_arena_block_new(usable);
+            if (!block) return NULL;
+            if (queue->arena) {
+                _fossil_sanity_log_arena_retire(queue->arena);
+            }
+            block->current = true;
+            queue->arena = block;
+        }
+    }
+
+    return _fossil_sanity_log_arena_carve(block, need);
+}
+
+// Drop one reference to an arena message
+static void _fossil_sanity_log_arena_release(const char *text) {
+    uint32_t offset;
+    memcpy(&offset, text - sizeof(offset), sizeof(offset));
+    fossil_sanity_log_arena_block_t *block = (fossil_sanity_log_arena_block_t *)(text - sizeof(offset) - offset);
+
+    if (--block->live == 0) {
+        if (block->current) {
+            block->used = 0;  // Rewind the fill block instead of freeing it
+        } else {
+            free(block);
+        }
+    }
+}
+
+// Store message bytes in the entry, inline when they fit, NUL-terminated
+static bool _fossil_sanity_log_entry_set_bytes(fossil_sanity_log_queue_t *queue, fossil_sanity_log_entry_t *entry, const void *data, size_t length) {
+    char *text;
+
+    if (length < FOSSIL_SANITY_LOG_INLINE_LENGTH) {
+        text = entry->inline_message;
+    } else {
+        text = _fossil_sanity_log_arena_alloc(queue, length);
+        if (!text) return false;
+    }
+    memcpy(text, data, length);
+    text[length] = '\0';
+    entry->message = text;
+    entry->length = (uint32_t)length;
+    return true;
+}
+
+// Add a slab of the given number of entries to the pool
+static fossil_sanity_log_entry_t *_fossil_sanity_log_pool_slab(fossil_sanity_log_pool_t *pool, size_t entries) {
+    size_t bytes = FOSSIL_SANITY_LOG_SLAB_HEADER + entries * sizeof(fossil_sanity_log_entry_t);
+    bytes = (bytes + FOSSIL_SANITY_LOG_CACHE_LINE - 1) & ~(size_t)(FOSSIL_SANITY_LOG_CACHE_LINE - 1);
+
+    fossil_sanity_log_slab_t *slab = (fossil_sanity_log_slab_t *)aligned_alloc(FOSSIL_SANITY_LOG_CACHE_LINE, bytes);
+    if (!slab) {
+        perror("Failed to allocate memory for log pool");
+        return NULL;
+    }
+    slab->entries = entries;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slab_count++;
+    pool->capacity += entries;
+    return (fossil_sanity_log_entry_t *)((char *)slab + FOSSIL_SANITY_LOG_SLAB_HEADER);
+}
+
+// Add one slab to the pool and thread its entries onto the free list
+static bool _fossil_sanity_log_pool_grow(fossil_sanity_log_pool_t *pool) {
+    fossil_sanity_log_entry_t *entries = _fossil_sanity_log_pool_slab(pool, pool->chunk_entries);
+    if (!entries) {
+        return false;
+    }
+
+    // Thread back to front so allocation walks the slab in address order
+    for (size_t i = pool->chunk_entries; i-- > 0;) {
+        entries[i].next = pool->free_list;
+        pool->free_list = &entries[i];
+    }
+    return true;
+}
+
+// Take an entry from the pool, or from the allocator when no pool is enabled
+static fossil_sanity_log_entry_t *_fossil_sanity_log_entry_alloc(fossil_sanity_log_queue_t *queue) {
+    fossil_sanity_log_pool_t *pool = &queue->pool;
+    fossil_sanity_log_entry_t *entry;
+
+    // Released slab entries are reused even while pooling is off, as after
+    // a restore
+    if (pool->chunk_entries || pool->free_list) {
+        if (!pool->free_list && !_fossil_sanity_log_pool_grow(pool)) {
+            return NULL;
+        }
+        entry = pool->free_list;
+        pool->free_list = entry->next;
+        pool->in_use++;
+        entry->flags = FOSSIL_SANITY_LOG_ENTRY_POOLED;
+        return entry;
+    }
+
+    entry = (fossil_sanity_log_entry_t *)malloc(sizeof(fossil_sanity_log_entry_t));
+    if (!entry) {
+        perror("Failed to allocate memory for log entry");
+        return NULL;
+    }
+    entry->flags = 0;
+    return entry;
+}
+
+// Whether the entry's message lives in the queue arena
+static bool _fossil_sanity_log_entry_in_arena(const fossil_sanity_log_entry_t *entry) {
+    if (entry->message == entry->inline_message) return false;
+    if (entry->flags & FOSSIL_SANITY_LOG_ENTRY_NODE) {
+        // Producer nodes carry their message right behind the node
+        const fossil_sanity_log_node_t *node = (const fossil_sanity_log_node_t *)((const char *)entry - offsetof(fossil_sanity_log_node_t, entry));
+        return entry->message != (const char *)(node + 1);
+    }
+    return true;
+}
+
+// Return an entry and its message to wherever they were allocated from
+static void _fossil_sanity_log_entry_free(fossil_sanity_log_queue_t *queue, fossil_sanity_log_entry_t *entry) {
+    if (_fossil_sanity_log_entry_in_arena(entry)) {
+        _fossil_sanity_log_arena_release(entry->message);
+    }
+    if (entry->flags & FOSSIL_SANITY_LOG_ENTRY_NODE) {
+        free((char *)entry - offsetof(fossil_sanity_log_node_t, entry));
+        return;
+    }
+    if (entry->flags & FOSSIL_SANITY_LOG_ENTRY_POOLED) {
+        entry->next = queue->pool.free_list;
+        queue->pool.free_list = entry;
+        queue->pool.in_use--;
+    } else {
+        free(entry);
+    }
+}
+
+// ==================================================================
+// Metrics
+// ==================================================================
+
+#define FOSSIL_SANITY_LOG_HIST_SUB_BITS 3   // 8 sub-buckets per power of two
+#define FOSSIL_SANITY_LOG_HIST_MAX_BITS 40  // Values clamp at about 18 minutes
+#define FOSSIL_SANITY_LOG_HIST_BUCKETS ((FOSSIL_SANITY_LOG_HIST_MAX_BITS - FOSSIL_SANITY_LOG_HIST_SUB_BITS + 2) << FOSSIL_SANITY_LOG_HIST_SUB_BITS)
+
+// Log-linear latency histogram: exact below 8 ns, then 8 linear buckets
+// between consecutive powers of two
+typedef struct fossil_sanity_log_histogram {
+    _Atomic uint64_t buckets[FOSSIL_SANITY_LOG_HIST_BUCKETS];
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+} fossil_sanity_log_histogram_t;
+
+// Counters of one thread. Only the owning thread writes them, so updates
+// are a relaxed load and store; readers may see them a moment late.
+typedef struct fossil_sanity_log_counters {
+    _Atomic uint64_t pushes[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+    _Atomic uint64_t drained;
+    _Atomic uint64_t bytes_stored;
+    _Atomic uint64_t bytes_written;
+    _Atomic uint64_t dropped;
+    _Atomic uint64_t evicted;
+    _Atomic uint64_t suppressed;
+    _Atomic uint64_t sampled[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+    fossil_sanity_log_histogram_t push_latency;
+    fossil_sanity_log_histogram_t drain_latency;
+    struct fossil_sanity_log_counters *next;  // Registry link
+} fossil_sanity_log_counters_t;
+
+static struct {
+    pthread_mutex_t lock;
+    fossil_sanity_log_counters_t *threads;   // Counters of live threads
+    fossil_sanity_log_counters_t retired;    // Totals of exited threads, under the lock
+    fossil_sanity_log_counters_t fallback;   // Shared when a thread's counters cannot be allocated
+    atomic_bool timing;
+} metrics = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static _Thread_local fossil_sanity_log_counters_t *thread_counters;
+static pthread_key_t thread_counters_key;
+static pthread_once_t thread_counters_once = PTHREAD_ONCE_INIT;
+
+static inline void _fossil_sanity_log_count(_Atomic uint64_t *counter, uint64_t amount) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+static inline uint64_t _fossil_sanity_log_counter(const _Atomic uint64_t *counter) {
+    return atomic_load_explicit((_Atomic uint64_t *)counter, memory_order_relaxed);
+}
+
+static void _fossil_sanity_log_counters_add(fossil_sanity_log_counters_t *total, const fossil_sanity_log_counters_t *counters) {
+    for (int level = 0; level < FOSSIL_SANITY_LOG_LEVEL_COUNT; level++) {
+        _fossil_sanity_log_count(&total->pushes[level], _fossil_sanity_log_counter(&counters->pushes[level]));
+        _fossil_sanity_log_count(&total->sampled[level], _fossil_sanity_log_counter(&counters->sampled[level]));
+    }
+    _fossil_sanity_log_count(&total->drained, _fossil_sanity_log_counter(&counters->drained));
+    _fossil_sanity_log_count(&total->bytes_stored, _fossil_sanity_log_counter(&counters->bytes_stored));
+    _fossil_sanity_log_count(&total->bytes_written, _fossil_sanity_log_counter(&counters->bytes_written));
+    _fossil_sanity_log_count(&total->dropped, _fossil_sanity_log_counter(&counters->dropped));
+    _fossil_sanity_log_count(&total->evicted, _fossil_sanity_log_counter(&counters->evicted));
+    _fossil_sanity_log_count(&total->suppressed, _fossil_sanity_log_counter(&counters->suppressed));
+
+    const fossil_sanity_log_histogram_t *from[2] = { &counters->push_latency, &counters->drain_latency };
+    fossil_sanity_log_histogram_t *to[2] = { &total->push_latency, &total->drain_latency };
+    for (int h = 0; h < 2; h++) {
+        for (size_t i = 0; i < FOSSIL_SANITY_LOG_HIST_BUCKETS; i++) {
+            _fossil_sanity_log_count(&to[h]->buckets[i], _fossil_sanity_log_counter(&from[h]->buckets[i]));
+        }
+        _fossil_sanity_log_count(&to[h]->sum, _fossil_sanity_log_counter(&from[h]->sum));
+        uint64_t max = _fossil_sanity_log_counter(&from[h]->max);
+        if (max > _fossil_sanity_log_counter(&to[h]->max)) {
+            atomic_store_explicit(&to[h]->max, max, memory_order_relaxed);
+        }
+    }
+}
+
+// Thread exit hook: fold the thread's counters into the retired totals.
+// The cache is cleared first so a log call from a later destructor on this
+// thread attaches fresh counters instead of touching freed ones.
+static void _fossil_sanity_log_counters_exit(void *arg) {
+    fossil_sanity_log_counters_t *counters = (fossil_sanity_log_counters_t *)arg;
+    thread_counters = NULL;
+    pthread_mutex_lock(&metrics.lock);
+    fossil_sanity_log_counters_t **link = &metrics.threads;
+    while (*link != counters) link = &(*link)->next;
+    *link = counters->next;
+    _fossil_sanity_log_counters_add(&metrics.retired, counters);
+    pthread_mutex_unlock(&metrics.lock);
+    free(counters);
+}
+
+static void _fossil_sanity_log_counters_key(void) {
+    pthread_key_create(&thread_counters_key, _fossil_sanity_log_counters_exit);
+}
+
+// Register the calling thread's counters on first use
+static fossil_sanity_log_counters_t *_fossil_sanity_log_counters_attach(void) {
+    fossil_sanity_log_counters_t *counters = (fossil_sanity_log_counters_t *)calloc(1, sizeof(*counters));
+    if (!counters) {
+        return &metrics.fallback;  // Not cached, so a later call retries
+    }
+    pthread_once(&thread_counters_once, _fossil_sanity_log_counters_key);
+    pthread_mutex_lock(&metrics.lock);
+    counters->next = metrics.threads;
+    metrics.threads = counters;
+    pthread_mutex_unlock(&metrics.lock);
+    pthread_setspecific(thread_counters_key, counters);
+    thread_counters = counters;
+    return counters;
+}
+
+static inline fossil_sanity_log_counters_t *_fossil_sanity_log_counters(void) {
+    fossil_sanity_log_counters_t *counters = thread_counters;
+    return counters ? counters : _fossil_sanity_log_counters_attach();
+}
+
+static uint64_t _fossil_sanity_log_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Start of a timed operation, 0 while timing is off
+static inline uint64_t _fossil_sanity_log_timer(void) {
+    return atomic_load_explicit(&metrics.timing, memory_order_relaxed) ? _fossil_sanity_log_now_ns() : 0;
+}
+
+static size_t _fossil_sanity_log_hist_bucket(uint64_t value) {
+    if (value < (1u << FOSSIL_SANITY_LOG_HIST_SUB_BITS)) {
+        return (size_t)value;
+    }
+    if (value >= (UINT64_C(1) << FOSSIL_SANITY_LOG_HIST_MAX_BITS)) {
+        value = (UINT64_C(1) << FOSSIL_SANITY_LOG_HIST_MAX_BITS) - 1;
+    }
+    int shift = 63 - __builtin_clzll(value) - FOSSIL_SANITY_LOG_HIST_SUB_BITS;
+    size_t sub = (size_t)(value >> shift) & ((1u << FOSSIL_SANITY_LOG_HIST_SUB_BITS) - 1);
+    return ((size_t)(shift + 1) << FOSSIL_SANITY_LOG_HIST_SUB_BITS) + sub;
+}
+
+// Midpoint of the values falling in a bucket
+static uint64_t _fossil_sanity_log_hist_value(size_t bucket) {
+    if (bucket < (1u << FOSSIL_SANITY_LOG_HIST_SUB_BITS)) {
+        return bucket;
+    }
+    int shift = (int)(bucket >> FOSSIL_SANITY_LOG_HIST_SUB_BITS) - 1;
+    uint64_t low = (uint64_t)((1u << FOSSIL_SANITY_LOG_HIST_SUB_BITS) + (bucket & ((1u << FOSSIL_SANITY_LOG_HIST_SUB_BITS) - 1))) << shift;
+    return low + ((UINT64_C(1) << shift) >> 1);
+}
+
+// Record count operations that took elapsed nanoseconds in total
+static void _fossil_sanity_log_hist_record(fossil_sanity_log_histogram_t *histogram, uint64_t elapsed, uint64_t count) {
+    uint64_t each = elapsed / count;
+    _fossil_sanity_log_count(&histogram->buckets[_fossil_sanity_log_hist_bucket(each)], count);
+    _fossil_sanity_log_count(&histogram->sum, elapsed);
+    if (each > _fossil_sanity_log_counter(&histogram->max)) {
+        atomic_store_explicit(&histogram->max, each, memory_order_relaxed);
+    }
+}
+
+// Count entries leaving a queue, timed from start when timing was on
+static void _fossil_sanity_log_count_drained(uint64_t start, uint64_t count) {
+    if (!count) return;
+    fossil_sanity_log_counters_t *counters = _fossil_sanity_log_counters();
+    _fossil_sanity_log_count(&counters->drained, count);
+    if (start) {
+        _fossil_sanity_log_hist_record(&counters->drain_latency, _fossil_sanity_log_now_ns() - start, count);
+    }
+}
+
+static void _fossil_sanity_log_hist_summary(const fossil_sanity_log_histogram_t *histogram, fossil_sanity_log_latency_t *latency) {
+    static const double ranks[4] = { 0.50, 0.90, 0.99, 0.999 };
+    uint64_t *targets[4] = { &latency->p50, &latency->p90, &latency->p99, &latency->p999 };
+
+    memset(latency, 0, sizeof(*latency));
+    for (size_t i = 0; i < FOSSIL_SANITY_LOG_HIST_BUCKETS; i++) {
+        latency->count += _fossil_sanity_log_counter(&histogram->buckets[i]);
+    }
+    if (!latency->count) return;
+    latency->mean = _fossil_sanity_log_counter(&histogram->sum) / latency->count;
+    latency->max = _fossil_sanity_log_counter(&histogram->max);
+
+    uint64_t seen = 0;
+    int next = 0;
+    for (size_t i = 0; i < FOSSIL_SANITY_LOG_HIST_BUCKETS && next < 4; i++) {
+        seen += _fossil_sanity_log_counter(&histogram->buckets[i]);
+        while (next < 4 && (double)seen >= ranks[next] * (double)latency->count) {
+            uint64_t value = _fossil_sanity_log_hist_value(i);
+            *targets[next++] = value < latency->max ? value : latency->max;
+        }
+    }
+}
+
+void fossil_sanity_log_metrics_timing(bool enable) {
+    atomic_store_explicit(&metrics.timing, enable, memory_order_relaxed);
+}
+
+// Sum the counters of every thread
+void fossil_sanity_log_metrics_read(const fossil_sanity_log_queue_t *queue, fossil_sanity_log_metrics_t *out) {
+    fossil_sanity_log_counters_t *total = (fossil_sanity_log_counters_t *)calloc(1, sizeof(*total));
+    memset(out, 0, sizeof(*out));
+    if (!total) {
+        perror("Failed to allocate memory for log metrics");
+        return;
+    }
+
+    pthread_mutex_lock(&metrics.lock);
+    _fossil_sanity_log_counters_add(total, &metrics.retired);
+    _fossil_sanity_log_counters_add(total, &metrics.fallback);
+    for (const fossil_sanity_log_counters_t *counters = metrics.threads; counters; counters = counters->next) {
+        _fossil_sanity_log_counters_add(total, counters);
+    }
+    pthread_mutex_unlock(&metrics.lock);
+
+    for (int level = 0; level < FOSSIL_SANITY_LOG_LEVEL_COUNT; level++) {
+        out->pushes[level] = total->pushes[level];
+        out->sampled[level] = total->sampled[level];
+    }
+    out->drained = total->drained;
+    out->bytes_stored = total->bytes_stored;
+    out->bytes_written = total->bytes_written;
+    out->dropped = total->dropped;
+    out->evicted = total->evicted;
+    out->suppressed = total->suppressed;
+    _fossil_sanity_log_hist_summary(&total->push_latency, &out->push_latency);
+    _fossil_sanity_log_hist_summary(&total->drain_latency, &out->drain_latency);
+    free(total);
+
+    if (queue) {
+        out->depth = queue->count;
+        out->peak_depth = queue->peak_count;
+    }
+}
+
+// Append to a bounded buffer, tracking the full length like snprintf
+static void _fossil_sanity_log_metrics_put(char *buffer, size_t size, size_t *length, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    size_t room = *length < size ? size - *length : 0;
+    int written = vsnprintf(room ? buffer + *length : NULL, room, format, args);
+    va_end(args);
+    if (written > 0) *length += (size_t)written;
+}
+
+size_t fossil_sanity_log_metrics_format(const fossil_sanity_log_metrics_t *m, fossil_sanity_log_metrics_format_t format, char *buffer, size_t size) {
+    static const char *const levels[FOSSIL_SANITY_LOG_LEVEL_COUNT] = { "debug", "info", "warning", "error", "fatal" };
+    const fossil_sanity_log_latency_t *latencies[2] = { &m->push_latency, &m->drain_latency };
+    static const char *const latency_names[2] = { "push_latency", "drain_latency" };
+    bool json = format == FOSSIL_SANITY_LOG_METRICS_JSON;
+    size_t length = 0;
+
+    if (size) buffer[0] = '\0';
+    _fossil_sanity_log_metrics_put(buffer, size, &length, json ? "{\"pushes\":{" : "");
+    for (int level = 0; level < FOSSIL_SANITY_LOG_LEVEL_COUNT; level++) {
+        _fossil_sanity_log_metrics_put(buffer, size, &length, json ? "%s\"%s\":%llu" : "%spushes.%s %llu\n",
+                                       json && level ? "," : "", levels[level], (unsigned long long)m->pushes[level]);
+    }
+    _fossil_sanity_log_metrics_put(buffer, size, &length, json ? "},\"sampled\":{" : "");
+    for (int level = 0; level < FOSSIL_SANITY_LOG_LEVEL_COUNT; level++) {
+        _fossil_sanity_log_metrics_put(buffer, size, &length, json ? "%s\"%s\":%llu" : "%ssampled.%s %llu\n",
+                                       json && level ? "," : "", levels[level], (unsigned long long)m->sampled[level]);
+    }
+    _fossil_sanity_log_metrics_put(buffer, size, &length,
+        json ? "},\"drained\":%llu,\"bytes_stored\":%llu,\"bytes_written\":%llu,\"dropped\":%llu,"
+               "\"evicted\":%llu,\"suppressed\":%llu,\"depth\":%zu,\"peak_depth\":%zu"
+             : "drained %llu\nbytes_stored %llu\nbytes_written %llu\ndropped %llu\n"
+               "evicted %llu\nsuppressed %llu\ndepth %zu\npeak_depth %zu\n",
+        (unsigned long long)m->drained, (unsigned long long)m->bytes_stored, (unsigned long long)m->bytes_written,
+        (unsigned long long)m->dropped, (unsigned long long)m->evicted, (unsigned long long)m->suppressed,
+        m->depth, m->peak_depth);
+    for (int h = 0; h < 2; h++) {
+        const fossil_sanity_log_latency_t *l = latencies[h];
+        _fossil_sanity_log_metrics_put(buffer, size, &length,
+            json ? ",\"%s\":{\"count\":%llu,\"mean\":%llu,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}"
+                 : "%s count=%llu mean=%llu p50=%llu p90=%llu p99=%llu p999=%llu max=%llu\n",
+            latency_names[h], (unsigned long long)l->count, (unsigned long long)l->mean, (unsigned long long)l->p50,
+            (unsigned long long)l->p90, (unsigned long long)l->p99, (unsigned long long)l->p999, (unsigned long long)l->max);
+    }
+    _fossil_sanity_log_metrics_put(buffer, size, &length, json ? "}" : "");
+    return length;
+}
+
+// ==================================================================
+// Deferred formatting
+// ==================================================================
+
+// A deferred message is a binary record: the format pointer followed by the
+// raw bytes of every argument, in order. Strings are copied into the record
+// as a 32-bit length, the bytes and a NUL. The text is produced later by
+// replaying the record through snprintf one conversion at a time.
+
+#define FOSSIL_SANITY_LOG_SPEC_LENGTH 32  // Longest conversion spec replayed
+
+typedef enum {
+    FOSSIL_SANITY_LOG_ARG_NONE,      // "%%"
+    FOSSIL_SANITY_LOG_ARG_INT,
+    FOSSIL_SANITY_LOG_ARG_LONG,
+    FOSSIL_SANITY_LOG_ARG_LLONG,
+    FOSSIL_SANITY_LOG_ARG_SIZE,
+    FOSSIL_SANITY_LOG_ARG_INTMAX,
+    FOSSIL_SANITY_LOG_ARG_PTRDIFF,
+    FOSSIL_SANITY_LOG_ARG_DOUBLE,
+    FOSSIL_SANITY_LOG_ARG_LDOUBLE,
+    FOSSIL_SANITY_LOG_ARG_POINTER,
+    FOSSIL_SANITY_LOG_ARG_STRING
+} fossil_sanity_log_arg_t;
+
+typedef struct fossil_sanity_log_spec {
+    const char *start;        // The '%'
+    size_t length;            // Through the conversion character
+    int stars;                // '*' width and precision arguments
+    int precision;            // Literal precision, -1 if none
+    fossil_sanity_log_arg_t kind;
+} fossil_sanity_log_spec_t;
+
+// Find the next conversion at or after the cursor. Returns false at the end
+// of the format; sets kind to -1 for conversions that cannot be deferred.
+static bool _fossil_sanity_log_spec_next(const char **cursor, fossil_sanity_log_spec_t *spec) {
+    const char *p = strchr(*cursor, '%');
+    if (!p) return false;
+
+    spec->start = p++;
+    spec->stars = 0;
+    spec->precision = -1;
+    while (*p && strchr("-+ #0'", *p)) p++;
+    if (*p == '*') { spec->stars++; p++; } else { while (*p >= '0' && *p <= '9') p++; }
+    if (*p == '.') {
+        p++;
+        if (*p == '*') {
+            spec->stars++;
+            p++;
+        } else {
+            spec->precision = 0;
+            while (*p >= '0' && *p <= '9') spec->precision = spec->precision * 10 + (*p++ - '0');
+        }
+    }
+
+    int size = 0;  // 0 none, 1 l, 2 ll, 3 z, 4 j, 5 t, 6 L
+    switch (*p) {
+        case 'h': p += p[1] == 'h' ? 2 : 1; break;
+        case 'l': if (p[1] == 'l') { size = 2; p += 2; } else { size = 1; p++; } break;
+        case 'z': size = 3; p++; break;
+        case 'j': size = 4; p++; break;
+        case 't': size = 5; p++; break;
+        case 'L': size = 6; p++; break;
+        default: break;
+    }
+
+    static const fossil_sanity_log_arg_t integers[] = {
+        FOSSIL_SANITY_LOG_ARG_INT, FOSSIL_SANITY_LOG_ARG_LONG, FOSSIL_SANITY_LOG_ARG_LLONG,
+        FOSSIL_SANITY_LOG_ARG_SIZE, FOSSIL_SANITY_LOG_ARG_INTMAX, FOSSIL_SANITY_LOG_ARG_PTRDIFF
+    };
+    spec->kind = (fossil_sanity_log_arg_t)-1;
+    switch (*p) {
+        case 'd': case 'i': case 'o': case 'u': case 'x': case 'X':
+            if (size < 6) spec->kind = integers[size];
+            break;
+        case 'c':
+            if (size == 0) spec->kind = FOSSIL_SANITY_LOG_ARG_INT;
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            if (size == 0 || size == 1) spec->kind = FOSSIL_SANITY_LOG_ARG_DOUBLE;
+            if (size == 6) spec->kind = FOSSIL_SANITY_LOG_ARG_LDOUBLE;
+            break;
+        case 'p':
+            if (size == 0) spec->kind = FOSSIL_SANITY_LOG_ARG_POINTER;
+            break;
+        case 's':
+            if (size == 0) spec->kind = FOSSIL_SANITY_LOG_ARG_STRING;
+            break;
+        case '%':
+            if (p == spec->start + 1) spec->kind = FOSSIL_SANITY_LOG_ARG_NONE;
+            break;
+        default:
+            break;  // %n, wide characters and anything unknown
+    }
+    if (*p) p++;
+    spec->length = (size_t)(p - spec->start);
+    if (spec->length >= FOSSIL_SANITY_LOG_SPEC_LENGTH) {
+        spec->kind = (fossil_sanity_log_arg_t)-1;
+    }
+    *cursor = p;
+    return true;
+}
+
+// Capture the format pointer and arguments into a record. Returns the record
+// length, or 0 if the arguments cannot be deferred or do not fit.
+static size_t _fossil_sanity_log_deferred_capture(char *record, size_t size, const char *format, va_list args) {
+    size_t used = sizeof(format);
+    fossil_sanity_log_spec_t spec;
+    const char *cursor = format;
+
+    if (size < used) return 0;
+    memcpy(record, &format, sizeof(format));
+
+#define FOSSIL_SANITY_LOG_CAPTURE(type, promoted) do {                      \
+        type value = (type)va_arg(args, promoted);                          \
+        if (used + sizeof(value) > size) return 0;                          \
+        memcpy(record + used, &value, sizeof(value));                       \
+        used += sizeof(value);                                              \
+    } while (0)
+
+    while (_fossil_sanity_log_spec_next(&cursor, &spec)) {
+        int precision = spec.precision;
+        for (int i = 0; i < spec.stars; i++) {
+            int star = va_arg(args, int);
+            if (used + sizeof(star) > size) return 0;
+            memcpy(record + used, &star, sizeof(star));
+            used += sizeof(star);
+            precision = star;  // The last star is the precision when both are present
+        }
+        if (spec.stars == 1 && spec.start[1] == '*') {
+            precision = spec.precision;  // A lone star was the width
+        }
+
+        switch (spec.kind) {
+            case FOSSIL_SANITY_LOG_ARG_NONE:    break;
+            case FOSSIL_SANITY_LOG_ARG_INT:     FOSSIL_SANITY_LOG_CAPTURE(int, int); break;
+            case FOSSIL_SANITY_LOG_ARG_LONG:    FOSSIL_SANITY_LOG_CAPTURE(long, long); break;
+            case FOSSIL_SANITY_LOG_ARG_LLONG:   FOSSIL_SANITY_LOG_CAPTURE(long long, long long); break;
+            case FOSSIL_SANITY_LOG_ARG_SIZE:    FOSSIL_SANITY_LOG_CAPTURE(size_t, size_t); break;
+            case FOSSIL_SANITY_LOG_ARG_INTMAX:  FOSSIL_SANITY_LOG_CAPTURE(intmax_t, intmax_t); break;
+            case FOSSIL_SANITY_LOG_ARG_PTRDIFF: FOSSIL_SANITY_LOG_CAPTURE(ptrdiff_t, ptrdiff_t); break;
+            case FOSSIL_SANITY_LOG_ARG_DOUBLE:  FOSSIL_SANITY_LOG_CAPTURE(double, double); break;
+            case FOSSIL_SANITY_LOG_ARG_LDOUBLE: FOSSIL_SANITY_LOG_CAPTURE(long double, long double); break;
+            case FOSSIL_SANITY_LOG_ARG_POINTER: FOSSIL_SANITY_LOG_CAPTURE(void *, void *); break;
+            case FOSSIL_SANITY_LOG_ARG_STRING: {
+                const char *text = va_arg(args, const char *);
+                if (!text) text = "(null)";
+                // With a precision the argument need not be NUL-terminated
+                size_t length = precision >= 0 ? strnlen(text, (size_t)precision) : strlen(text);
+                uint32_t stored = (uint32_t)length;
+                if (used + sizeof(stored) + length + 1 > size) return 0;
+                memcpy(record + used, &stored, sizeof(stored));
+                memcpy(record + used + sizeof(stored), text, length);
+                record[used + sizeof(stored) + length] = '\0';
+                used += sizeof(stored) + length + 1;
+                break;
+            }
+            default:
+                return 0;
+        }
+    }
+#undef FOSSIL_SANITY_LOG_CAPTURE
+    return used;
+}
+
+// Replay a record into text. Same contract as snprintf: returns the full
+// length and writes at most size bytes including the terminator.
+static size_t _fossil_sanity_log_deferred_render(const char *record, size_t record_length, char *out, size_t size) {
+    const char *format;
+    const char *args = record + sizeof(format);
+    const char *end = record + record_length;
+    const char *cursor;
+    const char *literal;
+    char spec_text[FOSSIL_SANITY_LOG_SPEC_LENGTH];
+    fossil_sanity_log_spec_t spec;
+    size_t pos = 0;
+
+    memcpy(&format, record, sizeof(format));
+    cursor = literal = format;
+
+#define FOSSIL_SANITY_LOG_ROOM  (pos < size ? size - pos : 0)
+#define FOSSIL_SANITY_LOG_DST   (pos < size ? out + pos : NULL)
+#define FOSSIL_SANITY_LOG_REPLAY(type) do {                                                            \
+        type value;                                                                                  \
+        memcpy(&value, args, sizeof(value));                                                         \
+        args += sizeof(value);                                                                       \
+        written = spec.stars == 0 ? snprintf(FOSSIL_SANITY_LOG_DST, FOSSIL_SANITY_LOG_ROOM, spec_text, value)              \
+                : spec.stars == 1 ? snprintf(FOSSIL_SANITY_LOG_DST, FOSSIL_SANITY_LOG_ROOM, spec_text, stars[0], value)    \
+                : snprintf(FOSSIL_SANITY_LOG_DST, FOSSIL_SANITY_LOG_ROOM, spec_text, stars[0], stars[1], value);          \
+    } while (0)
+
+    for (;;) {
+        bool more = _fossil_sanity_log_spec_next(&cursor, &spec);
+        size_t literal_length = more ? (size_t)(spec.start - literal) : strlen(literal);
+        if (pos < size) {
+            size_t copy = literal_length < size - pos ? literal_length : size - pos;
+            memcpy(out + pos, literal, copy);
+        }
+        pos += literal_length;
+        if (!more) break;
+        literal = cursor;
+
+        int stars[2] = { 0, 0 };
+        for (int i = 0; i < spec.stars; i++) {
+            memcpy(&stars[i], args, sizeof(int));
+            args += sizeof(int);
+        }
+        memcpy(spec_text, spec.start, spec.length);
+        spec_text[spec.length] = '\0';
+
+        int written = 0;
+        switch (spec.kind) {
+            case FOSSIL_SANITY_LOG_ARG_NONE:
+                if (pos < size) out[pos] = '%';
+                written = 1;
+                break;
+            case FOSSIL_SANITY_LOG_ARG_INT:     FOSSIL_SANITY_LOG_REPLAY(int); break;
+            case FOSSIL_SANITY_LOG_ARG_LONG:    FOSSIL_SANITY_LOG_REPLAY(long); break;
+            case FOSSIL_SANITY_LOG_ARG_LLONG:   FOSSIL_SANITY_LOG_REPLAY(long long); break;
+            case FOSSIL_SANITY_LOG_ARG_SIZE:    FOSSIL_SANITY_LOG_REPLAY(size_t); break;
+            case FOSSIL_SANITY_LOG_ARG_INTMAX:  FOSSIL_SANITY_LOG_REPLAY(intmax_t); break;
+            case FOSSIL_SANITY_LOG_ARG_PTRDIFF: FOSSIL_SANITY_LOG_REPLAY(ptrdiff_t); break;
+            case FOSSIL_SANITY_LOG_ARG_DOUBLE:  FOSSIL_SANITY_LOG_REPLAY(double); break;
+            case FOSSIL_SANITY_LOG_ARG_LDOUBLE: FOSSIL_SANITY_LOG_REPLAY(long double); break;
+            case FOSSIL_SANITY_LOG_ARG_POINTER: FOSSIL_SANITY_LOG_REPLAY(void *); break;
+            case FOSSIL_SANITY_LOG_ARG_STRING: {
+                uint32_t length;
+                memcpy(&length, args, sizeof(length));
+                const char *text = args + sizeof(length);
+                args += sizeof(length) + length + 1;
+                written = spec.stars == 0 ? snprintf(FOSSIL_SANITY_LOG_DST, FOSSIL_SANITY_LOG_ROOM, spec_text, text)
+                        : spec.stars == 1 ? snprintf(FOSSIL_SANITY_LOG_DST, FOSSIL_SANITY_LOG_ROOM, spec_text, stars[0], text)
+                        : snprintf(FOSSIL_SANITY_LOG_DST, FOSSIL_SANITY_LOG_ROOM, spec_text, stars[0], stars[1], text);
+                break;
+            }
+            default:
+                break;  // Never captured
+        }
+        if (written > 0) pos += (size_t)written;
+        if (args > end) break;  // Damaged record
+    }
+#undef FOSSIL_SANITY_LOG_REPLAY
+#undef FOSSIL_SANITY_LOG_DST
+#undef FOSSIL_SANITY_LOG_ROOM
+
+    if (size) out[pos < size ? pos : size - 1] = '\0';
+    return pos;
+}
+
+// Render the text of any entry into a buffer, like snprintf
+static size_t _fossil_sanity_log_entry_render(const fossil_sanity_log_entry_t *entry, char *out, size_t size) {
+    if (entry->flags & FOSSIL_SANITY_LOG_ENTRY_DEFERRED) {
+        return _fossil_sanity_log_deferred_render(entry->message, entry->length, out, size);
+    }
+    if (size) {
+        size_t copy = entry->length < size ? entry->length : size - 1;
+        memcpy(out, entry->message, copy);
+        out[copy] = '\0';
+    }
+    return entry->length;
+}
+
+// Replace a deferred record with its formatted text, for consumers that
+// need a plain message
+static bool _fossil_sanity_log_entry_resolve(fossil_sanity_log_queue_t *queue, fossil_sanity_log_entry_t *entry) {
+    if (!(entry->flags & FOSSIL_SANITY_LOG_ENTRY_DEFERRED)) return true;
+
+    char buffer[MAX_LOG_MESSAGE_LENGTH];
+    char *text = buffer;
+    size_t length = _fossil_sanity_log_entry_render(entry, buffer, sizeof(buffer));
+    if (length >= sizeof(buffer)) {
+        text = (char *)malloc(length + 1);
+        if (!text) {
+            perror("Failed to allocate memory for log message");
+            return false;
+        }
+        _fossil_sanity_log_entry_render(entry, text, length + 1);
+    }
+
+    const char *record = entry->message;
+    bool in_arena = _fossil_sanity_log_entry_in_arena(entry);
+    bool stored = _fossil_sanity_log_entry_set_bytes(queue, entry, text, length);
+    if (stored) {
+        entry->flags &= ~FOSSIL_SANITY_LOG_ENTRY_DEFERRED;
+        if (in_arena) _fossil_sanity_log_arena_release(record);
+    }
+    if (text != buffer) free(text);
+    return stored;
+}
+
+// Map a priority onto its level bucket, clamping unknown priorities
+static int _fossil_sanity_log_level(int priority) {
+    if (priority < FOSSIL_SANITY_LOG_LEVEL_DEBUG) return FOSSIL_SANITY_LOG_LEVEL_DEBUG;
+    if (priority > FOSSIL_SANITY_LOG_LEVEL_FATAL) return FOSSIL_SANITY_LOG_LEVEL_FATAL;
+    return priority;
+}
+
+// Lowest level set in a non-empty bitmap
+static int _fossil_sanity_log_lowest_level(unsigned int mask) {
+    int level = 0;
+    while (!(mask & 1u)) {
+        mask >>= 1;
+        level++;
+    }
+    return level;
+}
+
+// ==================================================================
+// Keyword index
+// ==================================================================
+
+#define FOSSIL_SANITY_LOG_INDEX_BUCKETS  1024  // Initial term table size
+#define FOSSIL_SANITY_LOG_POSTING_CHUNK  1024  // Postings allocated at a time
+
+// One (term, entry) pair, linked into the term's list for the entry's level
+// and into the entry's own list of postings. A posting without a term marks
+// a deferred entry waiting on the index's pending list.
+typedef struct fossil_sanity_log_posting {
+    fossil_sanity_log_entry_t *entry;
+    struct fossil_sanity_log_term *term;
+    struct fossil_sanity_log_posting *prev;     // Previous posting of the term at this level
+    struct fossil_sanity_log_posting *next;     // Next posting of the term at this level
+    struct fossil_sanity_log_posting *sibling;  // Next posting of the same entry
+    int level;
+} fossil_sanity_log_posting_t;
+
+typedef struct fossil_sanity_log_term {
+    struct fossil_sanity_log_term *chain;  // Next term in the same hash bucket
+    uint32_t hash;
+    uint32_t length;
+    size_t postings;
+    fossil_sanity_log_posting_t *head[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+    fossil_sanity_log_posting_t *tail[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+    char token[];
+} fossil_sanity_log_term_t;
+
+typedef struct fossil_sanity_log_posting_chunk {
+    struct fossil_sanity_log_posting_chunk *next;
+    fossil_sanity_log_posting_t postings[FOSSIL_SANITY_LOG_POSTING_CHUNK];
+} fossil_sanity_log_posting_chunk_t;
+
+struct fossil_sanity_log_index {
+    fossil_sanity_log_term_t **buckets;
+    size_t bucket_count;
+    size_t term_count;
+    fossil_sanity_log_posting_t *free_postings;
+    fossil_sanity_log_posting_chunk_t *chunks;
+    fossil_sanity_log_posting_t *pending_head;  // Deferred entries not indexed yet, oldest first
+    fossil_sanity_log_posting_t *pending_tail;
+};
+
+static bool _fossil_sanity_log_is_token_char(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Whether the keyword is a single token the index can answer
+static bool _fossil_sanity_log_is_token(const char *keyword) {
+    if (!*keyword) return false;
+    for (; *keyword; keyword++) {
+        if (!_fossil_sanity_log_is_token_char(*keyword)) return false;
+    }
+    return true;
+}
+
+static uint32_t _fossil_sanity_log_hash(const char *text, size_t length) {
+    uint32_t hash = 2166136261u;  // FNV-1a
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)text[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Whether the message contains the keyword as a whole token
+static bool _fossil_sanity_log_has_token(const char *message, const char *keyword, size_t length) {
+    const char *found = message;
+    while ((found = strstr(found, keyword)) != NULL) {
+        bool starts = found == message || !_fossil_sanity_log_is_token_char(found[-1]);
+        bool ends = !_fossil_sanity_log_is_token_char(found[length]);
+        if (starts && ends) return true;
+        found++;
+    }
+    return false;
+}
+
+static fossil_sanity_log_term_t *_fossil_sanity_log_index_find(const fossil_sanity_log_index_t *index, const char *token, size_t length, uint32_t hash) {
+    fossil_sanity_log_term_t *term = index->buckets[hash & (index->bucket_count - 1)];
+    for (; term; term = term->chain) {
+        if (term->hash == hash && term->length == length && memcmp(term->token, token, length) == 0) {
+            return term;
+        }
+    }
+    return NULL;
+}
+
+static void _fossil_sanity_log_index_grow(fossil_sanity_log_index_t *index) {
+    size_t count = index->bucket_count * 2;
+    fossil_sanity_log_term_t **buckets = (fossil_sanity_log_term_t **)calloc(count, sizeof(*buckets));
+    if (!buckets) return;  // Keep the longer chains
+
+    for (size_t i = 0; i < index->bucket_count; i++) {
+        fossil_sanity_log_term_t *term = index->buckets[i];
+        while (term) {
+            fossil_sanity_log_term_t *chain = term->chain;
+            term->chain = buckets[term->hash & (count - 1)];
+            buckets[term->hash & (count - 1)] = term;
+            term = chain;
+        }
+    }
+    free(index->buckets);
+    index->buckets = buckets;
+    index->bucket_count = count;
+}
+
+static fossil_sanity_log_posting_t *_fossil_sanity_log_posting_alloc(fossil_sanity_log_index_t *index) {
+    if (!index->free_postings) {
+        fossil_sanity_log_posting_chunk_t *chunk = (fossil_sanity_log_posting_chunk_t *)malloc(sizeof(fossil_sanity_log_posting_chunk_t));
+        if (!chunk) {
+            perror("Failed to allocate memory for log index");
+            return NULL;
+        }
+        chunk->next = index->chunks;
+        index->chunks = chunk;
+        for (size_t i = FOSSIL_SANITY_LOG_POSTING_CHUNK; i-- > 0;) {
+            chunk->postings[i].next = index->free_postings;
+            index->free_postings = &chunk->postings[i];
+        }
+    }
+    fossil_sanity_log_posting_t *posting = index->free_postings;
+    index->free_postings = posting->next;
+    return posting;
+}
+
+// Add one token of an entry to the index. A late entry is spliced in by
+// sequence rather than appended, so the term's list stays oldest first.
+static void _fossil_sanity_log_index_token(fossil_sanity_log_index_t *index, fossil_sanity_log_entry_t *entry, int level, const char *token, size_t length, bool late) {
+    uint32_t hash = _fossil_sanity_log_hash(token, length);
+    fossil_sanity_log_term_t *term = _fossil_sanity_log_index_find(index, token, length, hash);
+
+    if (!term) {
+        term = (fossil_sanity_log_term_t *)calloc(1, sizeof(fossil_sanity_log_term_t) + length + 1);
+        if (!term) {
+            perror("Failed to allocate memory for log index");
+            return;
+        }
+        term->hash = hash;
+        term->length = (uint32_t)length;
+        memcpy(term->token, token, length);
+        if (index->term_count >= index->bucket_count) {
+            _fossil_sanity_log_index_grow(index);
+        }
+        term->chain = index->buckets[hash & (index->bucket_count - 1)];
+        index->buckets[hash & (index->bucket_count - 1)] = term;
+        index->term_count++;
+    }
+
+    fossil_sanity_log_posting_t *after = term->tail[level];
+    while (late && after && after->entry->sequence > entry->sequence) after = after->prev;
+    if (after && after->entry == entry) {
+        return;  // Token repeated within the same message
+    }
+
+    fossil_sanity_log_posting_t *posting = _fossil_sanity_log_posting_alloc(index);
+    if (!posting) return;
+    posting->entry = entry;
+    posting->term = term;
+    posting->level = level;
+    posting->prev = after;
+    posting->next = after ? after->next : term->head[level];
+    if (posting->prev) {
+        posting->prev->next = posting;
+    } else {
+        term->head[level] = posting;
+    }
+    if (posting->next) {
+        posting->next->prev = posting;
+    } else {
+        term->tail[level] = posting;
+    }
+    term->postings++;
+
+    posting->sibling = entry->postings;
+    entry->postings = posting;
+}
+
+// Index every token of an entry's message
+static void _fossil_sanity_log_index_add(fossil_sanity_log_index_t *index, fossil_sanity_log_entry_t *entry, bool late) {
+    int level = _fossil_sanity_log_level(entry->priority);
+    const char *text = entry->message;
+
+    while (*text) {
+        while (*text && !_fossil_sanity_log_is_token_char(*text)) text++;
+        const char *start = text;
+        while (_fossil_sanity_log_is_token_char(*text)) text++;
+        if (text > start) {
+            _fossil_sanity_log_index_token(index, entry, level, start, (size_t)(text - start), late);
+        }
+    }
+}
+
+// Leave a deferred entry unformatted on the pending list until a search
+// needs it. False without memory for the marker.
+static bool _fossil_sanity_log_index_defer(fossil_sanity_log_index_t *index, fossil_sanity_log_entry_t *entry) {
+    fossil_sanity_log_posting_t *posting = _fossil_sanity_log_posting_alloc(index);
+    if (!posting) return false;
+    posting->entry = entry;
+    posting->term = NULL;
+    posting->sibling = NULL;
+    posting->next = NULL;
+    posting->prev = index->pending_tail;
+    if (posting->prev) posting->prev->next = posting; else index->pending_head = posting;
+    index->pending_tail = posting;
+    entry->postings = posting;
+    return true;
+}
+
+// Drop an entry's postings, and any term left without postings
+static void _fossil_sanity_log_index_remove(fossil_sanity_log_index_t *index, fossil_sanity_log_entry_t *entry) {
+    fossil_sanity_log_posting_t *posting = entry->postings;
+    while (posting) {
+        fossil_sanity_log_posting_t *sibling = posting->sibling;
+        fossil_sanity_log_term_t *term = posting->term;
+
+        if (!term) {
+            if (posting->prev) posting->prev->next = posting->next; else index->pending_head = posting->next;
+            if (posting->next) posting->next->prev = posting->prev; else index->pending_tail = posting->prev;
+            posting->next = index->free_postings;
+            index->free_postings = posting;
+            posting = sibling;
+            continue;
+        }
+
+        if (posting->prev) posting->prev->next = posting->next; else term->head[posting->level] = posting->next;
+        if (posting->next) posting->next->prev = posting->prev; else term->tail[posting->level] = posting->prev;
+
+        if (--term->postings == 0) {
+            fossil_sanity_log_term_t **link = &index->buckets[term->hash & (index->bucket_count - 1)];
+            while (*link != term) link = &(*link)->chain;
+            *link = term->chain;
+            free(term);
+            index->term_count--;
+        }
+
+        posting->next = index->free_postings;
+        index->free_postings = posting;
+        posting = sibling;
+    }
+    entry->postings = NULL;
+}
+
+// Forget every term; posting chunks are kept for reuse
+static void _fossil_sanity_log_index_reset(fossil_sanity_log_index_t *index) {
+    for (size_t i = 0; i < index->bucket_count; i++) {
+        fossil_sanity_log_term_t *term = index->buckets[i];
+        while (term) {
+            fossil_sanity_log_term_t *chain = term->chain;
+            free(term);
+            term = chain;
+        }
+        index->buckets[i] = NULL;
+    }
+    index->term_count = 0;
+    index->pending_head = index->pending_tail = NULL;
+
+    index->free_postings = NULL;
+    for (fossil_sanity_log_posting_chunk_t *chunk = index->chunks; chunk; chunk = chunk->next) {
+        for (size_t i = FOSSIL_SANITY_LOG_POSTING_CHUNK; i-- > 0;) {
+            chunk->postings[i].next = index->free_postings;
+            index->free_postings = &chunk->postings[i];
+        }
+    }
+}
+
+static void _fossil_sanity_log_index_free(fossil_sanity_log_index_t *index) {
+    _fossil_sanity_log_index_reset(index);
+    while (index->chunks) {
+        fossil_sanity_log_posting_chunk_t *next = index->chunks->next;
+        free(index->chunks);
+        index->chunks = next;
+    }
+    free(index->buckets);
+    free(index);
+}
+
+// ==================================================================
+// Time index
+// ==================================================================
+
+#define FOSSIL_SANITY_LOG_TIME_CHUNK_BYTES 4096  // Chunk size and alignment
+
+// Entries in arrival order. Removed entries leave a NULL slot; a chunk is
+// freed once its last entry is gone. Chunks are aligned to their size so a
+// slot pointer leads back to its chunk.
+typedef struct fossil_sanity_log_time_chunk {
+    struct fossil_sanity_log_time_chunk *prev;
+    struct fossil_sanity_log_time_chunk *next;
+    uint64_t first;   // Earliest timestamp added
+    uint64_t last;    // Latest timestamp added
+    size_t used;
+    size_t live;
+    fossil_sanity_log_entry_t *entries[];
+} fossil_sanity_log_time_chunk_t;
+
+#define FOSSIL_SANITY_LOG_TIME_CHUNK_ENTRIES \
+    ((FOSSIL_SANITY_LOG_TIME_CHUNK_BYTES - sizeof(fossil_sanity_log_time_chunk_t)) / sizeof(fossil_sanity_log_entry_t *))
+
+struct fossil_sanity_log_time_index {
+    fossil_sanity_log_time_chunk_t *head;
+    fossil_sanity_log_time_chunk_t *tail;
+};
+
+// Timestamp source for entries
+static uint64_t _fossil_sanity_log_timestamp(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// qsort order of entry pointers by sequence
+static int _fossil_sanity_log_by_sequence(const void *a, const void *b) {
+    uint64_t x = (*(const fossil_sanity_log_entry_t *const *)a)->sequence;
+    uint64_t y = (*(const fossil_sanity_log_entry_t *const *)b)->sequence;
+    return (x > y) - (x < y);
+}
+
+static void _fossil_sanity_log_time_add(fossil_sanity_log_time_index_t *index, fossil_sanity_log_entry_t *entry) {
+    fossil_sanity_log_time_chunk_t *chunk = index->tail;
+    if (!chunk || chunk->used == FOSSIL_SANITY_LOG_TIME_CHUNK_ENTRIES) {
+        chunk = (fossil_sanity_log_time_chunk_t *)aligned_alloc(FOSSIL_SANITY_LOG_TIME_CHUNK_BYTES, FOSSIL_SANITY_LOG_TIME_CHUNK_BYTES);
+        if (!chunk) {
+            perror("Failed to allocate memory for log time index");
+            entry->time_slot = NULL;
+            return;
+        }
+        chunk->used = chunk->live = 0;
+        chunk->first = UINT64_MAX;
+        chunk->last = 0;
+        chunk->next = NULL;
+        chunk->prev = index->tail;
+        if (index->tail) index->tail->next = chunk; else index->head = chunk;
+        index->tail = chunk;
+    }
+
+    if (entry->timestamp < chunk->first) chunk->first = entry->timestamp;
+    if (entry->timestamp > chunk->last) chunk->last = entry->timestamp;
+    chunk->entries[chunk->used] = entry;
+    entry->time_slot = &chunk->entries[chunk->used];
+    chunk->used++;
+    chunk->live++;
+}
+
+static void _fossil_sanity_log_time_remove(fossil_sanity_log_time_index_t *index, fossil_sanity_log_entry_t *entry) {
+    if (!entry->time_slot) return;
+    fossil_sanity_log_time_chunk_t *chunk = (fossil_sanity_log_time_chunk_t *)((uintptr_t)entry->time_slot & ~(uintptr_t)(FOSSIL_SANITY_LOG_TIME_CHUNK_BYTES - 1));
+    *entry->time_slot = NULL;
+    entry->time_slot = NULL;
+
+    if (--chunk->live == 0) {
+        if (chunk->prev) chunk->prev->next = chunk->next; else index->head = chunk->next;
+        if (chunk->next) chunk->next->prev = chunk->prev; else index->tail = chunk->prev;
+        free(chunk);
+    }
+}
+
+static void _fossil_sanity_log_time_reset(fossil_sanity_log_time_index_t *index) {
+    while (index->head) {
+        fossil_sanity_log_time_chunk_t *next = index->head->next;
+        free(index->head);
+        index->head = next;
+    }
+    index->tail = NULL;
+}
+
+// Link an entry at the back of its level bucket. Priorities past either
+// end share the edge bucket, where higher raw priorities still go first.
+static void _fossil_sanity_log_link(fossil_sanity_log_queue_t *queue, fossil_sanity_log_entry_t *entry) {
+    int level = _fossil_sanity_log_level(entry->priority);
+    fossil_sanity_log_entry_t *tail = queue->level_tail[level];
+    fossil_sanity_log_entry_t *after = tail;
+
+    if (!after) {
+        // Empty bucket: follow the newest entry of the closest higher level
+        unsigned int higher = queue->level_mask & ~((2u << level) - 1u);
+        if (higher) {
+            after = queue->level_tail[_fossil_sanity_log_lowest_level(higher)];
+        }
+        queue->level_head[level] = entry;
+        queue->level_mask |= 1u << level;
+    } else if (after->priority < entry->priority) {
+        while (after != queue->level_head[level] && after->prev->priority < entry->priority) after = after->prev;
+        if (after == queue->level_head[level]) {
+            queue->level_head[level] = entry;
+        }
+        after = after->prev;
+    }
+
+    entry->prev = after;
+    entry->next = after ? after->next : queue->head;
+    if (entry->prev) {
+        entry->prev->next = entry;
+    } else {
+        queue->head = entry;
+    }
+    if (entry->next) {
+        entry->next->prev = entry;
+    } else {
+        queue->tail = entry;
+    }
+
+    if (!tail || after == tail) {
+        queue->level_tail[level] = entry;
+    }
+    if (++queue->count > queue->peak_count) {
+        queue->peak_count = queue->count;
+    }
+
+    // Deferred entries stay unformatted until a keyword search needs them
+    entry->postings = NULL;
+    if (queue->index) {
+        bool deferred = (entry->flags & FOSSIL_SANITY_LOG_ENTRY_DEFERRED) && _fossil_sanity_log_index_defer(queue->index, entry);
+        if (!deferred && _fossil_sanity_log_entry_resolve(queue, entry)) {
+            _fossil_sanity_log_index_add(queue->index, entry, false);
+        }
+    }
+    entry->time_slot = NULL;
+    if (queue->time_index) {
+        _fossil_sanity_log_time_add(queue->time_index, entry);
+    }
+}
+
+// Unlink an entry from the queue and its level bucket
+static void _fossil_sanity_log_unlink(fossil_sanity_log_queue_t *queue, fossil_sanity_log_entry_t *entry) {
+    int level = _fossil_sanity_log_level(entry->priority);
+
+    if (queue->index) {
+        _fossil_sanity_log_index_remove(queue->index, entry);
+    }
+    if (queue->time_index) {
+        _fossil_sanity_log_time_remove(queue->time_index, entry);
+    }
+
+    if (queue->level_head[level] == entry && queue->level_tail[level] == entry) {
+        queue->level_head[level] = NULL;
+        queue->level_tail[level] = NULL;
+        queue->level_mask &= ~(1u << level);
+    } else if (queue->level_head[level] == entry) {
+        queue->level_head[level] = entry->next;
+    } else if (queue->level_tail[level] == entry) {
+        queue->level_tail[level] = entry->prev;
+    }
+
+    if (entry->prev) {
+        entry->prev->next = entry->next;
+    } else {
+        queue->head = entry->next;
+    }
+    if (entry->next) {
+        entry->next->prev = entry->prev;
+    } else {
+        queue->tail = entry->prev;
+    }
+
+    entry->prev = entry->next = NULL;
+    queue->count--;
+}
+
+// Evict the oldest entries of the lowest levels until the queue fits its capacity
+static void _fossil_sanity_log_trim(fossil_sanity_log_queue_t *queue) {
+    while (queue->capacity && queue->count > queue->capacity) {
+        int level = _fossil_sanity_log_lowest_level(queue->level_mask);
+        fossil_sanity_log_entry_t *victim = queue->level_head[level];
+        _fossil_sanity_log_unlink(queue, victim);
+        _fossil_sanity_log_entry_free(queue, victim);
+        queue->evicted[level]++;
+        _fossil_sanity_log_count(&_fossil_sanity_log_counters()->evicted, 1);
+    }
+}
+
+// Recompute the level buckets from the list order
+static void _fossil_sanity_log_rebuild_levels(fossil_sanity_log_queue_t *queue) {
+    memset(queue->level_head, 0, sizeof(queue->level_head));
+    memset(queue->level_tail, 0, sizeof(queue->level_tail));
+    queue->level_mask = 0;
+
+    for (fossil_sanity_log_entry_t *current = queue->head; current; current = current->next) {
+        int level = _fossil_sanity_log_level(current->priority);
+        if (!queue->level_head[level]) {
+            queue->level_head[level] = current;
+            queue->level_mask |= 1u << level;
+        }
+        queue->level_tail[level] = current;
+    }
+}
+
+// Publish a node on its level (wait-free for producers)
+static void _fossil_sanity_log_mpsc_put(fossil_sanity_log_mpsc_level_t *level, fossil_sanity_log_node_t *node) {
+    atomic_store_explicit(&node->link, NULL, memory_order_relaxed);
+    fossil_sanity_log_node_t *prev = atomic_exchange_explicit(&level->tail, node, memory_order_acq_rel);
+    atomic_store_explicit(&prev->link, node, memory_order_release);
+}
+
+// Take the oldest published node, or NULL if none is fully published yet
+static fossil_sanity_log_node_t *_fossil_sanity_log_mpsc_take(fossil_sanity_log_mpsc_level_t *level) {
+    fossil_sanity_log_node_t *head = level->head;
+    fossil_sanity_log_node_t *next = atomic_load_explicit(&head->link, memory_order_acquire);
+
+    if (head == &level->stub) {
+        if (!next) return NULL;
+        level->head = next;
+        head = next;
+        next = atomic_load_explicit(&head->link, memory_order_acquire);
+    }
+    if (next) {
+        level->head = next;
+        return head;
+    }
+    if (head != atomic_load_explicit(&level->tail, memory_order_acquire)) {
+        return NULL;  // A producer is between its exchange and its link
+    }
+
+    // Last node: put the stub behind it so it can be detached
+    _fossil_sanity_log_mpsc_put(level, &level->stub);
+    next = atomic_load_explicit(&head->link, memory_order_acquire);
+    if (next) {
+        level->head = next;
+        return head;
+    }
+    return NULL;
+}
+
+// Publish a pre-linked chain of nodes with a single exchange
+static void _fossil_sanity_log_mpsc_put_chain(fossil_sanity_log_mpsc_level_t *level, fossil_sanity_log_node_t *first, fossil_sanity_log_node_t *last) {
+    atomic_store_explicit(&last->link, NULL, memory_order_relaxed);
+    fossil_sanity_log_node_t *prev = atomic_exchange_explicit(&level->tail, last, memory_order_acq_rel);
+    atomic_store_explicit(&prev->link, first, memory_order_release);
+}
+
+// Publish the calling thread's staged nodes, keeping their order per level
+static void _fossil_sanity_log_stage_flush(fossil_sanity_log_stage_t *stage) {
+    if (!stage->count) return;
+
+    fossil_sanity_log_node_t *first[FOSSIL_SANITY_LOG_LEVEL_COUNT] = {0};
+    fossil_sanity_log_node_t *last[FOSSIL_SANITY_LOG_LEVEL_COUNT] = {0};
+    for (size_t i = 0; i < stage->count; i++) {
+        fossil_sanity_log_node_t *node = stage->nodes[i];
+        int level = _fossil_sanity_log_level(node->entry.priority);
+        if (last[level]) {
+            atomic_store_explicit(&last[level]->link, node, memory_order_relaxed);
+        } else {
+            first[level] = node;
+        }
+        last[level] = node;
+    }
+
+    fossil_sanity_log_mpsc_t *mpsc = stage->queue->mpsc;
+    for (int level = FOSSIL_SANITY_LOG_LEVEL_COUNT - 1; level >= 0; level--) {
+        if (first[level]) {
+            _fossil_sanity_log_mpsc_put_chain(&mpsc->levels[level], first[level], last[level]);
+        }
+    }
+    stage->count = 0;
+}
+
+// Thread exit hook: publish whatever the thread still has staged
+static void _fossil_sanity_log_stage_exit(void *arg) {
+    _fossil_sanity_log_stage_flush((fossil_sanity_log_stage_t *)arg);
+}
+
+static void _fossil_sanity_log_stage_key_init(void) {
+    pthread_key_create(&thread_stage_key, _fossil_sanity_log_stage_exit);
+}
+
+// Stage a node in the calling thread's ring
+static void _fossil_sanity_log_stage_put(fossil_sanity_log_queue_t *queue, fossil_sanity_log_node_t *node) {
+    fossil_sanity_log_stage_t *stage = &thread_stage;
+
+    if (stage->queue != queue) {
+        _fossil_sanity_log_stage_flush(stage);
+        if (!stage->queue) {
+            pthread_once(&thread_stage_once, _fossil_sanity_log_stage_key_init);
+            pthread_setspecific(thread_stage_key, stage);
+        }
+        stage->queue = queue;
+    }
+
+    stage->nodes[stage->count++] = node;
+    if (stage->count >= queue->mpsc->batch) {
+        _fossil_sanity_log_stage_flush(stage);
+    }
+}
+
+// Move everything producers have published into the level buckets. Returns
+// false if a level is held up behind a push that is still in progress.
+static bool _fossil_sanity_log_collect(fossil_sanity_log_queue_t *queue) {
+    if (!queue->mpsc) return true;
+
+    // Levels are published independently, so entries for the time index are
+    // gathered and added in sequence order once every level is taken
+    fossil_sanity_log_mpsc_t *mpsc = queue->mpsc;
+    fossil_sanity_log_time_index_t *time_index = queue->time_index;
+    size_t collected = 0;
+    queue->time_index = NULL;
+
+    bool settled = true;
+    for (int level = FOSSIL_SANITY_LOG_LEVEL_COUNT - 1; level >= 0; level--) {
+        fossil_sanity_log_mpsc_level_t *stage = &mpsc->levels[level];
+        fossil_sanity_log_node_t *node;
+        while ((node = _fossil_sanity_log_mpsc_take(stage)) != NULL) {
+            _fossil_sanity_log_link(queue, &node->entry);
+            if (!time_index) {
+                _fossil_sanity_log_trim(queue);
+                continue;
+            }
+            if (collected == mpsc->collected_capacity) {
+                size_t capacity = collected ? 2 * collected : 64;
+                fossil_sanity_log_entry_t **grown = (fossil_sanity_log_entry_t **)realloc(mpsc->collected, capacity * sizeof(*grown));
+                if (!grown) {
+                    perror("Failed to allocate memory for log time index");
+                    _fossil_sanity_log_time_add(time_index, &node->entry);  // Indexed, if out of order
+                    continue;
+                }
+                mpsc->collected = grown;
+                mpsc->collected_capacity = capacity;
+            }
+            mpsc->collected[collected++] = &node->entry;
+        }
+        if (atomic_load_explicit(&stage->tail, memory_order_acquire) != stage->head) {
+            settled = false;
+        }
+    }
+
+    if (time_index) {
+        queue->time_index = time_index;
+        qsort(mpsc->collected, collected, sizeof(*mpsc->collected), _fossil_sanity_log_by_sequence);
+        for (size_t i = 0; i < collected; i++) {
+            _fossil_sanity_log_time_add(time_index, mpsc->collected[i]);
+        }
+        _fossil_sanity_log_trim(queue);
+    }
+    return settled;
+}
+
+// Build a self-contained node for a concurrent push
+static bool _fossil_sanity_log_push_concurrent(fossil_sanity_log_queue_t *queue, const char *message, size_t length, unsigned int flags, int priority, int severity, uint64_t timestamp) {
+    size_t extra = length < FOSSIL_SANITY_LOG_INLINE_LENGTH ? 0 : length + 1;
+
+    fossil_sanity_log_node_t *node = (fossil_sanity_log_node_t *)malloc(sizeof(fossil_sanity_log_node_t) + extra);
+    if (!node) {
+        perror("Failed to allocate memory for log entry");
+        return false;
+    }
+
+    fossil_sanity_log_entry_t *entry = &node->entry;
+    char *text = extra ? (char *)(node + 1) : entry->inline_message;
+    memcpy(text, message, length);
+    text[length] = '\0';
+    entry->priority = priority;
+    entry->severity = severity;
+    entry->flags = FOSSIL_SANITY_LOG_ENTRY_NODE | flags;
+    entry->sequence = atomic_fetch_add_explicit(&queue->mpsc->sequence, 1, memory_order_relaxed);
+    entry->timestamp = timestamp;
+    entry->length = (uint32_t)((flags & FOSSIL_SANITY_LOG_ENTRY_FIELDS) ? strlen(text) : length);
+    entry->message = text;
+
+    if (queue->mpsc->batch) {
+        _fossil_sanity_log_stage_put(queue, node);
+    } else {
+        _fossil_sanity_log_mpsc_put(&queue->mpsc->levels[_fossil_sanity_log_level(priority)], node);
+    }
+    return true;
+}
+
+// Prefix written in front of a message when the smart log format is on
+static const char *_fossil_sanity_log_level_tag(int priority) {
+    switch (priority) {
+        case FOSSIL_SANITY_LOG_LEVEL_DEBUG:   return "[DEBUG]: ";
+        case FOSSIL_SANITY_LOG_LEVEL_INFO:    return "[INFO]: ";
+        case FOSSIL_SANITY_LOG_LEVEL_WARNING: return "[WARNING]: ";
+        case FOSSIL_SANITY_LOG_LEVEL_ERROR:   return "[ERROR]: ";
+        case FOSSIL_SANITY_LOG_LEVEL_FATAL:   return "[FATAL]: ";
+        default:                              return "[UNKNOWN]: ";
+    }
+}
+
+// ==================================================================
+// Structured fields
+// ==================================================================
+
+// Fields follow the message's terminator in the same storage: a count
+// byte, then per field a type byte, the key (8-bit length, bytes, NUL) and
+// the value (8 bytes for int and double, 1 for bool, and for strings a
+// 32-bit length, the bytes and a NUL). entry->length stays the length of
+// the message text, so every text consumer ignores the fields.
+
+#define FOSSIL_SANITY_LOG_FIELDS_MAX 255
+
+static atomic_int log_encoding = FOSSIL_SANITY_LOG_ENCODING_PLAIN;
+
+static const char *_fossil_sanity_log_entry_fields(const fossil_sanity_log_entry_t *entry) {
+    return (entry->flags & FOSSIL_SANITY_LOG_ENTRY_FIELDS) ? entry->message + entry->length + 1 : NULL;
+}
+
+// Bytes a field takes once packed
+static size_t _fossil_sanity_log_field_size(const fossil_sanity_log_field_t *field) {
+    size_t key = strnlen(field->key, 255);
+    size_t size = 1 + 1 + key + 1;
+    switch (field->type) {
+        case FOSSIL_SANITY_LOG_FIELD_BOOL:   return size + 1;
+        case FOSSIL_SANITY_LOG_FIELD_STRING: return size + sizeof(uint32_t) + strlen(field->value.s ? field->value.s : "") + 1;
+        default:                             return size + 8;
+    }
+}
+
+static char *_fossil_sanity_log_field_pack(char *out, const fossil_sanity_log_field_t *field) {
+    uint8_t key = (uint8_t)strnlen(field->key, 255);
+    *out++ = (char)field->type;
+    *out++ = (char)key;
+    memcpy(out, field->key, key);
+    out[key] = '\0';
+    out += key + 1;
+
+    switch (field->type) {
+        case FOSSIL_SANITY_LOG_FIELD_BOOL:
+            *out++ = field->value.b ? 1 : 0;
+            break;
+        case FOSSIL_SANITY_LOG_FIELD_STRING: {
+            const char *text = field->value.s ? field->value.s : "";
+            uint32_t length = (uint32_t)strlen(text);
+            memcpy(out, &length, sizeof(length));
+            memcpy(out + sizeof(length), text, length + 1);
+            out += sizeof(length) + length + 1;
+            break;
+        }
+        case FOSSIL_SANITY_LOG_FIELD_DOUBLE:
+            memcpy(out, &field->value.d, 8);
+            out += 8;
+            break;
+        default:
+            memcpy(out, &field->value.i, 8);
+            out += 8;
+            break;
+    }
+    return out;
+}
+
+// Decode the field at the cursor and advance past it
+static const char *_fossil_sanity_log_field_unpack(const char *in, fossil_sanity_log_field_t *field) {
+    field->type = (fossil_sanity_log_field_type_t)(unsigned char)*in++;
+    uint8_t key = (uint8_t)*in++;
+    field->key = in;
+    in += key + 1;
+
+    switch (field->type) {
+        case FOSSIL_SANITY_LOG_FIELD_BOOL:
+            field->value.b = *in++ != 0;
+            break;
+        case FOSSIL_SANITY_LOG_FIELD_STRING: {
+            uint32_t length;
+            memcpy(&length, in, sizeof(length));
+            field->value.s = in + sizeof(length);
+            in += sizeof(length) + length + 1;
+            break;
+        }
+        case FOSSIL_SANITY_LOG_FIELD_DOUBLE:
+            memcpy(&field->value.d, in, 8);
+            in += 8;
+            break;
+        default:
+            memcpy(&field->value.i, in, 8);
+            in += 8;
+            break;
+    }
+    return in;
+}
+
+// Whether the packed fields at the count byte decode without reading past
+// end, for storage that comes from outside the library
+static bool _fossil_sanity_log_fields_valid(const char *in, const char *end) {
+    if (in >= end) return false;
+    unsigned int count = (unsigned char)*in++;
+    for (unsigned int i = 0; i < count; i++) {
+        if (end - in < 2) return false;
+        unsigned char type = (unsigned char)in[0];
+        size_t key = (unsigned char)in[1];
+        in += 2;
+        if ((size_t)(end - in) <= key || in[key] != '\0') return false;
+        in += key + 1;
+
+        size_t value;
+        switch (type) {
+            case FOSSIL_SANITY_LOG_FIELD_BOOL:
+                value = 1;
+                break;
+            case FOSSIL_SANITY_LOG_FIELD_STRING: {
+                uint32_t length;
+                if ((size_t)(end - in) < sizeof(length)) return false;
+                memcpy(&length, in, sizeof(length));
+                in += sizeof(length);
+                if ((size_t)(end - in) <= length || in[length] != '\0') return false;
+                value = (size_t)length + 1;
+                break;
+            }
+            case FOSSIL_SANITY_LOG_FIELD_INT:
+            case FOSSIL_SANITY_LOG_FIELD_DOUBLE:
+                value = 8;
+                break;
+            default:
+                return false;
+        }
+        if ((size_t)(end - in) < value) return false;
+        in += value;
+    }
+    return true;
+}
+
+// Bounded output cursor: writes what fits and keeps counting, like snprintf
+typedef struct fossil_sanity_log_out {
+    char *buffer;
+    size_t size;
+    size_t pos;
+} fossil_sanity_log_out_t;
+
+static inline void _fossil_sanity_log_out_char(fossil_sanity_log_out_t *out, char c) {
+    if (out->pos < out->size) out->buffer[out->pos] = c;
+    out->pos++;
+}
+
+static inline void _fossil_sanity_log_out_bytes(fossil_sanity_log_out_t *out, const char *bytes, size_t length) {
+    if (out->pos < out->size) {
+        size_t room = out->size - out->pos;
+        memcpy(out->buffer + out->pos, bytes, length < room ? length : room);
+    }
+    out->pos += length;
+}
+
+static inline void _fossil_sanity_log_out_text(fossil_sanity_log_out_t *out, const char *text) {
+    _fossil_sanity_log_out_bytes(out, text, strlen(text));
+}
+
+static void _fossil_sanity_log_out_uint(fossil_sanity_log_out_t *out, uint64_t value) {
+    char digits[20];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - ++count] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value);
+    _fossil_sanity_log_out_bytes(out, digits + sizeof(digits) - count, count);
+}
+
+static void _fossil_sanity_log_out_int(fossil_sanity_log_out_t *out, int64_t value) {
+    if (value < 0) {
+        _fossil_sanity_log_out_char(out, '-');
+        _fossil_sanity_log_out_uint(out, (uint64_t)0 - (uint64_t)value);
+    } else {
+        _fossil_sanity_log_out_uint(out, (uint64_t)value);
+    }
+}
+
+// Fixed notation with up to six decimals; very large or small magnitudes
+// fall back to %g. JSON has no NaN or infinities, so they become null.
+static void _fossil_sanity_log_out_double(fossil_sanity_log_out_t *out, double value, bool json) {
+    if (value != value || value - value != 0) {
+        _fossil_sanity_log_out_text(out, json ? "null" : value != value ? "NaN" : value > 0 ? "+Inf" : "-Inf");
+        return;
+    }
+    double magnitude = value < 0 ? -value : value;
+    if (magnitude != 0 && (magnitude >= 1e15 || magnitude < 1e-4)) {
+        char text[32];
+        int length = snprintf(text, sizeof(text), "%g", value);
+        _fossil_sanity_log_out_bytes(out, text, (size_t)length);
+        return;
+    }
+
+    uint64_t whole = (uint64_t)magnitude;
+    uint64_t fraction = (uint64_t)((magnitude - (double)whole) * 1e6 + 0.5);
+    if (fraction >= 1000000) {
+        whole++;
+        fraction -= 1000000;
+    }
+    if (value < 0 && (whole || fraction)) _fossil_sanity_log_out_char(out, '-');
+    _fossil_sanity_log_out_uint(out, whole);
+    if (fraction) {
+        char digits[7] = { '.', 0 };
+        int last = 0;
+        for (int i = 6; i >= 1; i--) {
+            digits[i] = (char)('0' + fraction % 10);
+            if (!last && digits[i] != '0') last = i;
+            fraction /= 10;
+        }
+        _fossil_sanity_log_out_bytes(out, digits, (size_t)last + 1);
+    }
+}
+
+// A double-quoted string with JSON escapes
+static void _fossil_sanity_log_out_quoted(fossil_sanity_log_out_t *out, const char *text, size_t length) {
+    static const char hex[] = "0123456789abcdef";
+    _fossil_sanity_log_out_char(out, '"');
+    size_t run = 0;  // Bytes copied as they are, written in one go
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        _fossil_sanity_log_out_bytes(out, text + run, i - run);
+        run = i + 1;
+        _fossil_sanity_log_out_char(out, '\\');
+        switch (c) {
+            case '"':  _fossil_sanity_log_out_char(out, '"'); break;
+            case '\\': _fossil_sanity_log_out_char(out, '\\'); break;
+            case '\n': _fossil_sanity_log_out_char(out, 'n'); break;
+            case '\r': _fossil_sanity_log_out_char(out, 'r'); break;
+            case '\t': _fossil_sanity_log_out_char(out, 't'); break;
+            default: {
+                char code[5] = { 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+                _fossil_sanity_log_out_bytes(out, code, sizeof(code));
+                break;
+            }
+        }
+    }
+    _fossil_sanity_log_out_bytes(out, text + run, length - run);
+    _fossil_sanity_log_out_char(out, '"');
+}
+
+// A logfmt value: bare when it is a single token, quoted otherwise
+static void _fossil_sanity_log_out_logfmt(fossil_sanity_log_out_t *out, const char *text, size_t length) {
+    bool quote = length == 0;
+    for (size_t i = 0; i < length && !quote; i++) {
+        unsigned char c = (unsigned char)text[i];
+        quote = c <= ' ' || c == '=' || c == '"' || c == '\\';
+    }
+    if (quote) {
+        _fossil_sanity_log_out_quoted(out, text, length);
+    } else {
+        _fossil_sanity_log_out_bytes(out, text, length);
+    }
+}
+
+static void _fossil_sanity_log_out_value(fossil_sanity_log_out_t *out, const fossil_sanity_log_field_t *field, bool json) {
+    switch (field->type) {
+        case FOSSIL_SANITY_LOG_FIELD_INT:    _fossil_sanity_log_out_int(out, field->value.i); break;
+        case FOSSIL_SANITY_LOG_FIELD_DOUBLE: _fossil_sanity_log_out_double(out, field->value.d, json); break;
+        case FOSSIL_SANITY_LOG_FIELD_BOOL:   _fossil_sanity_log_out_text(out, field->value.b ? "true" : "false"); break;
+        case FOSSIL_SANITY_LOG_FIELD_STRING:
+            if (json) {
+                _fossil_sanity_log_out_quoted(out, field->value.s, strlen(field->value.s));
+            } else {
+                _fossil_sanity_log_out_logfmt(out, field->value.s, strlen(field->value.s));
+            }
+            break;
+    }
+}
+
+static size_t _fossil_sanity_log_encode(const fossil_sanity_log_entry_t *entry, fossil_sanity_log_encoding_t encoding, char *buffer, size_t size) {
+    static const char *const levels[FOSSIL_SANITY_LOG_LEVEL_COUNT] = { "debug", "info", "warning", "error", "fatal" };
+    static const char *const severities[3] = { "low", "medium", "high" };
+    fossil_sanity_log_out_t out = { buffer, size, 0 };
+    char rendered[4 * MAX_LOG_MESSAGE_LENGTH];
+    char *scratch = NULL;
+    const char *text = entry->message;
+    size_t length = entry->length;
+    bool json = encoding == FOSSIL_SANITY_LOG_ENCODING_JSON;
+
+    // Unresolved deferred entry: render it in full, on the heap if need be
+    if (entry->flags & FOSSIL_SANITY_LOG_ENTRY_DEFERRED) {
+        length = _fossil_sanity_log_entry_render(entry, rendered, sizeof(rendered));
+        text = rendered;
+        if (length >= sizeof(rendered)) {
+            scratch = (char *)malloc(length + 1);
+            if (!scratch) {
+                perror("Failed to allocate memory for log message");
+                if (size) buffer[0] = '\0';
+                return 0;
+            }
+            _fossil_sanity_log_entry_render(entry, scratch, length + 1);
+            text = scratch;
+        }
+    }
+
+    int level = entry->priority < FOSSIL_SANITY_LOG_LEVEL_DEBUG ? FOSSIL_SANITY_LOG_LEVEL_DEBUG
+              : entry->priority > FOSSIL_SANITY_LOG_LEVEL_FATAL ? FOSSIL_SANITY_LOG_LEVEL_FATAL : entry->priority;
+    const char *severity = entry->severity >= 0 && entry->severity < 3 ? severities[entry->severity] : NULL;
+
+    if (encoding == FOSSIL_SANITY_LOG_ENCODING_PLAIN) {
+        if (smart_log_format) _fossil_sanity_log_out_text(&out, _fossil_sanity_log_level_tag(entry->priority));
+        _fossil_sanity_log_out_bytes(&out, text, length);
+    } else {
+        _fossil_sanity_log_out_text(&out, json ? "{\"ts\":" : "ts=");
+        _fossil_sanity_log_out_uint(&out, entry->timestamp);
+        _fossil_sanity_log_out_text(&out, json ? ",\"level\":\"" : " level=");
+        _fossil_sanity_log_out_text(&out, levels[level]);
+        _fossil_sanity_log_out_text(&out, json ? "\",\"severity\":" : " severity=");
+        if (severity && json) {
+            _fossil_sanity_log_out_quoted(&out, severity, strlen(severity));
+        } else if (severity) {
+            _fossil_sanity_log_out_text(&out, severity);
+        } else {
+            _fossil_sanity_log_out_int(&out, entry->severity);
+        }
+        _fossil_sanity_log_out_text(&out, json ? ",\"msg\":" : " msg=");
+        if (json) {
+            _fossil_sanity_log_out_quoted(&out, text, length);
+        } else {
+            _fossil_sanity_log_out_logfmt(&out, text, length);
+        }
+    }
+
+    const char *fields = _fossil_sanity_log_entry_fields(entry);
+    if (fields) {
+        unsigned int count = (unsigned char)*fields++;
+        for (unsigned int i = 0; i < count; i++) {
+            fossil_sanity_log_field_t field;
+            fields = _fossil_sanity_log_field_unpack(fields, &field);
+            if (json) {
+                _fossil_sanity_log_out_char(&out, ',');
+                _fossil_sanity_log_out_quoted(&out, field.key, strlen(field.key));
+                _fossil_sanity_log_out_char(&out, ':');
+            } else {
+                _fossil_sanity_log_out_char(&out, ' ');
+                _fossil_sanity_log_out_text(&out, field.key);
+                _fossil_sanity_log_out_char(&out, '=');
+            }
+            _fossil_sanity_log_out_value(&out, &field, json);
+        }
+    }
+    if (json) _fossil_sanity_log_out_char(&out, '}');
+    free(scratch);
+
+    if (size) buffer[out.pos < size ? out.pos : size - 1] = '\0';
+    return out.pos;
+}
+
+// ==================================================================
+// Smart log limits
+// ==================================================================
+
+#define FOSSIL_SANITY_LOG_LIMIT_SLOTS 256  // Messages tracked for coalescing
+
+// A message seen recently; slots are picked by hash and replaced on collision
+typedef struct fossil_sanity_log_recent {
+    uint64_t hash;
+    uint64_t window_start;   // Nanoseconds, monotonic
+    uint64_t repeats;        // Folded since the message was last pushed
+    int level;
+    int severity;
+    char *message;           // NULL when the slot is free
+} fossil_sanity_log_recent_t;
+
+typedef struct fossil_sanity_log_bucket {
+    double tokens;
+    uint64_t refilled;       // Nanoseconds, monotonic
+} fossil_sanity_log_bucket_t;
+
+struct fossil_sanity_log_limiter {
+    pthread_mutex_t lock;
+    fossil_sanity_log_limit_config_t config;
+    fossil_sanity_log_limit_stats_t stats;
+    fossil_sanity_log_bucket_t buckets[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+    fossil_sanity_log_recent_t recent[FOSSIL_SANITY_LOG_LIMIT_SLOTS];
+};
+
+static uint64_t _fossil_sanity_log_hash_message(const char *message, int level) {
+    uint64_t hash = 14695981039346656037u ^ (uint64_t)(unsigned int)level;  // FNV-1a
+    for (; *message; message++) {
+        hash ^= (unsigned char)*message;
+        hash *= 1099511628211u;
+    }
+    return hash;
+}
+
+// Push the repeat count of a slot, if any, and forget its message
+static void _fossil_sanity_log_recent_close(fossil_sanity_log_queue_t *queue, fossil_sanity_log_recent_t *recent) {
+    if (recent->repeats) {
+        char buffer[MAX_LOG_MESSAGE_LENGTH];
+        size_t size = strlen(recent->message) + 48;  // Room for the repeat count
+        char *summary = size <= sizeof(buffer) ? buffer : (char *)malloc(size);
+        if (summary) {
+            snprintf(summary, size, "%s (repeated %llu times)", recent->message, (unsigned long long)recent->repeats);
+            fossil_sanity_log_push(queue, summary, recent->level, recent->severity);
+            if (summary != buffer) free(summary);
+        } else {
+            perror("Failed to allocate memory for log message");
+        }
+    }
+    free(recent->message);
+    recent->message = NULL;
+    recent->repeats = 0;
+}
+
+// Fold a repeat into its slot; false if the message should be logged
+static bool _fossil_sanity_log_limiter_coalesce(fossil_sanity_log_queue_t *queue, fossil_sanity_log_limiter_t *limiter, int level, int severity, const char *message, uint64_t now) {
+    uint64_t hash = _fossil_sanity_log_hash_message(message, level);
+    fossil_sanity_log_recent_t *recent = &limiter->recent[hash % FOSSIL_SANITY_LOG_LIMIT_SLOTS];
+    uint64_t window = (uint64_t)limiter->config.window_ms * 1000000u;
+
+    if (recent->message && recent->hash == hash && recent->level == level && strcmp(recent->message, message) == 0) {
+        if (now - recent->window_start < window) {
+            recent->repeats++;
+            limiter->stats.coalesced++;
+            _fossil_sanity_log_count(&_fossil_sanity_log_counters()->suppressed, 1);
+            if (severity == FOSSIL_SANITY_LOG_SEVERITY_HIGH) {
+                limiter->stats.notifications_suppressed++;
+            }
+            return true;
+        }
+    }
+
+    // A new window: report the old one and start tracking this message
+    if (recent->message) {
+        _fossil_sanity_log_recent_close(queue, recent);
+    }
+    recent->message = _custom_strdup(message);
+    recent->hash = hash;
+    recent->level = level;
+    recent->severity = severity;
+    recent->window_start = now;
+    return false;
+}
+
+// Take a token from the level's bucket; false if the entry must be dropped
+static bool _fossil_sanity_log_limiter_admit(fossil_sanity_log_limiter_t *limiter, int level, int severity, uint64_t now) {
+    unsigned int rate = limiter->config.rate[level];
+    if (!rate) return true;
+
+    fossil_sanity_log_bucket_t *bucket = &limiter->buckets[level];
+    double burst = limiter->config.burst[level] ? limiter->config.burst[level] : rate;
+    bucket->tokens += (double)(now - bucket->refilled) * rate / 1e9;
+    if (bucket->tokens > burst) bucket->tokens = burst;
+    bucket->refilled = now;
+
+    if (bucket->tokens < 1.0) {
+        limiter->stats.rate_limited[level]++;
+        _fossil_sanity_log_count(&_fossil_sanity_log_counters()->dropped, 1);
+        if (severity == FOSSIL_SANITY_LOG_SEVERITY_HIGH) {
+            limiter->stats.notifications_suppressed++;
+        }
+        return false;
+    }
+    bucket->tokens -= 1.0;
+    return true;
+}
+
+static void _fossil_sanity_log_limiter_free(fossil_sanity_log_limiter_t *limiter) {
+    for (size_t i = 0; i < FOSSIL_SANITY_LOG_LIMIT_SLOTS; i++) {
+        free(limiter->recent[i].message);
+    }
+    pthread_mutex_destroy(&limiter->lock);
+    free(limiter);
+}
+
+// ==================================================================
+// Sampling
+// ==================================================================
+
+// Rule and window state of one level. Rules are read without a lock, so
+// each field is atomic; the window counters are shared by all producers.
+typedef struct fossil_sanity_log_sample_level {
+    atomic_uint mode;
+    atomic_uint n;
+    _Atomic uint64_t window;          // Nanoseconds
+    _Atomic uint64_t window_start;    // Coarse monotonic nanoseconds
+    _Atomic uint64_t arrivals;        // Entries seen in the current window
+    _Atomic uint64_t kept;            // Entries kept in the current window
+    _Atomic uint64_t expected;        // Entries seen in the previous window
+} fossil_sanity_log_sample_level_t;
+
+struct fossil_sanity_log_sampler {
+    fossil_sanity_log_sample_level_t levels[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+};
+
+static _Thread_local uint64_t thread_random;
+
+// xorshift64*, seeded per thread with splitmix64
+static inline uint64_t _fossil_sanity_log_random(void) {
+    uint64_t x = thread_random;
+    if (!x) {
+        x = (uint64_t)(uintptr_t)&thread_random ^ _fossil_sanity_log_now_ns();
+        x += 0x9e3779b97f4a7c15u;
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+        x ^= x >> 31;
+        if (!x) x = 1;
+    }
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    thread_random = x;
+    return x * 0x2545f4914f6cdd1du;
+}
+
+// Uniform value below bound, without a division
+static inline uint64_t _fossil_sanity_log_random_below(uint64_t bound) {
+    if (bound <= UINT32_MAX) {
+        return ((_fossil_sanity_log_random() >> 32) * bound) >> 32;
+    }
+    return _fossil_sanity_log_random() % bound;
+}
+
+// Reservoir mode: open a new window when the current one has elapsed
+static bool _fossil_sanity_log_sample_window(fossil_sanity_log_sample_level_t *rule, uint64_t n) {
+    uint64_t now = _fossil_sanity_log_timestamp();
+    uint64_t start = atomic_load_explicit(&rule->window_start, memory_order_relaxed);
+    if (now - start >= atomic_load_explicit(&rule->window, memory_order_relaxed) &&
+        atomic_compare_exchange_strong_explicit(&rule->window_start, &start, now, memory_order_relaxed, memory_order_relaxed)) {
+        atomic_store_explicit(&rule->expected, atomic_exchange_explicit(&rule->arrivals, 0, memory_order_relaxed), memory_order_relaxed);
+        atomic_store_explicit(&rule->kept, 0, memory_order_relaxed);
+    }
+
+    uint64_t seen = atomic_fetch_add_explicit(&rule->arrivals, 1, memory_order_relaxed) + 1;
+    uint64_t expected = atomic_load_explicit(&rule->expected, memory_order_relaxed);
+    uint64_t estimate = expected > seen ? expected : seen;
+    if (estimate > n && _fossil_sanity_log_random_below(estimate) >= n) {
+        return false;
+    }
+    return atomic_fetch_add_explicit(&rule->kept, 1, memory_order_relaxed) < n;
+}
+
+// Whether the smart log keeps an entry of this level; counts the skipped ones
+static bool _fossil_sanity_log_sample(fossil_sanity_log_sampler_t *sampler, int level) {
+    int bucket = _fossil_sanity_log_level(level);
+    fossil_sanity_log_sample_level_t *rule = &sampler->levels[bucket];
+    uint64_t n = atomic_load_explicit(&rule->n, memory_order_relaxed);
+    bool keep;
+
+    switch (atomic_load_explicit(&rule->mode, memory_order_relaxed)) {
+        case FOSSIL_SANITY_LOG_SAMPLE_ONE_IN_N:
+            keep = n <= 1 || _fossil_sanity_log_random_below(n) == 0;
+            break;
+        case FOSSIL_SANITY_LOG_SAMPLE_RESERVOIR:
+            keep = _fossil_sanity_log_sample_window(rule, n);
+            break;
+        default:
+            keep = true;
+            break;
+    }
+
+    if (!keep) {
+        _fossil_sanity_log_count(&_fossil_sanity_log_counters()->sampled[bucket], 1);
+    }
+    return keep;
+}
+
 // Initialize the log queue
 void fossil_sanity_log_init(fossil_sanity_log_queue_t *queue) {
-    queue->head = NULL;
-    queue->tail = NULL;
+    memset(queue, 0, sizeof(*queue));
+}
+
+// Push message bytes, a string or a deferred record, as a new entry
+static bool _fossil_sanity_log_push_stored(fossil_sanity_log_queue_t *queue, const char *message, size_t length, unsigned int flags, int priority, int severity, uint64_t timestamp) {
+    if (queue->mpsc) {
+        return _fossil_sanity_log_push_concurrent(queue, message, length, flags, priority, severity, timestamp);
+    }
+
+    fossil_sanity_log_entry_t *new_entry = _fossil_sanity_log_entry_alloc(queue);
+    if (!new_entry) {
+        return false;
+    }
+
+    new_entry->priority = priority;
+    new_entry->severity = severity;
+    new_entry->sequence = queue->sequence++;
+    new_entry->timestamp = timestamp;
+    if (!_fossil_sanity_log_entry_set_bytes(queue, new_entry, message, length)) {
+        new_entry->message = new_entry->inline_message;  // Nothing to release
+        _fossil_sanity_log_entry_free(queue, new_entry);
+        return false;
+    }
+    new_entry->flags |= flags;
+    if (flags & FOSSIL_SANITY_LOG_ENTRY_FIELDS) {
+        new_entry->length = (uint32_t)strlen(new_entry->message);
+    }
+
+    // Append to the FIFO bucket of its level (Descending order overall)
+    _fossil_sanity_log_link(queue, new_entry);
+    _fossil_sanity_log_trim(queue);
+    return true;
+}
+
+// Store an entry stamped with the given time and count it in the calling
+// thread's metrics
+static void _fossil_sanity_log_push_at(fossil_sanity_log_queue_t *queue, const char *message, size_t length, unsigned int flags, int priority, int severity, uint64_t timestamp) {
+    uint64_t start = _fossil_sanity_log_timer();
+    bool stored = _fossil_sanity_log_push_stored(queue, message, length, flags, priority, severity, timestamp);
+
+    fossil_sanity_log_counters_t *counters = _fossil_sanity_log_counters();
+    if (!stored) {
+        _fossil_sanity_log_count(&counters->dropped, 1);
+        return;
+    }
+    _fossil_sanity_log_count(&counters->pushes[_fossil_sanity_log_level(priority)], 1);
+    _fossil_sanity_log_count(&counters->bytes_stored, length);
+    if (start) {
+        _fossil_sanity_log_hist_record(&counters->push_latency, _fossil_sanity_log_now_ns() - start, 1);
+    }
+}
+
+static void _fossil_sanity_log_push_bytes(fossil_sanity_log_queue_t *queue, const char *message, size_t length, unsigned int flags, int priority, int severity) {
+    _fossil_sanity_log_push_at(queue, message, length, flags, priority, severity, _fossil_sanity_log_timestamp());
+}
+
+// Push a log entry into the queue based on priority and severity
+void fossil_sanity_log_push(fossil_sanity_log_queue_t *queue, const char *message, int priority, int severity) {
+    _fossil_sanity_log_push_bytes(queue, message, strlen(message), 0, priority, severity);
+}
+
+// Record the format and arguments now, format when the entry is consumed
+void fossil_sanity_log_push_deferredv(fossil_sanity_log_queue_t *queue, int priority, int severity, const char *format, va_list args) {
+    char record[MAX_LOG_MESSAGE_LENGTH];
+    va_list copy;
+    va_copy(copy, args);
+    size_t length = _fossil_sanity_log_deferred_capture(record, sizeof(record), format, copy);
+    va_end(copy);
+
+    if (length) {
+        _fossil_sanity_log_push_bytes(queue, record, length, FOSSIL_SANITY_LOG_ENTRY_DEFERRED, priority, severity);
+        return;
+    }
+
+    // Arguments that cannot be recorded are formatted right away
+    char buffer[MAX_LOG_MESSAGE_LENGTH];
+    int formatted = vsnprintf(buffer, sizeof(buffer), format, args);
+    if (formatted < 0) return;
+    if ((size_t)formatted < sizeof(buffer)) {
+        _fossil_sanity_log_push_bytes(queue, buffer, (size_t)formatted, 0, priority, severity);
+        return;
+    }
+    char *message = (char *)malloc((size_t)formatted + 1);
+    if (!message) {
+        perror("Failed to allocate memory for log message");
+        return;
+    }
+    va_copy(copy, args);
+    vsnprintf(message, (size_t)formatted + 1, format, copy);
+    va_end(copy);
+    _fossil_sanity_log_push_bytes(queue, message, (size_t)formatted, 0, priority, severity);
+    free(message);
+}
+
+void fossil_sanity_log_push_deferred(fossil_sanity_log_queue_t *queue, int priority, int severity, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fossil_sanity_log_push_deferredv(queue, priority, severity, format, args);
+    va_end(args);
+}
+
+// Render the text of an entry, formatting deferred records
+size_t fossil_sanity_log_format_entry(const fossil_sanity_log_entry_t *entry, char *buffer, size_t size) {
+    return _fossil_sanity_log_entry_render(entry, buffer, size);
+}
+
+// Pack the message and its fields into one record stored with the entry
+void fossil_sanity_log_push_fields(fossil_sanity_log_queue_t *queue, int priority, int severity, const char *message, const fossil_sanity_log_field_t *fields, size_t count) {
+    if (count > FOSSIL_SANITY_LOG_FIELDS_MAX) count = FOSSIL_SANITY_LOG_FIELDS_MAX;
+    if (!count) {
+        fossil_sanity_log_push(queue, message, priority, severity);
+        return;
+    }
+
+    size_t text = strlen(message);
+    size_t size = text + 2;
+    for (size_t i = 0; i < count; i++) {
+        size += _fossil_sanity_log_field_size(&fields[i]);
+    }
+
+    char stack[4 * MAX_LOG_MESSAGE_LENGTH];
+    char *record = size <= sizeof(stack) ? stack : (char *)malloc(size);
+    if (!record) {
+        perror("Failed to allocate memory for log fields");
+        return;
+    }
+    memcpy(record, message, text + 1);
+    char *out = record + text + 1;
+    *out++ = (char)count;
+    for (size_t i = 0; i < count; i++) {
+        out = _fossil_sanity_log_field_pack(out, &fields[i]);
+    }
+
+    _fossil_sanity_log_push_bytes(queue, record, size, FOSSIL_SANITY_LOG_ENTRY_FIELDS, priority, severity);
+    if (record != stack) free(record);
+}
+
+// Decode an entry's fields in place
+size_t fossil_sanity_log_entry_fields(const fossil_sanity_log_entry_t *entry, fossil_sanity_log_field_t *fields, size_t max) {
+    const char *packed = _fossil_sanity_log_entry_fields(entry);
+    if (!packed) return 0;
+
+    size_t count = (unsigned char)*packed++;
+    for (size_t i = 0; i < count && i < max; i++) {
+        packed = _fossil_sanity_log_field_unpack(packed, &fields[i]);
+    }
+    return count;
+}
+
+void fossil_sanity_log_set_encoding(fossil_sanity_log_encoding_t encoding) {
+    atomic_store_explicit(&log_encoding, (int)encoding, memory_order_relaxed);
+}
+
+// Encode an entry as a line of text, JSON or logfmt
+size_t fossil_sanity_log_encode_entry(const fossil_sanity_log_entry_t *entry, fossil_sanity_log_encoding_t encoding, char *buffer, size_t size) {
+    return _fossil_sanity_log_encode(entry, encoding, buffer, size);
+}
+
+// Copy out an entry's text, then remove and free the entry
+static char *_fossil_sanity_log_take(fossil_sanity_log_queue_t *queue, fossil_sanity_log_entry_t *entry) {
+    char *message;
+    if (entry->flags & FOSSIL_SANITY_LOG_ENTRY_DEFERRED) {
+        char buffer[MAX_LOG_MESSAGE_LENGTH];
+        size_t length = _fossil_sanity_log_entry_render(entry, buffer, sizeof(buffer));
+        message = (char *)malloc(length + 1);
+        if (message && length < sizeof(buffer)) {
+            memcpy(message, buffer, length + 1);
+        } else if (message) {
+            _fossil_sanity_log_entry_render(entry, message, length + 1);
+        }
+    } else {
+        message = (char *)malloc(entry->length + 1);
+        if (message) {
+            memcpy(message, entry->message, entry->length + 1);
+        }
+    }
+
+    _fossil_sanity_log_unlink(queue, entry);
+    _fossil_sanity_log_entry_free(queue, entry);
+    return message;
+}
+
+// Pop the log with the highest priority
+char *fossil_sanity_log_pop(fossil_sanity_log_queue_t *queue) {
+    uint64_t start = _fossil_sanity_log_timer();
+    _fossil_sanity_log_collect(queue);
+    if (!queue->head) {
+        return NULL;
+    }
+    char *message = _fossil_sanity_log_take(queue, queue->head);
+    _fossil_sanity_log_count_drained(start, 1);
+    return message;
+}
+
+// Pop into a caller buffer without allocating
+bool fossil_sanity_log_pop_into(fossil_sanity_log_queue_t *queue, char *buffer, size_t size, size_t *length) {
+    uint64_t start = _fossil_sanity_log_timer();
+    _fossil_sanity_log_collect(queue);
+    fossil_sanity_log_entry_t *entry = queue->head;
+    if (!entry) {
+        *length = 0;
+        if (size) buffer[0] = '\0';
+        return false;
+    }
+
+    *length = _fossil_sanity_log_entry_render(entry, buffer, size);
+    if (*length >= size) {
+        return false;  // Too small; the entry stays queued
+    }
+    _fossil_sanity_log_unlink(queue, entry);
+    _fossil_sanity_log_entry_free(queue, entry);
+    _fossil_sanity_log_count_drained(start, 1);
+    return true;
+}
+
+// Pop and lend the entry until the next borrow
+const fossil_sanity_log_entry_t *fossil_sanity_log_pop_borrow(fossil_sanity_log_queue_t *queue) {
+    if (queue->borrowed) {
+        _fossil_sanity_log_entry_free(queue, queue->borrowed);
+        queue->borrowed = NULL;
+    }
+
+    uint64_t start = _fossil_sanity_log_timer();
+    _fossil_sanity_log_collect(queue);
+    fossil_sanity_log_entry_t *entry = queue->head;
+    if (!entry) {
+        return NULL;
+    }
+    _fossil_sanity_log_entry_resolve(queue, entry);
+    _fossil_sanity_log_unlink(queue, entry);
+    entry->prev = entry->next = NULL;
+    queue->borrowed = entry;
+    _fossil_sanity_log_count_drained(start, 1);
+    return entry;
+}
+
+// Pop several entries, visiting each before it is freed
+size_t fossil_sanity_log_pop_batch(fossil_sanity_log_queue_t *queue, size_t max, fossil_sanity_log_visit_t visitor, void *context) {
+    size_t popped = 0;
+    uint64_t start = _fossil_sanity_log_timer();
+    _fossil_sanity_log_collect(queue);
+
+    while (popped < max && queue->head) {
+        fossil_sanity_log_entry_t *entry = queue->head;
+        _fossil_sanity_log_entry_resolve(queue, entry);
+        _fossil_sanity_log_unlink(queue, entry);
+        bool more = visitor(entry, context);
+        _fossil_sanity_log_entry_free(queue, entry);
+        popped++;
+        if (!more) break;
+    }
+    _fossil_sanity_log_count_drained(start, popped);
+    return popped;
+}
+
+// Visit every entry in place
+size_t fossil_sanity_log_for_each(fossil_sanity_log_queue_t *queue, fossil_sanity_log_visit_t visitor, void *context) {
+    size_t visited = 0;
+    _fossil_sanity_log_collect(queue);
+
+    for (fossil_sanity_log_entry_t *current = queue->head; current; current = current->next) {
+        _fossil_sanity_log_entry_resolve(queue, current);
+        visited++;
+        if (!visitor(current, context)) break;
+    }
+    return visited;
+}
+
+// Pop the oldest log with the lowest priority
+char *fossil_sanity_log_pop_min(fossil_sanity_log_queue_t *queue) {
+    uint64_t start = _fossil_sanity_log_timer();
+    _fossil_sanity_log_collect(queue);
+    if (!queue->head) {
+        return NULL;
+    }
+    char *message = _fossil_sanity_log_take(queue, queue->level_head[_fossil_sanity_log_lowest_level(queue->level_mask)]);
+    _fossil_sanity_log_count_drained(start, 1);
+    return message;
+}
+
+const fossil_sanity_log_entry_t *fossil_sanity_log_peek_max(fossil_sanity_log_queue_t *queue) {
+    _fossil_sanity_log_collect(queue);
+    return queue->head;
+}
+
+const fossil_sanity_log_entry_t *fossil_sanity_log_peek_min(fossil_sanity_log_queue_t *queue) {
+    _fossil_sanity_log_collect(queue);
+    return queue->head ? queue->level_head[_fossil_sanity_log_lowest_level(queue->level_mask)] : NULL;
+}
+
+// Bound the queue, evicting from the low end
+void fossil_sanity_log_set_capacity(fossil_sanity_log_queue_t *queue, size_t capacity) {
+    _fossil_sanity_log_collect(queue);
+    queue->capacity = capacity;
+    _fossil_sanity_log_trim(queue);
+}
+
+// Print all logs in the queue
+void fossil_sanity_log_print(fossil_sanity_log_queue_t *queue) {
+    _fossil_sanity_log_collect(queue);
+    fossil_sanity_log_encoding_t encoding = (fossil_sanity_log_encoding_t)atomic_load_explicit(&log_encoding, memory_order_relaxed);
+    fossil_sanity_log_entry_t *current = queue->head;
+    while (current) {
+        _fossil_sanity_log_entry_resolve(queue, current);
+        if (encoding == FOSSIL_SANITY_LOG_ENCODING_PLAIN && !(current->flags & FOSSIL_SANITY_LOG_ENTRY_FIELDS)) {
+            printf("%s%s\n", smart_log_format ? _fossil_sanity_log_level_tag(current->priority) : "", current->message);
+        } else {
+            char line[4 * MAX_LOG_MESSAGE_LENGTH];
+            char *text = line;
+            size_t length = _fossil_sanity_log_encode(current, encoding, line, sizeof(line));
+            if (length >= sizeof(line)) {
+                text = (char *)malloc(length + 1);
+                if (text) {
+                    _fossil_sanity_log_encode(current, encoding, text, length + 1);
+                } else {
+                    text = line;  // Print what fit
+                    length = sizeof(line) - 1;
+                }
+            }
+            fwrite(text, 1, length, stdout);
+            putchar('\n');
+            if (text != line) free(text);
+        }
+        current = current->next;
+    }
+}
+
+// Clear all logs in the queue
+void fossil_sanity_log_clear(fossil_sanity_log_queue_t *queue) {
+    _fossil_sanity_log_collect(queue);
+    if (queue->borrowed) {
+        _fossil_sanity_log_entry_free(queue, queue->borrowed);
+        queue->borrowed = NULL;
+    }
+    if (queue->index) {
+        _fossil_sanity_log_index_reset(queue->index);
+    }
+    if (queue->time_index) {
+        _fossil_sanity_log_time_reset(queue->time_index);
+    }
+    fossil_sanity_log_entry_t *current = queue->head;
+    while (current) {
+        fossil_sanity_log_entry_t *next = current->next;
+        _fossil_sanity_log_entry_free(queue, current);
+        current = next;
+    }
+    queue->head = queue->tail = NULL;
+    memset(queue->level_head, 0, sizeof(queue->level_head));
+    memset(queue->level_tail, 0, sizeof(queue->level_tail));
+    queue->level_mask = 0;
+    queue->count = 0;
+}
+
+// Clear the queue and release the pool slabs
+void fossil_sanity_log_destroy(fossil_sanity_log_queue_t *queue) {
+    fossil_sanity_log_clear(queue);
+
+    fossil_sanity_log_slab_t *slab = queue->pool.slabs;
+    while (slab) {
+        fossil_sanity_log_slab_t *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    memset(&queue->pool, 0, sizeof(queue->pool));
+
+    if (queue->arena) {
+        _fossil_sanity_log_arena_retire(queue->arena);
+        queue->arena = NULL;
+    }
+
+    if (queue->mpsc) {
+        free(queue->mpsc->collected);
+        free(queue->mpsc);
+        queue->mpsc = NULL;
+    }
+
+    if (queue->index) {
+        _fossil_sanity_log_index_free(queue->index);
+        queue->index = NULL;
+    }
+
+    if (queue->limiter) {
+        _fossil_sanity_log_limiter_free(queue->limiter);
+        queue->limiter = NULL;
+    }
+
+    free(queue->sampler);
+    queue->sampler = NULL;
+
+    free(queue->time_index);
+    queue->time_index = NULL;
+}
+
+// Switch the queue to lock-free multi-producer pushes
+bool fossil_sanity_log_enable_concurrent(fossil_sanity_log_queue_t *queue) {
+    if (queue->mpsc) return true;
+
+    fossil_sanity_log_mpsc_t *mpsc = (fossil_sanity_log_mpsc_t *)aligned_alloc(FOSSIL_SANITY_LOG_CACHE_LINE, sizeof(fossil_sanity_log_mpsc_t));
+    if (!mpsc) {
+        perror("Failed to allocate memory for concurrent log queue");
+        return false;
+    }
+    for (int level = 0; level < FOSSIL_SANITY_LOG_LEVEL_COUNT; level++) {
+        fossil_sanity_log_mpsc_level_t *stage = &mpsc->levels[level];
+        atomic_init(&stage->stub.link, NULL);
+        atomic_init(&stage->tail, &stage->stub);
+        stage->head = &stage->stub;
+    }
+    mpsc->batch = 0;
+    mpsc->collected = NULL;
+    mpsc->collected_capacity = 0;
+    atomic_init(&mpsc->sequence, queue->sequence);
+    queue->mpsc = mpsc;
+    return true;
+}
+
+// Stage concurrent pushes in per-thread rings
+bool fossil_sanity_log_enable_thread_buffering(fossil_sanity_log_queue_t *queue, size_t batch) {
+    if (!fossil_sanity_log_enable_concurrent(queue)) {
+        return false;
+    }
+    if (batch == 0 || batch > FOSSIL_SANITY_LOG_THREAD_BATCH) {
+        batch = FOSSIL_SANITY_LOG_THREAD_BATCH;
+    }
+    queue->mpsc->batch = batch;
+    return true;
+}
+
+// Publish the calling thread's staged entries
+void fossil_sanity_log_flush_thread(void) {
+    _fossil_sanity_log_stage_flush(&thread_stage);
+}
+
+// Enable the slab pool for subsequent pushes
+bool fossil_sanity_log_pool_enable(fossil_sanity_log_queue_t *queue, size_t chunk_entries) {
+    if (queue->pool.chunk_entries) {
+        return true;  // Keep the slab size the pool was created with
+    }
+    queue->pool.chunk_entries = chunk_entries ? chunk_entries : FOSSIL_SANITY_LOG_POOL_CHUNK;
+    return true;
+}
+
+// Grow the pool until the requested number of entries fit
+bool fossil_sanity_log_pool_reserve(fossil_sanity_log_queue_t *queue, size_t capacity) {
+    fossil_sanity_log_pool_enable(queue, 0);
+    while (queue->pool.capacity < capacity) {
+        if (!_fossil_sanity_log_pool_grow(&queue->pool)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Report pool occupancy
+void fossil_sanity_log_pool_stats(const fossil_sanity_log_queue_t *queue, fossil_sanity_log_pool_stats_t *stats) {
+    const fossil_sanity_log_pool_t *pool = &queue->pool;
+    size_t bytes = 0;
+
+    for (const fossil_sanity_log_slab_t *slab = pool->slabs; slab; slab = slab->next) {
+        size_t slab_bytes = FOSSIL_SANITY_LOG_SLAB_HEADER + slab->entries * sizeof(fossil_sanity_log_entry_t);
+        bytes += (slab_bytes + FOSSIL_SANITY_LOG_CACHE_LINE - 1) & ~(size_t)(FOSSIL_SANITY_LOG_CACHE_LINE - 1);
+    }
+
+    stats->slab_count = pool->slab_count;
+    stats->capacity = pool->capacity;
+    stats->in_use = pool->in_use;
+    stats->available = pool->capacity - pool->in_use;
+    stats->bytes = bytes;
+}
+
+// Whether a comes after b in queue order
+static bool _fossil_sanity_log_sorts_after(const fossil_sanity_log_entry_t *a, const fossil_sanity_log_entry_t *b, fossil_sanity_log_compare_t compare) {
+    if (a->priority != b->priority) {
+        return a->priority < b->priority;
+    }
+    return compare && compare(a, b) > 0;
+}
+
+// Bottom-up merge sort of a NULL-terminated list over the next links only
+static fossil_sanity_log_entry_t *_fossil_sanity_log_sort_list(fossil_sanity_log_entry_t *list, fossil_sanity_log_compare_t compare) {
+
+    for (size_t width = 1;; width *= 2) {
+        fossil_sanity_log_entry_t *left = list;
+        fossil_sanity_log_entry_t *merged = NULL;
+        fossil_sanity_log_entry_t **out = &merged;
+        size_t merges = 0;
+
+        while (left) {
+            fossil_sanity_log_entry_t *right = left;
+            size_t left_size = 0;
+            while (right && left_size < width) {
+                right = right->next;
+                left_size++;
+            }
+            size_t right_size = width;
+            merges++;
+
+            // Take from the right run only when it strictly sorts first (stable)
+            while (left_size > 0 || (right_size > 0 && right)) {
+                fossil_sanity_log_entry_t *take;
+                if (left_size == 0) {
+                    take = right;
+                    right = right->next;
+                    right_size--;
+                } else if (right_size == 0 || !right || !_fossil_sanity_log_sorts_after(left, right, compare)) {
+                    take = left;
+                    left = left->next;
+                    left_size--;
+                } else {
+                    take = right;
+                    right = right->next;
+                    right_size--;
+                }
+                *out = take;
+                out = &take->next;
+            }
+            left = right;
+        }
+        *out = NULL;
+        list = merged;
+        if (merges <= 1) break;
+    }
+    return list;
+}
+
+// Make a next-linked list the queue's list: restore prev, head and tail
+static void _fossil_sanity_log_relink(fossil_sanity_log_queue_t *queue, fossil_sanity_log_entry_t *list) {
+    fossil_sanity_log_entry_t *prev = NULL;
+    queue->head = list;
+    for (fossil_sanity_log_entry_t *current = list; current; current = current->next) {
+        current->prev = prev;
+        prev = current;
+    }
+    queue->tail = prev;
+}
+
+// Pushes keep priority order, so a plain sort is usually already done
+static bool _fossil_sanity_log_is_sorted(const fossil_sanity_log_queue_t *queue, fossil_sanity_log_compare_t compare) {
+    if (!queue->head) return true;
+    for (const fossil_sanity_log_entry_t *current = queue->head; current->next; current = current->next) {
+        if (_fossil_sanity_log_sorts_after(current, current->next, compare)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sort logs by priority, then by the comparator within a priority
+void fossil_sanity_log_sort_by(fossil_sanity_log_queue_t *queue, fossil_sanity_log_compare_t compare) {
+    _fossil_sanity_log_collect(queue);
+    if (_fossil_sanity_log_is_sorted(queue, compare)) return;
+
+    _fossil_sanity_log_relink(queue, _fossil_sanity_log_sort_list(queue->head, compare));
+
+    // Nodes moved, so the bucket bounds must follow
+    _fossil_sanity_log_rebuild_levels(queue);
+}
+
+// Sort logs in descending order of priority (Highest priority first)
+void fossil_sanity_log_sort(fossil_sanity_log_queue_t *queue) {
+    fossil_sanity_log_sort_by(queue, NULL);
+}
+
+// Higher severity first, then insertion order
+int fossil_sanity_log_compare_severity(const fossil_sanity_log_entry_t *a, const fossil_sanity_log_entry_t *b) {
+    if (a->severity != b->severity) {
+        return a->severity > b->severity ? -1 : 1;
+    }
+    return fossil_sanity_log_compare_sequence(a, b);
+}
+
+// Insertion order
+int fossil_sanity_log_compare_sequence(const fossil_sanity_log_entry_t *a, const fossil_sanity_log_entry_t *b) {
+    return (a->sequence > b->sequence) - (a->sequence < b->sequence);
+}
+
+// One input of a k-way merge: the queue and its position in the input list
+typedef struct fossil_sanity_log_merge_input {
+    fossil_sanity_log_queue_t *queue;
+    size_t rank;
+} fossil_sanity_log_merge_input_t;
+
+// Whether the head of a leaves the merge before the head of b: higher level,
+// then older timestamp, then earlier input
+static bool _fossil_sanity_log_merge_before(const fossil_sanity_log_merge_input_t *a, const fossil_sanity_log_merge_input_t *b) {
+    const fossil_sanity_log_entry_t *x = a->queue->head;
+    const fossil_sanity_log_entry_t *y = b->queue->head;
+    int level_x = _fossil_sanity_log_level(x->priority);
+    int level_y = _fossil_sanity_log_level(y->priority);
+    if (level_x != level_y) return level_x > level_y;
+    if (x->timestamp != y->timestamp) return x->timestamp < y->timestamp;
+    return a->rank < b->rank;
+}
+
+static void _fossil_sanity_log_merge_sift(fossil_sanity_log_merge_input_t *heap, size_t size, size_t at) {
+    for (;;) {
+        size_t best = at;
+        size_t left = 2 * at + 1;
+        if (left < size && _fossil_sanity_log_merge_before(&heap[left], &heap[best])) best = left;
+        if (left + 1 < size && _fossil_sanity_log_merge_before(&heap[left + 1], &heap[best])) best = left + 1;
+        if (best == at) return;
+        fossil_sanity_log_merge_input_t swap = heap[at];
+        heap[at] = heap[best];
+        heap[best] = swap;
+        at = best;
+    }
+}
+
+// Heap of the non-empty inputs, keyed on their head entries, with a spare
+// slot for a merge destination
+static fossil_sanity_log_merge_input_t *_fossil_sanity_log_merge_heap(fossil_sanity_log_queue_t *const *queues, size_t count, const fossil_sanity_log_queue_t *skip, size_t *size) {
+    fossil_sanity_log_merge_input_t *heap = (fossil_sanity_log_merge_input_t *)malloc((count + 1) * sizeof(*heap));
+    *size = 0;
+    if (!heap) {
+        perror("Failed to allocate memory for log merge");
+        return NULL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        fossil_sanity_log_queue_t *queue = queues[i];
+        if (!queue || queue == skip) continue;
+        _fossil_sanity_log_collect(queue);
+        if (queue->borrowed) {
+            _fossil_sanity_log_entry_free(queue, queue->borrowed);
+            queue->borrowed = NULL;
+        }
+        if (queue->head) {
+            heap[(*size)++] = (fossil_sanity_log_merge_input_t){ queue, i };
+        }
+    }
+    for (size_t i = *size / 2; i-- > 0;) {
+        _fossil_sanity_log_merge_sift(heap, *size, i);
+    }
+    return heap;
+}
+
+// Unlink the next entry of the merge and restore the heap
+static fossil_sanity_log_entry_t *_fossil_sanity_log_merge_next(fossil_sanity_log_merge_input_t *heap, size_t *size, fossil_sanity_log_queue_t **owner) {
+    fossil_sanity_log_queue_t *queue = heap[0].queue;
+    fossil_sanity_log_entry_t *entry = queue->head;
+    _fossil_sanity_log_unlink(queue, entry);
+    *owner = queue;
+
+    if (!queue->head) {
+        heap[0] = heap[--*size];
+    }
+    _fossil_sanity_log_merge_sift(heap, *size, 0);
+    return entry;
+}
+
+// A merged entry and the input it came from
+typedef struct fossil_sanity_log_merge_order {
+    fossil_sanity_log_entry_t *entry;
+    size_t rank;
+} fossil_sanity_log_merge_order_t;
+
+// Logging order across inputs: time, then input, then the input's own order
+static int _fossil_sanity_log_merge_by_time(const void *a, const void *b) {
+    const fossil_sanity_log_merge_order_t *x = (const fossil_sanity_log_merge_order_t *)a;
+    const fossil_sanity_log_merge_order_t *y = (const fossil_sanity_log_merge_order_t *)b;
+    if (x->entry->timestamp != y->entry->timestamp) return x->entry->timestamp < y->entry->timestamp ? -1 : 1;
+    if (x->rank != y->rank) return x->rank < y->rank ? -1 : 1;
+    return (x->entry->sequence > y->entry->sequence) - (x->entry->sequence < y->entry->sequence);
+}
+
+// Hand the pool slabs and the arena block of a drained queue to another
+static void _fossil_sanity_log_adopt_storage(fossil_sanity_log_queue_t *dest, fossil_sanity_log_queue_t *source) {
+    fossil_sanity_log_pool_t *from = &source->pool;
+    fossil_sanity_log_pool_t *to = &dest->pool;
+
+    if (from->slabs) {
+        fossil_sanity_log_slab_t *last = from->slabs;
+        while (last->next) last = last->next;
+        last->next = to->slabs;
+        to->slabs = from->slabs;
+
+        fossil_sanity_log_entry_t *free_list = from->free_list;
+        while (free_list) {
+            fossil_sanity_log_entry_t *next = free_list->next;
+            free_list->next = to->free_list;
+            to->free_list = free_list;
+            free_list = next;
+        }
+        if (!to->chunk_entries) to->chunk_entries = from->chunk_entries;
+        to->slab_count += from->slab_count;
+        to->capacity += from->capacity;
+        to->in_use += from->in_use;
+
+        size_t chunk_entries = from->chunk_entries;
+        memset(from, 0, sizeof(*from));
+        from->chunk_entries = chunk_entries;  // The source grows fresh slabs
+    }
+
+    // Moved messages keep their block alive through its live count; the
+    // source starts a new block so the two never share one again
+    if (source->arena) {
+        _fossil_sanity_log_arena_retire(source->arena);
+        source->arena = NULL;
+    }
+}
+
+// Merge queues into one by relinking their entries
+size_t fossil_sanity_log_merge(fossil_sanity_log_queue_t *dest, fossil_sanity_log_queue_t *const *sources, size_t count) {
+    size_t size;
+    _fossil_sanity_log_collect(dest);
+
+    // The destination's own entries are one more input, ranked first
+    fossil_sanity_log_merge_input_t *heap = _fossil_sanity_log_merge_heap(sources, count, dest, &size);
+    if (!heap) return 0;
+    if (dest->head) {
+        heap[size++] = (fossil_sanity_log_merge_input_t){ dest, 0 };
+        for (size_t i = 0; i < size - 1; i++) heap[i].rank++;
+        for (size_t i = size / 2; i-- > 0;) {
+            _fossil_sanity_log_merge_sift(heap, size, i);
+        }
+    }
+
+    // Chain the merged entries first, so the destination is never read and
+    // written by the merge at once
+    size_t total = 0;
+    for (size_t i = 0; i < size; i++) total += heap[i].queue->count;
+    fossil_sanity_log_merge_order_t *order = (fossil_sanity_log_merge_order_t *)malloc((total ? total : 1) * sizeof(*order));
+    if (!order) {
+        perror("Failed to allocate memory for log merge");
+    }
+    fossil_sanity_log_entry_t *chain = NULL;
+    fossil_sanity_log_entry_t **out = &chain;
+    size_t merged = 0;
+    while (size) {
+        fossil_sanity_log_queue_t *owner;
+        size_t rank = heap[0].rank;
+        fossil_sanity_log_entry_t *entry = _fossil_sanity_log_merge_next(heap, &size, &owner);
+        if (order) order[merged] = (fossil_sanity_log_merge_order_t){ entry, rank };
+        *out = entry;
+        out = &entry->next;
+        merged++;
+    }
+    *out = NULL;
+    free(heap);
+
+    for (size_t i = 0; i < count; i++) {
+        if (sources[i] && sources[i] != dest) {
+            _fossil_sanity_log_adopt_storage(dest, sources[i]);
+        }
+    }
+
+    // Renumber from the destination's counter in the order entries were
+    // logged, so sequences stay unique and time queries stay oldest first
+    uint64_t sequence = dest->mpsc ? atomic_fetch_add_explicit(&dest->mpsc->sequence, merged, memory_order_relaxed)
+                                   : (dest->sequence += merged) - merged;
+    fossil_sanity_log_time_index_t *time_index = NULL;
+    if (order) {
+        qsort(order, merged, sizeof(*order), _fossil_sanity_log_merge_by_time);
+        for (size_t i = 0; i < merged; i++) order[i].entry->sequence = sequence + i;
+        time_index = dest->time_index;
+        dest->time_index = NULL;  // Fed below in sequence order instead
+    } else {
+        for (fossil_sanity_log_entry_t *entry = chain; entry; entry = entry->next) entry->sequence = sequence++;
+    }
+
+    while (chain) {
+        fossil_sanity_log_entry_t *next = chain->next;
+        _fossil_sanity_log_link(dest, chain);
+        chain = next;
+    }
+    if (time_index) {
+        dest->time_index = time_index;
+        for (size_t i = 0; i < merged; i++) _fossil_sanity_log_time_add(time_index, order[i].entry);
+    }
+    free(order);
+    _fossil_sanity_log_trim(dest);
+    return merged;
+}
+
+// Stream the merge of several queues into a visitor, freeing each entry after
+size_t fossil_sanity_log_merge_stream(fossil_sanity_log_queue_t *const *sources, size_t count, fossil_sanity_log_visit_t sink, void *context) {
+    size_t size;
+    uint64_t start = _fossil_sanity_log_timer();
+    fossil_sanity_log_merge_input_t *heap = _fossil_sanity_log_merge_heap(sources, count, NULL, &size);
+    if (!heap) return 0;
+
+    size_t visited = 0;
+    while (size) {
+        fossil_sanity_log_queue_t *owner;
+        _fossil_sanity_log_entry_resolve(heap[0].queue, heap[0].queue->head);
+        fossil_sanity_log_entry_t *entry = _fossil_sanity_log_merge_next(heap, &size, &owner);
+        bool more = sink(entry, context);
+        _fossil_sanity_log_entry_free(owner, entry);
+        visited++;
+        if (!more) break;
+    }
+    free(heap);
+    _fossil_sanity_log_count_drained(start, visited);
+    return visited;
+}
+
+// Filter logs based on minimum priority (Only logs with higher or equal priority will be shown)
+void fossil_sanity_log_filter(fossil_sanity_log_queue_t *queue, int min_priority) {
+    _fossil_sanity_log_collect(queue);
+    fossil_sanity_log_entry_t *current = queue->head;
+    while (current) {
+        if (current->priority < min_priority) {
+            // Remove log entry
+            fossil_sanity_log_entry_t *to_remove = current;
+            current = current->next;
+            _fossil_sanity_log_unlink(queue, to_remove);
+            _fossil_sanity_log_entry_free(queue, to_remove);
+        } else {
+            current = current->next;
+        }
+    }
+}
+
+// Search for a log entry containing the keyword
+char *fossil_sanity_log_search(fossil_sanity_log_queue_t *queue, const char *keyword) {
+    _fossil_sanity_log_collect(queue);
+    fossil_sanity_log_entry_t *current = queue->head;
+    while (current) {
+        _fossil_sanity_log_entry_resolve(queue, current);
+        if (strstr(current->message, keyword)) {
+            return (char *)current->message;
+        }
+        current = current->next;
+    }
+    return NULL;
+}
+
+// Keep a token index up to date on every push and removal
+bool fossil_sanity_log_index_enable(fossil_sanity_log_queue_t *queue) {
+    if (queue->index) return true;
+    _fossil_sanity_log_collect(queue);
+
+    fossil_sanity_log_index_t *index = (fossil_sanity_log_index_t *)calloc(1, sizeof(fossil_sanity_log_index_t));
+    if (index) {
+        index->bucket_count = FOSSIL_SANITY_LOG_INDEX_BUCKETS;
+        index->buckets = (fossil_sanity_log_term_t **)calloc(index->bucket_count, sizeof(*index->buckets));
+    }
+    if (!index || !index->buckets) {
+        perror("Failed to allocate memory for log index");
+        free(index);
+        return false;
+    }
+
+    for (fossil_sanity_log_entry_t *current = queue->head; current; current = current->next) {
+        current->postings = NULL;
+        if (_fossil_sanity_log_entry_resolve(queue, current)) {
+            _fossil_sanity_log_index_add(index, current, false);
+        }
+    }
+    queue->index = index;
+    return true;
+}
+
+// Format and index the deferred entries pushed since the last indexed
+// search; only those entries are touched
+static void _fossil_sanity_log_index_catch_up(fossil_sanity_log_queue_t *queue) {
+    fossil_sanity_log_index_t *index = queue->index;
+    while (index->pending_head) {
+        fossil_sanity_log_entry_t *entry = index->pending_head->entry;
+        _fossil_sanity_log_index_remove(index, entry);
+        if (_fossil_sanity_log_entry_resolve(queue, entry)) {
+            _fossil_sanity_log_index_add(index, entry, true);
+        }
+    }
+}
+
+// Start iterating over the entries matching a keyword
+void fossil_sanity_log_search_begin(fossil_sanity_log_search_iter_t *iter, fossil_sanity_log_queue_t *queue, const char *keyword, int min_priority) {
+    _fossil_sanity_log_collect(queue);
+
+    iter->queue = queue;
+    iter->keyword = keyword;
+    iter->length = strlen(keyword);
+    iter->min_priority = min_priority;
+    iter->token = _fossil_sanity_log_is_token(keyword);
+    iter->entry = queue->head;
+    iter->posting = NULL;
+    iter->level = FOSSIL_SANITY_LOG_LEVEL_COUNT;
+
+    if (iter->token && queue->index) {
+        _fossil_sanity_log_index_catch_up(queue);
+        fossil_sanity_log_term_t *term = _fossil_sanity_log_index_find(queue->index, keyword, iter->length, _fossil_sanity_log_hash(keyword, iter->length));
+        iter->term = term;
+        iter->entry = NULL;
+        if (!term) iter->level = -1;
+    }
+}
+
+// Next matching entry, or NULL when the search is exhausted
+const fossil_sanity_log_entry_t *fossil_sanity_log_search_next(fossil_sanity_log_search_iter_t *iter) {
+    if (iter->token && iter->queue->index) {
+        int lowest = _fossil_sanity_log_level(iter->min_priority);
+        for (;;) {
+            if (iter->posting) {
+                const fossil_sanity_log_posting_t *posting = iter->posting;
+                iter->posting = posting->next;
+                if (posting->entry->priority >= iter->min_priority) {
+                    return posting->entry;
+                }
+                continue;
+            }
+            if (--iter->level < lowest) {
+                iter->level = -1;
+                return NULL;
+            }
+            iter->posting = iter->term->head[iter->level];
+        }
+    }
+
+    while (iter->entry) {
+        const fossil_sanity_log_entry_t *current = iter->entry;
+        if (_fossil_sanity_log_level(current->priority) < _fossil_sanity_log_level(iter->min_priority)) {
+            iter->entry = NULL;  // Only lower levels follow from here
+            break;
+        }
+        iter->entry = current->next;
+        if (current->priority < iter->min_priority) continue;  // Shares the edge level
+        _fossil_sanity_log_entry_resolve(iter->queue, (fossil_sanity_log_entry_t *)current);
+        if (iter->token ? _fossil_sanity_log_has_token(current->message, iter->keyword, iter->length)
+                        : strstr(current->message, iter->keyword) != NULL) {
+            return current;
+        }
+    }
+    return NULL;
+}
+
+// Collect every matching entry
+size_t fossil_sanity_log_search_all(fossil_sanity_log_queue_t *queue, const char *keyword, int min_priority, const fossil_sanity_log_entry_t **results, size_t max_results) {
+    fossil_sanity_log_search_iter_t iter;
+    const fossil_sanity_log_entry_t *entry;
+    size_t found = 0;
+
+    fossil_sanity_log_search_begin(&iter, queue, keyword, min_priority);
+    while ((entry = fossil_sanity_log_search_next(&iter)) != NULL) {
+        if (results && found < max_results) {
+            results[found] = entry;
+        }
+        found++;
+    }
+    return found;
+}
+
+// ==================================================================
+// Parallel operations
+// ==================================================================
+
+#define FOSSIL_SANITY_LOG_PARALLEL_THREADS 8     // Most threads working on one call, caller included
+#define FOSSIL_SANITY_LOG_PARALLEL_MIN     8192  // Entries below which calls stay serial
+#define FOSSIL_SANITY_LOG_PARALLEL_SPLIT   4     // Chunks per thread, to even out the load
+
+typedef void (*fossil_sanity_log_task_fn)(size_t task, void *context);
+
+// Workers shared by all queues. One job runs at a time; the caller takes
+// tasks too, and a caller finding the pool busy runs its job alone.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t work;       // A new job was posted
+    pthread_cond_t done;       // A worker left the job
+    pthread_mutex_t busy;      // Held by the caller of the running job
+    pthread_once_t once;
+    size_t threads;            // Started workers
+    uint64_t generation;       // Jobs posted
+    fossil_sanity_log_task_fn fn;
+    void *context;
+    size_t tasks;
+    atomic_size_t next;        // Next task to take
+    size_t active;             // Workers inside the job
+} workers = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .work = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER,
+    .busy = PTHREAD_MUTEX_INITIALIZER,
+    .once = PTHREAD_ONCE_INIT,
+};
+
+static void _fossil_sanity_log_tasks_take(fossil_sanity_log_task_fn fn, void *context, size_t tasks) {
+    size_t task;
+    while ((task = atomic_fetch_add_explicit(&workers.next, 1, memory_order_relaxed)) < tasks) {
+        fn(task, context);
+    }
+}
+
+static void *_fossil_sanity_log_worker_main(void *arg) {
+    uint64_t seen = 0;
+    (void)arg;
+
+    pthread_mutex_lock(&workers.lock);
+    for (;;) {
+        while (workers.generation == seen) {
+            pthread_cond_wait(&workers.work, &workers.lock);
+        }
+        seen = workers.generation;
+        fossil_sanity_log_task_fn fn = workers.fn;
+        void *context = workers.context;
+        size_t tasks = workers.tasks;
+        workers.active++;
+        pthread_mutex_unlock(&workers.lock);
+
+        _fossil_sanity_log_tasks_take(fn, context, tasks);
+
+        pthread_mutex_lock(&workers.lock);
+        if (--workers.active == 0) {
+            pthread_cond_signal(&workers.done);
+        }
+    }
+    return NULL;
+}
+
+// One thread per core, the caller included; a single core starts no
+// workers and every job runs serially
+static void _fossil_sanity_log_workers_start(void) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threads = cores < 1 ? 1 : cores > FOSSIL_SANITY_LOG_PARALLEL_THREADS ? FOSSIL_SANITY_LOG_PARALLEL_THREADS : (size_t)cores;
+
+    for (size_t i = 0; i + 1 < threads; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, _fossil_sanity_log_worker_main, NULL) != 0) {
+            perror("Failed to start log worker thread");
+            break;
+        }
+        pthread_detach(thread);
+        workers.threads++;
+    }
+}
+
+// Threads a job can use, the caller included
+static size_t _fossil_sanity_log_parallelism(void) {
+    pthread_once(&workers.once, _fossil_sanity_log_workers_start);
+    return workers.threads + 1;
+}
+
+// Run fn for every task in [0, tasks) and wait for all of them
+static void _fossil_sanity_log_parallel_run(size_t tasks, fossil_sanity_log_task_fn fn, void *context) {
+    if (tasks < 2 || _fossil_sanity_log_parallelism() < 2 || pthread_mutex_trylock(&workers.busy) != 0) {
+        for (size_t task = 0; task < tasks; task++) fn(task, context);
+        return;
+    }
+
+    pthread_mutex_lock(&workers.lock);
+    workers.fn = fn;
+    workers.context = context;
+    workers.tasks = tasks;
+    atomic_store_explicit(&workers.next, 0, memory_order_relaxed);
+    workers.generation++;
+    pthread_cond_broadcast(&workers.work);
+    pthread_mutex_unlock(&workers.lock);
+
+    _fossil_sanity_log_tasks_take(fn, context, tasks);
+
+    // Once every task is taken, wait for the workers still running one
+    pthread_mutex_lock(&workers.lock);
+    while (workers.active) {
+        pthread_cond_wait(&workers.done, &workers.lock);
+    }
+    workers.tasks = 0;  // Late wakers find nothing to take
+    pthread_mutex_unlock(&workers.lock);
+    pthread_mutex_unlock(&workers.busy);
+}
+
+// Contiguous runs of the list, cut into about equal entry counts
+typedef struct fossil_sanity_log_chunk {
+    fossil_sanity_log_entry_t *first;
+    size_t count;
+    fossil_sanity_log_entry_t **hits;  // Entries selected by the task
+    size_t hit_count;
+    size_t hit_capacity;
+    bool failed;                       // Ran out of memory recording hits
+} fossil_sanity_log_chunk_t;
+
+typedef struct fossil_sanity_log_scan {
+    fossil_sanity_log_chunk_t *chunks;
+    fossil_sanity_log_visit_t keep;   // Filter predicate
+    void *context;
+    const char *keyword;              // Search keyword
+    size_t length;
+    bool token;
+    fossil_sanity_log_compare_t compare;  // Sort tie-breaker
+} fossil_sanity_log_scan_t;
+
+// Cut the first `total` entries into chunks, formatting deferred entries
+// on the way so the tasks only read plain messages
+static fossil_sanity_log_chunk_t *_fossil_sanity_log_chunks(fossil_sanity_log_queue_t *queue, size_t total, size_t *count) {
+    size_t chunks = _fossil_sanity_log_parallelism() * FOSSIL_SANITY_LOG_PARALLEL_SPLIT;
+    if (chunks > total) chunks = total ? total : 1;
+    fossil_sanity_log_chunk_t *chunk = (fossil_sanity_log_chunk_t *)calloc(chunks, sizeof(*chunk));
+    if (!chunk) {
+        perror("Failed to allocate memory for log chunks");
+        return NULL;
+    }
+
+    fossil_sanity_log_entry_t *current = queue->head;
+    for (size_t i = 0; i < chunks; i++) {
+        chunk[i].first = current;
+        chunk[i].count = total / chunks + (i < total % chunks);
+        for (size_t n = 0; n < chunk[i].count; n++, current = current->next) {
+            _fossil_sanity_log_entry_resolve(queue, current);
+        }
+    }
+    *count = chunks;
+    return chunk;
+}
+
+static void _fossil_sanity_log_chunk_hit(fossil_sanity_log_chunk_t *chunk, fossil_sanity_log_entry_t *entry) {
+    if (chunk->hit_count == chunk->hit_capacity) {
+        size_t capacity = chunk->hit_capacity ? chunk->hit_capacity * 2 : 64;
+        fossil_sanity_log_entry_t **hits = (fossil_sanity_log_entry_t **)realloc(chunk->hits, capacity * sizeof(*hits));
+        if (!hits) {
+            chunk->failed = true;
+            return;
+        }
+        chunk->hits = hits;
+        chunk->hit_capacity = capacity;
+    }
+    chunk->hits[chunk->hit_count++] = entry;
+}
+
+static void _fossil_sanity_log_chunks_free(fossil_sanity_log_chunk_t *chunks, size_t count) {
+    for (size_t i = 0; i < count; i++) free(chunks[i].hits);
+    free(chunks);
+}
+
+static void _fossil_sanity_log_filter_task(size_t task, void *arg) {
+    fossil_sanity_log_scan_t *scan = (fossil_sanity_log_scan_t *)arg;
+    fossil_sanity_log_chunk_t *chunk = &scan->chunks[task];
+    fossil_sanity_log_entry_t *current = chunk->first;
+    for (size_t n = 0; n < chunk->count; n++, current = current->next) {
+        if (!scan->keep(current, scan->context)) {
+            _fossil_sanity_log_chunk_hit(chunk, current);
+        }
+    }
+}
+
+// Remove the entries the predicate rejects, evaluating it on the pool
+size_t fossil_sanity_log_filter_parallel(fossil_sanity_log_queue_t *queue, fossil_sanity_log_visit_t keep, void *context) {
+    size_t removed = 0;
+    _fossil_sanity_log_collect(queue);
+
+    size_t count = 0;
+    bool split = queue->count >= FOSSIL_SANITY_LOG_PARALLEL_MIN && _fossil_sanity_log_parallelism() > 1;
+    fossil_sanity_log_chunk_t *chunks = split ? _fossil_sanity_log_chunks(queue, queue->count, &count) : NULL;
+    if (chunks) {
+        fossil_sanity_log_scan_t scan = { .chunks = chunks, .keep = keep, .context = context };
+        _fossil_sanity_log_parallel_run(count, _fossil_sanity_log_filter_task, &scan);
+
+        bool failed = false;
+        for (size_t i = 0; i < count; i++) failed |= chunks[i].failed;
+        if (!failed) {
+            for (size_t i = 0; i < count; i++) {
+                for (size_t h = 0; h < chunks[i].hit_count; h++) {
+                    _fossil_sanity_log_unlink(queue, chunks[i].hits[h]);
+                    _fossil_sanity_log_entry_free(queue, chunks[i].hits[h]);
+                }
+                removed += chunks[i].hit_count;
+            }
+            _fossil_sanity_log_chunks_free(chunks, count);
+            return removed;
+        }
+        _fossil_sanity_log_chunks_free(chunks, count);
+    }
+
+    // Small queue, single core or no memory for the hit lists: the same
+    // walk, serially
+    fossil_sanity_log_entry_t *current = queue->head;
+    while (current) {
+        fossil_sanity_log_entry_t *next = current->next;
+        _fossil_sanity_log_entry_resolve(queue, current);
+        if (!keep(current, context)) {
+            _fossil_sanity_log_unlink(queue, current);
+            _fossil_sanity_log_entry_free(queue, current);
+            removed++;
+        }
+        current = next;
+    }
+    return removed;
+}
+
+static void _fossil_sanity_log_search_task(size_t task, void *arg) {
+    fossil_sanity_log_scan_t *scan = (fossil_sanity_log_scan_t *)arg;
+    fossil_sanity_log_chunk_t *chunk = &scan->chunks[task];
+    fossil_sanity_log_entry_t *current = chunk->first;
+    for (size_t n = 0; n < chunk->count; n++, current = current->next) {
+        if (scan->token ? _fossil_sanity_log_has_token(current->message, scan->keyword, scan->length)
+                        : strstr(current->message, scan->keyword) != NULL) {
+            _fossil_sanity_log_chunk_hit(chunk, current);
+        }
+    }
+}
+
+// Scan the queue for a keyword on the pool; same results as search_all
+size_t fossil_sanity_log_search_all_parallel(fossil_sanity_log_queue_t *queue, const char *keyword, int min_priority, const fossil_sanity_log_entry_t **results, size_t max_results) {
+    bool token = _fossil_sanity_log_is_token(keyword);
+    _fossil_sanity_log_collect(queue);
+    if ((token && queue->index) || queue->count < FOSSIL_SANITY_LOG_PARALLEL_MIN || _fossil_sanity_log_parallelism() < 2) {
+        return fossil_sanity_log_search_all(queue, keyword, min_priority, results, max_results);
+    }
+
+    // The serial scan stops at the first entry below the minimum
+    size_t total = 0;
+    for (const fossil_sanity_log_entry_t *current = queue->head; current && current->priority >= min_priority; current = current->next) {
+        total++;
+    }
+
+    size_t count;
+    fossil_sanity_log_chunk_t *chunks = _fossil_sanity_log_chunks(queue, total, &count);
+    if (!chunks) {
+        return fossil_sanity_log_search_all(queue, keyword, min_priority, results, max_results);
+    }
+    fossil_sanity_log_scan_t scan = { .chunks = chunks, .keyword = keyword, .length = strlen(keyword), .token = token };
+    _fossil_sanity_log_parallel_run(count, _fossil_sanity_log_search_task, &scan);
+
+    bool failed = false;
+    for (size_t i = 0; i < count; i++) failed |= chunks[i].failed;
+    size_t found = 0;
+    for (size_t i = 0; i < count && !failed; i++) {
+        for (size_t h = 0; h < chunks[i].hit_count; h++, found++) {
+            if (results && found < max_results) results[found] = chunks[i].hits[h];
+        }
+    }
+    _fossil_sanity_log_chunks_free(chunks, count);
+    return failed ? fossil_sanity_log_search_all(queue, keyword, min_priority, results, max_results) : found;
+}
+
+// Stable merge of two sorted lists: b goes first only when strictly smaller
+static fossil_sanity_log_entry_t *_fossil_sanity_log_merge_lists(fossil_sanity_log_entry_t *a, fossil_sanity_log_entry_t *b, fossil_sanity_log_compare_t compare) {
+    fossil_sanity_log_entry_t *merged = NULL;
+    fossil_sanity_log_entry_t **out = &merged;
+    while (a && b) {
+        if (_fossil_sanity_log_sorts_after(a, b, compare)) {
+            *out = b;
+            b = b->next;
+        } else {
+            *out = a;
+            a = a->next;
+        }
+        out = &(*out)->next;
+    }
+    *out = a ? a : b;
+    return merged;
+}
+
+static void _fossil_sanity_log_sort_task(size_t task, void *arg) {
+    fossil_sanity_log_scan_t *scan = (fossil_sanity_log_scan_t *)arg;
+    scan->chunks[task].first = _fossil_sanity_log_sort_list(scan->chunks[task].first, scan->compare);
+}
+
+// One round of pairwise merges: run 2t absorbs run 2t + 1
+static void _fossil_sanity_log_merge_task(size_t task, void *arg) {
+    fossil_sanity_log_scan_t *scan = (fossil_sanity_log_scan_t *)arg;
+    fossil_sanity_log_chunk_t *left = &scan->chunks[2 * task * scan->length];
+    fossil_sanity_log_chunk_t *right = left + scan->length;
+    left->first = _fossil_sanity_log_merge_lists(left->first, right->first, scan->compare);
+}
+
+// Sort runs of the list on the pool, then merge them pairwise
+void fossil_sanity_log_sort_parallel(fossil_sanity_log_queue_t *queue, fossil_sanity_log_compare_t compare) {
+    _fossil_sanity_log_collect(queue);
+    if (queue->count < FOSSIL_SANITY_LOG_PARALLEL_MIN || _fossil_sanity_log_parallelism() < 2) {
+        fossil_sanity_log_sort_by(queue, compare);
+        return;
+    }
+    if (_fossil_sanity_log_is_sorted(queue, compare)) return;
+
+    // One run per thread, each NULL-terminated
+    size_t count = _fossil_sanity_log_parallelism();
+    fossil_sanity_log_chunk_t *chunks = (fossil_sanity_log_chunk_t *)calloc(count, sizeof(*chunks));
+    if (!chunks) {
+        fossil_sanity_log_sort_by(queue, compare);
+        return;
+    }
+    fossil_sanity_log_entry_t *current = queue->head;
+    for (size_t i = 0; i < count; i++) {
+        chunks[i].first = current;
+        size_t length = queue->count / count + (i < queue->count % count);
+        for (size_t n = 1; n < length; n++) current = current->next;
+        fossil_sanity_log_entry_t *next = current->next;
+        current->next = NULL;
+        current = next;
+    }
+
+    fossil_sanity_log_scan_t scan = { .chunks = chunks, .compare = compare };
+    _fossil_sanity_log_parallel_run(count, _fossil_sanity_log_sort_task, &scan);
+    for (scan.length = 1; scan.length < count; scan.length *= 2) {
+        size_t pairs = (count - scan.length + 2 * scan.length - 1) / (2 * scan.length);
+        _fossil_sanity_log_parallel_run(pairs, _fossil_sanity_log_merge_task, &scan);
+    }
+
+    _fossil_sanity_log_relink(queue, chunks[0].first);
+    free(chunks);
+    _fossil_sanity_log_rebuild_levels(queue);
+}
+
+// Merge step over the level buckets, which are each in arrival order:
+// return the entry with the lowest sequence and advance past it
+static fossil_sanity_log_entry_t *_fossil_sanity_log_next_oldest(fossil_sanity_log_entry_t *cursor[FOSSIL_SANITY_LOG_LEVEL_COUNT]) {
+    int oldest = -1;
+    for (int level = 0; level < FOSSIL_SANITY_LOG_LEVEL_COUNT; level++) {
+        fossil_sanity_log_entry_t *entry = cursor[level];
+        if (entry && _fossil_sanity_log_level(entry->priority) != level) {
+            entry = cursor[level] = NULL;  // Walked into the next level
+        }
+        if (entry && (oldest < 0 || entry->sequence < cursor[oldest]->sequence)) {
+            oldest = level;
+        }
+    }
+    if (oldest < 0) return NULL;
+    fossil_sanity_log_entry_t *entry = cursor[oldest];
+    cursor[oldest] = entry->next;
+    return entry;
+}
+
+// Whether every level is still one run in arrival order, as
+// _fossil_sanity_log_next_oldest needs
+static bool _fossil_sanity_log_levels_in_sequence(const fossil_sanity_log_queue_t *queue) {
+    unsigned int seen = 0;
+    int previous = -1;
+    for (const fossil_sanity_log_entry_t *entry = queue->head; entry; entry = entry->next) {
+        int level = _fossil_sanity_log_level(entry->priority);
+        if (level != previous) {
+            if (seen & (1u << level)) return false;
+            seen |= 1u << level;
+            previous = level;
+        } else if (entry->sequence < entry->prev->sequence) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The entries stamped in [from, to) in arrival order, for a queue whose
+// levels were sorted by another key; the caller frees the array
+static fossil_sanity_log_entry_t **_fossil_sanity_log_gather_arrival(const fossil_sanity_log_queue_t *queue, uint64_t from, uint64_t to, size_t *count) {
+    fossil_sanity_log_entry_t **range = (fossil_sanity_log_entry_t **)malloc((queue->count ? queue->count : 1) * sizeof(*range));
+    *count = 0;
+    if (!range) {
+        perror("Failed to allocate memory for log time query");
+        return NULL;
+    }
+    for (fossil_sanity_log_entry_t *entry = queue->head; entry; entry = entry->next) {
+        if (entry->timestamp >= from && entry->timestamp < to) range[(*count)++] = entry;
+    }
+    qsort(range, *count, sizeof(*range), _fossil_sanity_log_by_sequence);
+    return range;
+}
+
+uint64_t fossil_sanity_log_now(void) {
+    return _fossil_sanity_log_timestamp();
+}
+
+// Record arrival order in time-spanned chunks
+bool fossil_sanity_log_time_index_enable(fossil_sanity_log_queue_t *queue) {
+    if (queue->time_index) return true;
+    _fossil_sanity_log_collect(queue);
+
+    fossil_sanity_log_time_index_t *index = (fossil_sanity_log_time_index_t *)calloc(1, sizeof(fossil_sanity_log_time_index_t));
+    if (!index) {
+        perror("Failed to allocate memory for log time index");
+        return false;
+    }
+
+    // Index what is queued oldest first, like the pushes would have
+    if (_fossil_sanity_log_levels_in_sequence(queue)) {
+        fossil_sanity_log_entry_t *cursor[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+        fossil_sanity_log_entry_t *entry;
+        memcpy(cursor, queue->level_head, sizeof(cursor));
+        while ((entry = _fossil_sanity_log_next_oldest(cursor)) != NULL) {
+            _fossil_sanity_log_time_add(index, entry);
+        }
+    } else {
+        size_t count;
+        fossil_sanity_log_entry_t **all = _fossil_sanity_log_gather_arrival(queue, 0, UINT64_MAX, &count);
+        if (!all) {
+            free(index);
+            return false;
+        }
+        for (size_t i = 0; i < count; i++) {
+            _fossil_sanity_log_time_add(index, all[i]);
+        }
+        free(all);
+    }
+    queue->time_index = index;
+    return true;
+}
+
+// Visit the entries pushed in [from, to), oldest first
+size_t fossil_sanity_log_query_time(fossil_sanity_log_queue_t *queue, uint64_t from, uint64_t to, fossil_sanity_log_visit_t visitor, void *context) {
+    size_t visited = 0;
+    _fossil_sanity_log_collect(queue);
+
+    if (queue->time_index) {
+        for (fossil_sanity_log_time_chunk_t *chunk = queue->time_index->head; chunk; chunk = chunk->next) {
+            if (chunk->last < from || chunk->first >= to) continue;  // Skip the whole chunk
+            for (size_t i = 0; i < chunk->used; i++) {
+                fossil_sanity_log_entry_t *entry = chunk->entries[i];
+                if (!entry || entry->timestamp < from || entry->timestamp >= to) continue;
+                _fossil_sanity_log_entry_resolve(queue, entry);
+                visited++;
+                if (!visitor(entry, context)) return visited;
+            }
+        }
+        return visited;
+    }
+
+    // Levels in arrival order merge by sequence into arrival order too
+    fossil_sanity_log_entry_t *entry;
+    if (_fossil_sanity_log_levels_in_sequence(queue)) {
+        fossil_sanity_log_entry_t *cursor[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+        memcpy(cursor, queue->level_head, sizeof(cursor));
+        while ((entry = _fossil_sanity_log_next_oldest(cursor)) != NULL) {
+            if (entry->timestamp < from || entry->timestamp >= to) continue;
+            _fossil_sanity_log_entry_resolve(queue, entry);
+            visited++;
+            if (!visitor(entry, context)) break;
+        }
+        return visited;
+    }
+
+    size_t matched;
+    fossil_sanity_log_entry_t **range = _fossil_sanity_log_gather_arrival(queue, from, to, &matched);
+    if (!range) return 0;
+    for (size_t i = 0; i < matched; i++) {
+        _fossil_sanity_log_entry_resolve(queue, range[i]);
+        visited++;
+        if (!visitor(range[i], context)) break;
+    }
+    free(range);
+    return visited;
+}
+
+// Write every iovec completely, retrying short writes
+static bool _fossil_sanity_log_rotation_writev(fossil_sanity_log_rotation_t *rotation, struct iovec *iov, int count) {
+    while (count > 0) {
+        ssize_t written = writev(rotation->fd, iov, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            perror("Failed to write log file");
+            return false;
+        }
+        rotation->current_size += (size_t)written;
+        _fossil_sanity_log_count(&_fossil_sanity_log_counters()->bytes_written, (uint64_t)written);
+        while (count > 0 && (size_t)written >= iov->iov_len) {
+            written -= (ssize_t)iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= (size_t)written;
+        }
+    }
+    return true;
+}
+
+static size_t _fossil_sanity_log_rotation_limit(const fossil_sanity_log_rotation_t *rotation) {
+    return rotation->max_size ? rotation->max_size : MAX_LOG_FILE_SIZE;
+}
+
+// Move every generation up one number and the current file to .1
+static void _fossil_sanity_log_rotation_shift(const fossil_sanity_log_rotation_t *rotation) {
+    unsigned int generations = rotation->max_files ? rotation->max_files : FOSSIL_SANITY_LOG_ROTATE_FILES;
+    char from[MAX_LOG_MESSAGE_LENGTH + 16];
+    char to[MAX_LOG_MESSAGE_LENGTH + 16];
+
+    for (unsigned int i = generations; i > 1; i--) {
+        snprintf(from, sizeof(from), "%s.%u", rotation->log_file_path, i - 1);
+        snprintf(to, sizeof(to), "%s.%u", rotation->log_file_path, i);
+        rename(from, to);  // Missing generations are fine
+    }
+    snprintf(to, sizeof(to), "%s.1", rotation->log_file_path);
+    rename(rotation->log_file_path, to);
+}
+
+static bool _fossil_sanity_log_rotation_reopen(fossil_sanity_log_rotation_t *rotation) {
+    struct stat info;
+    rotation->fd = open(rotation->log_file_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    rotation->is_open = rotation->fd >= 0;
+    if (!rotation->is_open) {
+        perror("Failed to open log file");
+        return false;
+    }
+    rotation->current_size = fstat(rotation->fd, &info) == 0 ? (size_t)info.st_size : 0;
+    return true;
+}
+
+bool fossil_sanity_log_rotation_init(fossil_sanity_log_rotation_t *rotation, const char *path, size_t max_size, unsigned int max_files) {
+    memset(rotation, 0, sizeof(*rotation));
+    rotation->fd = -1;
+    if ((size_t)snprintf(rotation->log_file_path, sizeof(rotation->log_file_path), "%s", path) >= sizeof(rotation->log_file_path)) {
+        errno = ENAMETOOLONG;  // Truncating would write to another file
+        perror("Log file path is too long");
+        return false;
+    }
+    rotation->max_size = max_size;
+    rotation->max_files = max_files;
+    return true;
+}
+
+bool fossil_sanity_log_rotation_open(fossil_sanity_log_rotation_t *rotation, const char *path, size_t max_size, unsigned int max_files) {
+    return fossil_sanity_log_rotation_init(rotation, path, max_size, max_files) && _fossil_sanity_log_rotation_reopen(rotation);
+}
+
+bool fossil_sanity_log_rotation_write(fossil_sanity_log_rotation_t *rotation, const void *data, size_t length) {
+    struct iovec iov = { (void *)data, length };
+    return _fossil_sanity_log_rotation_writev(rotation, &iov, 1);
+}
+
+void fossil_sanity_log_rotation_close(fossil_sanity_log_rotation_t *rotation) {
+    if (!rotation->is_open) return;
+    close(rotation->fd);
+    rotation->fd = -1;
+    rotation->is_open = false;
+}
+
+// Rotate the log file once it outgrows the size limit
+void fossil_sanity_log_rotate(fossil_sanity_log_rotation_t *rotation) {
+    if (!rotation->is_open) {
+        struct stat info;
+        if (stat(rotation->log_file_path, &info) != 0) {
+            rotation->current_size = 0;
+            return;
+        }
+        rotation->current_size = (size_t)info.st_size;
+    }
+    if (rotation->current_size <= _fossil_sanity_log_rotation_limit(rotation)) {
+        return;
+    }
+
+    _fossil_sanity_log_rotation_shift(rotation);
+    rotation->current_size = 0;
+    if (rotation->is_open) {
+        close(rotation->fd);
+        _fossil_sanity_log_rotation_reopen(rotation);
+    }
+}
+
+// ==================================================================
+// Snapshots
+// ==================================================================
+
+#define FOSSIL_SANITY_LOG_SNAPSHOT_MAGIC   0x504e534cu  // "LSNP"
+#define FOSSIL_SANITY_LOG_SNAPSHOT_VERSION 1
+
+// A snapshot is this header followed by one record per entry in queue
+// order, each followed by its stored bytes padded to 8. Values are in the
+// byte order of the writer; a reader of the other order sees a bad magic.
+typedef struct fossil_sanity_log_snapshot_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;      // Entries
+    uint64_t payload;    // Bytes after the header
+    uint64_t sequence;   // Sequence of the next entry pushed
+    uint64_t clock;      // Entry clock when taken, see fossil_sanity_log_now
+    uint64_t wall;       // Wall clock when taken, in nanoseconds
+    uint64_t checksum;   // Of the fields above, then the payload
+} fossil_sanity_log_snapshot_header_t;
+
+// Wall-clock time in nanoseconds; unlike the entry clock it survives a reboot
+static uint64_t _fossil_sanity_log_wall_clock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+typedef struct fossil_sanity_log_snapshot_record {
+    int32_t priority;
+    int32_t severity;
+    uint32_t flags;      // FOSSIL_SANITY_LOG_ENTRY_FIELDS or 0
+    uint32_t size;       // Stored bytes: the message, then any fields
+    uint64_t sequence;
+    uint64_t timestamp;
+} fossil_sanity_log_snapshot_record_t;
+
+static size_t _fossil_sanity_log_snapshot_pad(size_t size) {
+    return (size + 7) & ~(size_t)7;
+}
+
+// Word-at-a-time hash, continuing from seed
+static uint64_t _fossil_sanity_log_checksum(uint64_t seed, const void *data, size_t size) {
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t hash = seed;
+    for (; size >= 8; bytes += 8, size -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, 8);
+        hash ^= word * 0x9e3779b97f4a7c15u;
+        hash = (hash << 31 | hash >> 33) * 0xc2b2ae3d27d4eb4fu;
+    }
+    for (; size; bytes++, size--) {
+        hash = (hash ^ *bytes) * 0x100000001b3u;
+    }
+    return hash ^ (hash >> 29);
+}
+
+static uint64_t _fossil_sanity_log_snapshot_sum(const fossil_sanity_log_snapshot_header_t *header, const char *payload) {
+    uint64_t hash = _fossil_sanity_log_checksum(14695981039346656037u, header, offsetof(fossil_sanity_log_snapshot_header_t, checksum));
+    return _fossil_sanity_log_checksum(hash, payload, (size_t)header->payload);
+}
+
+// Bytes an entry stores: its text, then the packed fields behind the terminator
+static size_t _fossil_sanity_log_entry_stored(const fossil_sanity_log_entry_t *entry) {
+    const char *fields = _fossil_sanity_log_entry_fields(entry);
+    if (!fields) {
+        return _fossil_sanity_log_entry_render(entry, NULL, 0);
+    }
+    const char *end = fields + 1;
+    for (unsigned int i = 0, count = (unsigned char)*fields; i < count; i++) {
+        fossil_sanity_log_field_t field;
+        end = _fossil_sanity_log_field_unpack(end, &field);
+    }
+    return (size_t)(end - entry->message);
+}
+
+size_t fossil_sanity_log_snapshot(fossil_sanity_log_queue_t *queue, void *buffer, size_t size) {
+    _fossil_sanity_log_collect(queue);
+    size_t total = sizeof(fossil_sanity_log_snapshot_header_t);
+    for (const fossil_sanity_log_entry_t *entry = queue->head; entry; entry = entry->next) {
+        total += sizeof(fossil_sanity_log_snapshot_record_t) + _fossil_sanity_log_snapshot_pad(_fossil_sanity_log_entry_stored(entry));
+    }
+    if (!buffer || size < total) {
+        return total;
+    }
+
+    char *out = (char *)buffer + sizeof(fossil_sanity_log_snapshot_header_t);
+    for (const fossil_sanity_log_entry_t *entry = queue->head; entry; entry = entry->next) {
+        fossil_sanity_log_snapshot_record_t record;
+        size_t stored = _fossil_sanity_log_entry_stored(entry);
+        memset(&record, 0, sizeof(record));
+        record.priority = entry->priority;
+        record.severity = entry->severity;
+        record.flags = entry->flags & FOSSIL_SANITY_LOG_ENTRY_FIELDS;
+        record.size = (uint32_t)stored;
+        record.sequence = entry->sequence;
+        record.timestamp = entry->timestamp;
+        memcpy(out, &record, sizeof(record));
+        out += sizeof(record);
+
+        // Deferred entries are saved as their text, since their format
+        // string and arguments do not outlive the process
+        if (entry->flags & FOSSIL_SANITY_LOG_ENTRY_DEFERRED) {
+            char scratch[MAX_LOG_MESSAGE_LENGTH];
+            char *text = stored < sizeof(scratch) ? scratch : (char *)malloc(stored + 1);
+            if (!text) {
+                perror("Failed to allocate memory for log snapshot");
+                return 0;
+            }
+            _fossil_sanity_log_entry_render(entry, text, stored + 1);
+            memcpy(out, text, stored);
+            if (text != scratch) free(text);
+        } else {
+            memcpy(out, entry->message, stored);
+        }
+        memset(out + stored, 0, _fossil_sanity_log_snapshot_pad(stored) - stored);
+        out += _fossil_sanity_log_snapshot_pad(stored);
+    }
+
+    fossil_sanity_log_snapshot_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = FOSSIL_SANITY_LOG_SNAPSHOT_MAGIC;
+    header.version = FOSSIL_SANITY_LOG_SNAPSHOT_VERSION;
+    header.count = queue->count;
+    header.payload = total - sizeof(header);
+    header.sequence = queue->mpsc ? atomic_load_explicit(&queue->mpsc->sequence, memory_order_relaxed) : queue->sequence;
+    header.clock = _fossil_sanity_log_timestamp();
+    header.wall = _fossil_sanity_log_wall_clock();
+    header.checksum = _fossil_sanity_log_snapshot_sum(&header, (const char *)buffer + sizeof(header));
+    memcpy(buffer, &header, sizeof(header));
+    return total;
+}
+
+// Continue numbering from the saved queue
+static void _fossil_sanity_log_snapshot_sequence(fossil_sanity_log_queue_t *queue, uint64_t sequence) {
+    if (queue->mpsc) {
+        atomic_store_explicit(&queue->mpsc->sequence, sequence, memory_order_relaxed);
+    }
+    queue->sequence = sequence;
+}
+
+bool fossil_sanity_log_restore(fossil_sanity_log_queue_t *queue, const void *blob, size_t size) {
+    fossil_sanity_log_snapshot_header_t header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, blob, sizeof(header));
+    const char *payload = (const char *)blob + sizeof(header);
+    if (header.magic != FOSSIL_SANITY_LOG_SNAPSHOT_MAGIC || header.version != FOSSIL_SANITY_LOG_SNAPSHOT_VERSION ||
+        header.payload != size - sizeof(header) || header.count > header.payload / sizeof(fossil_sanity_log_snapshot_record_t) ||
+        header.checksum != _fossil_sanity_log_snapshot_sum(&header, payload)) {
+        return false;
+    }
+    _fossil_sanity_log_collect(queue);
+    if (queue->count) return false;
+
+    // Check the records and size the message block before allocating
+    size_t text = 0;
+    const char *cursor = payload;
+    const char *end = payload + header.payload;
+    for (uint64_t i = 0; i < header.count; i++) {
+        fossil_sanity_log_snapshot_record_t record;
+        if ((size_t)(end - cursor) < sizeof(record)) return false;
+        memcpy(&record, cursor, sizeof(record));
+        cursor += sizeof(record);
+        if ((size_t)(end - cursor) < _fossil_sanity_log_snapshot_pad(record.size)) return false;
+        if (record.flags & FOSSIL_SANITY_LOG_ENTRY_FIELDS) {
+            const char *terminator = (const char *)memchr(cursor, '\0', record.size);
+            if (!terminator || !_fossil_sanity_log_fields_valid(terminator + 1, cursor + record.size)) return false;
+        }
+        if (record.size >= FOSSIL_SANITY_LOG_INLINE_LENGTH) text += _fossil_sanity_log_arena_need(record.size);
+        cursor += _fossil_sanity_log_snapshot_pad(record.size);
+    }
+    if (cursor != end) return false;
+    if (!header.count) {
+        _fossil_sanity_log_snapshot_sequence(queue, header.sequence);
+        return true;
+    }
+
+    // One slab for the entries, one arena block for the longer messages.
+    // The slab joins the pool without turning pooling on for later pushes.
+    fossil_sanity_log_arena_block_t *block = text ? _fossil_sanity_log_arena_block_new(text) : NULL;
+    fossil_sanity_log_entry_t *entries = text && !block ? NULL : _fossil_sanity_log_pool_slab(&queue->pool, (size_t)header.count);
+    if (!entries) {
+        free(block);
+        return false;
+    }
+    queue->pool.in_use += (size_t)header.count;
+
+    // The entry clock restarts with the machine, so timestamps are rebased
+    // to keep each entry's age: its age when saved plus the wall-clock time
+    // since. Ages beyond the current clock pin to 0.
+    uint64_t now = _fossil_sanity_log_timestamp();
+    uint64_t wall = _fossil_sanity_log_wall_clock();
+    uint64_t offline = wall > header.wall ? wall - header.wall : 0;
+
+    cursor = payload;
+    for (size_t i = 0; i < header.count; i++) {
+        fossil_sanity_log_snapshot_record_t record;
+        fossil_sanity_log_entry_t *entry = &entries[i];
+        memcpy(&record, cursor, sizeof(record));
+        cursor += sizeof(record);
+
+        char *message = record.size < FOSSIL_SANITY_LOG_INLINE_LENGTH ? entry->inline_message
+                      : _fossil_sanity_log_arena_carve(block, _fossil_sanity_log_arena_need(record.size));
+        memcpy(message, cursor, record.size);
+        message[record.size] = '\0';
+        cursor += _fossil_sanity_log_snapshot_pad(record.size);
+
+        entry->priority = record.priority;
+        entry->severity = record.severity;
+        entry->flags = FOSSIL_SANITY_LOG_ENTRY_POOLED | (record.flags & FOSSIL_SANITY_LOG_ENTRY_FIELDS);
+        entry->length = (uint32_t)((record.flags & FOSSIL_SANITY_LOG_ENTRY_FIELDS) ? strlen(message) : record.size);
+        entry->sequence = record.sequence;
+        uint64_t age = (header.clock > record.timestamp ? header.clock - record.timestamp : 0) + offline;
+        entry->timestamp = age < now ? now - age : 0;
+        entry->message = message;
+        entry->postings = NULL;
+        entry->time_slot = NULL;
+        entry->prev = i ? &entries[i - 1] : NULL;
+        entry->next = i + 1 < header.count ? &entries[i + 1] : NULL;
+    }
+
+    // Records come in queue order, so the list is linked as it stands
+    queue->head = &entries[0];
+    queue->tail = &entries[header.count - 1];
+    queue->count = (size_t)header.count;
+    if (queue->count > queue->peak_count) queue->peak_count = queue->count;
+    _fossil_sanity_log_rebuild_levels(queue);
+    _fossil_sanity_log_snapshot_sequence(queue, header.sequence);
+
+    if (queue->index) {
+        for (size_t i = 0; i < header.count; i++) _fossil_sanity_log_index_add(queue->index, &entries[i], false);
+    }
+    if (queue->time_index) {
+        // The time index takes entries in arrival order
+        fossil_sanity_log_entry_t **order = (fossil_sanity_log_entry_t **)malloc((size_t)header.count * sizeof(*order));
+        if (order) {
+            for (size_t i = 0; i < header.count; i++) order[i] = &entries[i];
+            qsort(order, (size_t)header.count, sizeof(*order), _fossil_sanity_log_by_sequence);
+            for (size_t i = 0; i < header.count; i++) _fossil_sanity_log_time_add(queue->time_index, order[i]);
+            free(order);
+        } else {
+            perror("Failed to allocate memory for log time index");
+        }
+    }
+    _fossil_sanity_log_trim(queue);
+    return true;
+}
+
+// ==================================================================
+// Memory-mapped ring file
+// ==================================================================
+
+#define FOSSIL_SANITY_LOG_RING_MAGIC    0x4c52534cu  // "LSRL"
+#define FOSSIL_SANITY_LOG_RING_VERSION  2  // 2: records carry their timestamp
+#define FOSSIL_SANITY_LOG_RECORD_MAGIC  0x31434552u  // "REC1"
+#define FOSSIL_SANITY_LOG_RECORD_PAD    0x44415050u  // "PPAD": skip to the end of the ring
+
+// The cursors count bytes since the ring was created and never wrap; a
+// cursor's offset in the record area is cursor % capacity. Records between
+// tail and commit are complete. An append first moves tail past anything it
+// will overwrite, then publishes write, copies the record and finally moves
+// commit up to write, so a crash at any point leaves tail..commit intact.
+typedef struct fossil_sanity_log_ring_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    _Atomic uint64_t tail;
+    _Atomic uint64_t write;
+    _Atomic uint64_t commit;
+    uint64_t reserved[3];
+} fossil_sanity_log_ring_header_t;
+
+typedef struct fossil_sanity_log_record {
+    uint32_t magic;
+    uint32_t length;
+    int32_t priority;
+    int32_t severity;
+    uint64_t timestamp;  // Append time in nanoseconds (see fossil_sanity_log_now)
+} fossil_sanity_log_record_t;
+
+struct fossil_sanity_log_ring {
+    int fd;
+    size_t mapped;
+    fossil_sanity_log_ring_header_t *header;
+    char *records;
+    pthread_mutex_t lock;
+};
+
+static size_t _fossil_sanity_log_record_size(size_t length) {
+    return (sizeof(fossil_sanity_log_record_t) + length + 7) & ~(size_t)7;
+}
+
+// Bytes the record at a cursor occupies, counting a wrap pad; 0 if damaged
+static uint64_t _fossil_sanity_log_ring_span(const char *records, uint64_t capacity, uint64_t cursor) {
+    uint64_t offset = cursor % capacity;
+    const fossil_sanity_log_record_t *record = (const fossil_sanity_log_record_t *)(records + offset);
+    if (record->magic == FOSSIL_SANITY_LOG_RECORD_PAD) {
+        return capacity - offset;
+    }
+    if (record->magic != FOSSIL_SANITY_LOG_RECORD_MAGIC || _fossil_sanity_log_record_size(record->length) > capacity - offset) {
+        return 0;
+    }
+    return _fossil_sanity_log_record_size(record->length);
+}
+
+// Map a ring file; on success the mapping describes a valid header
+static bool _fossil_sanity_log_ring_map(int fd, size_t capacity, bool create, char **mapped, size_t *mapped_size) {
+    struct stat info;
+    if (fstat(fd, &info) != 0) return false;
+
+    bool fresh = (size_t)info.st_size < sizeof(fossil_sanity_log_ring_header_t);
+    if (fresh) {
+        if (!create || capacity == 0) return false;
+        if (ftruncate(fd, (off_t)(sizeof(fossil_sanity_log_ring_header_t) + capacity)) != 0) return false;
+        info.st_size = (off_t)(sizeof(fossil_sanity_log_ring_header_t) + capacity);
+    }
+
+    int protection = create ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *map = mmap(NULL, (size_t)info.st_size, protection, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return false;
+
+    fossil_sanity_log_ring_header_t *header = (fossil_sanity_log_ring_header_t *)map;
+    if (fresh) {
+        header->capacity = capacity;
+        atomic_init(&header->tail, 0);
+        atomic_init(&header->write, 0);
+        atomic_init(&header->commit, 0);
+        header->version = FOSSIL_SANITY_LOG_RING_VERSION;
+        atomic_thread_fence(memory_order_release);
+        header->magic = FOSSIL_SANITY_LOG_RING_MAGIC;
+    }
+
+    bool valid = header->magic == FOSSIL_SANITY_LOG_RING_MAGIC
+              && header->version == FOSSIL_SANITY_LOG_RING_VERSION
+              && header->capacity >= 64 && header->capacity % 8 == 0
+              && sizeof(fossil_sanity_log_ring_header_t) + header->capacity <= (uint64_t)info.st_size
+              && (capacity == 0 || header->capacity == capacity);
+    if (!valid) {
+        munmap(map, (size_t)info.st_size);
+        return false;
+    }
+    *mapped = (char *)map;
+    *mapped_size = (size_t)info.st_size;
+    return true;
+}
+
+// Open or create a ring log file
+fossil_sanity_log_ring_t *fossil_sanity_log_ring_open(const char *path, size_t capacity) {
+    capacity = (capacity + 7) & ~(size_t)7;
+    fossil_sanity_log_ring_t *ring = (fossil_sanity_log_ring_t *)calloc(1, sizeof(fossil_sanity_log_ring_t));
+    if (!ring) {
+        perror("Failed to allocate memory for log ring");
+        return NULL;
+    }
+
+    char *mapped = NULL;
+    ring->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (ring->fd < 0 || !_fossil_sanity_log_ring_map(ring->fd, capacity, true, &mapped, &ring->mapped)) {
+        perror("Failed to open log ring");
+        if (ring->fd >= 0) close(ring->fd);
+        free(ring);
+        return NULL;
+    }
+    ring->header = (fossil_sanity_log_ring_header_t *)mapped;
+    ring->records = mapped + sizeof(fossil_sanity_log_ring_header_t);
+
+    // An append torn by a crash is abandoned
+    atomic_store_explicit(&ring->header->write, atomic_load_explicit(&ring->header->commit, memory_order_relaxed), memory_order_relaxed);
+    pthread_mutex_init(&ring->lock, NULL);
+    return ring;
+}
+
+bool fossil_sanity_log_ring_append(fossil_sanity_log_ring_t *ring, const char *message, int priority, int severity) {
+    fossil_sanity_log_ring_header_t *header = ring->header;
+    uint64_t capacity = header->capacity;
+    size_t length = strlen(message);
+    size_t size = _fossil_sanity_log_record_size(length);
+    if (size > capacity / 4) {
+        return false;
+    }
+
+    pthread_mutex_lock(&ring->lock);
+    uint64_t commit = atomic_load_explicit(&header->commit, memory_order_relaxed);
+    uint64_t offset = commit % capacity;
+    uint64_t pad = capacity - offset < size ? capacity - offset : 0;
+    uint64_t end = commit + pad + size;
+
+    // Retire the oldest records this append will overwrite
+    uint64_t tail = atomic_load_explicit(&header->tail, memory_order_relaxed);
+    while (end - tail > capacity) {
+        uint64_t span = _fossil_sanity_log_ring_span(ring->records, capacity, tail);
+        tail = span ? tail + span : commit;
+    }
+    atomic_store_explicit(&header->tail, tail, memory_order_release);
+    atomic_store_explicit(&header->write, end, memory_order_release);
+
+    if (pad) {
+        ((fossil_sanity_log_record_t *)(ring->records + offset))->magic = FOSSIL_SANITY_LOG_RECORD_PAD;
+        offset = 0;
+    }
+    fossil_sanity_log_record_t *record = (fossil_sanity_log_record_t *)(ring->records + offset);
+    record->magic = FOSSIL_SANITY_LOG_RECORD_MAGIC;
+    record->length = (uint32_t)length;
+    record->priority = priority;
+    record->severity = severity;
+    record->timestamp = _fossil_sanity_log_timestamp();
+    memcpy(record + 1, message, length);
+
+    atomic_store_explicit(&header->commit, end, memory_order_release);
+    pthread_mutex_unlock(&ring->lock);
+    return true;
+}
+
+void fossil_sanity_log_ring_sync(fossil_sanity_log_ring_t *ring) {
+    msync(ring->header, ring->mapped, MS_SYNC);
+}
+
+void fossil_sanity_log_ring_close(fossil_sanity_log_ring_t *ring) {
+    if (!ring) return;
+    munmap(ring->header, ring->mapped);
+    close(ring->fd);
+    pthread_mutex_destroy(&ring->lock);
+    free(ring);
+}
+
+// Recover the newest committed records of a ring file into a queue
+size_t fossil_sanity_log_ring_recover(const char *path, fossil_sanity_log_queue_t *queue, size_t max_entries) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    char *mapped;
+    size_t mapped_size;
+    if (fd < 0 || !_fossil_sanity_log_ring_map(fd, 0, false, &mapped, &mapped_size)) {
+        perror("Failed to open log ring");
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+
+    const fossil_sanity_log_ring_header_t *header = (const fossil_sanity_log_ring_header_t *)mapped;
+    const char *records = mapped + sizeof(fossil_sanity_log_ring_header_t);
+    uint64_t capacity = header->capacity;
+    uint64_t commit = atomic_load_explicit(&header->commit, memory_order_acquire);
+    uint64_t tail = atomic_load_explicit(&header->tail, memory_order_acquire);
+
+    // Count the records first so only the newest max_entries are pushed
+    size_t total = 0;
+    uint64_t end = tail;
+    while (end < commit) {
+        uint64_t span = _fossil_sanity_log_ring_span(records, capacity, end);
+        if (!span) break;
+        const fossil_sanity_log_record_t *record = (const fossil_sanity_log_record_t *)(records + end % capacity);
+        if (record->magic == FOSSIL_SANITY_LOG_RECORD_MAGIC) total++;
+        end += span;
+    }
+    size_t skip = max_entries && total > max_entries ? total - max_entries : 0;
+
+    size_t recovered = 0;
+    char buffer[MAX_LOG_MESSAGE_LENGTH];
+    for (uint64_t cursor = tail; cursor < end;) {
+        const fossil_sanity_log_record_t *record = (const fossil_sanity_log_record_t *)(records + cursor % capacity);
+        cursor += _fossil_sanity_log_ring_span(records, capacity, cursor);
+        if (record->magic != FOSSIL_SANITY_LOG_RECORD_MAGIC) continue;
+        if (skip) {
+            skip--;
+            continue;
+        }
+
+        char *message = record->length < sizeof(buffer) ? buffer : (char *)malloc(record->length + 1);
+        if (!message) break;
+        memcpy(message, record + 1, record->length);
+        message[record->length] = '\0';
+        _fossil_sanity_log_push_at(queue, message, strlen(message), 0, record->priority, record->severity, record->timestamp);
+        if (message != buffer) free(message);
+        recovered++;
+    }
+
+    munmap(mapped, mapped_size);
+    close(fd);
+    return recovered;
+}
+
+// ==================================================================
+// Shared-memory collector
+// ==================================================================
+
+#define FOSSIL_SANITY_LOG_SHM_MAGIC    0x4d48534cu  // "LSHM"
+#define FOSSIL_SANITY_LOG_SHM_VERSION  1
+#define FOSSIL_SANITY_LOG_SHM_SLOTS    1024
+
+// Positions count pushes since the ring was created. Each slot's state
+// holds the low 32 bits of a position and, in the high 32 bits, the pid of
+// the producer writing it:
+//   (p, 0)            free for the push at position p
+//   (p, pid)          claimed by pid for position p, being written
+//   (p + 1, pid)      committed, ready for the collector
+//   (p + capacity, 0) collected, free for the push one lap later
+// A producer claims the slot at tail with a CAS on its state, then moves
+// tail on; anyone finding the slot at tail claimed moves tail on for it,
+// so a producer dying between the two steps does not stall the others.
+typedef struct fossil_sanity_log_shm_slot {
+    _Alignas(FOSSIL_SANITY_LOG_CACHE_LINE) _Atomic uint64_t state;
+    uint64_t sequence;   // Producer's own sequence number
+    uint64_t timestamp;
+    int32_t priority;
+    int32_t severity;
+    uint32_t length;
+    char message[MAX_LOG_MESSAGE_LENGTH];
+} fossil_sanity_log_shm_slot_t;
+
+typedef struct fossil_sanity_log_shm_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t slot_size;
+    _Alignas(FOSSIL_SANITY_LOG_CACHE_LINE) _Atomic uint64_t tail;  // Next position to claim
+    _Alignas(FOSSIL_SANITY_LOG_CACHE_LINE) _Atomic uint64_t head;  // Next position to collect
+    _Atomic uint64_t dropped;
+    _Atomic uint64_t abandoned;
+} fossil_sanity_log_shm_header_t;
+
+struct fossil_sanity_log_shm {
+    fossil_sanity_log_shm_header_t *header;
+    fossil_sanity_log_shm_slot_t *slots;
+    size_t mapped;
+    uint64_t mask;
+};
+
+// The calling process, and the sequence numbers it hands out; a forked
+// child starts over from 0 under its own pid
+static struct {
+    pthread_once_t once;
+    _Atomic uint64_t sequence;
+    _Atomic uint32_t pid;
+} shm_process = { .once = PTHREAD_ONCE_INIT };
+
+static void _fossil_sanity_log_shm_forked(void) {
+    atomic_store_explicit(&shm_process.sequence, 0, memory_order_relaxed);
+    atomic_store_explicit(&shm_process.pid, (uint32_t)getpid(), memory_order_relaxed);
+}
+
+static void _fossil_sanity_log_shm_process_init(void) {
+    atomic_store_explicit(&shm_process.pid, (uint32_t)getpid(), memory_order_relaxed);
+    pthread_atfork(NULL, NULL, _fossil_sanity_log_shm_forked);
+}
+
+static inline uint64_t _fossil_sanity_log_shm_state(uint64_t position, uint32_t pid) {
+    return (uint64_t)pid << 32 | (uint32_t)position;
+}
+
+static size_t _fossil_sanity_log_shm_size(uint64_t capacity) {
+    return sizeof(fossil_sanity_log_shm_header_t) + capacity * sizeof(fossil_sanity_log_shm_slot_t);
+}
+
+// Map a ring object; on success the mapping describes a valid ring
+static fossil_sanity_log_shm_t *_fossil_sanity_log_shm_map(int fd, size_t capacity) {
+    struct stat info;
+    if (fstat(fd, &info) != 0) return NULL;
+
+    // The collector keeps a ring of the requested size, with its entries
+    if (capacity && (size_t)info.st_size != _fossil_sanity_log_shm_size(capacity)) {
+        if (ftruncate(fd, (off_t)_fossil_sanity_log_shm_size(capacity)) != 0) return NULL;
+        info.st_size = (off_t)_fossil_sanity_log_shm_size(capacity);
+    }
+    if ((size_t)info.st_size < sizeof(fossil_sanity_log_shm_header_t)) return NULL;
+
+    void *map = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) return NULL;
+
+    fossil_sanity_log_shm_header_t *header = (fossil_sanity_log_shm_header_t *)map;
+    fossil_sanity_log_shm_slot_t *slots = (fossil_sanity_log_shm_slot_t *)(header + 1);
+    if (capacity && (header->magic != FOSSIL_SANITY_LOG_SHM_MAGIC || header->version != FOSSIL_SANITY_LOG_SHM_VERSION ||
+                     header->capacity != capacity || header->slot_size != sizeof(fossil_sanity_log_shm_slot_t))) {
+        header->magic = 0;
+        atomic_thread_fence(memory_order_release);
+        header->version = FOSSIL_SANITY_LOG_SHM_VERSION;
+        header->capacity = capacity;
+        header->slot_size = sizeof(fossil_sanity_log_shm_slot_t);
+        atomic_init(&header->tail, 0);
+        atomic_init(&header->head, 0);
+        atomic_init(&header->dropped, 0);
+        atomic_init(&header->abandoned, 0);
+        for (uint64_t i = 0; i < capacity; i++) {
+            atomic_init(&slots[i].state, _fossil_sanity_log_shm_state(i, 0));
+        }
+        atomic_thread_fence(memory_order_release);
+        header->magic = FOSSIL_SANITY_LOG_SHM_MAGIC;
+    }
+
+    uint64_t slots_held = header->capacity;
+    bool valid = header->magic == FOSSIL_SANITY_LOG_SHM_MAGIC
+              && header->version == FOSSIL_SANITY_LOG_SHM_VERSION
+              && header->slot_size == sizeof(fossil_sanity_log_shm_slot_t)
+              && slots_held && (slots_held & (slots_held - 1)) == 0 && slots_held <= UINT32_MAX / 2
+              && _fossil_sanity_log_shm_size(slots_held) <= (uint64_t)info.st_size;
+    fossil_sanity_log_shm_t *shm = valid ? (fossil_sanity_log_shm_t *)calloc(1, sizeof(fossil_sanity_log_shm_t)) : NULL;
+    if (!shm) {
+        munmap(map, (size_t)info.st_size);
+        return NULL;
+    }
+    shm->header = header;
+    shm->slots = slots;
+    shm->mapped = (size_t)info.st_size;
+    shm->mask = slots_held - 1;
+    pthread_once(&shm_process.once, _fossil_sanity_log_shm_process_init);
+    return shm;
+}
+
+fossil_sanity_log_shm_t *fossil_sanity_log_shm_create(const char *name, size_t capacity) {
+    size_t slots = 1;
+    while (slots < (capacity ? capacity : FOSSIL_SANITY_LOG_SHM_SLOTS) && slots < (size_t)UINT32_MAX / 2) slots <<= 1;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    fossil_sanity_log_shm_t *shm = fd >= 0 ? _fossil_sanity_log_shm_map(fd, slots) : NULL;
+    if (!shm) perror("Failed to create shared log ring");
+    if (fd >= 0) close(fd);
+    return shm;
 }
 
-// Push a log entry into the queue based on priority and severity
-void fossil_sanity_log_push(fossil_sanity_log_queue_t *queue, const char *message, int priority, int severity) {
-    fossil_sanity_log_entry_t *new_entry = (fossil_sanity_log_entry_t *)malloc(sizeof(fossil_sanity_log_entry_t));
-    if (!new_entry) {
-        perror("Failed to allocate memory for log entry");
+fossil_sanity_log_shm_t *fossil_sanity_log_shm_open(const char *name) {
+    int fd = shm_open(name, O_RDWR | O_CLOEXEC, 0);
+    fossil_sanity_log_shm_t *shm = fd >= 0 ? _fossil_sanity_log_shm_map(fd, 0) : NULL;
+    if (!shm) perror("Failed to open shared log ring");
+    if (fd >= 0) close(fd);
+    return shm;
+}
+
+void fossil_sanity_log_shm_close(fossil_sanity_log_shm_t *shm) {
+    if (!shm) return;
+    munmap(shm->header, shm->mapped);
+    free(shm);
+}
+
+bool fossil_sanity_log_shm_unlink(const char *name) {
+    return shm_unlink(name) == 0;
+}
+
+// Help a claimed position past tail, whoever claimed it
+static void _fossil_sanity_log_shm_advance(fossil_sanity_log_shm_header_t *header, uint64_t position) {
+    atomic_compare_exchange_strong_explicit(&header->tail, &position, position + 1, memory_order_release, memory_order_relaxed);
+}
+
+char *fossil_sanity_log_shm_begin(fossil_sanity_log_shm_t *shm, int priority, int severity) {
+    fossil_sanity_log_shm_header_t *header = shm->header;
+    uint32_t pid = atomic_load_explicit(&shm_process.pid, memory_order_relaxed);
+    uint64_t position = atomic_load_explicit(&header->tail, memory_order_acquire);
+    fossil_sanity_log_shm_slot_t *slot;
+
+    for (;;) {
+        slot = &shm->slots[position & shm->mask];
+        uint64_t state = atomic_load_explicit(&slot->state, memory_order_acquire);
+        int32_t lap = (int32_t)((uint32_t)state - (uint32_t)position);
+        if (lap == 0 && state >> 32 == 0) {
+            if (atomic_compare_exchange_weak_explicit(&slot->state, &state, _fossil_sanity_log_shm_state(position, pid),
+                                                      memory_order_acquire, memory_order_relaxed)) {
+                _fossil_sanity_log_shm_advance(header, position);
+                break;
+            }
+        } else if (lap == 0) {
+            _fossil_sanity_log_shm_advance(header, position);
+        } else if (lap < 0) {
+            // Still holds the entry from the previous lap
+            atomic_fetch_add_explicit(&header->dropped, 1, memory_order_relaxed);
+            return NULL;
+        }
+        position = atomic_load_explicit(&header->tail, memory_order_acquire);
+    }
+
+    slot->sequence = atomic_fetch_add_explicit(&shm_process.sequence, 1, memory_order_relaxed);
+    slot->timestamp = _fossil_sanity_log_timestamp();
+    slot->priority = priority;
+    slot->severity = severity;
+    return slot->message;
+}
+
+void fossil_sanity_log_shm_commit(fossil_sanity_log_shm_t *shm, char *message, size_t length) {
+    fossil_sanity_log_shm_slot_t *slot = (fossil_sanity_log_shm_slot_t *)(message - offsetof(fossil_sanity_log_shm_slot_t, message));
+    (void)shm;
+    if (length >= sizeof(slot->message)) length = sizeof(slot->message) - 1;
+    message[length] = '\0';
+    slot->length = (uint32_t)length;
+
+    uint64_t state = atomic_load_explicit(&slot->state, memory_order_relaxed);
+    atomic_store_explicit(&slot->state, _fossil_sanity_log_shm_state((uint32_t)state + 1, (uint32_t)(state >> 32)), memory_order_release);
+}
+
+bool fossil_sanity_log_shm_push(fossil_sanity_log_shm_t *shm, const char *message, int priority, int severity) {
+    char *buffer = fossil_sanity_log_shm_begin(shm, priority, severity);
+    if (!buffer) return false;
+    size_t length = strnlen(message, MAX_LOG_MESSAGE_LENGTH - 1);
+    memcpy(buffer, message, length);
+    fossil_sanity_log_shm_commit(shm, buffer, length);
+    return true;
+}
+
+// Bytes of the packed pid and seq fields: type, key length, key with its
+// terminator and value, twice
+#define FOSSIL_SANITY_LOG_SHM_ORIGIN (2 * (1 + 1 + sizeof("pid") + 8))
+
+// Copy a committed slot out as an entry with pid and seq fields
+static void _fossil_sanity_log_shm_entry(const fossil_sanity_log_shm_slot_t *slot, uint32_t pid, fossil_sanity_log_entry_t *entry, char *record) {
+    const fossil_sanity_log_field_t origin[] = {
+        FOSSIL_SANITY_LOG_KV_INT("pid", pid),
+        FOSSIL_SANITY_LOG_KV_INT("seq", slot->sequence)
+    };
+    uint32_t length = slot->length < MAX_LOG_MESSAGE_LENGTH ? slot->length : MAX_LOG_MESSAGE_LENGTH - 1;
+    memcpy(record, slot->message, length);
+    record[length] = '\0';
+    length = (uint32_t)strlen(record);  // A message holding a NUL ends there
+
+    char *out = record + length + 1;
+    *out++ = 2;
+    out = _fossil_sanity_log_field_pack(out, &origin[0]);
+    _fossil_sanity_log_field_pack(out, &origin[1]);
+
+    memset(entry, 0, sizeof(*entry));
+    entry->priority = slot->priority;
+    entry->severity = slot->severity;
+    entry->flags = FOSSIL_SANITY_LOG_ENTRY_FIELDS;
+    entry->length = length;
+    entry->sequence = slot->sequence;
+    entry->timestamp = slot->timestamp;
+    entry->message = record;
+}
+
+size_t fossil_sanity_log_shm_drain_to(fossil_sanity_log_shm_t *shm, fossil_sanity_log_visit_t sink, void *context, size_t max) {
+    fossil_sanity_log_shm_header_t *header = shm->header;
+    uint64_t capacity = shm->mask + 1;
+    uint64_t position = atomic_load_explicit(&header->head, memory_order_relaxed);
+    char record[MAX_LOG_MESSAGE_LENGTH + 1 + FOSSIL_SANITY_LOG_SHM_ORIGIN];
+    size_t drained = 0;
+    bool more = true;
+
+    while (more && (!max || drained < max)) {
+        fossil_sanity_log_shm_slot_t *slot = &shm->slots[position & shm->mask];
+        uint64_t state = atomic_load_explicit(&slot->state, memory_order_acquire);
+        uint32_t pid = (uint32_t)(state >> 32);
+
+        if ((uint32_t)state == (uint32_t)(position + 1)) {
+            fossil_sanity_log_entry_t entry;
+            _fossil_sanity_log_shm_entry(slot, pid, &entry, record);
+            atomic_store_explicit(&slot->state, _fossil_sanity_log_shm_state(position + capacity, 0), memory_order_release);
+            position++;
+            drained++;
+            atomic_store_explicit(&header->head, position, memory_order_relaxed);
+            more = sink(&entry, context);
+        } else if ((uint32_t)state == (uint32_t)position && pid && kill((pid_t)pid, 0) != 0 && errno == ESRCH) {
+            // The producer died mid-write: tail may still point here
+            _fossil_sanity_log_shm_advance(header, position);
+            atomic_store_explicit(&slot->state, _fossil_sanity_log_shm_state(position + capacity, 0), memory_order_release);
+            atomic_fetch_add_explicit(&header->abandoned, 1, memory_order_relaxed);
+            position++;
+            atomic_store_explicit(&header->head, position, memory_order_relaxed);
+        } else {
+            break;  // Empty, or still being written
+        }
+    }
+    return drained;
+}
+
+// Re-queue a drained entry under the time its producer logged it; the
+// queue numbers it in drain order
+static bool _fossil_sanity_log_shm_enqueue(const fossil_sanity_log_entry_t *entry, void *context) {
+    size_t size = entry->length + 2 + FOSSIL_SANITY_LOG_SHM_ORIGIN;
+    _fossil_sanity_log_push_at((fossil_sanity_log_queue_t *)context, entry->message, size, FOSSIL_SANITY_LOG_ENTRY_FIELDS, entry->priority, entry->severity, entry->timestamp);
+    return true;
+}
+
+size_t fossil_sanity_log_shm_drain(fossil_sanity_log_shm_t *shm, fossil_sanity_log_queue_t *queue, size_t max) {
+    return fossil_sanity_log_shm_drain_to(shm, _fossil_sanity_log_shm_enqueue, queue, max);
+}
+
+void fossil_sanity_log_shm_stats(const fossil_sanity_log_shm_t *shm, fossil_sanity_log_shm_stats_t *stats) {
+    fossil_sanity_log_shm_header_t *header = shm->header;
+    uint64_t head = atomic_load_explicit(&header->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&header->tail, memory_order_relaxed);
+    stats->capacity = (size_t)(shm->mask + 1);
+    stats->pending = tail > head ? (size_t)(tail - head) : 0;
+    stats->dropped = atomic_load_explicit(&header->dropped, memory_order_relaxed);
+    stats->abandoned = atomic_load_explicit(&header->abandoned, memory_order_relaxed);
+}
+
+// ==================================================================
+// Offline queries
+// ==================================================================
+
+#define FOSSIL_SANITY_LOG_QUERY_CHUNK_MIN (64 * 1024)         // Smallest slice of a file per task
+#define FOSSIL_SANITY_LOG_QUERY_CHUNK_MAX (4 * 1024 * 1024)   // Largest; bounds the memory of a round
+
+// A matching line: offset from the chunk's base and length, newline excluded
+typedef struct fossil_sanity_log_query_span {
+    size_t offset;
+    size_t length;
+} fossil_sanity_log_query_span_t;
+
+// A slice of a file: text lines from begin to end, or ring records from
+// cursor first to last. Ring lines are rendered into text.
+typedef struct fossil_sanity_log_query_chunk {
+    const char *begin;
+    const char *end;
+    uint64_t first;
+    uint64_t last;
+    const char *base;                      // What span offsets count from
+    fossil_sanity_log_query_span_t *spans;
+    size_t count;
+    size_t capacity;
+    char *text;
+    size_t text_used;
+    size_t text_capacity;
+    bool failed;                           // Ran out of memory
+} fossil_sanity_log_query_chunk_t;
+
+typedef struct fossil_sanity_log_query_scan {
+    const fossil_sanity_log_query_t *query;
+    fossil_sanity_log_query_chunk_t *chunks;
+    size_t keyword_length;
+    size_t skip[256];                      // Horspool shifts for the keyword
+    bool attributes;                       // Lines must be parsed for the filters
+    const char *records;                   // Ring record area
+    uint64_t ring_capacity;
+} fossil_sanity_log_query_scan_t;
+
+// What a line tells about its entry; -1 and false where it does not say
+typedef struct fossil_sanity_log_line_info {
+    int level;
+    int severity;
+    bool timed;
+    uint64_t timestamp;
+} fossil_sanity_log_line_info_t;
+
+static const char *_fossil_sanity_log_find(const char *haystack, size_t size, const char *needle, size_t length) {
+    if (length == 0) return haystack;
+    const char *end = haystack + size;
+    while ((size_t)(end - haystack) >= length) {
+        const char *hit = (const char *)memchr(haystack, needle[0], (size_t)(end - haystack) - length + 1);
+        if (!hit) return NULL;
+        if (memcmp(hit + 1, needle + 1, length - 1) == 0) return hit;
+        haystack = hit + 1;
+    }
+    return NULL;
+}
+
+// Keywords of a few bytes are found faster by skipping ahead on the byte
+// under the end of the keyword than by scanning for its first byte
+static void _fossil_sanity_log_query_skips(fossil_sanity_log_query_scan_t *scan) {
+    const unsigned char *keyword = (const unsigned char *)scan->query->keyword;
+    size_t length = scan->keyword_length;
+    for (size_t i = 0; i < 256; i++) scan->skip[i] = length;
+    for (size_t i = 0; i + 1 < length; i++) scan->skip[keyword[i]] = length - 1 - i;
+}
+
+static const char *_fossil_sanity_log_query_find(const fossil_sanity_log_query_scan_t *scan, const char *haystack, size_t size) {
+    const char *keyword = scan->query->keyword;
+    size_t length = scan->keyword_length;
+    if (length < 4) return _fossil_sanity_log_find(haystack, size, keyword, length);
+
+    unsigned char last = (unsigned char)keyword[length - 1];
+    for (size_t position = 0; position + length <= size;) {
+        unsigned char under = (unsigned char)haystack[position + length - 1];
+        if (under == last && memcmp(haystack + position, keyword, length - 1) == 0) return haystack + position;
+        position += scan->skip[under];
+    }
+    return NULL;
+}
+
+static bool _fossil_sanity_log_scan_literal(const char **cursor, const char *end, const char *literal) {
+    size_t length = strlen(literal);
+    if ((size_t)(end - *cursor) < length || memcmp(*cursor, literal, length) != 0) return false;
+    *cursor += length;
+    return true;
+}
+
+static bool _fossil_sanity_log_scan_uint(const char **cursor, const char *end, uint64_t *value) {
+    const char *start = *cursor;
+    *value = 0;
+    while (*cursor < end && **cursor >= '0' && **cursor <= '9') {
+        *value = *value * 10 + (uint64_t)(**cursor - '0');
+        (*cursor)++;
+    }
+    return *cursor > start;
+}
+
+// A level or severity written as a name from the list, or as a number
+static int _fossil_sanity_log_scan_name(const char **cursor, const char *end, const char *const *names, int count, char stop) {
+    const char *start = *cursor;
+    while (*cursor < end && **cursor != stop) (*cursor)++;
+    size_t length = (size_t)(*cursor - start);
+    for (int i = 0; i < count; i++) {
+        if (strlen(names[i]) == length && memcmp(names[i], start, length) == 0) return i;
+    }
+    uint64_t number;
+    const char *digits = start;
+    if (_fossil_sanity_log_scan_uint(&digits, *cursor, &number) && digits == *cursor && number < 1000) return (int)number;
+    return -1;
+}
+
+// Read the level, severity and time of a line written by the library: a
+// JSON or logfmt encoding, or plain text behind a smart format tag
+static void _fossil_sanity_log_line_info(const char *line, const char *end, fossil_sanity_log_line_info_t *info) {
+    static const char *const levels[FOSSIL_SANITY_LOG_LEVEL_COUNT] = { "debug", "info", "warning", "error", "fatal" };
+    static const char *const severities[3] = { "low", "medium", "high" };
+    const char *cursor = line;
+    info->level = -1;
+    info->severity = -1;
+    info->timed = false;
+
+    bool json = _fossil_sanity_log_scan_literal(&cursor, end, "{\"ts\":");
+    if (json || _fossil_sanity_log_scan_literal(&cursor, end, "ts=")) {
+        info->timed = _fossil_sanity_log_scan_uint(&cursor, end, &info->timestamp);
+        if (!info->timed || !_fossil_sanity_log_scan_literal(&cursor, end, json ? ",\"level\":\"" : " level=")) return;
+        info->level = _fossil_sanity_log_scan_name(&cursor, end, levels, FOSSIL_SANITY_LOG_LEVEL_COUNT, json ? '"' : ' ');
+        if (!_fossil_sanity_log_scan_literal(&cursor, end, json ? "\",\"severity\":" : " severity=")) return;
+        bool quoted = json && _fossil_sanity_log_scan_literal(&cursor, end, "\"");
+        info->severity = _fossil_sanity_log_scan_name(&cursor, end, severities, 3, quoted ? '"' : json ? ',' : ' ');
         return;
     }
 
-    new_entry->priority = priority;
-    new_entry->severity = severity;
-    strncpy(new_entry->message, message, MAX_LOG_MESSAGE_LENGTH - 1);
-    new_entry->message[MAX_LOG_MESSAGE_LENGTH - 1] = '\0';  // Ensure null-termination
+    for (int level = 0; level < FOSSIL_SANITY_LOG_LEVEL_COUNT; level++) {
+        cursor = line;
+        if (_fossil_sanity_log_scan_literal(&cursor, end, _fossil_sanity_log_level_tag(level))) {
+            info->level = level;
+            return;
+        }
+    }
+}
 
-    new_entry->next = NULL;
-    new_entry->prev = NULL;
+static bool _fossil_sanity_log_query_accepts(const fossil_sanity_log_query_t *query, const fossil_sanity_log_line_info_t *info) {
+    unsigned int all = (1u << FOSSIL_SANITY_LOG_LEVEL_COUNT) - 1;
+    if ((query->levels & all) && (query->levels & all) != all &&
+        (info->level < 0 || info->level >= FOSSIL_SANITY_LOG_LEVEL_COUNT || !(query->levels & (1u << info->level)))) return false;
+    if (query->min_severity > 0 && info->severity < query->min_severity) return false;
+    if ((query->since || query->until) && !info->timed) return false;
+    if (query->since && info->timestamp < query->since) return false;
+    if (query->until && info->timestamp > query->until) return false;
+    return true;
+}
 
-    // Add the new log entry to the queue based on priority (Descending order)
-    if (!queue->head) {
-        queue->head = new_entry;
-        queue->tail = new_entry;
-    } else {
-        fossil_sanity_log_entry_t *current = queue->head;
-        while (current && current->priority >= priority) {
-            current = current->next;
+static void _fossil_sanity_log_query_hit(fossil_sanity_log_query_chunk_t *chunk, size_t offset, size_t length) {
+    if (chunk->count == chunk->capacity) {
+        size_t capacity = chunk->capacity ? chunk->capacity * 2 : 256;
+        fossil_sanity_log_query_span_t *spans = (fossil_sanity_log_query_span_t *)realloc(chunk->spans, capacity * sizeof(*spans));
+        if (!spans) {
+            chunk->failed = true;
+            return;
         }
-        if (!current) {
-            // Add to the tail
-            queue->tail->next = new_entry;
-            new_entry->prev = queue->tail;
-            queue->tail = new_entry;
-        } else if (current == queue->head) {
-            // Insert at the front
-            new_entry->next = queue->head;
-            queue->head->prev = new_entry;
-            queue->head = new_entry;
-        } else {
-            // Insert between current and current->prev
-            new_entry->prev = current->prev;
-            new_entry->next = current;
-            current->prev->next = new_entry;
-            current->prev = new_entry;
+        chunk->spans = spans;
+        chunk->capacity = capacity;
+    }
+    chunk->spans[chunk->count].offset = offset;
+    chunk->spans[chunk->count].length = length;
+    chunk->count++;
+}
+
+// Filter the lines of a text slice. With a keyword, jump from one
+// occurrence to the next instead of visiting every line.
+static void _fossil_sanity_log_query_text_task(size_t task, void *arg) {
+    fossil_sanity_log_query_scan_t *scan = (fossil_sanity_log_query_scan_t *)arg;
+    fossil_sanity_log_query_chunk_t *chunk = &scan->chunks[task];
+    const char *keyword = scan->keyword_length ? scan->query->keyword : NULL;
+    const char *cursor = chunk->begin;
+    const char *end = chunk->end;
+
+    while (cursor < end && !chunk->failed) {
+        const char *line = cursor;
+        const char *from = cursor;
+        if (keyword) {
+            from = _fossil_sanity_log_query_find(scan, cursor, (size_t)(end - cursor));
+            if (!from) break;
+            for (line = from; line > cursor && line[-1] != '\n'; line--);
+        }
+        const char *newline = (const char *)memchr(from, '\n', (size_t)(end - from));
+        const char *eol = newline ? newline : end;
+
+        fossil_sanity_log_line_info_t info;
+        if (scan->attributes) _fossil_sanity_log_line_info(line, eol, &info);
+        if (!scan->attributes || _fossil_sanity_log_query_accepts(scan->query, &info)) {
+            _fossil_sanity_log_query_hit(chunk, (size_t)(line - chunk->base), (size_t)(eol - line));
         }
+        cursor = eol + 1;
     }
 }
 
-// Pop the log with the highest priority
-char *fossil_sanity_log_pop(fossil_sanity_log_queue_t *queue) {
-    if (!queue->head) {
-        return NULL;
+// Filter the records of a ring slice, rendering matches as tagged lines
+static void _fossil_sanity_log_query_ring_task(size_t task, void *arg) {
+    fossil_sanity_log_query_scan_t *scan = (fossil_sanity_log_query_scan_t *)arg;
+    fossil_sanity_log_query_chunk_t *chunk = &scan->chunks[task];
+    const char *keyword = scan->keyword_length ? scan->query->keyword : NULL;
+
+    for (uint64_t cursor = chunk->first; cursor < chunk->last && !chunk->failed;) {
+        const fossil_sanity_log_record_t *record = (const fossil_sanity_log_record_t *)(scan->records + cursor % scan->ring_capacity);
+        uint64_t span = _fossil_sanity_log_ring_span(scan->records, scan->ring_capacity, cursor);
+        if (!span) break;  // Damaged: nothing after it can be trusted
+        cursor += span;
+        if (record->magic != FOSSIL_SANITY_LOG_RECORD_MAGIC) continue;
+
+        const char *message = (const char *)(record + 1);
+        fossil_sanity_log_line_info_t info = { record->priority, record->severity, true, record->timestamp };
+        if (!_fossil_sanity_log_query_accepts(scan->query, &info)) continue;
+        if (keyword && !_fossil_sanity_log_query_find(scan, message, record->length)) continue;
+
+        const char *tag = _fossil_sanity_log_level_tag(record->priority);
+        size_t tag_length = strlen(tag);
+        size_t length = tag_length + record->length;
+        if (chunk->text_used + length > chunk->text_capacity) {
+            size_t capacity = chunk->text_capacity ? chunk->text_capacity * 2 : 4096;
+            while (capacity < chunk->text_used + length) capacity *= 2;
+            char *text = (char *)realloc(chunk->text, capacity);
+            if (!text) {
+                chunk->failed = true;
+                return;
+            }
+            chunk->text = text;
+            chunk->text_capacity = capacity;
+        }
+        memcpy(chunk->text + chunk->text_used, tag, tag_length);
+        memcpy(chunk->text + chunk->text_used + tag_length, message, record->length);
+        _fossil_sanity_log_query_hit(chunk, chunk->text_used, length);
+        chunk->text_used += length;
     }
+    chunk->base = chunk->text;
+}
 
-    fossil_sanity_log_entry_t *log_to_pop = queue->head;
-    char *message = _custom_strdup(log_to_pop->message);
-    
-    queue->head = log_to_pop->next;
-    if (queue->head) {
-        queue->head->prev = NULL;
-    } else {
-        queue->tail = NULL;  // Queue is empty now
+// Run a round of chunks on the pool and hand their lines to the sink in
+// file order. False when the sink stops or memory runs out.
+static bool _fossil_sanity_log_query_round(fossil_sanity_log_query_scan_t *scan, size_t count, fossil_sanity_log_task_fn task,
+                                           fossil_sanity_log_line_fn sink, void *context, size_t *matched, bool *failed) {
+    _fossil_sanity_log_parallel_run(count, task, scan);
+    for (size_t i = 0; i < count; i++) {
+        if (scan->chunks[i].failed) {
+            errno = ENOMEM;
+            *failed = true;
+            return false;
+        }
     }
+    for (size_t i = 0; i < count; i++) {
+        fossil_sanity_log_query_chunk_t *chunk = &scan->chunks[i];
+        for (size_t s = 0; s < chunk->count; s++) {
+            (*matched)++;
+            if (!sink(chunk->base + chunk->spans[s].offset, chunk->spans[s].length, context)) return false;
+        }
+        chunk->count = 0;
+        chunk->text_used = 0;
+    }
+    return true;
+}
 
-    free(log_to_pop);
-    return message;
+static bool _fossil_sanity_log_query_text(fossil_sanity_log_query_scan_t *scan, size_t chunks, const char *data, size_t size,
+                                          fossil_sanity_log_line_fn sink, void *context, size_t *matched, bool *failed) {
+    size_t slice = size / chunks;
+    slice = slice < FOSSIL_SANITY_LOG_QUERY_CHUNK_MIN ? FOSSIL_SANITY_LOG_QUERY_CHUNK_MIN
+          : slice > FOSSIL_SANITY_LOG_QUERY_CHUNK_MAX ? FOSSIL_SANITY_LOG_QUERY_CHUNK_MAX : slice;
+    const char *cursor = data;
+    const char *end = data + size;
+
+    while (cursor < end) {
+        size_t count = 0;
+        for (; count < chunks && cursor < end; count++) {
+            fossil_sanity_log_query_chunk_t *chunk = &scan->chunks[count];
+            const char *stop = (size_t)(end - cursor) > slice ? cursor + slice : end;
+            const char *newline = stop < end ? (const char *)memchr(stop, '\n', (size_t)(end - stop)) : NULL;
+            chunk->begin = cursor;
+            chunk->end = newline ? newline + 1 : end;
+            chunk->base = data;
+            cursor = chunk->end;
+        }
+        if (!_fossil_sanity_log_query_round(scan, count, _fossil_sanity_log_query_text_task, sink, context, matched, failed)) return false;
+    }
+    return true;
 }
 
-// Print all logs in the queue
-void fossil_sanity_log_print(fossil_sanity_log_queue_t *queue) {
-    fossil_sanity_log_entry_t *current = queue->head;
-    while (current) {
-        if (smart_log_format) {
-            switch (current->priority) {
-                case FOSSIL_SANITY_LOG_LEVEL_DEBUG:
-                    printf("[DEBUG]: %s\n", current->message);
-                    break;
-                case FOSSIL_SANITY_LOG_LEVEL_INFO:
-                    printf("[INFO]: %s\n", current->message);
-                    break;
-                case FOSSIL_SANITY_LOG_LEVEL_WARNING:
-                    printf("[WARNING]: %s\n", current->message);
-                    break;
-                case FOSSIL_SANITY_LOG_LEVEL_ERROR:
-                    printf("[ERROR]: %s\n", current->message);
-                    break;
-                case FOSSIL_SANITY_LOG_LEVEL_FATAL:
-                    printf("[FATAL]: %s\n", current->message);
-                    break;
-                default:
-                    printf("[UNKNOWN]: %s\n", current->message);
-            }
-        } else {
-            printf("%s\n", current->message);
+static bool _fossil_sanity_log_query_ring(fossil_sanity_log_query_scan_t *scan, size_t chunks, const char *mapped,
+                                          fossil_sanity_log_line_fn sink, void *context, size_t *matched, bool *failed) {
+    const fossil_sanity_log_ring_header_t *header = (const fossil_sanity_log_ring_header_t *)mapped;
+    uint64_t commit = atomic_load_explicit(&header->commit, memory_order_acquire);
+    uint64_t cursor = atomic_load_explicit(&header->tail, memory_order_acquire);
+    scan->records = mapped + sizeof(fossil_sanity_log_ring_header_t);
+    scan->ring_capacity = header->capacity;
+    uint64_t slice = (commit - cursor) / chunks + 1;
+
+    // Cutting the ring walks the record headers only
+    size_t count = 0;
+    while (cursor < commit && count < chunks) {
+        fossil_sanity_log_query_chunk_t *chunk = &scan->chunks[count++];
+        chunk->first = cursor;
+        while (cursor < commit && cursor - chunk->first < slice) {
+            uint64_t span = _fossil_sanity_log_ring_span(scan->records, scan->ring_capacity, cursor);
+            cursor = span ? cursor + span : commit;
         }
-        current = current->next;
+        chunk->last = cursor;
     }
+    return _fossil_sanity_log_query_round(scan, count, _fossil_sanity_log_query_ring_task, sink, context, matched, failed);
 }
 
-// Clear all logs in the queue
-void fossil_sanity_log_clear(fossil_sanity_log_queue_t *queue) {
-    fossil_sanity_log_entry_t *current = queue->head;
-    while (current) {
-        fossil_sanity_log_entry_t *next = current->next;
-        free(current);
-        current = next;
+// Query one file, adding its matches to *matched; *stopped tells whether
+// the sink asked to stop
+static bool _fossil_sanity_log_query_path(const char *path, const fossil_sanity_log_query_t *query, fossil_sanity_log_line_fn sink, void *context,
+                                          size_t *matched, bool *stopped) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        perror("Failed to open log file for query");
+        if (fd >= 0) close(fd);
+        return false;
     }
-    queue->head = queue->tail = NULL;
+    size_t size = (size_t)info.st_size;
+    uint32_t magic = 0;
+    bool ring = size >= sizeof(fossil_sanity_log_ring_header_t) && pread(fd, &magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) &&
+                magic == FOSSIL_SANITY_LOG_RING_MAGIC;
+
+    char *mapped = NULL;
+    size_t mapped_size = size;
+    if (ring ? !_fossil_sanity_log_ring_map(fd, 0, false, &mapped, &mapped_size)
+             : size && (mapped = (char *)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+        perror("Failed to map log file for query");
+        close(fd);
+        return false;
+    }
+    close(fd);
+    if (!size) return true;
+    posix_madvise(mapped, mapped_size, POSIX_MADV_SEQUENTIAL);
+
+    size_t chunks = _fossil_sanity_log_parallelism() * FOSSIL_SANITY_LOG_PARALLEL_SPLIT;
+    fossil_sanity_log_query_scan_t scan = {
+        .query = query,
+        .chunks = (fossil_sanity_log_query_chunk_t *)calloc(chunks, sizeof(fossil_sanity_log_query_chunk_t)),
+        .keyword_length = query->keyword ? strlen(query->keyword) : 0,
+        .attributes = query->levels || query->min_severity > 0 || query->since || query->until,
+    };
+    if (scan.keyword_length) _fossil_sanity_log_query_skips(&scan);
+    if (!scan.chunks) {
+        perror("Failed to allocate memory for log query");
+        munmap(mapped, mapped_size);
+        return false;
+    }
+
+    bool failed = false;
+    bool more = ring ? _fossil_sanity_log_query_ring(&scan, chunks, mapped, sink, context, matched, &failed)
+                     : _fossil_sanity_log_query_text(&scan, chunks, mapped, size, sink, context, matched, &failed);
+    if (failed) perror("Failed to query log file");
+    *stopped = !more && !failed;
+
+    for (size_t i = 0; i < chunks; i++) {
+        free(scan.chunks[i].spans);
+        free(scan.chunks[i].text);
+    }
+    free(scan.chunks);
+    munmap(mapped, mapped_size);
+    return !failed;
 }
 
-// Sort logs in descending order of priority (Highest priority first)
-void fossil_sanity_log_sort(fossil_sanity_log_queue_t *queue) {
-    if (!queue->head) return;
+bool fossil_sanity_log_query_file(const char *path, const fossil_sanity_log_query_t *query, fossil_sanity_log_line_fn sink, void *context, size_t *matched) {
+    size_t found = 0;
+    bool stopped;
+    bool ok = _fossil_sanity_log_query_path(path, query, sink, context, &found, &stopped);
+    if (matched) *matched = found;
+    return ok;
+}
 
-    bool swapped;
-    do {
-        swapped = false;
-        fossil_sanity_log_entry_t *current = queue->head;
-        while (current && current->next) {
-            if (current->priority < current->next->priority) {
-                // Swap the log entries
-                int temp_priority = current->priority;
-                int temp_severity = current->severity;
-                char temp_message[MAX_LOG_MESSAGE_LENGTH];
-                strcpy(temp_message, current->message);
-
-                current->priority = current->next->priority;
-                current->severity = current->next->severity;
-                strcpy(current->message, current->next->message);
-
-                current->next->priority = temp_priority;
-                current->next->severity = temp_severity;
-                strcpy(current->next->message, temp_message);
-
-                swapped = true;
+// Query the rotated generations of a log, oldest first, then the log itself
+bool fossil_sanity_log_query_rotated(const char *path, const fossil_sanity_log_query_t *query, fossil_sanity_log_line_fn sink, void *context, size_t *matched) {
+    char generation[MAX_LOG_MESSAGE_LENGTH + 16];
+    struct stat info;
+    unsigned int oldest = 0;
+    size_t found = 0;
+    bool stopped = false;
+    bool ok = true;
+
+    while (snprintf(generation, sizeof(generation), "%s.%u", path, oldest + 1) < (int)sizeof(generation) && stat(generation, &info) == 0) {
+        oldest++;
+    }
+    for (unsigned int i = oldest; i > 0 && ok && !stopped; i--) {
+        snprintf(generation, sizeof(generation), "%s.%u", path, i);
+        ok = _fossil_sanity_log_query_path(generation, query, sink, context, &found, &stopped);
+    }
+
+    // Right after a rotation the log itself may not exist yet
+    if (ok && !stopped && (!oldest || stat(path, &info) == 0)) {
+        ok = _fossil_sanity_log_query_path(path, query, sink, context, &found, &stopped);
+    }
+    if (matched) *matched = found;
+    return ok;
+}
+
+// ==================================================================
+// Background writer
+// ==================================================================
+
+#define FOSSIL_SANITY_LOG_WRITER_BUFFER   (64 * 1024)
+#define FOSSIL_SANITY_LOG_WRITER_INTERVAL 10  // Milliseconds between idle drains
+
+struct fossil_sanity_log_writer {
+    fossil_sanity_log_queue_t *queue;
+    fossil_sanity_log_rotation_t rotation;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;         // Signals the writer thread
+    pthread_cond_t flushed;      // Signals callers waiting on a flush
+    uint64_t flush_requested;    // Flush generations asked for
+    uint64_t flush_completed;    // Flush generations finished
+    bool stopping;
+    size_t used;
+    char buffer[FOSSIL_SANITY_LOG_WRITER_BUFFER];
+};
+
+static void _fossil_sanity_log_writer_flush_buffer(fossil_sanity_log_writer_t *writer) {
+    if (!writer->used) return;
+    struct iovec iov = { writer->buffer, writer->used };
+    _fossil_sanity_log_rotation_writev(&writer->rotation, &iov, 1);
+    writer->used = 0;
+}
+
+// Format a deferred record straight into the output buffer
+static bool _fossil_sanity_log_writer_emit_deferred(fossil_sanity_log_writer_t *writer, const fossil_sanity_log_entry_t *entry, const char *tag, size_t tag_length) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t room = sizeof(writer->buffer) - writer->used;
+        if (room > tag_length + 1) {
+            char *text = writer->buffer + writer->used + tag_length;
+            size_t length = _fossil_sanity_log_entry_render(entry, text, room - tag_length);
+            if (length < room - tag_length) {
+                memcpy(writer->buffer + writer->used, tag, tag_length);
+                text[length] = '\n';
+                writer->used += tag_length + length + 1;
+                return true;
             }
-            current = current->next;
         }
-    } while (swapped);
+        _fossil_sanity_log_writer_flush_buffer(writer);
+    }
+    return false;
 }
 
-// Filter logs based on minimum priority (Only logs with higher or equal priority will be shown)
-void fossil_sanity_log_filter(fossil_sanity_log_queue_t *queue, int min_priority) {
-    fossil_sanity_log_entry_t *current = queue->head;
-    while (current) {
-        if (current->priority < min_priority) {
-            // Remove log entry
-            fossil_sanity_log_entry_t *to_remove = current;
-            current = current->next;
-            if (to_remove->prev) to_remove->prev->next = to_remove->next;
-            if (to_remove->next) to_remove->next->prev = to_remove->prev;
+// Encode an entry straight into the output buffer
+static void _fossil_sanity_log_writer_emit_encoded(fossil_sanity_log_writer_t *writer, const fossil_sanity_log_entry_t *entry, fossil_sanity_log_encoding_t encoding) {
+    size_t length = 0;
+    for (int attempt = 0; attempt < 2; attempt++) {
+        size_t room = sizeof(writer->buffer) - writer->used;
+        length = _fossil_sanity_log_encode(entry, encoding, writer->buffer + writer->used, room);
+        if (length < room) {
+            writer->buffer[writer->used + length] = '\n';
+            writer->used += length + 1;
+            return;
+        }
+        _fossil_sanity_log_writer_flush_buffer(writer);
+    }
+
+    // Larger than the whole buffer
+    char *text = (char *)malloc(length + 1);
+    if (!text) {
+        perror("Failed to allocate memory for log message");
+        return;
+    }
+    _fossil_sanity_log_encode(entry, encoding, text, length + 1);
+    struct iovec iov[2] = { { text, length }, { (void *)"\n", 1 } };
+    _fossil_sanity_log_rotation_writev(&writer->rotation, iov, 2);
+    free(text);
+}
+
+// Format one entry into the output buffer, spilling through writev when full
+static void _fossil_sanity_log_writer_emit(fossil_sanity_log_writer_t *writer, fossil_sanity_log_entry_t *entry) {
+    fossil_sanity_log_encoding_t encoding = (fossil_sanity_log_encoding_t)atomic_load_explicit(&log_encoding, memory_order_relaxed);
+    if (encoding != FOSSIL_SANITY_LOG_ENCODING_PLAIN || (entry->flags & FOSSIL_SANITY_LOG_ENTRY_FIELDS)) {
+        if (!_fossil_sanity_log_entry_resolve(writer->queue, entry)) return;  // Format once, not per attempt
+        _fossil_sanity_log_writer_emit_encoded(writer, entry, encoding);
+        return;
+    }
 
-            if (to_remove == queue->head) queue->head = current;
-            if (to_remove == queue->tail) queue->tail = current;
+    const char *tag = smart_log_format ? _fossil_sanity_log_level_tag(entry->priority) : "";
+    size_t tag_length = strlen(tag);
+    if (entry->flags & FOSSIL_SANITY_LOG_ENTRY_DEFERRED) {
+        if (_fossil_sanity_log_writer_emit_deferred(writer, entry, tag, tag_length)) return;
+        if (!_fossil_sanity_log_entry_resolve(writer->queue, entry)) return;  // Larger than the buffer
+    }
+    size_t need = tag_length + entry->length + 1;
+
+    if (writer->used + need > sizeof(writer->buffer)) {
+        if (need > sizeof(writer->buffer) / 2) {
+            // Large entry: send the pending buffer and the entry in one call
+            struct iovec iov[4] = {
+                { writer->buffer, writer->used },
+                { (void *)tag, tag_length },
+                { (void *)entry->message, entry->length },
+                { (void *)"\n", 1 }
+            };
+            _fossil_sanity_log_rotation_writev(&writer->rotation, iov, 4);
+            writer->used = 0;
+            return;
+        }
+        _fossil_sanity_log_writer_flush_buffer(writer);
+    }
+
+    memcpy(writer->buffer + writer->used, tag, tag_length);
+    memcpy(writer->buffer + writer->used + tag_length, entry->message, entry->length);
+    writer->buffer[writer->used + need - 1] = '\n';
+    writer->used += need;
+}
+
+// Write one entry and remove it from the queue
+static void _fossil_sanity_log_writer_take(fossil_sanity_log_writer_t *writer, fossil_sanity_log_entry_t *entry) {
+    if (writer->rotation.is_open) {
+        _fossil_sanity_log_writer_emit(writer, entry);
+    }
+    _fossil_sanity_log_unlink(writer->queue, entry);
+    _fossil_sanity_log_entry_free(writer->queue, entry);
+}
+
+// Drain the queue into the file. With settle set, keep going until no push
+// that completed before the call is still held up in the producer stage.
+static void _fossil_sanity_log_writer_drain(fossil_sanity_log_writer_t *writer, bool settle) {
+    fossil_sanity_log_queue_t *queue = writer->queue;
 
-            free(to_remove);
+    for (;;) {
+        uint64_t start = _fossil_sanity_log_timer();
+        uint64_t drained = 0;
+        bool settled = _fossil_sanity_log_collect(queue);
+
+        // A file is read as a timeline, so merge the levels by sequence, or
+        // sort the entries when a level is out of arrival order
+        size_t count = 0;
+        fossil_sanity_log_entry_t **order = NULL;
+        if (!_fossil_sanity_log_levels_in_sequence(queue)) {
+            order = _fossil_sanity_log_gather_arrival(queue, 0, UINT64_MAX, &count);
+        }
+        if (order) {
+            for (size_t i = 0; i < count; i++) _fossil_sanity_log_writer_take(writer, order[i]);
+            drained = count;
+            free(order);
         } else {
-            current = current->next;
+            fossil_sanity_log_entry_t *cursor[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+            fossil_sanity_log_entry_t *entry;
+            memcpy(cursor, queue->level_head, sizeof(cursor));
+            while ((entry = _fossil_sanity_log_next_oldest(cursor)) != NULL) {
+                _fossil_sanity_log_writer_take(writer, entry);
+                drained++;
+            }
         }
+        _fossil_sanity_log_count_drained(start, drained);
+        if (settled || !settle) break;
+        sched_yield();
     }
+
+    _fossil_sanity_log_writer_flush_buffer(writer);
+    fossil_sanity_log_rotate(&writer->rotation);
 }
 
-// Search for a log entry containing the keyword
-char *fossil_sanity_log_search(fossil_sanity_log_queue_t *queue, const char *keyword) {
-    fossil_sanity_log_entry_t *current = queue->head;
-    while (current) {
-        if (strstr(current->message, keyword)) {
-            return current->message;
+static void *_fossil_sanity_log_writer_main(void *arg) {
+    fossil_sanity_log_writer_t *writer = (fossil_sanity_log_writer_t *)arg;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        uint64_t target = writer->flush_requested;
+        bool stopping = writer->stopping;
+        pthread_mutex_unlock(&writer->lock);
+
+        _fossil_sanity_log_writer_drain(writer, stopping || target != writer->flush_completed);
+
+        pthread_mutex_lock(&writer->lock);
+        writer->flush_completed = target;
+        pthread_cond_broadcast(&writer->flushed);
+        if (stopping) break;
+
+        if (!writer->stopping && writer->flush_requested == target) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += FOSSIL_SANITY_LOG_WRITER_INTERVAL * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&writer->wake, &writer->lock, &deadline);
         }
-        current = current->next;
     }
+    pthread_mutex_unlock(&writer->lock);
     return NULL;
 }
 
-// Rotate log file when the size exceeds a threshold
-void fossil_sanity_log_rotate(fossil_sanity_log_rotation_t *rotation) {
-    FILE *file = fopen(rotation->log_file_path, "a");
-    if (!file) {
-        perror("Failed to open log file");
-        return;
+// Start a writer thread that drains the queue into the rotation's log file
+fossil_sanity_log_writer_t *fossil_sanity_log_writer_start(fossil_sanity_log_queue_t *queue, const fossil_sanity_log_rotation_t *rotation) {
+    if (!fossil_sanity_log_enable_concurrent(queue)) {
+        return NULL;
+    }
+
+    fossil_sanity_log_writer_t *writer = (fossil_sanity_log_writer_t *)calloc(1, sizeof(fossil_sanity_log_writer_t));
+    if (!writer) {
+        perror("Failed to allocate memory for log writer");
+        return NULL;
+    }
+    writer->queue = queue;
+    if (!fossil_sanity_log_rotation_open(&writer->rotation, rotation->log_file_path, rotation->max_size, rotation->max_files)) {
+        free(writer);
+        return NULL;
+    }
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->wake, NULL);
+    pthread_cond_init(&writer->flushed, NULL);
+    if (pthread_create(&writer->thread, NULL, _fossil_sanity_log_writer_main, writer) != 0) {
+        perror("Failed to start log writer");
+        fossil_sanity_log_rotation_close(&writer->rotation);
+        pthread_mutex_destroy(&writer->lock);
+        pthread_cond_destroy(&writer->wake);
+        pthread_cond_destroy(&writer->flushed);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+// Wait until everything pushed before this call is on disk
+void fossil_sanity_log_writer_flush(fossil_sanity_log_writer_t *writer) {
+    fossil_sanity_log_flush_thread();
+
+    pthread_mutex_lock(&writer->lock);
+    uint64_t target = ++writer->flush_requested;
+    pthread_cond_signal(&writer->wake);
+    while (writer->flush_completed < target) {
+        pthread_cond_wait(&writer->flushed, &writer->lock);
+    }
+    pthread_mutex_unlock(&writer->lock);
+}
+
+// Drain everything, stop the thread and close the file
+void fossil_sanity_log_writer_stop(fossil_sanity_log_writer_t *writer) {
+    if (!writer) return;
+    fossil_sanity_log_flush_thread();
+
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = true;
+    pthread_cond_signal(&writer->wake);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+
+    fossil_sanity_log_rotation_close(&writer->rotation);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->wake);
+    pthread_cond_destroy(&writer->flushed);
+    free(writer);
+}
+
+// ==================================================================
+// Notifications
+// ==================================================================
+
+typedef struct fossil_sanity_log_notify_sink {
+    fossil_sanity_log_notify_fn callback;
+    void *context;
+} fossil_sanity_log_notify_sink_t;
+
+// One process-wide notifier; alerts are not tied to a queue
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;      // Alerts queued, or stopping
+    pthread_cond_t space;      // Room freed for blocked producers
+    pthread_cond_t idle;       // Everything submitted has been handled
+    pthread_t thread;
+    bool running;
+    bool stopping;
+    bool delivering;
+    fossil_sanity_log_notify_config_t config;
+    char **ring;
+    char **batch;              // Alerts being delivered
+    size_t head;
+    size_t count;
+    fossil_sanity_log_notify_sink_t sinks[FOSSIL_SANITY_LOG_NOTIFY_SINKS];
+    size_t sink_count;
+    fossil_sanity_log_notify_stats_t stats;
+} notifier = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER,
+    .space = PTHREAD_COND_INITIALIZER,
+    .idle = PTHREAD_COND_INITIALIZER
+};
+
+static void _fossil_sanity_log_notify_deadline(struct timespec *deadline, unsigned int ms) {
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_sec += ms / 1000;
+    deadline->tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static void *_fossil_sanity_log_notify_main(void *arg) {
+    (void)arg;
+    char **batch = notifier.batch;
+    fossil_sanity_log_notify_sink_t sinks[FOSSIL_SANITY_LOG_NOTIFY_SINKS];
+
+    pthread_mutex_lock(&notifier.lock);
+    for (;;) {
+        while (!notifier.count && !notifier.stopping) {
+            pthread_cond_wait(&notifier.ready, &notifier.lock);
+        }
+        if (!notifier.count) break;  // Stopping with nothing left
+
+        // Give a partial batch a moment to fill up
+        if (notifier.count < notifier.config.batch && notifier.config.linger_ms && !notifier.stopping) {
+            struct timespec deadline;
+            _fossil_sanity_log_notify_deadline(&deadline, notifier.config.linger_ms);
+            while (notifier.count < notifier.config.batch && !notifier.stopping) {
+                if (pthread_cond_timedwait(&notifier.ready, &notifier.lock, &deadline) != 0) break;
+            }
+        }
+
+        size_t taken = notifier.count < notifier.config.batch ? notifier.count : notifier.config.batch;
+        for (size_t i = 0; i < taken; i++) {
+            batch[i] = notifier.ring[notifier.head];
+            notifier.head = (notifier.head + 1) % notifier.config.capacity;
+        }
+        notifier.count -= taken;
+        size_t sink_count = notifier.sink_count;
+        memcpy(sinks, notifier.sinks, sink_count * sizeof(sinks[0]));
+        notifier.delivering = true;
+        pthread_cond_broadcast(&notifier.space);
+        pthread_mutex_unlock(&notifier.lock);
+
+        for (size_t i = 0; i < sink_count; i++) {
+            sinks[i].callback((const char *const *)batch, taken, sinks[i].context);
+        }
+        for (size_t i = 0; i < taken; i++) {
+            free(batch[i]);
+        }
+
+        pthread_mutex_lock(&notifier.lock);
+        notifier.delivering = false;
+        notifier.stats.delivered += taken;
+        notifier.stats.batches++;
+        if (!notifier.count) {
+            pthread_cond_broadcast(&notifier.idle);
+        }
+    }
+    pthread_mutex_unlock(&notifier.lock);
+    return NULL;
+}
+
+// Start the notification thread
+bool fossil_sanity_log_notify_start(const fossil_sanity_log_notify_config_t *config) {
+    pthread_mutex_lock(&notifier.lock);
+    if (notifier.running) {
+        pthread_mutex_unlock(&notifier.lock);
+        return false;
+    }
+
+    notifier.config = *config;
+    if (!notifier.config.capacity) notifier.config.capacity = 1024;
+    if (!notifier.config.batch) notifier.config.batch = 32;
+    notifier.ring = (char **)calloc(notifier.config.capacity, sizeof(char *));
+    notifier.batch = (char **)calloc(notifier.config.batch, sizeof(char *));
+    if (!notifier.ring || !notifier.batch) {
+        perror("Failed to allocate memory for notifications");
+        free(notifier.ring);
+        free(notifier.batch);
+        pthread_mutex_unlock(&notifier.lock);
+        return false;
+    }
+    notifier.head = notifier.count = 0;
+    notifier.stopping = false;
+    memset(&notifier.stats, 0, sizeof(notifier.stats));
+
+    if (pthread_create(&notifier.thread, NULL, _fossil_sanity_log_notify_main, NULL) != 0) {
+        perror("Failed to start notification thread");
+        free(notifier.ring);
+        free(notifier.batch);
+        pthread_mutex_unlock(&notifier.lock);
+        return false;
+    }
+    notifier.running = true;
+    pthread_mutex_unlock(&notifier.lock);
+    return true;
+}
+
+bool fossil_sanity_log_notify_register(fossil_sanity_log_notify_fn callback, void *context) {
+    pthread_mutex_lock(&notifier.lock);
+    bool added = notifier.sink_count < FOSSIL_SANITY_LOG_NOTIFY_SINKS;
+    if (added) {
+        notifier.sinks[notifier.sink_count].callback = callback;
+        notifier.sinks[notifier.sink_count].context = context;
+        notifier.sink_count++;
+    }
+    pthread_mutex_unlock(&notifier.lock);
+    return added;
+}
+
+// Built-in sink: one "ALERT: ..." line per alert, a whole batch per writev
+static void _fossil_sanity_log_notify_fd_sink(const char *const *messages, size_t count, void *context) {
+    int fd = (int)(intptr_t)context;
+    struct iovec iov[3 * 16];
+    static const char prefix[] = "ALERT: Critical log - ";
+
+    for (size_t done = 0; done < count;) {
+        int used = 0;
+        for (; done < count && used < (int)(sizeof(iov) / sizeof(iov[0])); done++) {
+            iov[used++] = (struct iovec){ (void *)prefix, sizeof(prefix) - 1 };
+            iov[used++] = (struct iovec){ (void *)messages[done], strlen(messages[done]) };
+            iov[used++] = (struct iovec){ (void *)"\n", 1 };
+        }
+        struct iovec *cursor = iov;
+        while (used > 0) {
+            ssize_t written = writev(fd, cursor, used);
+            if (written < 0) {
+                if (errno == EINTR) continue;
+                return;  // A broken sink must not stall the notifier
+            }
+            while (used > 0 && (size_t)written >= cursor->iov_len) {
+                written -= (ssize_t)cursor->iov_len;
+                cursor++;
+                used--;
+            }
+            if (used > 0) {
+                cursor->iov_base = (char *)cursor->iov_base + written;
+                cursor->iov_len -= (size_t)written;
+            }
+        }
+    }
+}
+
+bool fossil_sanity_log_notify_register_fd(int fd) {
+    return fossil_sanity_log_notify_register(_fossil_sanity_log_notify_fd_sink, (void *)(intptr_t)fd);
+}
+
+// Wait until every submitted alert has been delivered or dropped
+void fossil_sanity_log_notify_flush(void) {
+    pthread_mutex_lock(&notifier.lock);
+    while (notifier.running && (notifier.count || notifier.delivering)) {
+        pthread_cond_wait(&notifier.idle, &notifier.lock);
     }
+    pthread_mutex_unlock(&notifier.lock);
+}
 
-    fseek(file, 0, SEEK_END);
-    rotation->current_size = ftell(file);
-    if (rotation->current_size > MAX_LOG_FILE_SIZE) {
-        // Rotate the log file (move the current log to a backup and create a new one)
-        fclose(file);
-        rename(rotation->log_file_path, "log_backup.txt");
-        file = fopen(rotation->log_file_path, "w");
+// Deliver what is queued, stop the thread and forget the sinks
+void fossil_sanity_log_notify_stop(void) {
+    pthread_mutex_lock(&notifier.lock);
+    if (!notifier.running) {
+        pthread_mutex_unlock(&notifier.lock);
+        return;
     }
+    notifier.stopping = true;
+    pthread_cond_broadcast(&notifier.ready);
+    pthread_cond_broadcast(&notifier.space);
+    pthread_mutex_unlock(&notifier.lock);
+    pthread_join(notifier.thread, NULL);
+
+    pthread_mutex_lock(&notifier.lock);
+    notifier.running = false;
+    notifier.sink_count = 0;
+    free(notifier.ring);
+    free(notifier.batch);
+    pthread_cond_broadcast(&notifier.idle);
+    pthread_mutex_unlock(&notifier.lock);
+}
 
-    fclose(file);
+void fossil_sanity_log_notify_stats(fossil_sanity_log_notify_stats_t *stats) {
+    pthread_mutex_lock(&notifier.lock);
+    *stats = notifier.stats;
+    pthread_mutex_unlock(&notifier.lock);
 }
 
 // Send a notification for critical logs (e.g., FATAL level)
 void fossil_sanity_log_notify(const char *message) {
-    printf("ALERT: Critical log - %s\n", message);  // Example notification (can be email or SMS in real applications)
+    pthread_mutex_lock(&notifier.lock);
+    if (!notifier.running) {
+        pthread_mutex_unlock(&notifier.lock);
+        printf("ALERT: Critical log - %s\n", message);  // Example notification (can be email or SMS in real applications)
+        return;
+    }
+
+    notifier.stats.submitted++;
+    if (notifier.config.policy == FOSSIL_SANITY_LOG_NOTIFY_BLOCK) {
+        while (notifier.count == notifier.config.capacity && !notifier.stopping) {
+            pthread_cond_wait(&notifier.space, &notifier.lock);
+        }
+    }
+    if (notifier.count == notifier.config.capacity || notifier.stopping) {
+        notifier.stats.dropped++;
+        if (notifier.config.policy != FOSSIL_SANITY_LOG_NOTIFY_DROP_OLDEST || notifier.stopping) {
+            pthread_mutex_unlock(&notifier.lock);
+            return;
+        }
+        free(notifier.ring[notifier.head]);
+        notifier.head = (notifier.head + 1) % notifier.config.capacity;
+        notifier.count--;
+    }
+
+    char *copy = _custom_strdup(message);
+    if (!copy) {
+        notifier.stats.dropped++;
+        pthread_mutex_unlock(&notifier.lock);
+        return;
+    }
+    notifier.ring[(notifier.head + notifier.count) % notifier.config.capacity] = copy;
+    notifier.count++;
+    pthread_cond_signal(&notifier.ready);
+    pthread_mutex_unlock(&notifier.lock);
 }
 
-// Log with smart formatting based on severity and level
-void fossil_sanity_log_smart_log(fossil_sanity_log_queue_t *queue, int level, int severity, const char *message) {
+// Enable duplicate suppression and rate limits for the smart log
+bool fossil_sanity_log_limit_enable(fossil_sanity_log_queue_t *queue, const fossil_sanity_log_limit_config_t *config) {
+    fossil_sanity_log_limiter_t *limiter = queue->limiter;
+    if (!limiter) {
+        limiter = (fossil_sanity_log_limiter_t *)calloc(1, sizeof(fossil_sanity_log_limiter_t));
+        if (!limiter) {
+            perror("Failed to allocate memory for log limits");
+            return false;
+        }
+        pthread_mutex_init(&limiter->lock, NULL);
+        queue->limiter = limiter;
+    }
+
+    uint64_t now = _fossil_sanity_log_now_ns();
+    pthread_mutex_lock(&limiter->lock);
+    limiter->config = *config;
+    for (int level = 0; level < FOSSIL_SANITY_LOG_LEVEL_COUNT; level++) {
+        unsigned int burst = config->burst[level] ? config->burst[level] : config->rate[level];
+        limiter->buckets[level].tokens = burst;  // Start full
+        limiter->buckets[level].refilled = now;
+    }
+    pthread_mutex_unlock(&limiter->lock);
+    return true;
+}
+
+void fossil_sanity_log_limit_flush(fossil_sanity_log_queue_t *queue) {
+    fossil_sanity_log_limiter_t *limiter = queue->limiter;
+    if (!limiter) return;
+
+    pthread_mutex_lock(&limiter->lock);
+    for (size_t i = 0; i < FOSSIL_SANITY_LOG_LIMIT_SLOTS; i++) {
+        if (limiter->recent[i].message) {
+            _fossil_sanity_log_recent_close(queue, &limiter->recent[i]);
+        }
+    }
+    pthread_mutex_unlock(&limiter->lock);
+}
+
+void fossil_sanity_log_limit_stats(fossil_sanity_log_queue_t *queue, fossil_sanity_log_limit_stats_t *stats) {
+    fossil_sanity_log_limiter_t *limiter = queue->limiter;
+    if (!limiter) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    pthread_mutex_lock(&limiter->lock);
+    *stats = limiter->stats;
+    pthread_mutex_unlock(&limiter->lock);
+}
+
+// Enable per-level sampling for the smart log
+bool fossil_sanity_log_sample_enable(fossil_sanity_log_queue_t *queue, const fossil_sanity_log_sample_config_t *config) {
+    fossil_sanity_log_sampler_t *sampler = queue->sampler;
+    if (!sampler) {
+        sampler = (fossil_sanity_log_sampler_t *)calloc(1, sizeof(fossil_sanity_log_sampler_t));
+        if (!sampler) {
+            perror("Failed to allocate memory for log sampling");
+            return false;
+        }
+    }
+
+    for (int level = 0; level < FOSSIL_SANITY_LOG_LEVEL_COUNT; level++) {
+        const fossil_sanity_log_sample_rule_t *rule = &config->levels[level];
+        fossil_sanity_log_sample_level_t *state = &sampler->levels[level];
+        uint64_t window = (uint64_t)(rule->window_ms ? rule->window_ms : 1000u) * 1000000u;
+        atomic_store_explicit(&state->n, rule->n, memory_order_relaxed);
+        atomic_store_explicit(&state->window, window, memory_order_relaxed);
+        atomic_store_explicit(&state->mode, (unsigned int)rule->mode, memory_order_relaxed);
+    }
+    queue->sampler = sampler;
+    return true;
+}
+
+// Limits, notification and push, once the gate and sampling have passed
+static void _fossil_sanity_log_smart_emit(fossil_sanity_log_queue_t *queue, int level, int severity, const char *message) {
+    fossil_sanity_log_limiter_t *limiter = queue->limiter;
+    if (limiter) {
+        uint64_t now = _fossil_sanity_log_now_ns();
+        int bucket = _fossil_sanity_log_level(level);
+        pthread_mutex_lock(&limiter->lock);
+        bool held = (limiter->config.window_ms && _fossil_sanity_log_limiter_coalesce(queue, limiter, level, severity, message, now))
+                 || !_fossil_sanity_log_limiter_admit(limiter, bucket, severity, now);
+        pthread_mutex_unlock(&limiter->lock);
+        if (held) {
+            return;
+        }
+    }
     if (severity == FOSSIL_SANITY_LOG_SEVERITY_HIGH) {
         fossil_sanity_log_notify(message);  // Notify if severity is high
     }
     fossil_sanity_log_push(queue, message, level, severity);
 }
 
+// Log with smart formatting based on severity and level
+void fossil_sanity_log_smart_log(fossil_sanity_log_queue_t *queue, int level, int severity, const char *message) {
+    if (!FOSSIL_SANITY_LOG_ENABLED(level)) {
+        return;
+    }
+    if (queue->sampler && !_fossil_sanity_log_sample(queue->sampler, level)) {
+        return;
+    }
+    _fossil_sanity_log_smart_emit(queue, level, severity, message);
+}
+
+// Format, then log, once the level gate and sampling have passed
+void fossil_sanity_log_smart_logv(fossil_sanity_log_queue_t *queue, int level, int severity, const char *format, va_list args) {
+    if (!FOSSIL_SANITY_LOG_ENABLED(level)) {
+        return;
+    }
+    if (queue->sampler && !_fossil_sanity_log_sample(queue->sampler, level)) {
+        return;
+    }
+
+    char buffer[MAX_LOG_MESSAGE_LENGTH];
+    va_list copy;
+    va_copy(copy, args);
+    int length = vsnprintf(buffer, sizeof(buffer), format, copy);
+    va_end(copy);
+    if (length < 0) {
+        return;
+    }
+
+    if ((size_t)length < sizeof(buffer)) {
+        _fossil_sanity_log_smart_emit(queue, level, severity, buffer);
+        return;
+    }
+
+    char *message = (char *)malloc((size_t)length + 1);
+    if (!message) {
+        perror("Failed to allocate memory for log message");
+        return;
+    }
+    vsnprintf(message, (size_t)length + 1, format, args);
+    _fossil_sanity_log_smart_emit(queue, level, severity, message);
+    free(message);
+}
+
+void fossil_sanity_log_smart_logf(fossil_sanity_log_queue_t *queue, int level, int severity, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fossil_sanity_log_smart_logv(queue, level, severity, format, args);
+    va_end(args);
+}
+
+// Runtime level gate
+void fossil_sanity_log_set_level(int level) {
+    atomic_store_explicit(&smart_log_level, level, memory_order_relaxed);
+}
+
+int fossil_sanity_log_get_level(void) {
+    return atomic_load_explicit(&smart_log_level, memory_order_relaxed);
+}
+
 // Enable or disable smart log format
 void fossil_sanity_log_set_smart_format(bool enable) {
     smart_log_format = enable;
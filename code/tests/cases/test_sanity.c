@@ -0,0 +1,1576 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 07/01/2024
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fossil/test/framework.h>
+#include <fossil/sanity/framework.h>
+#include <pthread.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Utilites
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// Setup steps for things like test fixtures and
+// mock objects are set here.
+// * * * * * * * * * * * * * * * * * * * * * * * *
+
+#define STRESS_PRODUCERS 8
+#define STRESS_PER_THREAD 20000
+
+typedef struct {
+    fossil_sanity_log_queue_t *queue;
+    int id;
+} stress_producer_t;
+
+static void *stress_produce(void *arg) {
+    stress_producer_t *producer = (stress_producer_t *)arg;
+    char message[64];
+    for (int i = 0; i < STRESS_PER_THREAD; i++) {
+        snprintf(message, sizeof(message), "%d %d", producer->id, i);
+        fossil_sanity_log_push(producer->queue, message, i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    return NULL;
+}
+
+static size_t count_lines(const char *path) {
+    FILE *file = fopen(path, "r");
+    size_t lines = 0;
+    int c;
+    if (!file) return 0;
+    while ((c = fgetc(file)) != EOF) {
+        if (c == '\n') lines++;
+    }
+    fclose(file);
+    return lines;
+}
+
+// Notification sink that counts alerts and the largest batch seen
+typedef struct {
+    pthread_mutex_t lock;
+    size_t alerts;
+    size_t largest_batch;
+} notify_counter_t;
+
+static void notify_count(const char *const *messages, size_t count, void *context) {
+    notify_counter_t *counter = (notify_counter_t *)context;
+    (void)messages;
+    pthread_mutex_lock(&counter->lock);
+    counter->alerts += count;
+    if (count > counter->largest_batch) counter->largest_batch = count;
+    pthread_mutex_unlock(&counter->lock);
+}
+
+// Notification sink that holds the notification thread until released
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    bool entered;
+    bool released;
+} notify_gate_t;
+
+static void notify_hold(const char *const *messages, size_t count, void *context) {
+    notify_gate_t *gate = (notify_gate_t *)context;
+    (void)messages;
+    (void)count;
+    pthread_mutex_lock(&gate->lock);
+    gate->entered = true;
+    pthread_cond_broadcast(&gate->changed);
+    while (!gate->released) pthread_cond_wait(&gate->changed, &gate->lock);
+    pthread_mutex_unlock(&gate->lock);
+}
+
+// Visitor recording up to four messages
+typedef struct {
+    char messages[4][32];
+    size_t count;
+} visit_record_t;
+
+static bool record_visit(const fossil_sanity_log_entry_t *entry, void *context) {
+    visit_record_t *record = (visit_record_t *)context;
+    snprintf(record->messages[record->count % 4], sizeof(record->messages[0]), "%s", entry->message);
+    record->count++;
+    return record->count < 4;
+}
+
+// Visitor counting entries
+static bool count_visit(const fossil_sanity_log_entry_t *entry, void *context) {
+    (void)entry;
+    (*(size_t *)context)++;
+    return true;
+}
+
+// Pushes ten debug entries from a short-lived thread
+static void *metrics_producer(void *arg) {
+    fossil_sanity_log_queue_t queue;
+    (void)arg;
+    fossil_sanity_log_init(&queue);
+    for (int i = 0; i < 10; i++) {
+        fossil_sanity_log_push(&queue, "x", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    fossil_sanity_log_destroy(&queue);
+    return NULL;
+}
+
+// Define the test suite and add test cases
+FOSSIL_TEST_SUITE(c_log_suite);
+
+// Setup function for the test suite
+FOSSIL_SETUP(c_log_suite) {
+    // Setup code here
+}
+
+// Teardown function for the test suite
+FOSSIL_TEARDOWN(c_log_suite) {
+    // Teardown code here
+}
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Cases
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// The test cases below are provided as samples, inspired
+// by the Meson build system's approach of using test cases
+// as samples for library usage.
+// * * * * * * * * * * * * * * * * * * * * * * * *
+
+FOSSIL_TEST_CASE(c_log_push_pop_order) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+
+    fossil_sanity_log_push(&queue, "info one", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "error one", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+    fossil_sanity_log_push(&queue, "info two", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "debug one", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "error two", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM);
+    FOSSIL_TEST_ASSUME(queue.count == 5, "Queue should hold five entries");
+
+    const char *expected[] = {"error one", "error two", "info one", "info two", "debug one"};
+    for (int i = 0; i < 5; i++) {
+        char *message = fossil_sanity_log_pop(&queue);
+        FOSSIL_TEST_ASSUME(message != NULL, "Pop should return a message");
+        FOSSIL_TEST_ASSUME(message && strcmp(message, expected[i]) == 0, "Pop should follow priority then FIFO order");
+        free(message);
+    }
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_pop(&queue) == NULL, "Empty queue should pop NULL");
+    FOSSIL_TEST_ASSUME(queue.head == NULL && queue.tail == NULL, "Empty queue should have no head or tail");
+    FOSSIL_TEST_ASSUME(queue.level_mask == 0, "Empty queue should have no active levels");
+
+    // Priorities outside the levels share the edge buckets in priority order
+    static const struct { const char *message; int priority; } pushes[] = {
+        {"fatal one", 4}, {"seven", 7}, {"fatal two", 4}, {"nine", 9}, {"debug one", 0}, {"below", -2},
+        {"debug two", 0}, {"info", 1}, {"lowest", -5}, {"fatal three", 4}
+    };
+    for (size_t i = 0; i < sizeof(pushes) / sizeof(pushes[0]); i++) {
+        fossil_sanity_log_push(&queue, pushes[i].message, pushes[i].priority, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    const char *ordered[] = {"nine", "seven", "fatal one", "fatal two", "fatal three", "info", "debug one", "debug two", "below", "lowest"};
+    for (int i = 0; i < 10; i++) {
+        char *message = fossil_sanity_log_pop(&queue);
+        FOSSIL_TEST_ASSUME(message && strcmp(message, ordered[i]) == 0, "Out-of-range priorities should keep descending order");
+        free(message);
+    }
+    FOSSIL_TEST_ASSUME(queue.count == 0 && queue.level_mask == 0, "The edge buckets should empty cleanly");
+} // end case
+
+FOSSIL_TEST_CASE(c_log_filter_keeps_buckets) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+
+    fossil_sanity_log_push(&queue, "debug", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "warning", FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM);
+    fossil_sanity_log_push(&queue, "info", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_filter(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO);
+
+    FOSSIL_TEST_ASSUME(queue.count == 2, "Filter should drop the debug entry");
+    FOSSIL_TEST_ASSUME(queue.tail && strcmp(queue.tail->message, "info") == 0, "Tail should be the info entry");
+
+    fossil_sanity_log_push(&queue, "info again", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "fatal", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+    FOSSIL_TEST_ASSUME(strcmp(queue.head->message, "fatal") == 0, "Fatal entry should lead the queue");
+    FOSSIL_TEST_ASSUME(strcmp(queue.tail->message, "info again") == 0, "Newest info entry should trail the queue");
+
+    fossil_sanity_log_clear(&queue);
+    FOSSIL_TEST_ASSUME(queue.count == 0 && queue.head == NULL, "Clear should empty the queue");
+} // end case
+
+FOSSIL_TEST_CASE(c_log_search) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+
+    fossil_sanity_log_push(&queue, "disk almost full", FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM);
+    fossil_sanity_log_push(&queue, "user logged in", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search(&queue, "logged") != NULL, "Search should find the keyword");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search(&queue, "network") == NULL, "Search should miss unknown keywords");
+
+    fossil_sanity_log_clear(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_indexed_search) {
+    fossil_sanity_log_queue_t queue;
+    const fossil_sanity_log_entry_t *results[4];
+    fossil_sanity_log_init(&queue);
+
+    fossil_sanity_log_push(&queue, "disk sda full", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_index_enable(&queue), "Index should be enabled");
+    fossil_sanity_log_push(&queue, "disk sdb full, disk offline", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+    fossil_sanity_log_push(&queue, "diskless boot", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "disk sdc full", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "disk", FOSSIL_SANITY_LOG_LEVEL_DEBUG, results, 4) == 3, "Whole tokens should match once per entry");
+    FOSSIL_TEST_ASSUME(strcmp(results[0]->message, "disk sdb full, disk offline") == 0, "Higher levels should come first");
+    FOSSIL_TEST_ASSUME(strcmp(results[1]->message, "disk sdc full") == 0, "Entries should keep insertion order");
+    FOSSIL_TEST_ASSUME(strcmp(results[2]->message, "disk sda full") == 0, "Entries indexed on enable should match");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "disk", FOSSIL_SANITY_LOG_LEVEL_WARNING, NULL, 0) == 2, "Level filter should apply");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "disk sd", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0) == 3, "Phrases should match as substrings");
+
+    fossil_sanity_log_filter(&queue, FOSSIL_SANITY_LOG_LEVEL_WARNING);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "disk", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0) == 2, "Filtered entries should leave the index");
+    char *message = fossil_sanity_log_pop(&queue);
+    free(message);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "sdb", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0) == 0, "Popped entries should leave the index");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "sdc", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0) == 1, "Remaining entries should stay indexed");
+
+    // Deferred entries are formatted and indexed by the next search, in order
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW, "disk %s full", "sdd");
+    fossil_sanity_log_push(&queue, "disk sde full", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW, "disk %s removed", "sdf");
+    FOSSIL_TEST_ASSUME(strcmp(queue.tail->message, "disk sdf removed") != 0, "An index should not format deferred entries on push");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "disk", FOSSIL_SANITY_LOG_LEVEL_DEBUG, results, 4) == 4 &&
+                       strcmp(results[1]->message, "disk sdd full") == 0 && strcmp(results[2]->message, "disk sde full") == 0 &&
+                       strcmp(results[3]->message, "disk sdf removed") == 0, "Deferred entries should be found in insertion order");
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_HIGH, "disk %s lost", "sdg");
+    message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, "disk sdg lost") == 0, "Unindexed entries should pop normally");
+    free(message);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "lost", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0) == 0 &&
+                       fossil_sanity_log_search_all(&queue, "sdf", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0) == 1, "Popped deferred entries should not be indexed");
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW, "disk %s back", "sdf");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "sdf", FOSSIL_SANITY_LOG_LEVEL_DEBUG, results, 4) == 2 &&
+                       strcmp(results[1]->message, "disk sdf back") == 0, "Each search should index the deferred entries pushed since the last");
+    fossil_sanity_log_destroy(&queue);
+
+    // Priorities past the highest level share its bucket
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_push(&queue, "four alarm", 4, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "seven alarm", 7, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "alarm", 5, results, 4) == 1 && strcmp(results[0]->message, "seven alarm") == 0,
+                       "A scan should look past lower priorities of the same level");
+    fossil_sanity_log_index_enable(&queue);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "alarm", 5, NULL, 0) == 1, "The index should agree with the scan");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_deferred_format) {
+    fossil_sanity_log_queue_t queue;
+    char expected[MAX_LOG_MESSAGE_LENGTH];
+    char rendered[MAX_LOG_MESSAGE_LENGTH];
+    const char name[4] = { 'd', 'i', 's', 'k' };  // Not NUL-terminated
+    fossil_sanity_log_init(&queue);
+
+    snprintf(expected, sizeof(expected), "%-6s|%5.2f|%lld|%zu|%c|%.*s|%*d|100%%", "io", 3.14159, -42LL, (size_t)7, 'x', 4, name, 4, 9);
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_HIGH,
+        "%-6s|%5.2f|%lld|%zu|%c|%.*s|%*d|100%%", "io", 3.14159, -42LL, (size_t)7, 'x', 4, name, 4, 9);
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, "request %d took %u ms", 17, 250u);
+
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_format_entry(queue.head, rendered, sizeof(rendered)) == strlen(expected), "Rendering should report the full length");
+    FOSSIL_TEST_ASSUME(strcmp(rendered, expected) == 0, "Rendering should match snprintf");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_format_entry(queue.head, rendered, 5) == strlen(expected) && strlen(rendered) == 4, "Rendering should truncate like snprintf");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search(&queue, "took 250") != NULL, "Search should see the formatted text");
+
+    char *message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, expected) == 0, "Pop should return the formatted text");
+    free(message);
+    message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, "request 17 took 250 ms") == 0, "Resolved entries should keep their text");
+    free(message);
+
+    fossil_sanity_log_enable_concurrent(&queue);
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM, "retry %d of %s", 3, "a rather long upstream host name");
+    message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, "retry 3 of a rather long upstream host name") == 0, "Concurrent pushes should defer too");
+    free(message);
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_smart_limits) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_limit_config_t config;
+    fossil_sanity_log_limit_stats_t stats;
+    char message[32];
+    fossil_sanity_log_init(&queue);
+
+    memset(&config, 0, sizeof(config));
+    config.window_ms = 60000;
+    config.rate[FOSSIL_SANITY_LOG_LEVEL_INFO] = 10;
+    config.burst[FOSSIL_SANITY_LOG_LEVEL_INFO] = 5;
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_limit_enable(&queue, &config), "Limits should be enabled");
+
+    for (int i = 0; i < 1000; i++) {
+        fossil_sanity_log_smart_log(&queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM, "disk failure");
+    }
+    FOSSIL_TEST_ASSUME(queue.count == 1, "Repeats within the window should fold into one entry");
+
+    for (int i = 0; i < 100; i++) {
+        snprintf(message, sizeof(message), "request %d", i);
+        fossil_sanity_log_smart_log(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, message);
+    }
+    FOSSIL_TEST_ASSUME(queue.count == 6, "The info bucket should admit its burst");
+
+    fossil_sanity_log_limit_stats(&queue, &stats);
+    FOSSIL_TEST_ASSUME(stats.coalesced == 999, "Folded repeats should be counted");
+    FOSSIL_TEST_ASSUME(stats.rate_limited[FOSSIL_SANITY_LOG_LEVEL_INFO] == 95, "Dropped entries should be counted per level");
+    FOSSIL_TEST_ASSUME(stats.rate_limited[FOSSIL_SANITY_LOG_LEVEL_ERROR] == 0, "Unlimited levels should drop nothing");
+
+    fossil_sanity_log_limit_flush(&queue);
+    char *first = fossil_sanity_log_pop(&queue);
+    char *summary = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(first && strcmp(first, "disk failure") == 0, "The first occurrence should be logged");
+    FOSSIL_TEST_ASSUME(summary && strcmp(summary, "disk failure (repeated 999 times)") == 0, "Flush should report the repeat count");
+    free(first);
+    free(summary);
+
+    // Long messages keep their full text in the summary
+    char text[600], expected[640];
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    snprintf(expected, sizeof(expected), "%s (repeated 2 times)", text);
+    for (int i = 0; i < 3; i++) {
+        fossil_sanity_log_smart_log(&queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM, text);
+    }
+    fossil_sanity_log_limit_flush(&queue);
+    free(fossil_sanity_log_pop(&queue));
+    summary = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(summary && strcmp(summary, expected) == 0, "A long summary should not be truncated");
+    free(summary);
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_bounded_eviction) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_set_capacity(&queue, 3);
+
+    fossil_sanity_log_push(&queue, "a", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "b", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "c", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "d", FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "e", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "f", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(queue.count == 3, "Queue should stay within its capacity");
+    FOSSIL_TEST_ASSUME(queue.evicted[FOSSIL_SANITY_LOG_LEVEL_DEBUG] == 2, "Least important entries should go first");
+    FOSSIL_TEST_ASSUME(queue.evicted[FOSSIL_SANITY_LOG_LEVEL_INFO] == 1, "Evictions should be counted per level");
+
+    FOSSIL_TEST_ASSUME(strcmp(fossil_sanity_log_peek_max(&queue)->message, "f") == 0, "Peek max should see the fatal entry");
+    FOSSIL_TEST_ASSUME(strcmp(fossil_sanity_log_peek_min(&queue)->message, "d") == 0, "Peek min should see the warning entry");
+    char *low = fossil_sanity_log_pop_min(&queue);
+    char *high = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(low && strcmp(low, "d") == 0, "Pop min should remove the least important entry");
+    FOSSIL_TEST_ASSUME(high && strcmp(high, "f") == 0, "Pop should still remove the most important entry");
+    free(low);
+    free(high);
+
+    for (int i = 0; i < 10000; i++) {
+        fossil_sanity_log_push(&queue, "storm", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    FOSSIL_TEST_ASSUME(queue.count == 3 && queue.level_head[FOSSIL_SANITY_LOG_LEVEL_ERROR] != NULL, "A storm should not push out important entries");
+    fossil_sanity_log_set_capacity(&queue, 1);
+    FOSSIL_TEST_ASSUME(queue.count == 1 && strcmp(queue.head->message, "b") == 0, "Lowering the capacity should evict at once");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_zero_copy) {
+    fossil_sanity_log_queue_t queue;
+    char small[3];
+    char buffer[32];
+    size_t length;
+    visit_record_t record;
+    memset(&record, 0, sizeof(record));
+    fossil_sanity_log_init(&queue);
+
+    fossil_sanity_log_push(&queue, "one", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "two", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "three", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "four", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "five", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "six", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_for_each(&queue, record_visit, &record) == 4, "Visitor should stop the walk");
+    FOSSIL_TEST_ASSUME(queue.count == 6 && strcmp(record.messages[3], "four") == 0, "Visiting should not remove entries");
+
+    FOSSIL_TEST_ASSUME(!fossil_sanity_log_pop_into(&queue, small, sizeof(small), &length) && length == 3, "A short buffer should report the length needed");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_pop_into(&queue, buffer, sizeof(buffer), &length) && strcmp(buffer, "one") == 0, "Pop into should copy the message");
+
+    const fossil_sanity_log_entry_t *entry = fossil_sanity_log_pop_borrow(&queue);
+    FOSSIL_TEST_ASSUME(entry && entry->length == 3 && strcmp(entry->message, "two") == 0, "Borrow should lend the next entry");
+    entry = fossil_sanity_log_pop_borrow(&queue);
+    FOSSIL_TEST_ASSUME(entry && strcmp(entry->message, "three") == 0 && queue.count == 3, "Borrowing again should move on");
+
+    memset(&record, 0, sizeof(record));
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_pop_batch(&queue, 2, record_visit, &record) == 2, "Batch should pop at most the limit");
+    FOSSIL_TEST_ASSUME(strcmp(record.messages[0], "four") == 0 && strcmp(record.messages[1], "five") == 0 && queue.count == 1, "Batch should pop in priority order");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_time_range) {
+    for (int indexed = 0; indexed < 2; indexed++) {
+        fossil_sanity_log_queue_t queue;
+        size_t seen = 0;
+        fossil_sanity_log_init(&queue);
+        if (indexed) {
+            fossil_sanity_log_push(&queue, "before index", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+            FOSSIL_TEST_ASSUME(fossil_sanity_log_time_index_enable(&queue), "Time index should be enabled");
+        }
+
+        for (int i = 0; i < 1000; i++) {
+            fossil_sanity_log_push(&queue, "early", i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        }
+        struct timespec pause = { 0, 20 * 1000000L };
+        nanosleep(&pause, NULL);
+        uint64_t middle = fossil_sanity_log_now();
+        for (int i = 0; i < 500; i++) {
+            fossil_sanity_log_push(&queue, "late", i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        }
+        FOSSIL_TEST_ASSUME(queue.head->timestamp != 0 && queue.head->timestamp <= fossil_sanity_log_now(), "Entries should carry timestamps");
+
+        FOSSIL_TEST_ASSUME(fossil_sanity_log_query_time(&queue, middle, UINT64_MAX, count_visit, &seen) == 500 && seen == 500, "Range should hold only the late entries");
+        seen = 0;
+        fossil_sanity_log_query_time(&queue, 0, middle, count_visit, &seen);
+        FOSSIL_TEST_ASSUME(seen == 1000u + (size_t)indexed, "Range should hold the early entries");
+
+        fossil_sanity_log_filter(&queue, FOSSIL_SANITY_LOG_LEVEL_WARNING);
+        seen = 0;
+        fossil_sanity_log_query_time(&queue, middle, UINT64_MAX, count_visit, &seen);
+        FOSSIL_TEST_ASSUME(seen == 300, "Removed entries should leave the range");
+
+        fossil_sanity_log_destroy(&queue);
+    }
+
+    // Oldest first also holds for concurrent pushes and after a sort by another key
+    struct timespec pause = { 0, 10 * 1000000L };
+    for (int mode = 0; mode < 2; mode++) {
+        fossil_sanity_log_queue_t queue;
+        visit_record_t record = { .count = 0 };
+        fossil_sanity_log_init(&queue);
+        if (mode == 0) {
+            fossil_sanity_log_enable_concurrent(&queue);
+            fossil_sanity_log_time_index_enable(&queue);
+        }
+        fossil_sanity_log_push(&queue, "older", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        nanosleep(&pause, NULL);
+        fossil_sanity_log_push(&queue, "newer", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+        fossil_sanity_log_push(&queue, "newest", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+        if (mode == 1) {
+            fossil_sanity_log_sort_by(&queue, fossil_sanity_log_compare_severity);
+        }
+        fossil_sanity_log_query_time(&queue, 0, UINT64_MAX, record_visit, &record);
+        FOSSIL_TEST_ASSUME(record.count == 3 && strcmp(record.messages[0], "older") == 0 && strcmp(record.messages[1], "newer") == 0 &&
+                           strcmp(record.messages[2], "newest") == 0, "Time queries should return the oldest entry first");
+        fossil_sanity_log_destroy(&queue);
+    }
+} // end case
+
+FOSSIL_TEST_CASE(c_log_metrics) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_metrics_t before, after;
+    pthread_t thread;
+    char text[1024], json[1024], small[8];
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_metrics_read(NULL, &before);
+    fossil_sanity_log_metrics_timing(true);
+
+    for (int i = 0; i < 3; i++) {
+        fossil_sanity_log_push(&queue, "abc", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    fossil_sanity_log_push(&queue, "boom", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+    fossil_sanity_log_set_capacity(&queue, 3);
+    free(fossil_sanity_log_pop(&queue));
+    pthread_create(&thread, NULL, metrics_producer, NULL);
+    pthread_join(thread, NULL);
+
+    fossil_sanity_log_metrics_read(&queue, &after);
+    fossil_sanity_log_metrics_timing(false);
+    FOSSIL_TEST_ASSUME(after.pushes[FOSSIL_SANITY_LOG_LEVEL_INFO] - before.pushes[FOSSIL_SANITY_LOG_LEVEL_INFO] == 3 &&
+                       after.pushes[FOSSIL_SANITY_LOG_LEVEL_ERROR] - before.pushes[FOSSIL_SANITY_LOG_LEVEL_ERROR] == 1, "Pushes should be counted per level");
+    FOSSIL_TEST_ASSUME(after.pushes[FOSSIL_SANITY_LOG_LEVEL_DEBUG] - before.pushes[FOSSIL_SANITY_LOG_LEVEL_DEBUG] == 10, "Exited threads should still count");
+    FOSSIL_TEST_ASSUME(after.bytes_stored - before.bytes_stored == 23, "Stored bytes should be counted");
+    FOSSIL_TEST_ASSUME(after.evicted - before.evicted == 1 && after.drained - before.drained == 1, "Evictions and drains should be counted");
+    FOSSIL_TEST_ASSUME(after.depth == 2 && after.peak_depth == 4, "Depth and peak should describe the queue");
+    FOSSIL_TEST_ASSUME(after.push_latency.count - before.push_latency.count == 14 && after.drain_latency.count >= 1, "Timed operations should be recorded");
+    FOSSIL_TEST_ASSUME(after.push_latency.p50 <= after.push_latency.p99 && after.push_latency.p99 <= after.push_latency.max, "Percentiles should be ordered");
+
+    size_t length = fossil_sanity_log_metrics_format(&after, FOSSIL_SANITY_LOG_METRICS_TEXT, text, sizeof(text));
+    FOSSIL_TEST_ASSUME(length == strlen(text) && strstr(text, "pushes.info ") && strstr(text, "push_latency count="), "Text should name every metric");
+    length = fossil_sanity_log_metrics_format(&after, FOSSIL_SANITY_LOG_METRICS_JSON, json, sizeof(json));
+    FOSSIL_TEST_ASSUME(json[0] == '{' && json[length - 1] == '}' && strstr(json, "\"peak_depth\":4"), "JSON should be one object");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_metrics_format(&after, FOSSIL_SANITY_LOG_METRICS_JSON, small, sizeof(small)) == length &&
+                       strlen(small) == sizeof(small) - 1, "A small buffer should truncate like snprintf");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_sampling) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_metrics_t before, after;
+    fossil_sanity_log_sample_config_t config;
+    memset(&config, 0, sizeof(config));
+    config.levels[FOSSIL_SANITY_LOG_LEVEL_DEBUG] = (fossil_sanity_log_sample_rule_t){ FOSSIL_SANITY_LOG_SAMPLE_ONE_IN_N, 10, 0 };
+    config.levels[FOSSIL_SANITY_LOG_LEVEL_INFO] = (fossil_sanity_log_sample_rule_t){ FOSSIL_SANITY_LOG_SAMPLE_RESERVOIR, 5, 60000 };
+    fossil_sanity_log_init(&queue);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_sample_enable(&queue, &config), "Sampling should be enabled");
+    fossil_sanity_log_metrics_read(NULL, &before);
+
+    for (int i = 0; i < 10000; i++) {
+        fossil_sanity_log_smart_logf(&queue, FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW, "debug %d", i);
+    }
+    for (int i = 0; i < 100; i++) {
+        fossil_sanity_log_smart_log(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, "info");
+    }
+    for (int i = 0; i < 3; i++) {
+        fossil_sanity_log_smart_log(&queue, FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_LOW, "warning");
+    }
+    fossil_sanity_log_metrics_read(NULL, &after);
+
+    uint64_t kept[FOSSIL_SANITY_LOG_LEVEL_COUNT], skipped[FOSSIL_SANITY_LOG_LEVEL_COUNT];
+    for (int level = 0; level < FOSSIL_SANITY_LOG_LEVEL_COUNT; level++) {
+        kept[level] = after.pushes[level] - before.pushes[level];
+        skipped[level] = after.sampled[level] - before.sampled[level];
+    }
+    FOSSIL_TEST_ASSUME(kept[FOSSIL_SANITY_LOG_LEVEL_DEBUG] + skipped[FOSSIL_SANITY_LOG_LEVEL_DEBUG] == 10000, "Skipped entries should be counted");
+    FOSSIL_TEST_ASSUME(kept[FOSSIL_SANITY_LOG_LEVEL_DEBUG] > 800 && kept[FOSSIL_SANITY_LOG_LEVEL_DEBUG] < 1200, "About one in ten should be kept");
+    FOSSIL_TEST_ASSUME(kept[FOSSIL_SANITY_LOG_LEVEL_INFO] == 5 && skipped[FOSSIL_SANITY_LOG_LEVEL_INFO] == 95, "A window should keep its budget");
+    FOSSIL_TEST_ASSUME(kept[FOSSIL_SANITY_LOG_LEVEL_WARNING] == 3 && skipped[FOSSIL_SANITY_LOG_LEVEL_WARNING] == 0, "Unsampled levels should keep everything");
+    FOSSIL_TEST_ASSUME(queue.count == kept[FOSSIL_SANITY_LOG_LEVEL_DEBUG] + 8, "Only kept entries should be queued");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_merge) {
+    static const char *expected[] = { "b-fatal", "a-error", "a-info", "b-info with a message longer than inline", "c-info", "d-info" };
+    fossil_sanity_log_queue_t a, b, c, dest;
+    fossil_sanity_log_pool_stats_t stats;
+    struct timespec pause = { 0, 10 * 1000000L };
+    fossil_sanity_log_init(&a);
+    fossil_sanity_log_init(&b);
+    fossil_sanity_log_init(&c);
+    fossil_sanity_log_init(&dest);
+    fossil_sanity_log_pool_reserve(&a, 8);
+    fossil_sanity_log_index_enable(&c);
+
+    fossil_sanity_log_push(&a, "a-info", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&a, "a-error", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    nanosleep(&pause, NULL);
+    fossil_sanity_log_push(&b, expected[3], FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&b, "b-fatal", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+    nanosleep(&pause, NULL);
+    fossil_sanity_log_push(&c, "c-info", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    nanosleep(&pause, NULL);
+    fossil_sanity_log_push(&dest, "d-info", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+
+    fossil_sanity_log_queue_t *sources[] = { &a, &b, NULL, &c };
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_merge(&dest, sources, 4) == 6, "Every entry should be merged");
+    FOSSIL_TEST_ASSUME(dest.count == 6 && a.count == 0 && b.head == NULL && c.count == 0, "Sources should be drained");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search(&c, "c-info") == NULL, "Moved entries should leave the source index");
+    fossil_sanity_log_pool_stats(&dest, &stats);
+    FOSSIL_TEST_ASSUME(stats.slab_count == 1 && stats.in_use == 2, "The destination should adopt the source slabs");
+    uint64_t sequences = 0;
+    for (const fossil_sanity_log_entry_t *entry = dest.head; entry; entry = entry->next) {
+        sequences |= 1u << entry->sequence;
+    }
+    FOSSIL_TEST_ASSUME(sequences == 0x7e && dest.sequence == 7, "Merged entries should be renumbered after the destination's own");
+    FOSSIL_TEST_ASSUME(dest.head->sequence == 4 && dest.tail->sequence == 6, "Numbers should follow the order entries were logged");
+    fossil_sanity_log_push(&dest, "d-late", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(dest.tail->sequence == 7, "Pushes should continue after the merged entries");
+    free(fossil_sanity_log_pop_min(&dest));
+
+    // The sources live on independently
+    fossil_sanity_log_push(&a, "again", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_destroy(&a);
+    fossil_sanity_log_destroy(&b);
+    for (size_t i = 0; i < 6; i++) {
+        char *message = fossil_sanity_log_pop(&dest);
+        FOSSIL_TEST_ASSUME(message && strcmp(message, expected[i]) == 0, "Merged entries should be in priority then time order");
+        free(message);
+    }
+
+    // Streaming stops when the sink does and leaves the rest queued
+    visit_record_t record = { .count = 0 };
+    for (int i = 0; i < 3; i++) {
+        fossil_sanity_log_push(&c, "c", FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        fossil_sanity_log_push(&dest, "d", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    fossil_sanity_log_queue_t *streams[] = { &c, &dest };
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_merge_stream(streams, 2, record_visit, &record) == 4, "The sink should stop the stream");
+    FOSSIL_TEST_ASSUME(strcmp(record.messages[2], "d") == 0 && strcmp(record.messages[3], "c") == 0, "Higher priorities should stream first");
+    FOSSIL_TEST_ASSUME(c.count == 2 && dest.count == 0, "Unvisited entries should stay queued");
+
+    // A non-empty destination takes a heap slot of its own
+    nanosleep(&pause, NULL);
+    fossil_sanity_log_push(&dest, "d-fatal", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_time_index_enable(&dest);
+    fossil_sanity_log_queue_t *only[] = { &c };
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_merge(&dest, only, 1) == 3 && dest.count == 3 && c.count == 0, "A full destination should merge with a full source");
+    FOSSIL_TEST_ASSUME(strcmp(dest.head->message, "d-fatal") == 0 && strcmp(dest.tail->message, "c") == 0, "Merged entries should keep priority order");
+    record.count = 0;
+    fossil_sanity_log_query_time(&dest, 0, UINT64_MAX, record_visit, &record);
+    FOSSIL_TEST_ASSUME(record.count == 3 && strcmp(record.messages[2], "d-fatal") == 0, "The time index should see the merge oldest first");
+
+    fossil_sanity_log_destroy(&c);
+    fossil_sanity_log_destroy(&dest);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_fields) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_field_t decoded[8];
+    char line[512], expected[512];
+    fossil_sanity_log_field_t fields[] = {
+        FOSSIL_SANITY_LOG_KV_INT("code", -42),
+        FOSSIL_SANITY_LOG_KV_DOUBLE("ratio", 3.25),
+        FOSSIL_SANITY_LOG_KV_STR("user", "a b\"c"),
+        FOSSIL_SANITY_LOG_KV_BOOL("ok", true)
+    };
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_set_smart_format(false);
+
+    fossil_sanity_log_push_fields(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, "request done", fields, 4);
+    const fossil_sanity_log_entry_t *entry = fossil_sanity_log_peek_max(&queue);
+    FOSSIL_TEST_ASSUME(entry->length == 12 && strcmp(entry->message, "request done") == 0, "The message should stay plain text");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_entry_fields(entry, decoded, 8) == 4, "Every field should be stored");
+    FOSSIL_TEST_ASSUME(decoded[0].value.i == -42 && decoded[1].value.d == 3.25 && strcmp(decoded[2].value.s, "a b\"c") == 0 &&
+                       decoded[3].value.b && strcmp(decoded[3].key, "ok") == 0, "Fields should read back with their types");
+
+    unsigned long long ts = (unsigned long long)entry->timestamp;
+    size_t length = fossil_sanity_log_encode_entry(entry, FOSSIL_SANITY_LOG_ENCODING_JSON, line, sizeof(line));
+    snprintf(expected, sizeof(expected), "{\"ts\":%llu,\"level\":\"info\",\"severity\":\"low\",\"msg\":\"request done\",\"code\":-42,\"ratio\":3.25,\"user\":\"a b\\\"c\",\"ok\":true}", ts);
+    FOSSIL_TEST_ASSUME(length == strlen(expected) && strcmp(line, expected) == 0, "JSON should carry the fields");
+    fossil_sanity_log_encode_entry(entry, FOSSIL_SANITY_LOG_ENCODING_LOGFMT, line, sizeof(line));
+    snprintf(expected, sizeof(expected), "ts=%llu level=info severity=low msg=\"request done\" code=-42 ratio=3.25 user=\"a b\\\"c\" ok=true", ts);
+    FOSSIL_TEST_ASSUME(strcmp(line, expected) == 0, "logfmt should quote only where needed");
+    fossil_sanity_log_encode_entry(entry, FOSSIL_SANITY_LOG_ENCODING_PLAIN, line, sizeof(line));
+    FOSSIL_TEST_ASSUME(strcmp(line, "request done code=-42 ratio=3.25 user=\"a b\\\"c\" ok=true") == 0, "Plain text should append the fields");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_encode_entry(entry, FOSSIL_SANITY_LOG_ENCODING_JSON, line, 10) == length && strlen(line) == 9, "A small buffer should truncate like snprintf");
+
+    char *message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, "request done") == 0, "Pop should return the message alone");
+    free(message);
+
+    // A deferred entry is encoded in full, however long it renders
+    static char wide[4096];
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, "%*d", 2000, 7);
+    length = fossil_sanity_log_encode_entry(queue.head, FOSSIL_SANITY_LOG_ENCODING_LOGFMT, wide, sizeof(wide));
+    FOSSIL_TEST_ASSUME(length == strlen(wide) && strstr(wide, " msg=\"") != NULL && strlen(strstr(wide, " msg=\"")) == 2007,
+                       "Deferred messages should not be clipped when encoded");
+    free(fossil_sanity_log_pop(&queue));
+
+    // The writer encodes straight into its file
+    fossil_sanity_log_rotation_t rotation;
+    fossil_sanity_log_rotation_init(&rotation, "fossil_sanity_fields_test.log", 0, 0);
+    remove(rotation.log_file_path);
+    fossil_sanity_log_set_encoding(FOSSIL_SANITY_LOG_ENCODING_JSON);
+    fossil_sanity_log_writer_t *writer = fossil_sanity_log_writer_start(&queue, &rotation);
+    FOSSIL_TEST_ASSUME(writer != NULL, "Writer should start");
+    fossil_sanity_log_push_fields(&queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_HIGH, "disk\tfull", fields, 1);
+    fossil_sanity_log_push(&queue, "plain", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, "%*d", 2000, 7);
+    fossil_sanity_log_writer_stop(writer);
+    fossil_sanity_log_set_encoding(FOSSIL_SANITY_LOG_ENCODING_PLAIN);
+
+    FILE *file = fopen(rotation.log_file_path, "r");
+    FOSSIL_TEST_ASSUME(file != NULL && fgets(line, sizeof(line), file) != NULL, "The file should hold the entry");
+    FOSSIL_TEST_ASSUME(strstr(line, "\"msg\":\"disk\\tfull\",\"code\":-42}\n") != NULL, "The writer should emit JSON lines");
+    FOSSIL_TEST_ASSUME(fgets(line, sizeof(line), file) != NULL && strstr(line, "\"msg\":\"plain\"}") != NULL, "Entries without fields should be encoded too");
+    FOSSIL_TEST_ASSUME(fgets(wide, sizeof(wide), file) != NULL && strlen(strstr(wide, "\"msg\":\"")) == 2010, "The writer should not clip deferred messages");
+    fclose(file);
+    remove(rotation.log_file_path);
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+static bool keep_above_info(const fossil_sanity_log_entry_t *entry, void *context) {
+    return entry->priority > *(const int *)context;
+}
+
+static bool same_order(const fossil_sanity_log_queue_t *a, const fossil_sanity_log_queue_t *b) {
+    const fossil_sanity_log_entry_t *x = a->head, *y = b->head;
+    for (; x && y; x = x->next, y = y->next) {
+        if (x->priority != y->priority || x->severity != y->severity || strcmp(x->message, y->message) != 0) return false;
+    }
+    return x == NULL && y == NULL && a->count == b->count;
+}
+
+FOSSIL_TEST_CASE(c_log_parallel) {
+    enum { TOTAL = 50000 };
+    fossil_sanity_log_queue_t serial, parallel;
+    char message[64];
+    int info = FOSSIL_SANITY_LOG_LEVEL_INFO;
+    fossil_sanity_log_init(&serial);
+    fossil_sanity_log_init(&parallel);
+    for (int i = 0; i < TOTAL; i++) {
+        int level = (i * 7) % FOSSIL_SANITY_LOG_LEVEL_COUNT;
+        int severity = (i * 13) % 3;
+        snprintf(message, sizeof(message), "event %d tok%d%s", i, i % 10, i % 3 ? "" : " with a longer tail than inline storage");
+        fossil_sanity_log_push(&serial, message, level, severity);
+        fossil_sanity_log_push(&parallel, message, level, severity);
+    }
+
+    static const fossil_sanity_log_entry_t *expected[TOTAL], *found[TOTAL];
+    static const char *keywords[] = { "tok3", "7 tok", "nothing" };
+    for (size_t k = 0; k < 3; k++) {
+        size_t count = fossil_sanity_log_search_all(&serial, keywords[k], FOSSIL_SANITY_LOG_LEVEL_INFO, expected, TOTAL);
+        FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all_parallel(&parallel, keywords[k], FOSSIL_SANITY_LOG_LEVEL_INFO, found, TOTAL) == count,
+                           "Parallel search should find as many entries");
+        bool same = true;
+        for (size_t i = 0; i < count; i++) same &= strcmp(expected[i]->message, found[i]->message) == 0;
+        FOSSIL_TEST_ASSUME(same, "Parallel search should return entries in the same order");
+    }
+
+    fossil_sanity_log_sort_by(&serial, fossil_sanity_log_compare_severity);
+    fossil_sanity_log_sort_parallel(&parallel, fossil_sanity_log_compare_severity);
+    FOSSIL_TEST_ASSUME(same_order(&serial, &parallel), "Parallel sort should match the serial sort");
+    fossil_sanity_log_sort_by(&serial, fossil_sanity_log_compare_sequence);
+    fossil_sanity_log_sort_parallel(&parallel, fossil_sanity_log_compare_sequence);
+    FOSSIL_TEST_ASSUME(same_order(&serial, &parallel), "Sorting back should match too");
+
+    fossil_sanity_log_filter(&serial, FOSSIL_SANITY_LOG_LEVEL_WARNING);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_filter_parallel(&parallel, keep_above_info, &info) == TOTAL - serial.count,
+                       "Parallel filter should remove as many entries");
+    FOSSIL_TEST_ASSUME(same_order(&serial, &parallel), "Parallel filter should keep the same entries");
+    char *top = fossil_sanity_log_pop(&parallel);
+    FOSSIL_TEST_ASSUME(top && strcmp(top, "event 2 tok2") == 0, "The queue should stay usable");
+    free(top);
+
+    fossil_sanity_log_destroy(&serial);
+    fossil_sanity_log_destroy(&parallel);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_pool_reuse) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_pool_stats_t stats;
+    fossil_sanity_log_init(&queue);
+
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_pool_reserve(&queue, 100), "Reserve should succeed");
+    fossil_sanity_log_pool_stats(&queue, &stats);
+    FOSSIL_TEST_ASSUME(stats.capacity >= 100, "Pool should hold the reserved capacity");
+    FOSSIL_TEST_ASSUME(stats.in_use == 0, "No entries should be in use yet");
+    size_t slabs = stats.slab_count;
+
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 100; i++) {
+            fossil_sanity_log_push(&queue, "pooled", i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        }
+        fossil_sanity_log_pool_stats(&queue, &stats);
+        FOSSIL_TEST_ASSUME(stats.in_use == 100, "Every queued entry should come from the pool");
+        for (int i = 0; i < 50; i++) {
+            free(fossil_sanity_log_pop(&queue));
+        }
+        fossil_sanity_log_filter(&queue, FOSSIL_SANITY_LOG_LEVEL_FATAL + 1);
+        fossil_sanity_log_clear(&queue);
+    }
+
+    fossil_sanity_log_pool_stats(&queue, &stats);
+    FOSSIL_TEST_ASSUME(stats.slab_count == slabs, "Steady state should not add slabs");
+    FOSSIL_TEST_ASSUME(stats.in_use == 0 && stats.available == stats.capacity, "Cleared entries should return to the pool");
+
+    fossil_sanity_log_destroy(&queue);
+    fossil_sanity_log_pool_stats(&queue, &stats);
+    FOSSIL_TEST_ASSUME(stats.slab_count == 0 && stats.bytes == 0, "Destroy should release the slabs");
+} // end case
+
+FOSSIL_TEST_CASE(c_log_long_messages) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+
+    static char medium[1024];
+    static char huge[70000];
+    memset(medium, 'm', sizeof(medium) - 1);
+    memset(huge, 'h', sizeof(huge) - 1);
+
+    fossil_sanity_log_push(&queue, "short", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, medium, FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, huge, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(queue.tail->length == 5, "Short message length should be recorded");
+
+    char *message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strlen(message) == sizeof(huge) - 1, "Huge message should not be truncated");
+    free(message);
+    message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, medium) == 0, "Medium message should round-trip intact");
+    free(message);
+    message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, "short") == 0, "Short message should round-trip intact");
+    free(message);
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_concurrent_stress) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_enable_concurrent(&queue), "Concurrent mode should enable");
+
+    pthread_t threads[STRESS_PRODUCERS];
+    stress_producer_t producers[STRESS_PRODUCERS];
+    for (int t = 0; t < STRESS_PRODUCERS; t++) {
+        producers[t].queue = &queue;
+        producers[t].id = t;
+        pthread_create(&threads[t], NULL, stress_produce, &producers[t]);
+    }
+
+    // Drain while producers are running; each producer's entries of one level must stay in order
+    int last[STRESS_PRODUCERS][FOSSIL_SANITY_LOG_LEVEL_COUNT];
+    memset(last, -1, sizeof(last));
+    int drained = 0;
+    bool ordered = true;
+    while (drained < STRESS_PRODUCERS * STRESS_PER_THREAD) {
+        char *message = fossil_sanity_log_pop(&queue);
+        if (!message) continue;
+        int id = -1, seq = -1;
+        sscanf(message, "%d %d", &id, &seq);
+        if (id < 0 || id >= STRESS_PRODUCERS || seq < 0) {
+            ordered = false;
+        } else {
+            int level = seq % FOSSIL_SANITY_LOG_LEVEL_COUNT;
+            if (seq <= last[id][level]) ordered = false;
+            last[id][level] = seq;
+        }
+        free(message);
+        drained++;
+    }
+
+    for (int t = 0; t < STRESS_PRODUCERS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    FOSSIL_TEST_ASSUME(drained == STRESS_PRODUCERS * STRESS_PER_THREAD, "Every pushed entry should be drained");
+    FOSSIL_TEST_ASSUME(ordered, "Entries should keep per-producer FIFO order within a level");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_pop(&queue) == NULL, "Queue should be empty afterwards");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_thread_buffering) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_enable_thread_buffering(&queue, 16), "Thread buffering should enable");
+
+    // Staged entries stay private until the thread flushes
+    fossil_sanity_log_push(&queue, "low", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "high", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_pop(&queue) == NULL, "Staged entries should not be visible yet");
+    fossil_sanity_log_flush_thread();
+    char *message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, "high") == 0, "Flushed entries should drain by priority");
+    free(message);
+    message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, "low") == 0, "Lower priority entry should follow");
+    free(message);
+
+    // Worker threads publish their partial last batch when they exit
+    pthread_t threads[STRESS_PRODUCERS];
+    stress_producer_t producers[STRESS_PRODUCERS];
+    for (int t = 0; t < STRESS_PRODUCERS; t++) {
+        producers[t].queue = &queue;
+        producers[t].id = t;
+        pthread_create(&threads[t], NULL, stress_produce, &producers[t]);
+    }
+    for (int t = 0; t < STRESS_PRODUCERS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    int drained = 0;
+    bool ordered = true;
+    message = fossil_sanity_log_pop(&queue);  // Collects everything published so far
+    if (message) {
+        free(message);
+        drained++;
+    }
+    for (const fossil_sanity_log_entry_t *entry = queue.head; entry && entry->next; entry = entry->next) {
+        if (entry->priority < entry->next->priority) ordered = false;
+    }
+    while ((message = fossil_sanity_log_pop(&queue)) != NULL) {
+        free(message);
+        drained++;
+    }
+    FOSSIL_TEST_ASSUME(drained == STRESS_PRODUCERS * STRESS_PER_THREAD, "Every staged entry should be published on thread exit");
+    FOSSIL_TEST_ASSUME(ordered, "Published entries should drain in priority order");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_background_writer) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_rotation_t rotation;
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_rotation_init(&rotation, "fossil_sanity_writer_test.log", 0, 0);
+    remove(rotation.log_file_path);
+
+    fossil_sanity_log_writer_t *writer = fossil_sanity_log_writer_start(&queue, &rotation);
+    FOSSIL_TEST_ASSUME(writer != NULL, "Writer should start");
+
+    // The file is written in the order entries were pushed, whatever their level
+    fossil_sanity_log_push(&queue, "first-debug", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "second-info", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "third-fatal", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+    fossil_sanity_log_writer_flush(writer);
+    char line[128];
+    bool chronological = true;
+    FILE *file = fopen(rotation.log_file_path, "r");
+    static const char *order[] = { "first-debug", "second-info", "third-fatal" };
+    for (int i = 0; i < 3; i++) {
+        chronological = chronological && file && fgets(line, sizeof(line), file) && strstr(line, order[i]);
+    }
+    if (file) fclose(file);
+    FOSSIL_TEST_ASSUME(chronological, "The writer should drain oldest first");
+
+    for (int i = 0; i < 997; i++) {
+        fossil_sanity_log_push(&queue, "written by the background thread", i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    fossil_sanity_log_writer_flush(writer);
+    FOSSIL_TEST_ASSUME(count_lines(rotation.log_file_path) == 1000, "Flush should put every pushed entry on disk");
+
+    for (int i = 0; i < 500; i++) {
+        fossil_sanity_log_push(&queue, "drained on shutdown", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    fossil_sanity_log_writer_stop(writer);
+    FOSSIL_TEST_ASSUME(count_lines(rotation.log_file_path) == 1500, "Stop should drain the remaining entries");
+    FOSSIL_TEST_ASSUME(queue.head == NULL, "Queue should be empty after the writer stops");
+
+    fossil_sanity_log_destroy(&queue);
+    remove(rotation.log_file_path);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_rotation_generations) {
+    static const char *path = "fossil_sanity_rotation_test.log";
+    char line[41];
+    fossil_sanity_log_rotation_t rotation;
+    remove(path);
+    remove("fossil_sanity_rotation_test.log.1");
+    remove("fossil_sanity_rotation_test.log.2");
+    memset(line, 'x', sizeof(line) - 1);
+    line[sizeof(line) - 2] = '\n';
+
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_rotation_open(&rotation, path, 100, 2), "Rotation should open the file");
+    for (int i = 0; i < 12; i++) {
+        FOSSIL_TEST_ASSUME(fossil_sanity_log_rotation_write(&rotation, line, sizeof(line) - 1), "Write should succeed");
+        fossil_sanity_log_rotate(&rotation);
+    }
+    FOSSIL_TEST_ASSUME(rotation.current_size == 0, "Size should be tracked from writes");
+    FOSSIL_TEST_ASSUME(count_lines(path) == 0, "Current file should start over after a rotation");
+    FOSSIL_TEST_ASSUME(count_lines("fossil_sanity_rotation_test.log.1") == 3, "Newest generation should be numbered 1");
+    FOSSIL_TEST_ASSUME(count_lines("fossil_sanity_rotation_test.log.2") == 3, "Older generations should be kept");
+    FOSSIL_TEST_ASSUME(count_lines("fossil_sanity_rotation_test.log.3") == 0, "Generations past the limit should be dropped");
+    fossil_sanity_log_rotation_close(&rotation);
+
+    char long_path[MAX_LOG_MESSAGE_LENGTH + 8];
+    memset(long_path, 'p', sizeof(long_path) - 1);
+    long_path[sizeof(long_path) - 1] = '\0';
+    FOSSIL_TEST_ASSUME(!fossil_sanity_log_rotation_open(&rotation, long_path, 0, 0) && !rotation.is_open, "A path that does not fit should be refused");
+
+    // A rotation set up without opening checks the file on disk
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_rotation_init(&rotation, "fossil_sanity_rotation_test.log.1", 1000, 2) && !rotation.is_open, "Init should not open the file");
+    fossil_sanity_log_rotate(&rotation);
+    FOSSIL_TEST_ASSUME(rotation.current_size == 120 && count_lines("fossil_sanity_rotation_test.log.1") == 3, "A small file should not rotate");
+
+    remove(path);
+    remove("fossil_sanity_rotation_test.log.1");
+    remove("fossil_sanity_rotation_test.log.2");
+} // end case
+
+FOSSIL_TEST_CASE(c_log_ring_recovery) {
+    static const char *path = "fossil_sanity_ring_test.log";
+    fossil_sanity_log_queue_t queue;
+    char expected[32];
+    int status = 0;
+    remove(path);
+
+    // The child dies without closing the ring, as a crashing process would
+    pid_t child = fork();
+    if (child == 0) {
+        fossil_sanity_log_ring_t *ring = fossil_sanity_log_ring_open(path, 4096);
+        for (int i = 0; ring && i < 500; i++) {
+            snprintf(expected, sizeof(expected), "ring entry %d", i);
+            fossil_sanity_log_ring_append(ring, expected, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        }
+        _exit(ring ? 0 : 1);
+    }
+    FOSSIL_TEST_ASSUME(child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == 0, "Child should fill the ring");
+
+    fossil_sanity_log_init(&queue);
+    size_t recovered = fossil_sanity_log_ring_recover(path, &queue, 0);
+    FOSSIL_TEST_ASSUME(recovered > 10 && recovered < 500, "A full ring should hold only the newest entries");
+    bool consecutive = true;
+    for (size_t i = 0; i < recovered; i++) {
+        char *message = fossil_sanity_log_pop(&queue);
+        snprintf(expected, sizeof(expected), "ring entry %zu", 500 - recovered + i);
+        consecutive = consecutive && message && strcmp(message, expected) == 0;
+        free(message);
+    }
+    FOSSIL_TEST_ASSUME(consecutive, "Recovered entries should be the newest, oldest first");
+
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_ring_recover(path, &queue, 3) == 3, "Recovery should honor the entry limit");
+    char *message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, "ring entry 497") == 0, "Limited recovery should keep the newest entries");
+    free(message);
+    fossil_sanity_log_clear(&queue);
+
+    fossil_sanity_log_ring_t *ring = fossil_sanity_log_ring_open(path, 0);
+    FOSSIL_TEST_ASSUME(ring != NULL, "An existing ring should reopen");
+    uint64_t appended = fossil_sanity_log_now();
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_ring_append(ring, "after restart", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_HIGH), "Append should succeed");
+    fossil_sanity_log_ring_close(ring);
+    struct timespec pause = { 0, 20 * 1000000 };
+    nanosleep(&pause, NULL);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_ring_recover(path, &queue, 1) == 1, "Recovery should see the new entry");
+    FOSSIL_TEST_ASSUME(queue.head && strcmp(queue.head->message, "after restart") == 0, "Appends should continue after a restart");
+    FOSSIL_TEST_ASSUME(queue.head->timestamp >= appended && queue.head->timestamp < appended + 10 * 1000000, "Recovered entries should keep their append time");
+
+    fossil_sanity_log_destroy(&queue);
+    remove(path);
+} // end case
+
+typedef struct shm_record {
+    pid_t pids[4];
+    long long next[4];  // Next sequence expected from each producer
+    size_t count;
+    bool ordered;
+} shm_record_t;
+
+static bool shm_collect(const fossil_sanity_log_entry_t *entry, void *context) {
+    shm_record_t *record = (shm_record_t *)context;
+    fossil_sanity_log_field_t fields[2];
+    if (fossil_sanity_log_entry_fields(entry, fields, 2) != 2 || strcmp(fields[0].key, "pid") != 0) {
+        record->ordered = false;
+        return true;
+    }
+    for (int i = 0; i < 4; i++) {
+        if (record->pids[i] == (pid_t)fields[0].value.i) {
+            record->ordered = record->ordered && fields[1].value.i == record->next[i] && entry->sequence == (uint64_t)record->next[i];
+            record->next[i]++;
+        }
+    }
+    record->count++;
+    return true;
+}
+
+FOSSIL_TEST_CASE(c_log_shm_collector) {
+    enum { PRODUCERS = 4, PER_PRODUCER = 300 };
+    char name[64];
+    fossil_sanity_log_shm_stats_t stats;
+    shm_record_t record = { .ordered = true };
+    int status = 0;
+    snprintf(name, sizeof(name), "/fossil_sanity_shm_test_%d", (int)getpid());
+    fossil_sanity_log_shm_unlink(name);
+
+    fossil_sanity_log_shm_t *shm = fossil_sanity_log_shm_create(name, 2048);
+    FOSSIL_TEST_ASSUME(shm != NULL, "The collector should create the ring");
+
+    // A producer dies holding a claimed slot, ahead of everyone else
+    pid_t crashed = fork();
+    if (crashed == 0) {
+        char *buffer = fossil_sanity_log_shm_begin(shm, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+        if (buffer) strcpy(buffer, "never committed");
+        _exit(buffer ? 0 : 1);
+    }
+    FOSSIL_TEST_ASSUME(crashed > 0 && waitpid(crashed, &status, 0) == crashed && WEXITSTATUS(status) == 0, "The crashing producer should claim a slot");
+
+    for (int p = 0; p < PRODUCERS; p++) {
+        record.pids[p] = fork();
+        if (record.pids[p] == 0) {
+            // One child attaches by name, the others use the inherited mapping
+            fossil_sanity_log_shm_t *ring = p == 0 ? fossil_sanity_log_shm_open(name) : shm;
+            char message[64];
+            bool pushed = ring != NULL;
+            for (int i = 0; pushed && i < PER_PRODUCER; i++) {
+                snprintf(message, sizeof(message), "producer %d entry %d", p, i);
+                pushed = fossil_sanity_log_shm_push(ring, message, i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+            }
+            _exit(pushed ? 0 : 1);
+        }
+    }
+    bool exited = true;
+    for (int p = 0; p < PRODUCERS; p++) {
+        exited = exited && record.pids[p] > 0 && waitpid(record.pids[p], &status, 0) == record.pids[p] && WEXITSTATUS(status) == 0;
+    }
+    FOSSIL_TEST_ASSUME(exited, "Every producer should push all of its entries");
+
+    fossil_sanity_log_shm_stats(shm, &stats);
+    FOSSIL_TEST_ASSUME(stats.capacity == 2048 && stats.pending == PRODUCERS * PER_PRODUCER + 1, "Every claim should be pending");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_shm_drain_to(shm, shm_collect, &record, 0) == PRODUCERS * PER_PRODUCER, "Every committed entry should be collected");
+    FOSSIL_TEST_ASSUME(record.ordered, "Each producer's entries should arrive in its own sequence");
+    fossil_sanity_log_shm_stats(shm, &stats);
+    FOSSIL_TEST_ASSUME(stats.pending == 0 && stats.abandoned == 1 && stats.dropped == 0, "The dead producer's slot should be reclaimed");
+
+    // A full ring refuses pushes; the collector feeds a queue
+    fossil_sanity_log_shm_t *small = fossil_sanity_log_shm_create(name, 4);
+    FOSSIL_TEST_ASSUME(small != NULL, "The ring should be recreated at a new size");
+    for (int i = 0; i < 4; i++) {
+        fossil_sanity_log_shm_push(small, "filler", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    FOSSIL_TEST_ASSUME(!fossil_sanity_log_shm_push(small, "one too many", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW), "A full ring should refuse pushes");
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    struct timespec pause = { 0, 20 * 1000000 };
+    nanosleep(&pause, NULL);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_shm_drain(small, &queue, 3) == 3 && queue.count == 3, "Drain should honor its limit");
+    fossil_sanity_log_push(&queue, "collector", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(queue.tail->timestamp - queue.head->timestamp >= 10 * 1000000 && queue.tail->sequence == 3,
+                       "Queued entries should keep the time they were logged");
+    fossil_sanity_log_field_t fields[2], next[2];
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_entry_fields(queue.head, fields, 2) == 2 && fields[0].value.i == getpid() &&
+                       fossil_sanity_log_entry_fields(queue.head->next, next, 2) == 2 && next[1].value.i == fields[1].value.i + 1,
+                       "Queued entries should name their producer");
+    FOSSIL_TEST_ASSUME(strcmp(queue.head->message, "filler") == 0, "Queued entries should keep their message");
+    fossil_sanity_log_shm_stats(small, &stats);
+    FOSSIL_TEST_ASSUME(stats.dropped == 1 && stats.pending == 1, "The refused push should be counted");
+
+    fossil_sanity_log_destroy(&queue);
+    fossil_sanity_log_shm_close(small);
+    fossil_sanity_log_shm_close(shm);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_shm_unlink(name), "The ring should be removed");
+} // end case
+
+typedef struct query_record {
+    size_t count;
+    long last;      // Number in the last "event N" line
+    bool ordered;
+    size_t stop_after;
+    char first[128];
+} query_record_t;
+
+static bool query_collect(const char *line, size_t length, void *context) {
+    query_record_t *record = (query_record_t *)context;
+    const char *event = strstr(line, "event ");
+    if (record->count == 0) snprintf(record->first, sizeof(record->first), "%.*s", (int)length, line);
+    if (event && event < line + length) {
+        long number = strtol(event + 6, NULL, 10);
+        record->ordered = record->ordered && number > record->last;
+        record->last = number;
+    }
+    record->count++;
+    return !record->stop_after || record->count < record->stop_after;
+}
+
+FOSSIL_TEST_CASE(c_log_query) {
+    static const char *levels[] = { "debug", "info", "warning", "error", "fatal" };
+    static const char *severities[] = { "low", "medium", "high" };
+    static const char *path = "fossil_sanity_query_test.log";
+    enum { LINES = 20000 };
+    fossil_sanity_log_query_t query;
+    size_t matched = 0;
+
+    // Two rotated generations, then the current file in JSON
+    FILE *file = fopen("fossil_sanity_query_test.log.2", "w");
+    fputs("[INFO]: event -3 plain\n[ERROR]: event -2 plain\n", file);
+    fclose(file);
+    file = fopen("fossil_sanity_query_test.log.1", "w");
+    fputs("ts=5 level=error severity=high msg=\"event -1 logfmt\"\n", file);
+    fclose(file);
+    file = fopen(path, "w");
+    size_t errors = 1, high_errors = 0;
+    for (int i = 0; i < LINES; i++) {
+        fprintf(file, "{\"ts\":%d,\"level\":\"%s\",\"severity\":\"%s\",\"msg\":\"event %d\"}\n", 1000 + i, levels[i % 5], severities[i % 3], i);
+        errors += i % 5 == 3;
+        high_errors += i % 5 == 3 && i % 3 == 2;
+    }
+    fclose(file);
+
+    memset(&query, 0, sizeof(query));
+    query_record_t all = { .last = -10, .ordered = true };
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_query_rotated(path, &query, query_collect, &all, &matched), "Every generation should be read");
+    FOSSIL_TEST_ASSUME(matched == LINES + 3 && all.count == matched && all.ordered, "Lines should come out oldest first");
+    FOSSIL_TEST_ASSUME(strcmp(all.first, "[INFO]: event -3 plain") == 0, "The oldest generation should come first");
+
+    query.levels = 1u << FOSSIL_SANITY_LOG_LEVEL_ERROR;
+    query_record_t error = { .last = -10, .ordered = true };
+    fossil_sanity_log_query_rotated(path, &query, query_collect, &error, &matched);
+    FOSSIL_TEST_ASSUME(matched == errors + 1 && error.ordered, "Levels should be read from every format");
+
+    query.min_severity = FOSSIL_SANITY_LOG_SEVERITY_HIGH;
+    query.keyword = "event 1";
+    query_record_t keyword = { .last = -10, .ordered = true };
+    size_t expected = 0;
+    char number[16];
+    for (int i = 0; i < LINES; i++) {
+        snprintf(number, sizeof(number), "%d", i);
+        expected += i % 5 == 3 && i % 3 == 2 && number[0] == '1';
+    }
+    fossil_sanity_log_query_file(path, &query, query_collect, &keyword, &matched);
+    FOSSIL_TEST_ASSUME(matched == expected && keyword.ordered && high_errors > expected, "Keyword and severity should combine");
+
+    memset(&query, 0, sizeof(query));
+    query.since = 1100;
+    query.until = 1199;
+    query_record_t timed = { .last = -10, .ordered = true };
+    fossil_sanity_log_query_rotated(path, &query, query_collect, &timed, &matched);
+    FOSSIL_TEST_ASSUME(matched == 100 && timed.last == 199, "Only timestamped lines in range should match");
+
+    query.since = query.until = 0;
+    query_record_t stopped = { .last = -10, .ordered = true, .stop_after = 5 };
+    fossil_sanity_log_query_rotated(path, &query, query_collect, &stopped, &matched);
+    FOSSIL_TEST_ASSUME(matched == 5 && stopped.last == 1, "The sink should end the query");
+
+    // Ring files are recognized and read as tagged lines
+    remove("fossil_sanity_query_test.ring");
+    fossil_sanity_log_ring_t *ring = fossil_sanity_log_ring_open("fossil_sanity_query_test.ring", 4096);
+    fossil_sanity_log_ring_append(ring, "ring event 1", FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    struct timespec pause = { 0, 20 * 1000000 };
+    nanosleep(&pause, NULL);
+    uint64_t between = fossil_sanity_log_now();
+    nanosleep(&pause, NULL);
+    fossil_sanity_log_ring_append(ring, "ring event 2", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+    fossil_sanity_log_ring_close(ring);
+    query.levels = 1u << FOSSIL_SANITY_LOG_LEVEL_FATAL;
+    query_record_t ringed = { .last = -10, .ordered = true };
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_query_file("fossil_sanity_query_test.ring", &query, query_collect, &ringed, &matched) && matched == 1 &&
+                       strcmp(ringed.first, "[FATAL]: ring event 2") == 0, "Ring records should be filtered");
+    memset(&query, 0, sizeof(query));
+    query.until = between;
+    query_record_t early = { .last = -10, .ordered = true };
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_query_file("fossil_sanity_query_test.ring", &query, query_collect, &early, &matched) && matched == 1 &&
+                       strcmp(early.first, "[WARNING]: ring event 1") == 0, "Ring records should be filtered by time");
+    query.since = between;
+    query.until = 0;
+    query_record_t late = { .last = -10, .ordered = true };
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_query_file("fossil_sanity_query_test.ring", &query, query_collect, &late, &matched) && matched == 1 &&
+                       strcmp(late.first, "[FATAL]: ring event 2") == 0, "Ring records after the bound should match");
+
+    // A damaged record ends the readable part of a ring
+    remove("fossil_sanity_query_damaged.ring");
+    ring = fossil_sanity_log_ring_open("fossil_sanity_query_damaged.ring", 4096);
+    for (int i = 1; i <= 3; i++) {
+        char message[32];
+        snprintf(message, sizeof(message), "ring event %d", i);
+        fossil_sanity_log_ring_append(ring, message, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    fossil_sanity_log_ring_close(ring);
+    file = fopen("fossil_sanity_query_damaged.ring", "r+b");
+    char bytes[8192];
+    size_t size = fread(bytes, 1, sizeof(bytes), file);
+    int records = 0;
+    for (size_t i = 0; i + 4 <= size; i++) {
+        if (memcmp(bytes + i, "REC1", 4) == 0 && ++records == 2) {
+            fseek(file, (long)i, SEEK_SET);
+            fputs("XXXX", file);
+            break;
+        }
+    }
+    fclose(file);
+    memset(&query, 0, sizeof(query));
+    query_record_t damaged = { .last = -10, .ordered = true };
+    FOSSIL_TEST_ASSUME(records == 2 && fossil_sanity_log_query_file("fossil_sanity_query_damaged.ring", &query, query_collect, &damaged, &matched) &&
+                       matched == 1 && strcmp(damaged.first, "[ERROR]: ring event 1") == 0, "Records after a damaged one should be skipped");
+    remove("fossil_sanity_query_damaged.ring");
+
+    FOSSIL_TEST_ASSUME(!fossil_sanity_log_query_file("fossil_sanity_query_missing.log", &query, query_collect, &ringed, &matched), "A missing file should fail");
+    remove("fossil_sanity_query_test.ring");
+    remove("fossil_sanity_query_test.log.2");
+    remove("fossil_sanity_query_test.log.1");
+    remove(path);
+} // end case
+
+// Recomputes a snapshot checksum after a test edits the payload, mirroring the
+// library's hash over the 48 header bytes ahead of it and then the payload
+static void snapshot_reseal(char *blob, size_t size) {
+    const size_t header = 56, covered = 48;
+    uint64_t hash = 14695981039346656037u;
+    for (int part = 0; part < 2; part++) {
+        const unsigned char *bytes = (const unsigned char *)blob + (part ? header : 0);
+        size_t length = part ? size - header : covered;
+        for (; length >= 8; bytes += 8, length -= 8) {
+            uint64_t word;
+            memcpy(&word, bytes, 8);
+            hash ^= word * 0x9e3779b97f4a7c15u;
+            hash = (hash << 31 | hash >> 33) * 0xc2b2ae3d27d4eb4fu;
+        }
+        for (; length; bytes++, length--) {
+            hash = (hash ^ *bytes) * 0x100000001b3u;
+        }
+        hash ^= hash >> 29;
+    }
+    memcpy(blob + covered, &hash, sizeof(hash));
+}
+
+FOSSIL_TEST_CASE(c_log_snapshot) {
+    fossil_sanity_log_queue_t queue, restored;
+    fossil_sanity_log_pool_stats_t stats;
+    fossil_sanity_log_field_t decoded[4];
+    char long_message[600];
+    fossil_sanity_log_field_t fields[] = {
+        FOSSIL_SANITY_LOG_KV_INT("code", 7),
+        FOSSIL_SANITY_LOG_KV_STR("host", "db1")
+    };
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_init(&restored);
+    fossil_sanity_log_set_smart_format(false);
+
+    memset(long_message, 'x', sizeof(long_message) - 1);
+    long_message[sizeof(long_message) - 1] = '\0';
+    for (int i = 0; i < 200; i++) {
+        fossil_sanity_log_push(&queue, i % 10 ? "short disk event" : long_message, i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_HIGH, "disk %d failed after %u tries", 3, 5u);
+    fossil_sanity_log_push_fields(&queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM, "query slow", fields, 2);
+
+    size_t size = fossil_sanity_log_snapshot(&queue, NULL, 0);
+    char *blob = (char *)malloc(size);
+    FOSSIL_TEST_ASSUME(size > 0 && fossil_sanity_log_snapshot(&queue, blob, size - 1) == size, "A short buffer should only report the size");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_snapshot(&queue, blob, size) == size, "The snapshot should fill the buffer");
+
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_index_enable(&restored) && fossil_sanity_log_time_index_enable(&restored), "Indexes should be enabled");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_restore(&restored, blob, size), "The snapshot should restore");
+    FOSSIL_TEST_ASSUME(restored.count == queue.count, "Every entry should come back");
+    fossil_sanity_log_pool_stats(&restored, &stats);
+    FOSSIL_TEST_ASSUME(stats.slab_count == 1 && stats.in_use == queue.count && stats.available == 0, "Entries should share one slab");
+    FOSSIL_TEST_ASSUME(restored.pool.chunk_entries == 0, "Restoring should not turn pooling on");
+
+    // Timestamps are rebased by one shift that keeps every entry's age
+    bool same = true;
+    const fossil_sanity_log_entry_t *a = queue.head, *b = restored.head;
+    uint64_t shift = b->timestamp - a->timestamp;
+    char text[MAX_LOG_MESSAGE_LENGTH * 4];
+    for (; a && b; a = a->next, b = b->next) {
+        fossil_sanity_log_format_entry(a, text, sizeof(text));
+        same = same && a->priority == b->priority && a->severity == b->severity && a->sequence == b->sequence &&
+               b->timestamp - a->timestamp == shift && strcmp(text, b->message) == 0 && (!b->next || b->next->prev == b);
+    }
+    FOSSIL_TEST_ASSUME(same && !a && !b, "Order, levels and text should match");
+    FOSSIL_TEST_ASSUME(shift + 1000000000u < 2000000000u && restored.head->timestamp <= fossil_sanity_log_now(), "Rebasing should keep timestamps close in one process");
+    const char *found = fossil_sanity_log_search(&restored, "failed after");
+    FOSSIL_TEST_ASSUME(found && strcmp(found, "disk 3 failed after 5 tries") == 0, "Deferred entries should come back formatted");
+
+    const fossil_sanity_log_entry_t *error = restored.head;
+    while (error && error->priority != FOSSIL_SANITY_LOG_LEVEL_ERROR) error = error->next;
+    while (error && strcmp(error->message, "query slow") != 0) error = error->next;
+    FOSSIL_TEST_ASSUME(error && fossil_sanity_log_entry_fields(error, decoded, 4) == 2 && decoded[0].value.i == 7 && strcmp(decoded[1].value.s, "db1") == 0 &&
+                       strcmp(error->message, "query slow") == 0, "Fields should survive");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&restored, "disk", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0) ==
+                       fossil_sanity_log_search_all(&queue, "disk", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0), "The keyword index should be rebuilt");
+    size_t seen = 0;
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_query_time(&restored, 0, UINT64_MAX, count_visit, &seen) == queue.count, "The time index should be rebuilt");
+
+    // New pushes continue the sequence and the restored entries release normally
+    fossil_sanity_log_push(&restored, "after restore", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(restored.tail->sequence == queue.sequence, "The sequence should continue");
+    char *message = fossil_sanity_log_pop(&restored);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, "short disk event") == 0, "Pop should work on restored entries");
+    free(message);
+    fossil_sanity_log_push(&restored, "reuses a slab entry", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_pool_stats(&restored, &stats);
+    FOSSIL_TEST_ASSUME(stats.slab_count == 1 && stats.available == 0, "Released restored entries should be reused");
+    fossil_sanity_log_filter(&restored, FOSSIL_SANITY_LOG_LEVEL_WARNING);
+    FOSSIL_TEST_ASSUME(!fossil_sanity_log_restore(&restored, blob, size), "A non-empty queue should be refused");
+    fossil_sanity_log_destroy(&restored);
+
+    // Damage is caught before anything is allocated
+    fossil_sanity_log_init(&restored);
+    blob[size / 2] ^= 0x10;
+    FOSSIL_TEST_ASSUME(!fossil_sanity_log_restore(&restored, blob, size) && restored.count == 0, "A corrupted snapshot should be refused");
+    blob[size / 2] ^= 0x10;
+    FOSSIL_TEST_ASSUME(!fossil_sanity_log_restore(&restored, blob, size - 8), "A truncated snapshot should be refused");
+    fossil_sanity_log_pool_stats(&restored, &stats);
+    FOSSIL_TEST_ASSUME(stats.slab_count == 0, "A refused snapshot should allocate nothing");
+
+    // Capacity limits apply to what is restored
+    fossil_sanity_log_set_capacity(&restored, 50);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_restore(&restored, blob, size) && restored.count == 50, "Capacity should trim the restored queue");
+    FOSSIL_TEST_ASSUME(restored.head->priority == FOSSIL_SANITY_LOG_LEVEL_FATAL, "Trimming should keep the highest levels");
+
+    free(blob);
+    fossil_sanity_log_destroy(&restored);
+    fossil_sanity_log_destroy(&queue);
+
+    // Fields that run past their record are refused even with a valid checksum
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_init(&restored);
+    fossil_sanity_log_push_fields(&queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM, "query slow", fields, 2);
+    size = fossil_sanity_log_snapshot(&queue, NULL, 0);
+    blob = (char *)malloc(size);
+    FOSSIL_TEST_ASSUME(blob && fossil_sanity_log_snapshot(&queue, blob, size) == size, "The field snapshot should be taken");
+    char *host = NULL;
+    for (size_t i = 0; i + 4 <= size && !host; i++) {
+        if (memcmp(blob + i, "db1", 4) == 0) host = blob + i;
+    }
+    FOSSIL_TEST_ASSUME(host != NULL, "The string field should be in the snapshot");
+    uint32_t length = 4096;
+    memcpy(host - sizeof(length), &length, sizeof(length));
+    snapshot_reseal(blob, size);
+    FOSSIL_TEST_ASSUME(!fossil_sanity_log_restore(&restored, blob, size) && restored.count == 0, "Fields past the record should be refused");
+    length = 3;
+    memcpy(host - sizeof(length), &length, sizeof(length));
+    snapshot_reseal(blob, size);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_restore(&restored, blob, size) && restored.count == 1, "The resealed snapshot should restore");
+
+    free(blob);
+    fossil_sanity_log_destroy(&restored);
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_notify_thread) {
+    fossil_sanity_log_notify_config_t config;
+    fossil_sanity_log_notify_stats_t stats;
+    notify_counter_t counter = { PTHREAD_MUTEX_INITIALIZER, 0, 0 };
+
+    memset(&config, 0, sizeof(config));
+    config.capacity = 8;
+    config.policy = FOSSIL_SANITY_LOG_NOTIFY_BLOCK;
+    config.batch = 4;
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_notify_start(&config), "Notification thread should start");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_notify_register(notify_count, &counter), "Sink should register");
+    for (int i = 0; i < 200; i++) {
+        fossil_sanity_log_notify("blocking alert");
+    }
+    fossil_sanity_log_notify_flush();
+    fossil_sanity_log_notify_stats(&stats);
+    fossil_sanity_log_notify_stop();
+    FOSSIL_TEST_ASSUME(counter.alerts == 200 && stats.delivered == 200 && stats.dropped == 0, "Blocking policy should deliver every alert");
+    FOSSIL_TEST_ASSUME(counter.largest_batch >= 1 && counter.largest_batch <= 4, "Batches should respect the batch size");
+
+    // Hold the thread on the first alert so the next ones overflow
+    int pipe_fds[2];
+    char output[256] = { 0 };
+    notify_gate_t gate = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, false, false };
+    FOSSIL_TEST_ASSUME(pipe(pipe_fds) == 0, "Pipe should open");
+    config.capacity = 2;
+    config.policy = FOSSIL_SANITY_LOG_NOTIFY_DROP_OLDEST;
+    config.batch = 1;
+    fossil_sanity_log_notify_register(notify_hold, &gate);
+    fossil_sanity_log_notify_register_fd(pipe_fds[1]);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_notify_start(&config), "Notification thread should restart");
+
+    fossil_sanity_log_notify("a");
+    pthread_mutex_lock(&gate.lock);
+    while (!gate.entered) pthread_cond_wait(&gate.changed, &gate.lock);
+    pthread_mutex_unlock(&gate.lock);
+    fossil_sanity_log_notify("b");
+    fossil_sanity_log_notify("c");
+    fossil_sanity_log_notify("d");
+    fossil_sanity_log_notify("e");
+    pthread_mutex_lock(&gate.lock);
+    gate.released = true;
+    pthread_cond_broadcast(&gate.changed);
+    pthread_mutex_unlock(&gate.lock);
+
+    fossil_sanity_log_notify_flush();
+    fossil_sanity_log_notify_stats(&stats);
+    fossil_sanity_log_notify_stop();
+    close(pipe_fds[1]);
+    ssize_t got = read(pipe_fds[0], output, sizeof(output) - 1);
+    close(pipe_fds[0]);
+    FOSSIL_TEST_ASSUME(stats.dropped == 2, "Two alerts should overflow the queue");
+    FOSSIL_TEST_ASSUME(got > 0 && strcmp(output, "ALERT: Critical log - a\nALERT: Critical log - d\nALERT: Critical log - e\n") == 0,
+                       "Drop-oldest should keep the newest alerts");
+} // end case
+
+FOSSIL_TEST_CASE(c_log_sort_by_severity) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+
+    for (int i = 0; i < 300; i++) {
+        fossil_sanity_log_push(&queue, "entry", i % 3, (i * 7) % 3);
+    }
+    fossil_sanity_log_sort_by(&queue, fossil_sanity_log_compare_severity);
+
+    bool ordered = true;
+    size_t seen = 0;
+    for (const fossil_sanity_log_entry_t *entry = queue.head; entry; entry = entry->next) {
+        const fossil_sanity_log_entry_t *next = entry->next;
+        seen++;
+        if (!next) {
+            if (entry != queue.tail) ordered = false;
+            break;
+        }
+        if (next->prev != entry) ordered = false;
+        if (entry->priority < next->priority) ordered = false;
+        if (entry->priority == next->priority && entry->severity < next->severity) ordered = false;
+        if (entry->priority == next->priority && entry->severity == next->severity && entry->sequence > next->sequence) ordered = false;
+    }
+    FOSSIL_TEST_ASSUME(seen == 300, "Sort should keep every entry");
+    FOSSIL_TEST_ASSUME(ordered, "Entries should be ordered by priority, severity, then sequence");
+
+    // Pushes after a sort still land in their level bucket
+    fossil_sanity_log_push(&queue, "late", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(queue.level_tail[FOSSIL_SANITY_LOG_LEVEL_INFO] && strcmp(queue.level_tail[FOSSIL_SANITY_LOG_LEVEL_INFO]->message, "late") == 0, "Late entry should close its level");
+
+    // A plain sort restores insertion order within each level
+    fossil_sanity_log_sort(&queue);
+    fossil_sanity_log_sort_by(&queue, fossil_sanity_log_compare_sequence);
+    for (const fossil_sanity_log_entry_t *entry = queue.head; entry && entry->next; entry = entry->next) {
+        if (entry->priority == entry->next->priority && entry->sequence > entry->next->sequence) ordered = false;
+    }
+    FOSSIL_TEST_ASSUME(ordered, "Sequence comparator should restore insertion order");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(c_log_level_gate) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    int evaluated = 0;
+
+    fossil_sanity_log_set_level(FOSSIL_SANITY_LOG_LEVEL_WARNING);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_get_level() == FOSSIL_SANITY_LOG_LEVEL_WARNING, "Runtime level should be stored");
+
+    FOSSIL_SANITY_LOG_DEBUG(&queue, FOSSIL_SANITY_LOG_SEVERITY_LOW, "debug %d", ++evaluated);
+    FOSSIL_SANITY_LOG_INFO(&queue, FOSSIL_SANITY_LOG_SEVERITY_LOW, "info %d", ++evaluated);
+    fossil_sanity_log_smart_log(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, "plain info");
+    FOSSIL_TEST_ASSUME(evaluated == 0, "Arguments of gated calls should not be evaluated");
+    FOSSIL_TEST_ASSUME(queue.head == NULL, "Gated calls should not push entries");
+
+    FOSSIL_SANITY_LOG_ERROR(&queue, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM, "error %d of %s", ++evaluated, "many");
+    FOSSIL_TEST_ASSUME(evaluated == 1, "Arguments of enabled calls should be evaluated once");
+    FOSSIL_TEST_ASSUME(queue.head && strcmp(queue.head->message, "error 1 of many") == 0, "Enabled call should push the formatted message");
+
+    fossil_sanity_log_set_level(FOSSIL_SANITY_LOG_LEVEL_DEBUG);
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Pool
+// * * * * * * * * * * * * * * * * * * * * * * * *
+FOSSIL_TEST_GROUP(c_log_test_cases) {
+    FOSSIL_TEST_ADD(c_log_suite, c_log_push_pop_order);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_filter_keeps_buckets);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_search);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_indexed_search);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_deferred_format);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_smart_limits);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_bounded_eviction);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_zero_copy);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_time_range);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_metrics);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_sampling);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_merge);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_fields);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_parallel);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_pool_reuse);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_long_messages);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_sort_by_severity);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_level_gate);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_concurrent_stress);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_thread_buffering);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_background_writer);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_rotation_generations);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_ring_recovery);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_shm_collector);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_query);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_snapshot);
+    FOSSIL_TEST_ADD(c_log_suite, c_log_notify_thread);
+
+    FOSSIL_TEST_REGISTER(c_log_suite);
+} // end of group
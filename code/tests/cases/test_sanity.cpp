@@ -0,0 +1,765 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ * Date: 07/01/2024
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#include <fossil/test/framework.h>
+#include <fossil/sanity/framework.h>
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Utilites
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// Setup steps for things like test fixtures and
+// mock objects are set here.
+// * * * * * * * * * * * * * * * * * * * * * * * *
+
+// Visitor recording up to four messages
+static bool record_visit(const fossil_sanity_log_entry_t *entry, void *context) {
+    auto *record = static_cast<std::vector<std::string> *>(context);
+    record->push_back(std::string(entry->message, entry->length));
+    return record->size() < 4;
+}
+
+// Visitor counting entries
+static bool count_visit(const fossil_sanity_log_entry_t *, void *context) {
+    ++*static_cast<size_t *>(context);
+    return true;
+}
+
+// Define the test suite and add test cases
+FOSSIL_TEST_SUITE(cpp_log_suite);
+
+// Setup function for the test suite
+FOSSIL_SETUP(cpp_log_suite) {
+    // Setup code here
+}
+
+// Teardown function for the test suite
+FOSSIL_TEARDOWN(cpp_log_suite) {
+    // Teardown code here
+}
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Cases
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// The test cases below are provided as samples, inspired
+// by the Meson build system's approach of using test cases
+// as samples for library usage.
+// * * * * * * * * * * * * * * * * * * * * * * * *
+
+FOSSIL_TEST_CASE(cpp_log_push_pop_order) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+
+    fossil_sanity_log_push(&queue, "info one", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "error one", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+    fossil_sanity_log_push(&queue, "info two", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "debug one", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "error two", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM);
+    FOSSIL_TEST_ASSUME(queue.count == 5, "Queue should hold five entries");
+
+    const std::string expected[] = {"error one", "error two", "info one", "info two", "debug one"};
+    for (int i = 0; i < 5; i++) {
+        char *message = fossil_sanity_log_pop(&queue);
+        FOSSIL_TEST_ASSUME(message != NULL, "Pop should return a message");
+        FOSSIL_TEST_ASSUME(message && expected[i] == message, "Pop should follow priority then FIFO order");
+        free(message);
+    }
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_pop(&queue) == NULL, "Empty queue should pop NULL");
+    FOSSIL_TEST_ASSUME(queue.head == NULL && queue.tail == NULL, "Empty queue should have no head or tail");
+    FOSSIL_TEST_ASSUME(queue.level_mask == 0, "Empty queue should have no active levels");
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_filter_keeps_buckets) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+
+    fossil_sanity_log_push(&queue, "debug", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "warning", FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM);
+    fossil_sanity_log_push(&queue, "info", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_filter(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO);
+
+    FOSSIL_TEST_ASSUME(queue.count == 2, "Filter should drop the debug entry");
+    FOSSIL_TEST_ASSUME(queue.tail && strcmp(queue.tail->message, "info") == 0, "Tail should be the info entry");
+
+    fossil_sanity_log_push(&queue, "info again", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "fatal", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+    FOSSIL_TEST_ASSUME(strcmp(queue.head->message, "fatal") == 0, "Fatal entry should lead the queue");
+    FOSSIL_TEST_ASSUME(strcmp(queue.tail->message, "info again") == 0, "Newest info entry should trail the queue");
+
+    fossil_sanity_log_clear(&queue);
+    FOSSIL_TEST_ASSUME(queue.count == 0 && queue.head == NULL, "Clear should empty the queue");
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_search) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+
+    fossil_sanity_log_push(&queue, "disk almost full", FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM);
+    fossil_sanity_log_push(&queue, "user logged in", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search(&queue, "logged") != NULL, "Search should find the keyword");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search(&queue, "network") == NULL, "Search should miss unknown keywords");
+
+    fossil_sanity_log_clear(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_indexed_search) {
+    fossil_sanity_log_queue_t queue;
+    const fossil_sanity_log_entry_t *results[4];
+    fossil_sanity_log_init(&queue);
+
+    fossil_sanity_log_push(&queue, "disk sda full", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_index_enable(&queue), "Index should be enabled");
+    fossil_sanity_log_push(&queue, "disk sdb full, disk offline", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+    fossil_sanity_log_push(&queue, "diskless boot", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "disk sdc full", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "disk", FOSSIL_SANITY_LOG_LEVEL_DEBUG, results, 4) == 3, "Whole tokens should match once per entry");
+    FOSSIL_TEST_ASSUME(std::string(results[0]->message) == "disk sdb full, disk offline", "Higher levels should come first");
+    FOSSIL_TEST_ASSUME(std::string(results[1]->message) == "disk sdc full", "Entries should keep insertion order");
+    FOSSIL_TEST_ASSUME(std::string(results[2]->message) == "disk sda full", "Entries indexed on enable should match");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "disk", FOSSIL_SANITY_LOG_LEVEL_WARNING, NULL, 0) == 2, "Level filter should apply");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "disk sd", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0) == 3, "Phrases should match as substrings");
+
+    fossil_sanity_log_filter(&queue, FOSSIL_SANITY_LOG_LEVEL_WARNING);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "disk", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0) == 2, "Filtered entries should leave the index");
+    char *message = fossil_sanity_log_pop(&queue);
+    free(message);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "sdb", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0) == 0, "Popped entries should leave the index");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search_all(&queue, "sdc", FOSSIL_SANITY_LOG_LEVEL_DEBUG, NULL, 0) == 1, "Remaining entries should stay indexed");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_deferred_format) {
+    fossil_sanity_log_queue_t queue;
+    char expected[MAX_LOG_MESSAGE_LENGTH];
+    char rendered[MAX_LOG_MESSAGE_LENGTH];
+    const char name[4] = { 'd', 'i', 's', 'k' };  // Not NUL-terminated
+    fossil_sanity_log_init(&queue);
+
+    snprintf(expected, sizeof(expected), "%-6s|%5.2f|%lld|%zu|%c|%.*s|%*d|100%%", "io", 3.14159, -42LL, (size_t)7, 'x', 4, name, 4, 9);
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_HIGH,
+        "%-6s|%5.2f|%lld|%zu|%c|%.*s|%*d|100%%", "io", 3.14159, -42LL, (size_t)7, 'x', 4, name, 4, 9);
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, "request %d took %u ms", 17, 250u);
+
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_format_entry(queue.head, rendered, sizeof(rendered)) == strlen(expected), "Rendering should report the full length");
+    FOSSIL_TEST_ASSUME(std::string(rendered) == expected, "Rendering should match snprintf");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_format_entry(queue.head, rendered, 5) == strlen(expected) && strlen(rendered) == 4, "Rendering should truncate like snprintf");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_search(&queue, "took 250") != NULL, "Search should see the formatted text");
+
+    char *message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && std::string(message) == expected, "Pop should return the formatted text");
+    free(message);
+    message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && std::string(message) == "request 17 took 250 ms", "Resolved entries should keep their text");
+    free(message);
+
+    fossil_sanity_log_enable_concurrent(&queue);
+    fossil_sanity_log_push_deferred(&queue, FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM, "retry %d of %s", 3, "a rather long upstream host name");
+    message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && std::string(message) == "retry 3 of a rather long upstream host name", "Concurrent pushes should defer too");
+    free(message);
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_smart_limits) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_limit_config_t config;
+    fossil_sanity_log_limit_stats_t stats;
+    char message[32];
+    fossil_sanity_log_init(&queue);
+
+    memset(&config, 0, sizeof(config));
+    config.window_ms = 60000;
+    config.rate[FOSSIL_SANITY_LOG_LEVEL_INFO] = 10;
+    config.burst[FOSSIL_SANITY_LOG_LEVEL_INFO] = 5;
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_limit_enable(&queue, &config), "Limits should be enabled");
+
+    for (int i = 0; i < 1000; i++) {
+        fossil_sanity_log_smart_log(&queue, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM, "disk failure");
+    }
+    FOSSIL_TEST_ASSUME(queue.count == 1, "Repeats within the window should fold into one entry");
+
+    for (int i = 0; i < 100; i++) {
+        snprintf(message, sizeof(message), "request %d", i);
+        fossil_sanity_log_smart_log(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, message);
+    }
+    FOSSIL_TEST_ASSUME(queue.count == 6, "The info bucket should admit its burst");
+
+    fossil_sanity_log_limit_stats(&queue, &stats);
+    FOSSIL_TEST_ASSUME(stats.coalesced == 999, "Folded repeats should be counted");
+    FOSSIL_TEST_ASSUME(stats.rate_limited[FOSSIL_SANITY_LOG_LEVEL_INFO] == 95, "Dropped entries should be counted per level");
+    FOSSIL_TEST_ASSUME(stats.rate_limited[FOSSIL_SANITY_LOG_LEVEL_ERROR] == 0, "Unlimited levels should drop nothing");
+
+    fossil_sanity_log_limit_flush(&queue);
+    char *first = fossil_sanity_log_pop(&queue);
+    char *summary = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(first && strcmp(first, "disk failure") == 0, "The first occurrence should be logged");
+    FOSSIL_TEST_ASSUME(summary && strcmp(summary, "disk failure (repeated 999 times)") == 0, "Flush should report the repeat count");
+    free(first);
+    free(summary);
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_bounded_eviction) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_set_capacity(&queue, 3);
+
+    fossil_sanity_log_push(&queue, "a", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "b", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "c", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "d", FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "e", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "f", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(queue.count == 3, "Queue should stay within its capacity");
+    FOSSIL_TEST_ASSUME(queue.evicted[FOSSIL_SANITY_LOG_LEVEL_DEBUG] == 2, "Least important entries should go first");
+    FOSSIL_TEST_ASSUME(queue.evicted[FOSSIL_SANITY_LOG_LEVEL_INFO] == 1, "Evictions should be counted per level");
+
+    FOSSIL_TEST_ASSUME(std::string(fossil_sanity_log_peek_max(&queue)->message) == "f", "Peek max should see the fatal entry");
+    FOSSIL_TEST_ASSUME(std::string(fossil_sanity_log_peek_min(&queue)->message) == "d", "Peek min should see the warning entry");
+    char *low = fossil_sanity_log_pop_min(&queue);
+    char *high = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(low && std::string(low) == "d", "Pop min should remove the least important entry");
+    FOSSIL_TEST_ASSUME(high && std::string(high) == "f", "Pop should still remove the most important entry");
+    free(low);
+    free(high);
+
+    for (int i = 0; i < 10000; i++) {
+        fossil_sanity_log_push(&queue, "storm", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    FOSSIL_TEST_ASSUME(queue.count == 3 && queue.level_head[FOSSIL_SANITY_LOG_LEVEL_ERROR] != NULL, "A storm should not push out important entries");
+    fossil_sanity_log_set_capacity(&queue, 1);
+    FOSSIL_TEST_ASSUME(queue.count == 1 && std::string(queue.head->message) == "b", "Lowering the capacity should evict at once");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_zero_copy) {
+    fossil_sanity_log_queue_t queue;
+    char small[3];
+    char buffer[32];
+    size_t length;
+    std::vector<std::string> record;
+    fossil_sanity_log_init(&queue);
+
+    fossil_sanity_log_push(&queue, "one", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "two", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "three", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "four", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "five", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, "six", FOSSIL_SANITY_LOG_LEVEL_DEBUG, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_for_each(&queue, record_visit, &record) == 4, "Visitor should stop the walk");
+    FOSSIL_TEST_ASSUME(queue.count == 6 && std::string(record[3]) == "four", "Visiting should not remove entries");
+
+    FOSSIL_TEST_ASSUME(!fossil_sanity_log_pop_into(&queue, small, sizeof(small), &length) && length == 3, "A short buffer should report the length needed");
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_pop_into(&queue, buffer, sizeof(buffer), &length) && std::string(buffer) == "one", "Pop into should copy the message");
+
+    const fossil_sanity_log_entry_t *entry = fossil_sanity_log_pop_borrow(&queue);
+    FOSSIL_TEST_ASSUME(entry && entry->length == 3 && std::string(entry->message) == "two", "Borrow should lend the next entry");
+    entry = fossil_sanity_log_pop_borrow(&queue);
+    FOSSIL_TEST_ASSUME(entry && std::string(entry->message) == "three" && queue.count == 3, "Borrowing again should move on");
+
+    record.clear();
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_pop_batch(&queue, 2, record_visit, &record) == 2, "Batch should pop at most the limit");
+    FOSSIL_TEST_ASSUME(std::string(record[0]) == "four" && std::string(record[1]) == "five" && queue.count == 1, "Batch should pop in priority order");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_time_range) {
+    for (int indexed = 0; indexed < 2; indexed++) {
+        fossil_sanity_log_queue_t queue;
+        size_t seen = 0;
+        fossil_sanity_log_init(&queue);
+        if (indexed) {
+            fossil_sanity_log_push(&queue, "before index", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+            FOSSIL_TEST_ASSUME(fossil_sanity_log_time_index_enable(&queue), "Time index should be enabled");
+        }
+
+        for (int i = 0; i < 1000; i++) {
+            fossil_sanity_log_push(&queue, "early", i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        uint64_t middle = fossil_sanity_log_now();
+        for (int i = 0; i < 500; i++) {
+            fossil_sanity_log_push(&queue, "late", i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        }
+        FOSSIL_TEST_ASSUME(queue.head->timestamp != 0 && queue.head->timestamp <= fossil_sanity_log_now(), "Entries should carry timestamps");
+
+        FOSSIL_TEST_ASSUME(fossil_sanity_log_query_time(&queue, middle, UINT64_MAX, count_visit, &seen) == 500 && seen == 500, "Range should hold only the late entries");
+        seen = 0;
+        fossil_sanity_log_query_time(&queue, 0, middle, count_visit, &seen);
+        FOSSIL_TEST_ASSUME(seen == 1000u + (size_t)indexed, "Range should hold the early entries");
+
+        fossil_sanity_log_filter(&queue, FOSSIL_SANITY_LOG_LEVEL_WARNING);
+        seen = 0;
+        fossil_sanity_log_query_time(&queue, middle, UINT64_MAX, count_visit, &seen);
+        FOSSIL_TEST_ASSUME(seen == 300, "Removed entries should leave the range");
+
+        fossil_sanity_log_destroy(&queue);
+    }
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_metrics) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_metrics_t before, after;
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_metrics_read(nullptr, &before);
+
+    for (int i = 0; i < 3; i++) {
+        fossil_sanity_log_push(&queue, "abc", FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    std::thread producer([] {
+        fossil_sanity_log_queue_t local;
+        fossil_sanity_log_init(&local);
+        fossil_sanity_log_push(&local, "from a thread", FOSSIL_SANITY_LOG_LEVEL_FATAL, FOSSIL_SANITY_LOG_SEVERITY_HIGH);
+        fossil_sanity_log_destroy(&local);
+    });
+    producer.join();
+    free(fossil_sanity_log_pop(&queue));
+
+    fossil_sanity_log_metrics_read(&queue, &after);
+    FOSSIL_TEST_ASSUME(after.pushes[FOSSIL_SANITY_LOG_LEVEL_WARNING] - before.pushes[FOSSIL_SANITY_LOG_LEVEL_WARNING] == 3 &&
+                       after.pushes[FOSSIL_SANITY_LOG_LEVEL_FATAL] - before.pushes[FOSSIL_SANITY_LOG_LEVEL_FATAL] == 1, "Pushes should be counted per level");
+    FOSSIL_TEST_ASSUME(after.bytes_stored - before.bytes_stored == 22 && after.drained - before.drained == 1, "Bytes and drains should be counted");
+    FOSSIL_TEST_ASSUME(after.depth == 2 && after.peak_depth == 3, "Depth and peak should describe the queue");
+
+    std::string json(1024, '\0');
+    json.resize(fossil_sanity_log_metrics_format(&after, FOSSIL_SANITY_LOG_METRICS_JSON, json.data(), json.size()));
+    FOSSIL_TEST_ASSUME(json.front() == '{' && json.back() == '}', "JSON should be one object");
+    std::string text(1024, '\0');
+    text.resize(fossil_sanity_log_metrics_format(&after, FOSSIL_SANITY_LOG_METRICS_TEXT, text.data(), text.size()));
+    FOSSIL_TEST_ASSUME(text.find("depth 2\n") != std::string::npos, "Text should hold one metric per line");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_sampling) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_metrics_t before, after;
+    fossil_sanity_log_sample_config_t config{};
+    config.levels[FOSSIL_SANITY_LOG_LEVEL_INFO] = { FOSSIL_SANITY_LOG_SAMPLE_ONE_IN_N, 4, 0 };
+    fossil_sanity_log_init(&queue);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_sample_enable(&queue, &config), "Sampling should be enabled");
+    fossil_sanity_log_metrics_read(nullptr, &before);
+
+    for (int i = 0; i < 4000; i++) {
+        fossil_sanity_log_smart_log(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, "sampled");
+    }
+    fossil_sanity_log_metrics_read(nullptr, &after);
+    uint64_t skipped = after.sampled[FOSSIL_SANITY_LOG_LEVEL_INFO] - before.sampled[FOSSIL_SANITY_LOG_LEVEL_INFO];
+    FOSSIL_TEST_ASSUME(queue.count + skipped == 4000, "Kept and skipped entries should add up");
+    FOSSIL_TEST_ASSUME(queue.count > 800 && queue.count < 1200, "About one in four should be kept");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_merge) {
+    std::vector<fossil_sanity_log_queue_t> queues(3);
+    std::vector<fossil_sanity_log_queue_t *> sources;
+    for (auto &queue : queues) {
+        fossil_sanity_log_init(&queue);
+        sources.push_back(&queue);
+    }
+    fossil_sanity_log_push(&queues[0], "first warning", FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queues[1], "only error", FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    fossil_sanity_log_push(&queues[2], "second warning", FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+
+    std::vector<std::string> record;
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_merge_stream(sources.data(), sources.size(), record_visit, &record) == 3, "Every entry should stream");
+    FOSSIL_TEST_ASSUME((record == std::vector<std::string>{ "only error", "first warning", "second warning" }), "Entries should stream by priority, then time");
+
+    for (auto &queue : queues) {
+        FOSSIL_TEST_ASSUME(queue.count == 0, "Streamed entries should be freed");
+        fossil_sanity_log_destroy(&queue);
+    }
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_fields) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    const fossil_sanity_log_field_t fields[] = {
+        FOSSIL_SANITY_LOG_KV_STR("path", "/index.html"),
+        FOSSIL_SANITY_LOG_KV_INT("status", 404),
+        FOSSIL_SANITY_LOG_KV_DOUBLE("ms", 0.5),
+        FOSSIL_SANITY_LOG_KV_BOOL("cached", false)
+    };
+    fossil_sanity_log_push_fields(&queue, FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM,
+                                  "a message too long to be stored inline", fields, 4);
+
+    const fossil_sanity_log_entry_t *entry = fossil_sanity_log_peek_max(&queue);
+    std::string line(256, '\0');
+    line.resize(fossil_sanity_log_encode_entry(entry, FOSSIL_SANITY_LOG_ENCODING_LOGFMT, line.data(), line.size()));
+    std::string tail = " level=warning severity=medium msg=\"a message too long to be stored inline\" path=/index.html status=404 ms=0.5 cached=false";
+    FOSSIL_TEST_ASSUME(line.size() > tail.size() && line.compare(line.size() - tail.size(), tail.size(), tail) == 0, "logfmt should carry every field");
+
+    std::vector<fossil_sanity_log_field_t> decoded(4);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_entry_fields(entry, decoded.data(), decoded.size()) == 4 &&
+                       std::string(decoded[0].value.s) == "/index.html" && decoded[1].value.i == 404, "Fields should read back");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_parallel) {
+    fossil_sanity_log_queue_t serial, parallel;
+    fossil_sanity_log_init(&serial);
+    fossil_sanity_log_init(&parallel);
+    for (int i = 0; i < 20000; i++) {
+        std::string message = "item " + std::to_string(i) + (i % 5 == 0 ? " flagged" : "");
+        fossil_sanity_log_push(&serial, message.c_str(), i % FOSSIL_SANITY_LOG_LEVEL_COUNT, (i / 7) % 3);
+        fossil_sanity_log_push(&parallel, message.c_str(), i % FOSSIL_SANITY_LOG_LEVEL_COUNT, (i / 7) % 3);
+    }
+
+    std::vector<const fossil_sanity_log_entry_t *> expected(4000), found(4000);
+    size_t count = fossil_sanity_log_search_all(&serial, "flagged", FOSSIL_SANITY_LOG_LEVEL_DEBUG, expected.data(), expected.size());
+    FOSSIL_TEST_ASSUME(count == 4000 && fossil_sanity_log_search_all_parallel(&parallel, "flagged", FOSSIL_SANITY_LOG_LEVEL_DEBUG, found.data(), found.size()) == count,
+                       "Both searches should find every flagged entry");
+    FOSSIL_TEST_ASSUME(std::string(expected.back()->message) == found.back()->message, "Both searches should end on the same entry");
+
+    fossil_sanity_log_sort_by(&serial, fossil_sanity_log_compare_severity);
+    fossil_sanity_log_sort_parallel(&parallel, fossil_sanity_log_compare_severity);
+    auto keep = [](const fossil_sanity_log_entry_t *entry, void *) { return entry->severity != FOSSIL_SANITY_LOG_SEVERITY_LOW; };
+    size_t removed = fossil_sanity_log_filter_parallel(&parallel, keep, nullptr);
+    FOSSIL_TEST_ASSUME(removed > 0 && parallel.count == 20000 - removed, "Rejected entries should be removed");
+
+    bool same = true;
+    const fossil_sanity_log_entry_t *y = parallel.head;
+    for (const fossil_sanity_log_entry_t *x = serial.head; x; x = x->next) {
+        if (x->severity == FOSSIL_SANITY_LOG_SEVERITY_LOW) continue;
+        same = same && y && std::string(x->message) == y->message;
+        y = y ? y->next : nullptr;
+    }
+    FOSSIL_TEST_ASSUME(same && y == nullptr, "Parallel sort and filter should keep the serial order");
+
+    fossil_sanity_log_destroy(&serial);
+    fossil_sanity_log_destroy(&parallel);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_shm_collector) {
+    const std::string name = "/fossil_sanity_shm_cpp_" + std::to_string(getpid());
+    fossil_sanity_log_shm_unlink(name.c_str());
+    fossil_sanity_log_shm_t *shm = fossil_sanity_log_shm_create(name.c_str(), 0);
+    fossil_sanity_log_shm_t *attached = fossil_sanity_log_shm_open(name.c_str());
+    FOSSIL_TEST_ASSUME(shm != nullptr && attached != nullptr, "The ring should be created and opened");
+
+    // Threads of one process draw from its single sequence
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; t++) {
+        producers.emplace_back([ring = t % 2 ? attached : shm] {
+            for (int i = 0; i < 200; i++) {
+                fossil_sanity_log_shm_push(ring, "threaded", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+            }
+        });
+    }
+    for (auto &producer : producers) producer.join();
+
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_shm_drain(shm, &queue, 0) == 800, "Every entry should be collected");
+    std::vector<int64_t> sequences;
+    for (const fossil_sanity_log_entry_t *entry = queue.head; entry; entry = entry->next) {
+        fossil_sanity_log_field_t fields[2];
+        fossil_sanity_log_entry_fields(entry, fields, 2);
+        sequences.push_back(fields[1].value.i);
+    }
+    std::sort(sequences.begin(), sequences.end());
+    bool unique = true;
+    for (size_t i = 1; i < sequences.size(); i++) unique = unique && sequences[i] == sequences[0] + (int64_t)i;
+    FOSSIL_TEST_ASSUME(unique, "Sequence numbers should not repeat within a process");
+
+    fossil_sanity_log_destroy(&queue);
+    fossil_sanity_log_shm_close(attached);
+    fossil_sanity_log_shm_close(shm);
+    fossil_sanity_log_shm_unlink(name.c_str());
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_query) {
+    const std::string path = "fossil_sanity_query_cpp.log";
+    fossil_sanity_log_rotation_t rotation;
+    fossil_sanity_log_rotation_init(&rotation, path.c_str(), 0, 0);
+    remove(path.c_str());
+
+    // Lines as the background writer leaves them
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_set_encoding(FOSSIL_SANITY_LOG_ENCODING_LOGFMT);
+    fossil_sanity_log_writer_t *writer = fossil_sanity_log_writer_start(&queue, &rotation);
+    for (int i = 0; i < 100; i++) {
+        fossil_sanity_log_push(&queue, ("request " + std::to_string(i)).c_str(), i % 2 ? FOSSIL_SANITY_LOG_LEVEL_WARNING : FOSSIL_SANITY_LOG_LEVEL_INFO,
+                               FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    }
+    fossil_sanity_log_writer_stop(writer);
+    fossil_sanity_log_set_encoding(FOSSIL_SANITY_LOG_ENCODING_PLAIN);
+
+    fossil_sanity_log_query_t query{};
+    query.levels = 1u << FOSSIL_SANITY_LOG_LEVEL_WARNING;
+    query.keyword = "request 9";
+    std::vector<std::string> lines;
+    size_t matched = 0;
+    auto collect = [](const char *line, size_t length, void *context) {
+        static_cast<std::vector<std::string> *>(context)->emplace_back(line, length);
+        return true;
+    };
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_query_rotated(path.c_str(), &query, collect, &lines, &matched) && matched == 6, "Odd requests in the nineties should match");
+    FOSSIL_TEST_ASSUME(lines.size() == 6 && lines.front().find("msg=\"request 9\"") != std::string::npos &&
+                       lines.back().find("msg=\"request 99\"") != std::string::npos, "Lines should come out in file order");
+
+    fossil_sanity_log_destroy(&queue);
+    remove(path.c_str());
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_snapshot) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    fossil_sanity_log_enable_concurrent(&queue);
+    const std::string long_message(300, 'y');
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 2; t++) {
+        producers.emplace_back([&queue, &long_message, t] {
+            for (int i = 0; i < 500; i++) {
+                fossil_sanity_log_push(&queue, i % 50 ? ("event " + std::to_string(t * 1000 + i)).c_str() : long_message.c_str(),
+                                       i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+            }
+        });
+    }
+    for (auto &producer : producers) producer.join();
+
+    // Concurrent pushes are collected into the snapshot
+    std::vector<char> blob(fossil_sanity_log_snapshot(&queue, nullptr, 0));
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_snapshot(&queue, blob.data(), blob.size()) == blob.size() && queue.count == 1000, "Every push should be saved");
+
+    fossil_sanity_log_queue_t restored;
+    fossil_sanity_log_init(&restored);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_restore(&restored, blob.data(), blob.size()) && restored.count == 1000, "The snapshot should restore");
+
+    std::vector<std::string> original, copy;
+    for (char *message; (message = fossil_sanity_log_pop(&queue)) != nullptr; free(message)) original.emplace_back(message);
+    for (char *message; (message = fossil_sanity_log_pop(&restored)) != nullptr; free(message)) copy.emplace_back(message);
+    FOSSIL_TEST_ASSUME(original == copy, "Both queues should drain identically");
+
+    blob[blob.size() - 1] ^= 1;
+    FOSSIL_TEST_ASSUME(!fossil_sanity_log_restore(&restored, blob.data(), blob.size()) && restored.count == 0, "A damaged snapshot should be refused");
+
+    fossil_sanity_log_destroy(&restored);
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_pool_reuse) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_pool_stats_t stats;
+    fossil_sanity_log_init(&queue);
+
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_pool_reserve(&queue, 100), "Reserve should succeed");
+    fossil_sanity_log_pool_stats(&queue, &stats);
+    FOSSIL_TEST_ASSUME(stats.capacity >= 100, "Pool should hold the reserved capacity");
+    FOSSIL_TEST_ASSUME(stats.in_use == 0, "No entries should be in use yet");
+    size_t slabs = stats.slab_count;
+
+    for (int round = 0; round < 10; round++) {
+        for (int i = 0; i < 100; i++) {
+            fossil_sanity_log_push(&queue, "pooled", i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+        }
+        fossil_sanity_log_pool_stats(&queue, &stats);
+        FOSSIL_TEST_ASSUME(stats.in_use == 100, "Every queued entry should come from the pool");
+        for (int i = 0; i < 50; i++) {
+            free(fossil_sanity_log_pop(&queue));
+        }
+        fossil_sanity_log_filter(&queue, FOSSIL_SANITY_LOG_LEVEL_FATAL + 1);
+        fossil_sanity_log_clear(&queue);
+    }
+
+    fossil_sanity_log_pool_stats(&queue, &stats);
+    FOSSIL_TEST_ASSUME(stats.slab_count == slabs, "Steady state should not add slabs");
+    FOSSIL_TEST_ASSUME(stats.in_use == 0 && stats.available == stats.capacity, "Cleared entries should return to the pool");
+
+    fossil_sanity_log_destroy(&queue);
+    fossil_sanity_log_pool_stats(&queue, &stats);
+    FOSSIL_TEST_ASSUME(stats.slab_count == 0 && stats.bytes == 0, "Destroy should release the slabs");
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_long_messages) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+
+    static char medium[1024];
+    static char huge[70000];
+    memset(medium, 'm', sizeof(medium) - 1);
+    memset(huge, 'h', sizeof(huge) - 1);
+
+    fossil_sanity_log_push(&queue, "short", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, medium, FOSSIL_SANITY_LOG_LEVEL_WARNING, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    fossil_sanity_log_push(&queue, huge, FOSSIL_SANITY_LOG_LEVEL_ERROR, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(queue.tail->length == 5, "Short message length should be recorded");
+
+    char *message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strlen(message) == sizeof(huge) - 1, "Huge message should not be truncated");
+    free(message);
+    message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, medium) == 0, "Medium message should round-trip intact");
+    free(message);
+    message = fossil_sanity_log_pop(&queue);
+    FOSSIL_TEST_ASSUME(message && strcmp(message, "short") == 0, "Short message should round-trip intact");
+    free(message);
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_concurrent_stress) {
+    const int producers = 8;
+    const int per_thread = 20000;
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_enable_concurrent(&queue), "Concurrent mode should enable");
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t < producers; t++) {
+        threads.emplace_back([&queue, t] {
+            for (int i = 0; i < per_thread; i++) {
+                std::string message = std::to_string(t) + " " + std::to_string(i);
+                fossil_sanity_log_push(&queue, message.c_str(), i % FOSSIL_SANITY_LOG_LEVEL_COUNT, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+            }
+        });
+    }
+
+    std::vector<std::vector<int>> last(producers, std::vector<int>(FOSSIL_SANITY_LOG_LEVEL_COUNT, -1));
+    int drained = 0;
+    bool ordered = true;
+    while (drained < producers * per_thread) {
+        char *message = fossil_sanity_log_pop(&queue);
+        if (!message) continue;
+        int id = -1, seq = -1;
+        sscanf(message, "%d %d", &id, &seq);
+        if (id < 0 || id >= producers || seq < 0) {
+            ordered = false;
+        } else {
+            int level = seq % FOSSIL_SANITY_LOG_LEVEL_COUNT;
+            if (seq <= last[id][level]) ordered = false;
+            last[id][level] = seq;
+        }
+        free(message);
+        drained++;
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+    FOSSIL_TEST_ASSUME(drained == producers * per_thread, "Every pushed entry should be drained");
+    FOSSIL_TEST_ASSUME(ordered, "Entries should keep per-producer FIFO order within a level");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_sort_by_severity) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+
+    for (int i = 0; i < 300; i++) {
+        fossil_sanity_log_push(&queue, "entry", i % 3, (i * 7) % 3);
+    }
+    fossil_sanity_log_sort_by(&queue, fossil_sanity_log_compare_severity);
+
+    bool ordered = true;
+    size_t seen = 0;
+    for (const fossil_sanity_log_entry_t *entry = queue.head; entry; entry = entry->next) {
+        const fossil_sanity_log_entry_t *next = entry->next;
+        seen++;
+        if (!next) {
+            if (entry != queue.tail) ordered = false;
+            break;
+        }
+        if (next->prev != entry) ordered = false;
+        if (entry->priority < next->priority) ordered = false;
+        if (entry->priority == next->priority && entry->severity < next->severity) ordered = false;
+        if (entry->priority == next->priority && entry->severity == next->severity && entry->sequence > next->sequence) ordered = false;
+    }
+    FOSSIL_TEST_ASSUME(seen == 300, "Sort should keep every entry");
+    FOSSIL_TEST_ASSUME(ordered, "Entries should be ordered by priority, severity, then sequence");
+
+    // Pushes after a sort still land in their level bucket
+    fossil_sanity_log_push(&queue, "late", FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW);
+    FOSSIL_TEST_ASSUME(queue.level_tail[FOSSIL_SANITY_LOG_LEVEL_INFO] && strcmp(queue.level_tail[FOSSIL_SANITY_LOG_LEVEL_INFO]->message, "late") == 0, "Late entry should close its level");
+
+    // A plain sort restores insertion order within each level
+    fossil_sanity_log_sort(&queue);
+    fossil_sanity_log_sort_by(&queue, fossil_sanity_log_compare_sequence);
+    for (const fossil_sanity_log_entry_t *entry = queue.head; entry && entry->next; entry = entry->next) {
+        if (entry->priority == entry->next->priority && entry->sequence > entry->next->sequence) ordered = false;
+    }
+    FOSSIL_TEST_ASSUME(ordered, "Sequence comparator should restore insertion order");
+
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+FOSSIL_TEST_CASE(cpp_log_level_gate) {
+    fossil_sanity_log_queue_t queue;
+    fossil_sanity_log_init(&queue);
+    int evaluated = 0;
+
+    fossil_sanity_log_set_level(FOSSIL_SANITY_LOG_LEVEL_WARNING);
+    FOSSIL_TEST_ASSUME(fossil_sanity_log_get_level() == FOSSIL_SANITY_LOG_LEVEL_WARNING, "Runtime level should be stored");
+
+    FOSSIL_SANITY_LOG_DEBUG(&queue, FOSSIL_SANITY_LOG_SEVERITY_LOW, "debug %d", ++evaluated);
+    FOSSIL_SANITY_LOG_INFO(&queue, FOSSIL_SANITY_LOG_SEVERITY_LOW, "info %d", ++evaluated);
+    fossil_sanity_log_smart_log(&queue, FOSSIL_SANITY_LOG_LEVEL_INFO, FOSSIL_SANITY_LOG_SEVERITY_LOW, "plain info");
+    FOSSIL_TEST_ASSUME(evaluated == 0, "Arguments of gated calls should not be evaluated");
+    FOSSIL_TEST_ASSUME(queue.head == NULL, "Gated calls should not push entries");
+
+    FOSSIL_SANITY_LOG_ERROR(&queue, FOSSIL_SANITY_LOG_SEVERITY_MEDIUM, "error %d of %s", ++evaluated, "many");
+    FOSSIL_TEST_ASSUME(evaluated == 1, "Arguments of enabled calls should be evaluated once");
+    FOSSIL_TEST_ASSUME(queue.head && strcmp(queue.head->message, "error 1 of many") == 0, "Enabled call should push the formatted message");
+
+    fossil_sanity_log_set_level(FOSSIL_SANITY_LOG_LEVEL_DEBUG);
+    fossil_sanity_log_destroy(&queue);
+} // end case
+
+// * * * * * * * * * * * * * * * * * * * * * * * *
+// * Fossil Logic Test Pool
+// * * * * * * * * * * * * * * * * * * * * * * * *
+FOSSIL_TEST_GROUP(cpp_log_test_cases) {
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_push_pop_order);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_filter_keeps_buckets);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_search);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_indexed_search);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_deferred_format);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_smart_limits);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_bounded_eviction);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_zero_copy);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_time_range);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_metrics);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_sampling);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_merge);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_fields);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_parallel);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_shm_collector);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_query);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_snapshot);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_pool_reuse);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_long_messages);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_sort_by_severity);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_level_gate);
+    FOSSIL_TEST_ADD(cpp_log_suite, cpp_log_concurrent_stress);
+
+    FOSSIL_TEST_REGISTER(cpp_log_suite);
+} // end of group
@@ -0,0 +1,138 @@
+/*
+ * -----------------------------------------------------------------------------
+ * Project: Fossil Logic
+ *
+ * This file is part of the Fossil Logic project, which aims to develop high-
+ * performance, cross-platform applications and libraries. The code contained
+ * herein is subject to the terms and conditions defined in the project license.
+ *
+ * Author: Michael Gene Brockus (Dreamer)
+ *
+ * Copyright (C) 2024 Fossil Logic. All rights reserved.
+ * -----------------------------------------------------------------------------
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <fossil/sanity/framework.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// fossil-log-query: filter log files written by the library and print the
+// matching lines. Each file is read with its rotated generations, oldest
+// first, unless -1 is given.
+
+static const char *const query_levels[FOSSIL_SANITY_LOG_LEVEL_COUNT] = { "debug", "info", "warning", "error", "fatal" };
+static const char *const query_severities[3] = { "low", "medium", "high" };
+
+static void usage(FILE *out) {
+    fputs("usage: fossil-log-query [-l level] [-L level] [-s severity] [-k text] [-a ns] [-b ns] [-1] [-c] file...\n"
+          "  -l level     lowest level to print (debug, info, warning, error, fatal)\n"
+          "  -L level     highest level to print\n"
+          "  -s severity  lowest severity to print (low, medium, high)\n"
+          "  -k text      only lines containing text\n"
+          "  -a ns        only entries logged at or after this timestamp\n"
+          "  -b ns        only entries logged at or before this timestamp\n"
+          "  -1           read only the named files, not their rotated generations\n"
+          "  -c           print the number of matching lines instead of the lines\n", out);
+}
+
+static int parse_name(const char *text, const char *const *names, int count) {
+    for (int i = 0; i < count; i++) {
+        if (strcmp(text, names[i]) == 0) return i;
+    }
+    return -1;
+}
+
+static bool parse_time(const char *text, uint64_t *value) {
+    char *end;
+    errno = 0;
+    unsigned long long parsed = strtoull(text, &end, 10);
+    if (errno || end == text || *end) return false;
+    *value = (uint64_t)parsed;
+    return true;
+}
+
+static bool print_line(const char *line, size_t length, void *context) {
+    (void)context;
+    return fwrite(line, 1, length, stdout) == length && putchar('\n') != EOF;
+}
+
+static bool count_line(const char *line, size_t length, void *context) {
+    (void)line;
+    (void)length;
+    (void)context;
+    return true;
+}
+
+int main(int argc, char **argv) {
+    fossil_sanity_log_query_t query;
+    int lowest = FOSSIL_SANITY_LOG_LEVEL_DEBUG;
+    int highest = FOSSIL_SANITY_LOG_LEVEL_FATAL;
+    bool rotated = true;
+    bool count = false;
+    int option;
+    memset(&query, 0, sizeof(query));
+
+    while ((option = getopt(argc, argv, "l:L:s:k:a:b:1ch")) != -1) {
+        switch (option) {
+            case 'l': lowest = parse_name(optarg, query_levels, FOSSIL_SANITY_LOG_LEVEL_COUNT); break;
+            case 'L': highest = parse_name(optarg, query_levels, FOSSIL_SANITY_LOG_LEVEL_COUNT); break;
+            case 's':
+                query.min_severity = parse_name(optarg, query_severities, 3);
+                if (query.min_severity < 0) {
+                    fprintf(stderr, "fossil-log-query: unknown severity '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case 'k': query.keyword = optarg; break;
+            case 'a':
+            case 'b':
+                if (!parse_time(optarg, option == 'a' ? &query.since : &query.until)) {
+                    fprintf(stderr, "fossil-log-query: bad timestamp '%s'\n", optarg);
+                    return 2;
+                }
+                break;
+            case '1': rotated = false; break;
+            case 'c': count = true; break;
+            case 'h': usage(stdout); return 0;
+            default: usage(stderr); return 2;
+        }
+        if (lowest < 0 || highest < 0) {
+            fprintf(stderr, "fossil-log-query: unknown level '%s'\n", optarg);
+            return 2;
+        }
+    }
+    if (lowest > highest) {
+        fprintf(stderr, "fossil-log-query: -l level is above the -L level\n");
+        usage(stderr);
+        return 2;
+    }
+    if (optind == argc) {
+        usage(stderr);
+        return 2;
+    }
+    for (int level = lowest; level <= highest; level++) {
+        query.levels |= 1u << level;
+    }
+
+    static char output[1 << 20];
+    setvbuf(stdout, output, _IOFBF, sizeof(output));
+
+    size_t total = 0;
+    int status = 0;
+    for (int i = optind; i < argc; i++) {
+        size_t matched = 0;
+        fossil_sanity_log_line_fn sink = count ? count_line : print_line;
+        bool read = rotated ? fossil_sanity_log_query_rotated(argv[i], &query, sink, NULL, &matched)
+                            : fossil_sanity_log_query_file(argv[i], &query, sink, NULL, &matched);
+        if (!read) {
+            fprintf(stderr, "fossil-log-query: cannot read '%s'\n", argv[i]);
+            status = 2;
+        }
+        if (ferror(stdout)) return 2;  // Closed pipe or full disk
+        total += matched;
+    }
+    if (count) printf("%zu\n", total);
+    if (fflush(stdout) != 0) return 2;
+    return status ? status : total ? 0 : 1;
+}